@@ -68,10 +68,13 @@ class Server(object):
     name = Unicode()
     pid_file = Unicode()
     port = Int()
+    bind_addr = Unicode()
+    use_ssl = Int()
 
     def __init__(self, uuid=None, access_log=None, error_log=None,
                  chroot=None, default_host=None, name=None, pid_file=None,
-                 port=None, hosts=None):
+                 port=None, hosts=None, bind_addr='0.0.0.0',
+                 use_ssl=0):
         super(Server, self).__init__()
         self.uuid = unicode(uuid)
         self.access_log = unicode(access_log)
@@ -81,14 +84,17 @@ class Server(object):
         self.name = unicode(name) if name else self.default_host
         self.pid_file = unicode(pid_file)
         self.port = port
+        self.bind_addr = unicode(bind_addr)
+        self.use_ssl = use_ssl
 
         for h in hosts or []:
             self.hosts.add(h)
 
     def __repr__(self):
-        return "Server(uuid=%r, access_log=%r, error_log=%r, chroot=%r, default_host=%r, port=%d)" % (
+        return "Server(uuid=%r, access_log=%r, error_log=%r, chroot=%r, default_host=%r, port=%d, bind_addr=%r, use_ssl=%d)" % (
             self.uuid, self.access_log, self.error_log, 
-            self.chroot, self.default_host, self.port)
+            self.chroot, self.default_host, self.port, self.bind_addr,
+            self.use_ssl)
 
 
 class Host(object):
@@ -129,18 +135,20 @@ class Handler(object):
     send_ident = Unicode()
     recv_spec = Unicode()
     recv_ident = Unicode()
+    coalesce = Int()
 
-    def __init__(self, send_spec, send_ident, recv_spec, recv_ident):
+    def __init__(self, send_spec, send_ident, recv_spec, recv_ident, coalesce=0):
         super(Handler, self).__init__()
         self.send_spec = unicode(send_spec)
         self.send_ident = unicode(send_ident)
         self.recv_spec = unicode(recv_spec)
         self.recv_ident = unicode(recv_ident)
+        self.coalesce = coalesce
 
     def __repr__(self):
-        return "Handler(send_spec=%r, send_ident=%r, recv_spec=%r, recv_ident=%r)" % (
+        return "Handler(send_spec=%r, send_ident=%r, recv_spec=%r, recv_ident=%r, coalesce=%d)" % (
             self.send_spec, self.send_ident, self.recv_spec,
-            self.recv_ident)
+            self.recv_ident, self.coalesce)
 
 
 
@@ -149,16 +157,22 @@ class Proxy(object):
     id = Int(primary = True)
     addr = Unicode()
     port = Int()
+    buffer_size = Int()
+    retries = Int()
+    hedge_delay = Int()
 
-    def __init__(self, addr, port):
+    def __init__(self, addr, port, buffer_size=0, retries=0, hedge_delay=0):
         super(Proxy, self).__init__()
         self.addr = unicode(addr)
         self.port = port
+        self.buffer_size = buffer_size
+        self.retries = retries
+        self.hedge_delay = hedge_delay
         
 
     def __repr__(self):
-        return "Proxy(addr=%r, port=%d)" % (
-            self.addr, self.port)
+        return "Proxy(addr=%r, port=%d, buffer_size=%d, retries=%d, hedge_delay=%d)" % (
+            self.addr, self.port, self.buffer_size, self.retries, self.hedge_delay)
 
 
 
@@ -0,0 +1,228 @@
+/**
+ *
+ * Copyright (c) 2010, Zed A. Shaw and Mongrel2 Project Contributors.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ *     * Neither the name of the Mongrel2 Project, Zed A. Shaw, nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <breaker.h>
+#include <register.h>
+#include <dbg.h>
+#include <stdlib.h>
+
+#include "setting.h"
+
+int BREAKER_FAILURES = -1;
+int BREAKER_RESET = 0;
+int BREAKER_LATENCY = 0;
+int BREAKER_TIMEOUT = 0;
+
+static Breaker *BREAKERS = NULL;
+
+static const char *BREAKER_STATES[] = {"closed", "open", "half_open"};
+
+
+// settings load after the backends are created, so read them on first use
+static inline void Breaker_init()
+{
+    if(BREAKER_FAILURES == -1) {
+        BREAKER_FAILURES = Setting_get_int("breaker.failures", 0);
+        BREAKER_RESET = Setting_get_int("breaker.reset_timeout", 10);
+        BREAKER_LATENCY = Setting_get_int("breaker.latency", 0);
+        BREAKER_TIMEOUT = Setting_get_int("breaker.timeout", 30);
+        log_info("MAX breaker.failures=%d, breaker.reset_timeout=%d, breaker.latency=%d, breaker.timeout=%d",
+                BREAKER_FAILURES, BREAKER_RESET, BREAKER_LATENCY, BREAKER_TIMEOUT);
+    }
+}
+
+Breaker *Breaker_create(bstring name)
+{
+    Breaker *breaker = calloc(sizeof(Breaker), 1);
+    check_mem(breaker);
+
+    breaker->name = name;
+    breaker->state = BREAKER_CLOSED;
+
+    breaker->next = BREAKERS;
+    if(BREAKERS) BREAKERS->prev = breaker;
+    BREAKERS = breaker;
+
+    return breaker;
+
+error:
+    bdestroy(name);
+    return NULL;
+}
+
+void Breaker_destroy(Breaker *breaker)
+{
+    if(breaker) {
+        if(breaker->prev) breaker->prev->next = breaker->next;
+        if(breaker->next) breaker->next->prev = breaker->prev;
+        if(BREAKERS == breaker) BREAKERS = breaker->next;
+
+        Register_forget(breaker);
+        bdestroy(breaker->name);
+        free(breaker);
+    }
+}
+
+static inline void Breaker_trip(Breaker *breaker, time_t now)
+{
+    if(breaker->state == BREAKER_CLOSED) {
+        log_warn("Backend %s failed %d times in a row, failing fast for %d seconds.",
+                bdata(breaker->name), breaker->failures, BREAKER_RESET);
+        breaker->trips++;
+    } else {
+        log_warn("Probe of backend %s failed, failing fast for another %d seconds.",
+                bdata(breaker->name), BREAKER_RESET);
+    }
+
+    breaker->state = BREAKER_OPEN;
+    breaker->opened_at = now;
+    breaker->probe_at = 0;
+}
+
+/**
+ * Says whether a request may go to the backend.  Once the reset timeout
+ * is up an open breaker lets a single probe through, and if that probe
+ * never reports back another one goes after the same timeout.
+ */
+int Breaker_allow(Breaker *breaker)
+{
+    time_t now = 0;
+
+    Breaker_init();
+    if(!breaker || BREAKER_FAILURES <= 0) return 1;
+    if(breaker->state == BREAKER_CLOSED) return 1;
+
+    now = time(NULL);
+
+    if(breaker->state == BREAKER_OPEN) {
+        if(now - breaker->opened_at < BREAKER_RESET) return 0;
+
+        debug("Backend %s has been open long enough, probing it.", bdata(breaker->name));
+        breaker->state = BREAKER_HALF_OPEN;
+    }
+
+    if(breaker->probe_at && now - breaker->probe_at < BREAKER_RESET) return 0;
+
+    breaker->probe_at = now;
+    return 1;
+}
+
+void Breaker_success(Breaker *breaker, int latency)
+{
+    if(!breaker) return;
+    Breaker_init();
+
+    // a cheap moving average that's good enough for the status report
+    breaker->latency += (latency - breaker->latency) / 8;
+
+    if(BREAKER_LATENCY > 0 && latency > BREAKER_LATENCY) {
+        debug("Backend %s took %d ms, counting it as a failure.", bdata(breaker->name), latency);
+        Breaker_failure(breaker);
+        return;
+    }
+
+    if(breaker->state == BREAKER_HALF_OPEN) {
+        log_info("Backend %s is answering again, closing its breaker.", bdata(breaker->name));
+    }
+
+    breaker->state = BREAKER_CLOSED;
+    breaker->failures = 0;
+    breaker->probe_at = 0;
+}
+
+void Breaker_failure(Breaker *breaker)
+{
+    if(!breaker) return;
+    Breaker_init();
+
+    breaker->failures++;
+
+    if(BREAKER_FAILURES <= 0) return;
+
+    if(breaker->state == BREAKER_HALF_OPEN ||
+            (breaker->state == BREAKER_CLOSED && breaker->failures >= BREAKER_FAILURES))
+    {
+        Breaker_trip(breaker, time(NULL));
+    }
+}
+
+/**
+ * Milliseconds a request can wait for its first reply before the backend
+ * is charged a failure, or 0 when breakers are off.  A reply slower than
+ * breaker.latency is a failure anyway, so there's no point waiting longer.
+ */
+int Breaker_timeout()
+{
+    int timeout = 0;
+
+    Breaker_init();
+    if(BREAKER_FAILURES <= 0) return 0;
+
+    timeout = BREAKER_TIMEOUT * 1000;
+
+    if(BREAKER_LATENCY > 0 && (timeout <= 0 || BREAKER_LATENCY < timeout)) {
+        timeout = BREAKER_LATENCY;
+    }
+
+    return timeout;
+}
+
+int Breaker_retry_after(Breaker *breaker)
+{
+    int left = BREAKER_RESET;
+
+    if(breaker && breaker->state == BREAKER_OPEN) {
+        left = BREAKER_RESET - (int)(time(NULL) - breaker->opened_at);
+    }
+
+    return left > 0 ? left : 1;
+}
+
+bstring Breaker_info()
+{
+    int total = 0;
+    Breaker *breaker = NULL;
+    bstring result = bfromcstr("{\"backends\": [");
+
+    // the same backend can show up under more than one route, so no keys
+    for(breaker = BREAKERS; breaker != NULL; breaker = breaker->next) {
+        bformata(result, "%s{\"name\":\"%s\",\"state\":\"%s\",\"failures\":%d,\"latency\":%d,\"trips\":%d}",
+                total ? "," : "", bdata(breaker->name), BREAKER_STATES[breaker->state],
+                breaker->failures, breaker->latency, breaker->trips);
+        total++;
+    }
+
+    bformata(result, "], \"total\": %d}", total);
+    return result;
+}
@@ -0,0 +1,78 @@
+/**
+ *
+ * Copyright (c) 2010, Zed A. Shaw and Mongrel2 Project Contributors.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ *     * Neither the name of the Mongrel2 Project, Zed A. Shaw, nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _breaker_h
+#define _breaker_h
+
+#include <bstring.h>
+#include <time.h>
+
+extern int BREAKER_FAILURES;
+extern int BREAKER_RESET;
+extern int BREAKER_LATENCY;
+extern int BREAKER_TIMEOUT;
+
+enum {
+    BREAKER_CLOSED, BREAKER_OPEN, BREAKER_HALF_OPEN
+};
+
+typedef struct Breaker {
+    bstring name;
+    int state;
+    int failures;
+    int latency;
+    int trips;
+    time_t opened_at;
+    time_t probe_at;
+    struct Breaker *next;
+    struct Breaker *prev;
+} Breaker;
+
+Breaker *Breaker_create(bstring name);
+
+void Breaker_destroy(Breaker *breaker);
+
+int Breaker_allow(Breaker *breaker);
+
+void Breaker_success(Breaker *breaker, int latency);
+
+void Breaker_failure(Breaker *breaker);
+
+int Breaker_timeout();
+
+int Breaker_retry_after(Breaker *breaker);
+
+bstring Breaker_info();
+
+#endif
@@ -60,12 +60,14 @@ static tst_t *LOADED_DIRS = NULL;
 
 static int Config_load_handler_cb(void *param, int cols, char **data, char **names)
 {
-    arity(5);
+    arity(6);
 
     Handler *handler = Handler_create(data[1], data[2], data[3], data[4]);
     check(handler != NULL, "Loaded handler %s with send_spec=%s send_ident=%s recv_spec=%s recv_ident=%s", data[0], data[1], data[2], data[3], data[4]);
+    handler->coalesce = data[5] ? atoi(data[5]) : 0;
 
-    log_info("Loaded handler %s with send_spec=%s send_ident=%s recv_spec=%s recv_ident=%s", data[0], data[1], data[2], data[3], data[4]);
+    log_info("Loaded handler %s with send_spec=%s send_ident=%s recv_spec=%s recv_ident=%s coalesce=%d",
+            data[0], data[1], data[2], data[3], data[4], handler->coalesce);
 
     LOADED_HANDLERS = tst_insert(LOADED_HANDLERS, data[0], strlen(data[0]), handler);
 
@@ -77,7 +79,7 @@ error:
 
 static int Config_load_handlers()
 {
-    const char *HANDLER_QUERY = "SELECT id, send_spec, send_ident, recv_spec, recv_ident FROM handler";
+    const char *HANDLER_QUERY = "SELECT id, send_spec, send_ident, recv_spec, recv_ident, coalesce FROM handler";
 
     int rc = DB_exec(HANDLER_QUERY, Config_load_handler_cb, NULL);
     check(rc == 0, "Failed to load handlers");
@@ -90,12 +92,16 @@ error:
 
 static int Config_load_proxy_cb(void *param, int cols, char **data, char **names)
 {
-    arity(3);
+    arity(6);
 
     Proxy *proxy = Proxy_create(bfromcstr(data[1]), atoi(data[2]));
     check(proxy != NULL, "Failed to create proxy %s with address=%s port=%s", data[0], data[1], data[2]);
+    proxy->buffer_size = data[3] ? atoi(data[3]) : 0;
+    proxy->retries = data[4] ? atoi(data[4]) : 0;
+    proxy->hedge_delay = data[5] ? atoi(data[5]) : 0;
 
-    log_info("Loaded proxy %s with address=%s port=%s", data[0], data[1], data[2]);
+    log_info("Loaded proxy %s with address=%s port=%s buffer_size=%d retries=%d hedge_delay=%d",
+            data[0], data[1], data[2], proxy->buffer_size, proxy->retries, proxy->hedge_delay);
 
     LOADED_PROXIES = tst_insert(LOADED_PROXIES, data[0], strlen(data[0]), proxy);
 
@@ -107,7 +113,7 @@ error:
 
 static int Config_load_proxies()
 {
-    const char *PROXY_QUERY = "SELECT id, addr, port FROM proxy";
+    const char *PROXY_QUERY = "SELECT id, addr, port, buffer_size, retries, hedge_delay FROM proxy";
 
     int rc = DB_exec(PROXY_QUERY, Config_load_proxy_cb, NULL);
     check(rc == 0, "Failed to load proxies");
@@ -242,7 +248,7 @@ static int Config_load_server_cb(void* param, int cols, char **data, char **name
 {
 	Server **server = NULL;
     char *query = NULL;
-    arity(8);
+    arity(10);
 
     server = (Server **)param;
     if(*server != NULL)
@@ -251,8 +257,9 @@ static int Config_load_server_cb(void* param, int cols, char **data, char **name
         Server_destroy(*server);
     }
 
-    *server = Server_create(data[1], data[2], data[3], data[4], data[5], data[6], data[7]);
+    *server = Server_create(data[1], data[2], data[3], data[8], data[4], data[5], data[6], data[7]);
     check(*server, "Failed to create server %s:%s on port %s", data[0], data[2], data[3]);
+    (*server)->use_ssl = data[9] ? atoi(data[9]) : 0;
 
 
     const char *HOST_QUERY = "SELECT id, name, matching, server_id FROM host WHERE server_id = %s";
@@ -281,7 +288,7 @@ Server *Config_load_server(const char *uuid)
     Config_load_proxies();
     Config_load_dirs();
 
-    const char *SERVER_QUERY = "SELECT id, uuid, default_host, port, chroot, access_log, error_log, pid_file FROM server WHERE uuid=%Q";
+    const char *SERVER_QUERY = "SELECT id, uuid, default_host, port, chroot, access_log, error_log, pid_file, bind_addr, use_ssl FROM server WHERE uuid=%Q";
     char *query = SQL(SERVER_QUERY, uuid);
 
     Server *server = NULL;
@@ -18,7 +18,9 @@ CREATE TABLE server (id INTEGER PRIMARY KEY,
     pid_File TEXT,
     default_host INTEGER,
     name TEXT DEFAULT "",
-    port INTEGER);
+    port INTEGER,
+    bind_addr TEXT DEFAULT "0.0.0.0",
+    use_ssl INTEGER DEFAULT 0);
 
 CREATE TABLE host (id INTEGER PRIMARY KEY, 
     server_id INTEGER,
@@ -30,11 +32,15 @@ CREATE TABLE handler (id INTEGER PRIMARY KEY,
     send_spec TEXT, 
     send_ident TEXT,
     recv_spec TEXT,
-    recv_ident TEXT);
+    recv_ident TEXT,
+    coalesce INTEGER DEFAULT 0);
 
 CREATE TABLE proxy (id INTEGER PRIMARY KEY,
     addr TEXT,
-    port INTEGER);
+    port INTEGER,
+    buffer_size INTEGER DEFAULT 0,
+    retries INTEGER DEFAULT 0,
+    hedge_delay INTEGER DEFAULT 0);
 
 CREATE TABLE directory (id INTEGER PRIMARY KEY,
     base TEXT, index_file TEXT, default_ctype TEXT);
@@ -44,6 +44,8 @@
 #include "task/task.h"
 #include "events.h"
 #include "register.h"
+#include "write_queue.h"
+#include "response_cache.h"
 #include "handler.h"
 #include "pattern.h"
 #include "dir.h"
@@ -64,6 +66,7 @@ struct tagbstring PING_PATTERN = bsStatic("@[a-z/]- {\"type\":\\s*\"ping\"}");
 int MAX_CONTENT_LENGTH = 20 * 1024;
 int BUFFER_SIZE = 4 * 1024;
 int CONNECTION_STACK = 32 * 1024;
+int MAX_SSL_HANDSHAKES = 1024;
 
 static inline int Connection_backend_event(Backend *found, Connection *conn)
 {
@@ -261,6 +264,20 @@ error:
     return NULL;
 }
 
+/**
+ * Fast-fails a request whose backend has an open breaker, telling the
+ * client when it's worth trying again.
+ */
+static inline int connection_unavailable(Connection *conn, Breaker *breaker)
+{
+    debug("Breaker for %s is open, failing fast.", bdata(breaker->name));
+
+    Response_send_unavailable(conn, Breaker_retry_after(breaker));
+    Log_request(conn, 503, 0);
+
+    return CLOSE;
+}
+
 int connection_http_to_handler(int event, void *data)
 {
     TRACE(http_to_handler);
@@ -275,6 +292,13 @@ int connection_http_to_handler(int event, void *data)
     Handler *handler = Request_get_action(conn->req, handler);
     error_unless(handler, conn, 404, "No action for request: %s", bdata(Request_path(conn->req)));
 
+    if(ResponseCache_request(conn) == CACHE_HIT) {
+        return REQ_SENT;
+    }
+
+    if(!Breaker_allow(handler->breaker)) {
+        return connection_unavailable(conn, handler->breaker);
+    }
 
     if(content_len == 0) {
         body = "";
@@ -311,9 +335,13 @@ int connection_http_to_handler(int event, void *data)
     debug("HTTP TO HANDLER: %.*s", blength(result) - content_len, bdata(result));
 
     rc = Handler_deliver(handler->send_socket, bdata(result), blength(result));
+    if(rc == -1) Breaker_failure(handler->breaker);
     error_unless(rc != -1, conn, 502, "Failed to deliver to handler: %s", 
             bdata(Request_path(conn->req)));
 
+    // handlers can hold long polls and streams open, so never call them overdue
+    Register_sent(conn->fd, NULL);
+
     bdestroy(result);
     return REQ_SENT;
 
@@ -357,13 +385,19 @@ int connection_http_to_proxy(int event, void *data)
     Proxy *proxy = Request_get_action(conn->req, proxy);
     check(proxy != NULL, "Should have a proxy backend.");
 
-    conn->proxy_fd = netdial(1, bdata(proxy->server), proxy->port);
+    // proxy_failed sees the open breaker and answers with a 503
+    check_debug(Breaker_allow(proxy->breaker), "Breaker for %s is open, failing fast.",
+            bdata(proxy->breaker->name));
+
+    conn->proxy_fd = Proxy_connect_request(proxy, conn->req);
+    if(conn->proxy_fd == -1) Breaker_failure(proxy->breaker);
     check(conn->proxy_fd != -1, "Failed to connect to proxy backend %s:%d",
             bdata(proxy->server), proxy->port);
 
     if(!conn->proxy_buf) {
         conn->proxy_buf = h_calloc(sizeof(char), BUFFER_SIZE+1);
         check_mem(conn->proxy_buf);
+        conn->proxy_buf_size = BUFFER_SIZE;
         hattach(conn->proxy_buf, conn);
     }
 
@@ -379,18 +413,64 @@ error:
     return FAILED;
 }
 
+/**
+ * A keep-alive backend connection can be dead by the time we use it, so
+ * a request that's safe to resend gets one more go on a new connection.
+ */
+static inline int proxy_send_request(Connection *conn, Proxy *proxy, int len)
+{
+    int rc = fdsend(conn->proxy_fd, conn->buf, len);
+
+    if(rc != len && conn->proxy_req && proxy->retries > 0) {
+        log_warn("Failed to send request to proxy backend %s:%d, trying again.",
+                bdata(proxy->server), proxy->port);
 
+        fdclose(conn->proxy_fd);
+        conn->proxy_fd = Proxy_connect(proxy);
+        if(conn->proxy_fd == -1) return -1;
+
+        rc = fdsend(conn->proxy_fd, conn->buf, len);
+    }
+
+    return rc;
+}
 
 int connection_proxy_deliver(int event, void *data)
 {
     TRACE(proxy_deliver);
     Connection *conn = (Connection *)data;
+    Proxy *proxy = Request_get_action(conn->req, proxy);
     int rc = 0;
 
     int total_len = Request_header_length(conn->req) + Request_content_length(conn->req);
 
+    if(ResponseCache_request(conn) == CACHE_HIT) {
+        // already answered, so just skip over the request
+        conn->cached = 1;
+        conn->nread = total_len < conn->nread ? conn->nread - total_len : 0;
+        memmove(conn->buf, conn->buf + total_len, conn->nread);
+        return REQ_SENT;
+    }
+
+    if(!conn->proxy_fd) {
+        // a buffering proxy lets go of the backend after every response
+        conn->proxy_fd = Proxy_connect_request(proxy, conn->req);
+        if(conn->proxy_fd == -1) Breaker_failure(proxy->breaker);
+        check_debug(conn->proxy_fd != -1, "Failed to reconnect to proxy backend %s:%d",
+                bdata(proxy->server), proxy->port);
+    }
+
+    bdestroy(conn->proxy_req);
+    conn->proxy_req = NULL;
+
+    if(total_len <= conn->nread && Proxy_idempotent(proxy, conn->req)) {
+        // keep it in case it has to go out again
+        conn->proxy_req = blk2bstr(conn->buf, total_len);
+        check_mem(conn->proxy_req);
+    }
+
     if(total_len < conn->nread) {
-        rc = fdsend(conn->proxy_fd, conn->buf, total_len);
+        rc = proxy_send_request(conn, proxy, total_len);
         check_debug(rc > 0, "Failed to write request to proxy.");
 
         // setting up for the next request to be read
@@ -414,11 +494,12 @@ int connection_proxy_deliver(int event, void *data)
         } while(total_len > 0);
     } else {
         // not > and not < means ==, so we just write this and try again
-        rc = fdsend(conn->proxy_fd, conn->buf, total_len);
+        rc = proxy_send_request(conn, proxy, total_len);
         check_debug(rc == total_len, "Failed to write complete request to proxy, wrote only: %d", rc);
         conn->nread = 0;
     }
 
+    Register_sent(conn->fd, proxy->breaker);
     return REQ_SENT;
 
 error:
@@ -432,15 +513,38 @@ int connection_proxy_reply_parse(int event, void *data)
     TRACE(proxy_reply_parse);
     int nread = 0;
     int rc = 0;
+    int elapsed = 0;
     Connection *conn = (Connection *)data;
     Proxy *proxy = Request_get_action(conn->req, proxy);
     httpclient_parser *client = conn->client;
 
-    nread = Proxy_read_and_parse(conn, 0);
+    if(conn->cached) {
+        conn->cached = 0;
+        return REQ_RECV;
+    }
+
+    nread = Proxy_read_reply(conn, proxy);
+    if(nread == -1) {
+        // clear the stamp so closing the client doesn't count this twice
+        Register_elapsed(conn->fd);
+        Breaker_failure(proxy->breaker);
+    }
     check(nread != -1, "Failed to read from proxy server: %s:%d", 
             bdata(proxy->server), proxy->port);
 
-    if(client->chunked) {
+    // a backend answering with errors is as good as down
+    elapsed = Register_elapsed(conn->fd);
+    if(client->status >= 500) {
+        Breaker_failure(proxy->breaker);
+    } else if(elapsed >= 0) {
+        Breaker_success(proxy->breaker, elapsed);
+    }
+
+    if(proxy->buffer_size > 0) {
+        rc = Proxy_buffer_response(conn, proxy, nread);
+        check(rc != -1, "Failed buffering the proxy response.");
+
+    } else if(client->chunked) {
         rc = Proxy_stream_chunks(conn, nread);
         check(rc != -1, "Failed to stream chunked encoding to client.");
 
@@ -453,17 +557,25 @@ int connection_proxy_reply_parse(int event, void *data)
                conn->proxy_buf);
 
         do {
-            rc = conn->send(conn, conn->proxy_buf, nread);
+            rc = Proxy_send(conn, conn->proxy_buf, nread);
             check(rc == nread, "Failed to send all of the request: %d length.", nread);
         } while((nread = fdrecv(conn->proxy_fd, conn->proxy_buf, BUFFER_SIZE)) > 0);
     } else {
         sentinel("Should not reach this code, Tell Zed.");
     }
 
+    bdestroy(conn->proxy_req);
+    conn->proxy_req = NULL;
+
+    ResponseCache_finish(conn->fd);
     Log_request(conn, client->status, client->content_len);
     return REQ_RECV;
 
 error:
+    bdestroy(conn->proxy_req);
+    conn->proxy_req = NULL;
+
+    ResponseCache_abandon(conn->fd);
     return FAILED;
 }
 
@@ -519,8 +631,13 @@ int connection_proxy_failed(int event, void *data)
 {
     TRACE(proxy_failed);
     Connection *conn = (Connection *)data;
+    Proxy *proxy = Request_get_action(conn->req, proxy);
 
-    Response_send_status(conn, &HTTP_502);
+    if(proxy && proxy->breaker->state != BREAKER_CLOSED) {
+        Response_send_unavailable(conn, Breaker_retry_after(proxy->breaker));
+    } else {
+        Response_send_status(conn, &HTTP_502);
+    }
 
     return CLOSE;
 }
@@ -545,6 +662,12 @@ static inline int close_or_error(int event, void *data, int next)
         connection_proxy_close(event, data);
     }
 
+    // whatever's buffered has to go out before the socket closes, unless
+    // the write queue has it and is about to be thrown out anyway
+    if(conn->ssl && !WriteQueue_pending(conn->fd)) ssl_flush(conn->ssl);
+
+    ResponseCache_abandon(conn->fd);
+    WriteQueue_discard(conn->fd);
     check(Register_disconnect(conn->fd) != -1, "Register disconnect didn't work for %d", conn->fd);
 
 error:
@@ -605,7 +728,13 @@ static inline int ident_and_register(int event, void *data, int reg_too)
         error_response(conn, 500, "Invalid code branch, tell Zed.");
     }
 
-    if(reg_too) Register_connect(conn->fd, conn_type);
+    if(reg_too) {
+        Register_connect(conn->fd, conn_type);
+
+        // handler replies get encrypted on their way through the write queue
+        if(conn->ssl && conn->ktls != 1) Register_ssl(conn->fd, conn->ssl);
+    }
+
     return next;
 
 error:
@@ -669,8 +798,11 @@ void Connection_destroy(Connection *conn)
     if(conn) {
         Request_destroy(conn->req);
         conn->req = NULL;
-        if(conn->ssl) 
+        bdestroy(conn->proxy_req);
+        if(conn->ssl) {
+            taskonswitch(NULL, NULL);
             ssl_free(conn->ssl);
+        }
         h_free(conn);
     }
 }
@@ -685,11 +817,51 @@ static ssize_t plaintext_recv(Connection *conn, char *buffer, int len)
     return fdrecv(conn->fd, buffer, len);
 }
 
+static ssize_t plaintext_sendv(Connection *conn, struct iovec *iov, int iovcnt)
+{
+    return fdsendv(conn->fd, iov, iovcnt);
+}
+
+/*
+ * TLS sends are buffered into whole records, and whatever's left goes out
+ * as soon as the connection's task waits on anything.  While the write
+ * queue is sending handler replies it picks that up instead, since our
+ * records can't go out in the middle of its.
+ */
+static void ssl_flush_task(void *data)
+{
+    Connection *conn = (Connection *)data;
+
+    if(!WriteQueue_pending(conn->fd)) ssl_flush(conn->ssl);
+}
+
 static ssize_t ssl_send(Connection *conn, char *buffer, int len)
 {
     check(conn->ssl != NULL, "Cannot ssl_send on a connection without ssl");
-    
-    return ssl_write(conn->ssl, (const unsigned char*) buffer, len);
+
+    WriteQueue_wait(conn->fd);
+    return ssl_write_buf(conn->ssl, (const unsigned char*) buffer, len);
+
+error:
+    return -1;
+}
+
+static ssize_t ssl_sendv(Connection *conn, struct iovec *iov, int iovcnt)
+{
+    check(conn->ssl != NULL, "Cannot ssl_sendv on a connection without ssl");
+    int i = 0;
+    int rc = 0;
+    ssize_t total = 0;
+
+    WriteQueue_wait(conn->fd);
+
+    for(i = 0; i < iovcnt; i++) {
+        rc = ssl_write_buf(conn->ssl, iov[i].iov_base, iov[i].iov_len);
+        if(rc < 0) return rc;
+        total += rc;
+    }
+
+    return total;
 
 error:
     return -1;
@@ -698,49 +870,47 @@ error:
 static ssize_t ssl_recv(Connection *conn, char *buffer, int len)
 {
     check(conn->ssl != NULL, "Cannot ssl_recv on a connection without ssl");
-    char *pread;
-    int nread;
-
-    // If we didn't read all of what we recieved last time
-    if(conn->ssl_buff != NULL) {
-        if(conn->ssl_buff_len < len) {
-            nread = conn->ssl_buff_len;
-            pread = conn->ssl_buff;
-            conn->ssl_buff_len = 0;
-            conn->ssl_buff = NULL;
-        }
-        else {
-            nread = len;
-            pread = conn->ssl_buff;
-            conn->ssl_buff += nread;
-            conn->ssl_buff_len -= nread;
-        }
-    }
-    else {
-        do {
-            nread = ssl_read(conn->ssl, (unsigned char **) &pread);
-        } while(nread == SSL_OK);
-
-        // If we got more than they asked for, we should stash it for
-        // successive calls.
-        if(nread > len) {
-            conn->ssl_buff = buffer + len;
-            conn->ssl_buff_len = nread - len;
-            nread = len;
-        }
-    }
-    if(nread < 0) 
-        return nread;
+    int nread = 0;
+
+    if(len <= 0) return 0;
+
+    // decrypts right into buffer, and the ssl keeps whatever doesn't fit
+    do {
+        nread = ssl_read_buf(conn->ssl, (uint8_t *)buffer, len);
+    } while(nread == SSL_OK);
 
-    check(pread != NULL, "Got a NULL from ssl_read despite no error code");
-    
-    memcpy(buffer, pread, nread);
     return nread;
 
 error:
     return -1;
 }
 
+/**
+ * Tries once per connection to have the kernel do the TLS encryption, and
+ * if it will then plain sends and sendfile work on the socket from now on.
+ */
+int Connection_ktls(Connection *conn)
+{
+    if(conn->ssl == NULL) return 0;
+
+    if(conn->ktls == 0) {
+        // the kernel carries on from our sequence, so the queue goes first
+        WriteQueue_wait(conn->fd);
+
+        if(ssl_ktls_tx(conn->ssl) == SSL_OK) {
+            debug("Kernel TLS is on for %d.", conn->fd);
+            conn->ktls = 1;
+            conn->send = plaintext_send;
+            conn->sendv = plaintext_sendv;
+            Register_ssl(conn->fd, NULL);
+        } else {
+            conn->ktls = -1;
+        }
+    }
+
+    return conn->ktls == 1;
+}
+
 Connection *Connection_create(Server *srv, int fd, int rport, 
                               const char *remote, SSL_CTX *ssl_ctx)
 {
@@ -761,8 +931,6 @@ Connection *Connection_create(Server *srv, int fd, int rport,
     check_mem(conn->buf);
     hattach(conn->buf, conn);
 
-    conn->ssl_buff = 0;
-    conn->ssl_buff_len = 0;
     conn->ssl = NULL;
     if(ssl_ctx != NULL)
     {
@@ -770,12 +938,14 @@ Connection *Connection_create(Server *srv, int fd, int rport,
         check(conn->ssl != NULL, "Failed to create new ssl for connection");
         conn->send = ssl_send;
         conn->recv = ssl_recv;
+        conn->sendv = ssl_sendv;
     }
     else
     {
         conn->ssl = NULL;
         conn->send = plaintext_send;
         conn->recv = plaintext_recv;
+        conn->sendv = plaintext_sendv;
     }
     return conn;
 
@@ -800,6 +970,8 @@ void Connection_task(void *v)
 
     State_init(&conn->state, &CONN_ACTIONS);
 
+    if(conn->ssl) taskonswitch(ssl_flush_task, conn);
+
     for(i = 0, next = OPEN; next != CLOSE; i++) {
         next = State_exec(&conn->state, next, (void *)conn);
         error_unless(next >= FINISHED && next < EVENT_END, conn, 500, 
@@ -816,7 +988,7 @@ error:
 
 int Connection_deliver_raw(int to_fd, bstring buf)
 {
-    return fdsend(to_fd, bdata(buf), blength(buf));
+    return WriteQueue_send(to_fd, bdata(buf), blength(buf));
 }
 
 int Connection_deliver(int to_fd, bstring buf)
@@ -824,8 +996,8 @@ int Connection_deliver(int to_fd, bstring buf)
     int rc = 0;
 
     bstring b64_buf = bBase64Encode(buf);
-    rc = fdsend(to_fd, bdata(b64_buf), blength(b64_buf)+1);
-    check_debug(rc == blength(b64_buf)+1, "Failed to write entire message to conn %d", to_fd);
+    rc = WriteQueue_send(to_fd, bdata(b64_buf), blength(b64_buf)+1);
+    check_debug(rc != -1, "Failed to write entire message to conn %d", to_fd);
 
     bdestroy(b64_buf);
     return 0;
@@ -886,7 +1058,7 @@ int Connection_read_header(Connection *conn, Request *req)
 
     // add the x-forwarded-for header
     dict_alloc_insert(conn->req->headers, bfromcstr("X-Forwarded-For"),
-            blk2bstr(conn->remote, IPADDR_SIZE));
+            bfromcstr(conn->remote));
 
     check_should_close(conn, conn->req);
     return conn->nread; 
@@ -902,8 +1074,10 @@ void Connection_init()
     MAX_CONTENT_LENGTH = Setting_get_int("limits.content_length", 20 * 1024);
     BUFFER_SIZE = Setting_get_int("limits.buffer_size", 4 * 1024);
     CONNECTION_STACK = Setting_get_int("limits.connection_stack_size", 32 * 1024);
+    MAX_SSL_HANDSHAKES = Setting_get_int("limits.ssl_handshakes", 1024);
+    ssl_set_max_private_jobs(MAX_SSL_HANDSHAKES);
 
-    log_info("MAX limits.content_length=%d, limits.buffer_size=%d, limits.connection_stack_size=%d",
-            MAX_CONTENT_LENGTH, BUFFER_SIZE, CONNECTION_STACK);
+    log_info("MAX limits.content_length=%d, limits.buffer_size=%d, limits.connection_stack_size=%d, limits.ssl_handshakes=%d",
+            MAX_CONTENT_LENGTH, BUFFER_SIZE, CONNECTION_STACK, MAX_SSL_HANDSHAKES);
 }
 
@@ -40,6 +40,7 @@
 #include <state.h>
 #include <proxy.h>
 #include <ssl/ssl.h>
+#include <sys/uio.h>
 
 extern int CONNECTION_STACK;
 extern int BUFFER_SIZE;
@@ -59,16 +60,19 @@ typedef struct Connection {
     State state;
     char *buf;
     char *proxy_buf;
+    int proxy_buf_size;
+    bstring proxy_req;
     struct httpclient_parser *client;
     char remote[IPADDR_SIZE+1];
     int close;
+    int cached;
 
     ssize_t (*send)(struct Connection *, char *buffer, int len);
     ssize_t (*recv)(struct Connection *, char *buffer, int len);
+    ssize_t (*sendv)(struct Connection *, struct iovec *iov, int iovcnt);
 
     SSL *ssl;
-    char *ssl_buff;
-    int ssl_buff_len;
+    int ktls;
 } Connection;
 
 void Connection_destroy(Connection *conn);
@@ -87,6 +91,8 @@ int Connection_deliver(int to_fd, bstring buf);
 
 int Connection_read_header(Connection *conn, Request *req);
 
+int Connection_ktls(Connection *conn);
+
 void Connection_init();
 
 #endif
@@ -4,6 +4,7 @@
 #include "bstring.h"
 #include "task/task.h"
 #include "register.h"
+#include "breaker.h"
 #include "dbg.h"
 #include <stdlib.h>
 #include <time.h>
@@ -66,19 +67,19 @@ error:
 static int CONTROL_RUNNING = 1;
 
 
-#line 108 "src/control.rl"
+#line 111 "src/control.rl"
 
 
 
 #line 2 "src/control.c"
 static const int ControlParser_start = 1;
-static const int ControlParser_first_final = 34;
+static const int ControlParser_first_final = 41;
 static const int ControlParser_error = 0;
 
 static const int ControlParser_en_main = 1;
 
 
-#line 111 "src/control.rl"
+#line 114 "src/control.rl"
 
 bstring Control_execute(bstring req)
 {
@@ -96,7 +97,7 @@ bstring Control_execute(bstring req)
 	cs = ControlParser_start;
 	}
 
-#line 123 "src/control.rl"
+#line 126 "src/control.rl"
     
 #line 2 "src/control.c"
 	{
@@ -107,7 +108,7 @@ case 1:
 		case 99: goto st2;
 		case 107: goto st13;
 		case 115: goto st18;
-		case 116: goto st31;
+		case 116: goto st38;
 	}
 	goto st0;
 st0:
@@ -180,29 +181,33 @@ case 12:
 		goto tr15;
 	goto st0;
 tr15:
-#line 74 "src/control.rl"
+#line 76 "src/control.rl"
 	{
         reply = bfromcstr("{\"msg\": \"stopping control port\"}");
-        CONTROL_RUNNING = 0; {p++; cs = 34; goto _out;}
+        CONTROL_RUNNING = 0; {p++; cs = 41; goto _out;}
     }
-	goto st34;
-tr30:
+	goto st41;
+tr36:
+#line 74 "src/control.rl"
+	{ reply = Breaker_info(); {p++; cs = 41; goto _out;} }
+	goto st41;
+tr38:
+#line 73 "src/control.rl"
+	{ reply = Register_info(); {p++; cs = 41; goto _out;} }
+	goto st41;
+tr42:
 #line 72 "src/control.rl"
-	{ reply = Register_info(); {p++; cs = 34; goto _out;} }
-	goto st34;
-tr34:
-#line 71 "src/control.rl"
-	{ reply = taskgetinfo(); {p++; cs = 34; goto _out;} }
-	goto st34;
-tr37:
-#line 79 "src/control.rl"
+	{ reply = taskgetinfo(); {p++; cs = 41; goto _out;} }
+	goto st41;
+tr45:
+#line 81 "src/control.rl"
 	{
-        reply = bformat("{\"time\": %d}", (int)time(NULL)); {p++; cs = 34; goto _out;}
+        reply = bformat("{\"time\": %d}", (int)time(NULL)); {p++; cs = 41; goto _out;}
     }
-	goto st34;
-st34:
+	goto st41;
+st41:
 	p += 1;
-case 34:
+case 41:
 #line 2 "src/control.c"
 	goto st0;
 st13:
@@ -243,9 +248,9 @@ case 17:
 		goto st17;
 	goto st0;
 tr20:
-#line 69 "src/control.rl"
+#line 70 "src/control.rl"
 	{ mark = p; }
-#line 83 "src/control.rl"
+#line 85 "src/control.rl"
 	{
         int id = atoi(p);
 
@@ -262,11 +267,11 @@ tr20:
             }
         }
 
-        {p++; cs = 35; goto _out;}
+        {p++; cs = 42; goto _out;}
     }
-	goto st35;
-tr38:
-#line 83 "src/control.rl"
+	goto st42;
+tr46:
+#line 85 "src/control.rl"
 	{
         int id = atoi(p);
 
@@ -283,15 +288,15 @@ tr38:
             }
         }
 
-        {p++; cs = 35; goto _out;}
+        {p++; cs = 42; goto _out;}
     }
-	goto st35;
-st35:
+	goto st42;
+st42:
 	p += 1;
-case 35:
+case 42:
 #line 2 "src/control.c"
 	if ( 48 <= (*p) && (*p) <= 57 )
-		goto tr38;
+		goto tr46;
 	goto st0;
 st18:
 	p += 1;
@@ -336,8 +341,9 @@ st24:
 case 24:
 	switch( (*p) ) {
 		case 32: goto st24;
-		case 110: goto st25;
-		case 116: goto st27;
+		case 98: goto st25;
+		case 110: goto st32;
+		case 116: goto st34;
 	}
 	if ( 9 <= (*p) && (*p) <= 13 )
 		goto st24;
@@ -345,63 +351,105 @@ case 24:
 st25:
 	p += 1;
 case 25:
-	if ( (*p) == 101 )
+	if ( (*p) == 97 )
 		goto st26;
 	goto st0;
 st26:
 	p += 1;
 case 26:
-	if ( (*p) == 116 )
-		goto tr30;
+	if ( (*p) == 99 )
+		goto st27;
 	goto st0;
 st27:
 	p += 1;
 case 27:
-	if ( (*p) == 97 )
+	if ( (*p) == 107 )
 		goto st28;
 	goto st0;
 st28:
 	p += 1;
 case 28:
-	if ( (*p) == 115 )
+	if ( (*p) == 101 )
 		goto st29;
 	goto st0;
 st29:
 	p += 1;
 case 29:
-	if ( (*p) == 107 )
+	if ( (*p) == 110 )
 		goto st30;
 	goto st0;
 st30:
 	p += 1;
 case 30:
-	if ( (*p) == 115 )
-		goto tr34;
+	if ( (*p) == 100 )
+		goto st31;
 	goto st0;
 st31:
 	p += 1;
 case 31:
-	if ( (*p) == 105 )
-		goto st32;
+	if ( (*p) == 115 )
+		goto tr36;
 	goto st0;
 st32:
 	p += 1;
 case 32:
-	if ( (*p) == 109 )
+	if ( (*p) == 101 )
 		goto st33;
 	goto st0;
 st33:
 	p += 1;
 case 33:
+	if ( (*p) == 116 )
+		goto tr38;
+	goto st0;
+st34:
+	p += 1;
+case 34:
+	if ( (*p) == 97 )
+		goto st35;
+	goto st0;
+st35:
+	p += 1;
+case 35:
+	if ( (*p) == 115 )
+		goto st36;
+	goto st0;
+st36:
+	p += 1;
+case 36:
+	if ( (*p) == 107 )
+		goto st37;
+	goto st0;
+st37:
+	p += 1;
+case 37:
+	if ( (*p) == 115 )
+		goto tr42;
+	goto st0;
+st38:
+	p += 1;
+case 38:
+	if ( (*p) == 105 )
+		goto st39;
+	goto st0;
+st39:
+	p += 1;
+case 39:
+	if ( (*p) == 109 )
+		goto st40;
+	goto st0;
+st40:
+	p += 1;
+case 40:
 	if ( (*p) == 101 )
-		goto tr37;
+		goto tr45;
 	goto st0;
 	}
 
 	_out: {}
 	}
 
-#line 124 "src/control.rl"
+#line 127 "src/control.rl"
 
     check(p <= pe, "Buffer overflow after parsing.  Tell Zed that you sent something from a handler that went %ld past the end in the parser.", 
         (long int)(pe - p));
@@ -409,7 +457,7 @@ case 33:
     if ( cs == 
 #line 2 "src/control.c"
 0
-#line 128 "src/control.rl"
+#line 131 "src/control.rl"
  ) {
         check(pe - p > 0, "Major erorr in the parser, tell Zed.");
         return bformat("{\"error\": \"parsing error at: ...%s\"}", bdata(req) + (pe - p));
@@ -2,6 +2,7 @@
 #include "bstring.h"
 #include "task/task.h"
 #include "register.h"
+#include "breaker.h"
 #include "dbg.h"
 #include <stdlib.h>
 #include <time.h>
@@ -70,6 +71,7 @@ static int CONTROL_RUNNING = 1;
 
     action status_tasks { reply = taskgetinfo(); fbreak; }
     action status_net { reply = Register_info(); fbreak; }
+    action status_backends { reply = Breaker_info(); fbreak; }
 
     action control_stop {
         reply = bfromcstr("{\"msg\": \"stopping control port\"}");
@@ -99,7 +101,8 @@ static int CONTROL_RUNNING = 1;
         fbreak;
     }
 
-    Status = "status" space+ ("tasks" @status_tasks | "net" @status_net);
+    Status = "status" space+ ("tasks" @status_tasks | "net" @status_net |
+            "backends" @status_backends);
     Control = "control stop" @control_stop;
     Time = "time" @time;
     Kill = "kill" space+ digit+ >mark @kill;
@@ -37,6 +37,13 @@
 #include <string.h>
 #include "crypto.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONFIG_AES_NI
+#include <cpuid.h>
+#include <wmmintrin.h>
+#define AES_NI_TARGET __attribute__((target("aes,sse2")))
+#endif
+
 /* all commented out in skeleton mode */
 #ifndef CONFIG_SSL_SKELETON_MODE
 
@@ -164,6 +171,18 @@ static const unsigned char Rcon[30]=
 static void AES_encrypt(const AES_CTX *ctx, uint32_t *data);
 static void AES_decrypt(const AES_CTX *ctx, uint32_t *data);
 
+#ifdef CONFIG_AES_NI
+static int AES_ni_supported(void);
+static void AES_ni_set_key(AES_CTX *ctx);
+static void AES_ni_convert_key(AES_CTX *ctx);
+static void AES_ni_cbc_encrypt(AES_CTX *ctx, const uint8_t *msg,
+        uint8_t *out, int length);
+static void AES_ni_cbc_decrypt(AES_CTX *ctx, const uint8_t *msg,
+        uint8_t *out, int length);
+static void AES_ni_ctr_encrypt(AES_CTX *ctx, uint8_t *ctr,
+        const uint8_t *msg, uint8_t *out, int length);
+#endif
+
 /* Perform doubling in Galois Field GF(2^8) using the irreducible polynomial
    x^8+x^4+x^3+x+1 */
 static unsigned char AES_xtime(uint32_t x)
@@ -244,6 +263,11 @@ void AES_set_key(AES_CTX *ctx, const uint8_t *key,
 
     /* copy the iv across */
     memcpy(ctx->iv, iv, 16);
+
+#ifdef CONFIG_AES_NI
+    ctx->ni = AES_ni_supported();
+    AES_ni_set_key(ctx);
+#endif
 }
 
 /**
@@ -263,6 +287,11 @@ void AES_convert_key(AES_CTX *ctx)
         w = inv_mix_col(w,t1,t2,t3,t4);
         *k++ =w;
     }
+
+#ifdef CONFIG_AES_NI
+    if (ctx->ni)
+        AES_ni_convert_key(ctx);
+#endif
 }
 
 /**
@@ -273,6 +302,14 @@ void AES_cbc_encrypt(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length)
     int i;
     uint32_t tin[4], tout[4], iv[4];
 
+#ifdef CONFIG_AES_NI
+    if (ctx->ni)
+    {
+        AES_ni_cbc_encrypt(ctx, msg, out, length);
+        return;
+    }
+#endif
+
     memcpy(iv, ctx->iv, AES_IV_SIZE);
     for (i = 0; i < 4; i++)
         tout[i] = ntohl(iv[i]);
@@ -312,6 +349,14 @@ void AES_cbc_decrypt(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length)
     int i;
     uint32_t tin[4], xor[4], tout[4], data[4], iv[4];
 
+#ifdef CONFIG_AES_NI
+    if (ctx->ni)
+    {
+        AES_ni_cbc_decrypt(ctx, msg, out, length);
+        return;
+    }
+#endif
+
     memcpy(iv, ctx->iv, AES_IV_SIZE);
     for (i = 0; i < 4; i++)
         xor[i] = ntohl(iv[i]);
@@ -347,6 +392,57 @@ void AES_cbc_decrypt(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length)
     memcpy(ctx->iv, iv, AES_IV_SIZE);
 }
 
+/**
+ * Encrypt (or decrypt) in CTR mode the way GCM uses it.  ctr is the whole
+ * counter block and its last four bytes are bumped big endian after each
+ * block.  Only the last call on a stream may end part way through a block.
+ * out may trail msg, for decrypting in place over a prefix being dropped.
+ */
+void AES_ctr_encrypt(AES_CTX *ctx, uint8_t *ctr, const uint8_t *msg, 
+        uint8_t *out, int length)
+{
+    int i, n;
+    uint32_t blk[4];
+    uint8_t stream[AES_BLOCKSIZE];
+
+#ifdef CONFIG_AES_NI
+    if (ctx->ni)
+    {
+        AES_ni_ctr_encrypt(ctx, ctr, msg, out, length);
+        return;
+    }
+#endif
+
+    while (length > 0)
+    {
+        memcpy(blk, ctr, AES_BLOCKSIZE);
+
+        for (i = 0; i < 4; i++)
+            blk[i] = ntohl(blk[i]);
+
+        AES_encrypt(ctx, blk);
+
+        for (i = 0; i < 4; i++)
+            blk[i] = htonl(blk[i]);
+
+        memcpy(stream, blk, AES_BLOCKSIZE);
+        n = length < AES_BLOCKSIZE ? length : AES_BLOCKSIZE;
+
+        for (i = 0; i < n; i++)
+            out[i] = msg[i] ^ stream[i];
+
+        for (i = AES_BLOCKSIZE-1; i >= AES_BLOCKSIZE-4; i--)
+        {
+            if (++ctr[i])
+                break;
+        }
+
+        msg += n;
+        out += n;
+        length -= n;
+    }
+}
+
 /**
  * Encrypt a single block (16 bytes) of data
  */
@@ -453,4 +549,248 @@ static void AES_decrypt(const AES_CTX *ctx, uint32_t *data)
     }
 }
 
+#ifdef CONFIG_AES_NI
+/**
+ * Check (once) whether the CPU has the AES instructions.
+ */
+static int AES_ni_supported(void)
+{
+    static int supported = -1;
+    unsigned int eax, ebx, ecx, edx;
+
+    if (supported == -1)
+    {
+        supported = __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+                        (ecx & bit_AES) && (edx & bit_SSE2);
+    }
+
+    return supported;
+}
+
+/**
+ * The round keys are the same as the portable key schedule, just laid out
+ * as bytes the way the AES instructions want them.
+ */
+static void AES_ni_set_key(AES_CTX *ctx)
+{
+    int i;
+    uint8_t *k = ctx->ni_ks;
+
+    for (i = 0; i < 4*(ctx->rounds+1); i++)
+    {
+        *k++ = ctx->ks[i] >> 24;
+        *k++ = ctx->ks[i] >> 16;
+        *k++ = ctx->ks[i] >> 8;
+        *k++ = ctx->ks[i];
+    }
+}
+
+/**
+ * aesdec wants the round keys backwards and through InvMixColumns.
+ */
+static AES_NI_TARGET void AES_ni_convert_key(AES_CTX *ctx)
+{
+    __m128i ek[AES_MAXROUNDS+1];
+    int i, rounds = ctx->rounds;
+    __m128i *ks = (__m128i *)ctx->ni_ks;
+
+    for (i = 0; i <= rounds; i++)
+        ek[i] = _mm_loadu_si128(&ks[i]);
+
+    _mm_storeu_si128(&ks[0], ek[rounds]);
+
+    for (i = 1; i < rounds; i++)
+        _mm_storeu_si128(&ks[i], _mm_aesimc_si128(ek[rounds-i]));
+
+    _mm_storeu_si128(&ks[rounds], ek[0]);
+}
+
+static AES_NI_TARGET void AES_ni_cbc_encrypt(AES_CTX *ctx,
+        const uint8_t *msg, uint8_t *out, int length)
+{
+    __m128i k[AES_MAXROUNDS+1];
+    __m128i block, iv;
+    int i, rounds = ctx->rounds;
+
+    for (i = 0; i <= rounds; i++)
+        k[i] = _mm_loadu_si128((const __m128i *)&ctx->ni_ks[i*AES_BLOCKSIZE]);
+
+    iv = _mm_loadu_si128((const __m128i *)ctx->iv);
+
+    /* each block needs the one before it, so there's nothing to overlap */
+    for (length -= AES_BLOCKSIZE; length >= 0; length -= AES_BLOCKSIZE)
+    {
+        block = _mm_xor_si128(_mm_loadu_si128((const __m128i *)msg), iv);
+        block = _mm_xor_si128(block, k[0]);
+
+        for (i = 1; i < rounds; i++)
+            block = _mm_aesenc_si128(block, k[i]);
+
+        iv = _mm_aesenclast_si128(block, k[rounds]);
+        _mm_storeu_si128((__m128i *)out, iv);
+
+        msg += AES_BLOCKSIZE;
+        out += AES_BLOCKSIZE;
+    }
+
+    _mm_storeu_si128((__m128i *)ctx->iv, iv);
+}
+
+/**
+ * CBC decryption of one block doesn't depend on the others, so four go
+ * through the pipeline together.  All four are loaded before any are
+ * stored, so decrypting in place works.
+ */
+static AES_NI_TARGET void AES_ni_cbc_decrypt(AES_CTX *ctx,
+        const uint8_t *msg, uint8_t *out, int length)
+{
+    __m128i k[AES_MAXROUNDS+1];
+    __m128i c0, c1, c2, c3, b0, b1, b2, b3, iv;
+    int i, rounds = ctx->rounds;
+
+    for (i = 0; i <= rounds; i++)
+        k[i] = _mm_loadu_si128((const __m128i *)&ctx->ni_ks[i*AES_BLOCKSIZE]);
+
+    iv = _mm_loadu_si128((const __m128i *)ctx->iv);
+
+    for (; length >= 4*AES_BLOCKSIZE; length -= 4*AES_BLOCKSIZE)
+    {
+        c0 = _mm_loadu_si128((const __m128i *)msg);
+        c1 = _mm_loadu_si128((const __m128i *)(msg + 16));
+        c2 = _mm_loadu_si128((const __m128i *)(msg + 32));
+        c3 = _mm_loadu_si128((const __m128i *)(msg + 48));
+
+        b0 = _mm_xor_si128(c0, k[0]);
+        b1 = _mm_xor_si128(c1, k[0]);
+        b2 = _mm_xor_si128(c2, k[0]);
+        b3 = _mm_xor_si128(c3, k[0]);
+
+        for (i = 1; i < rounds; i++)
+        {
+            b0 = _mm_aesdec_si128(b0, k[i]);
+            b1 = _mm_aesdec_si128(b1, k[i]);
+            b2 = _mm_aesdec_si128(b2, k[i]);
+            b3 = _mm_aesdec_si128(b3, k[i]);
+        }
+
+        b0 = _mm_aesdeclast_si128(b0, k[rounds]);
+        b1 = _mm_aesdeclast_si128(b1, k[rounds]);
+        b2 = _mm_aesdeclast_si128(b2, k[rounds]);
+        b3 = _mm_aesdeclast_si128(b3, k[rounds]);
+
+        _mm_storeu_si128((__m128i *)out, _mm_xor_si128(b0, iv));
+        _mm_storeu_si128((__m128i *)(out + 16), _mm_xor_si128(b1, c0));
+        _mm_storeu_si128((__m128i *)(out + 32), _mm_xor_si128(b2, c1));
+        _mm_storeu_si128((__m128i *)(out + 48), _mm_xor_si128(b3, c2));
+        iv = c3;
+
+        msg += 4*AES_BLOCKSIZE;
+        out += 4*AES_BLOCKSIZE;
+    }
+
+    for (length -= AES_BLOCKSIZE; length >= 0; length -= AES_BLOCKSIZE)
+    {
+        c0 = _mm_loadu_si128((const __m128i *)msg);
+        b0 = _mm_xor_si128(c0, k[0]);
+
+        for (i = 1; i < rounds; i++)
+            b0 = _mm_aesdec_si128(b0, k[i]);
+
+        b0 = _mm_aesdeclast_si128(b0, k[rounds]);
+        _mm_storeu_si128((__m128i *)out, _mm_xor_si128(b0, iv));
+        iv = c0;
+
+        msg += AES_BLOCKSIZE;
+        out += AES_BLOCKSIZE;
+    }
+
+    _mm_storeu_si128((__m128i *)ctx->iv, iv);
+}
+
+/**
+ * CTR blocks are independent, so four go through the pipeline together
+ * like CBC decryption.  The counter blocks are built in memory, which
+ * keeps this to SSE2.
+ */
+static AES_NI_TARGET void AES_ni_ctr_encrypt(AES_CTX *ctx, uint8_t *ctr,
+        const uint8_t *msg, uint8_t *out, int length)
+{
+    __m128i k[AES_MAXROUNDS+1];
+    __m128i b0, b1, b2, b3, m0, m1, m2, m3;
+    uint8_t blocks[4*AES_BLOCKSIZE];
+    uint32_t c = (ctr[12] << 24) | (ctr[13] << 16) | (ctr[14] << 8) | ctr[15];
+    int i, rounds = ctx->rounds;
+
+    for (i = 0; i <= rounds; i++)
+        k[i] = _mm_loadu_si128((const __m128i *)&ctx->ni_ks[i*AES_BLOCKSIZE]);
+
+    while (length > 0)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            uint8_t *b = &blocks[i*AES_BLOCKSIZE];
+            memcpy(b, ctr, 12);
+            b[12] = (c + i) >> 24;
+            b[13] = (c + i) >> 16;
+            b[14] = (c + i) >> 8;
+            b[15] = c + i;
+        }
+
+        b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)blocks), k[0]);
+        b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(blocks + 16)), k[0]);
+        b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(blocks + 32)), k[0]);
+        b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(blocks + 48)), k[0]);
+
+        for (i = 1; i < rounds; i++)
+        {
+            b0 = _mm_aesenc_si128(b0, k[i]);
+            b1 = _mm_aesenc_si128(b1, k[i]);
+            b2 = _mm_aesenc_si128(b2, k[i]);
+            b3 = _mm_aesenc_si128(b3, k[i]);
+        }
+
+        b0 = _mm_aesenclast_si128(b0, k[rounds]);
+        b1 = _mm_aesenclast_si128(b1, k[rounds]);
+        b2 = _mm_aesenclast_si128(b2, k[rounds]);
+        b3 = _mm_aesenclast_si128(b3, k[rounds]);
+
+        if (length >= 4*AES_BLOCKSIZE)
+        {
+            /* load all four before storing any, as out may trail msg */
+            m0 = _mm_loadu_si128((const __m128i *)msg);
+            m1 = _mm_loadu_si128((const __m128i *)(msg + 16));
+            m2 = _mm_loadu_si128((const __m128i *)(msg + 32));
+            m3 = _mm_loadu_si128((const __m128i *)(msg + 48));
+            _mm_storeu_si128((__m128i *)out, _mm_xor_si128(b0, m0));
+            _mm_storeu_si128((__m128i *)(out + 16), _mm_xor_si128(b1, m1));
+            _mm_storeu_si128((__m128i *)(out + 32), _mm_xor_si128(b2, m2));
+            _mm_storeu_si128((__m128i *)(out + 48), _mm_xor_si128(b3, m3));
+
+            c += 4;
+            msg += 4*AES_BLOCKSIZE;
+            out += 4*AES_BLOCKSIZE;
+            length -= 4*AES_BLOCKSIZE;
+        }
+        else
+        {
+            _mm_storeu_si128((__m128i *)blocks, b0);
+            _mm_storeu_si128((__m128i *)(blocks + 16), b1);
+            _mm_storeu_si128((__m128i *)(blocks + 32), b2);
+            _mm_storeu_si128((__m128i *)(blocks + 48), b3);
+
+            for (i = 0; i < length; i++)
+                out[i] = msg[i] ^ blocks[i];
+
+            c += (length + AES_BLOCKSIZE-1) / AES_BLOCKSIZE;
+            length = 0;
+        }
+    }
+
+    ctr[12] = c >> 24;
+    ctr[13] = c >> 16;
+    ctr[14] = c >> 8;
+    ctr[15] = c;
+}
+#endif
+
 #endif
@@ -62,6 +62,8 @@ typedef struct aes_key_st
     uint16_t key_size;
     uint32_t ks[(AES_MAXROUNDS+1)*8];
     uint8_t iv[AES_IV_SIZE];
+    uint8_t ni;                 /* use AES-NI and ni_ks instead of ks */
+    uint8_t ni_ks[(AES_MAXROUNDS+1)*AES_BLOCKSIZE];
 } AES_CTX;
 
 typedef enum
@@ -76,6 +78,32 @@ void AES_cbc_encrypt(AES_CTX *ctx, const uint8_t *msg,
         uint8_t *out, int length);
 void AES_cbc_decrypt(AES_CTX *ks, const uint8_t *in, uint8_t *out, int length);
 void AES_convert_key(AES_CTX *ctx);
+void AES_ctr_encrypt(AES_CTX *ctx, uint8_t *ctr, const uint8_t *msg, 
+        uint8_t *out, int length);
+
+/**************************************************************************
+ * GCM declarations 
+ **************************************************************************/
+
+#define GCM_IV_SIZE             12
+#define GCM_TAG_SIZE            16
+
+typedef struct
+{
+    AES_CTX aes;
+    uint64_t HL[16];            /* 4 bit tables of multiples of H */
+    uint64_t HH[16];
+    uint8_t ni;                 /* use PCLMULQDQ and ni_h instead */
+    uint8_t ni_h[4][16];        /* H, H^2, H^3, H^4, byte reversed */
+} GCM_CTX;
+
+void GCM_set_key(GCM_CTX *ctx, const uint8_t *key, AES_MODE mode);
+void GCM_encrypt(GCM_CTX *ctx, const uint8_t *iv, 
+        const uint8_t *aad, int aad_len,
+        const uint8_t *msg, uint8_t *out, int length, uint8_t *tag);
+int GCM_decrypt(GCM_CTX *ctx, const uint8_t *iv, 
+        const uint8_t *aad, int aad_len,
+        const uint8_t *msg, uint8_t *out, int length, const uint8_t *tag);
 
 /**************************************************************************
  * RC4 declarations 
@@ -106,12 +134,64 @@ typedef struct
     uint32_t Length_High;           /* Message length in bits */
     uint16_t Message_Block_Index;   /* Index into message block array   */
     uint8_t Message_Block[64];      /* 512-bit message blocks */
+    uint8_t ni;                     /* use the SHA extensions */
 } SHA1_CTX;
 
 void SHA1_Init(SHA1_CTX *);
 void SHA1_Update(SHA1_CTX *, const uint8_t * msg, int len);
 void SHA1_Final(uint8_t *digest, SHA1_CTX *);
 
+/**************************************************************************
+ * SHA256 declarations 
+ **************************************************************************/
+
+#define SHA256_SIZE   32
+
+typedef struct
+{
+    uint64_t total;                 /* bytes hashed so far */
+    uint32_t state[8];
+    uint8_t buffer[64];
+} SHA256_CTX;
+
+void SHA256_Init(SHA256_CTX *);
+void SHA256_Update(SHA256_CTX *, const uint8_t *msg, int len);
+void SHA256_Final(uint8_t *digest, SHA256_CTX *);
+
+/**************************************************************************
+ * SHA512/SHA384 declarations 
+ **************************************************************************/
+
+#define SHA384_SIZE   48
+#define SHA512_SIZE   64
+
+typedef struct
+{
+    uint64_t total;                 /* bytes hashed so far */
+    uint64_t state[8];
+    uint8_t buffer[128];
+    int size;                       /* digest size, 48 for SHA384 */
+} SHA512_CTX;
+
+typedef SHA512_CTX SHA384_CTX;
+
+void SHA512_Init(SHA512_CTX *);
+void SHA384_Init(SHA384_CTX *);
+void SHA512_Update(SHA512_CTX *, const uint8_t *msg, int len);
+void SHA512_Final(uint8_t *digest, SHA512_CTX *);
+
+#define SHA384_Update SHA512_Update
+#define SHA384_Final SHA512_Final
+
+/**************************************************************************
+ * X25519 declarations 
+ **************************************************************************/
+
+#define X25519_SIZE   32
+
+int X25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point);
+void X25519_public(uint8_t *out, const uint8_t *scalar);
+
 /**************************************************************************
  * MD2 declarations 
  **************************************************************************/
@@ -154,6 +234,26 @@ void hmac_md5(const uint8_t *msg, int length, const uint8_t *key,
         int key_len, uint8_t *digest);
 void hmac_sha1(const uint8_t *msg, int length, const uint8_t *key, 
         int key_len, uint8_t *digest);
+void hmac_sha256(const uint8_t *msg, int length, const uint8_t *key, 
+        int key_len, uint8_t *digest);
+void hmac_sha384(const uint8_t *msg, int length, const uint8_t *key, 
+        int key_len, uint8_t *digest);
+
+/*
+ * A SHA1 HMAC key with its ipad and opad blocks already compressed, so
+ * each MAC made with it is two compressions cheaper. Start a MAC by
+ * copying inner, SHA1_Update the message into the copy and hand it to
+ * hmac_sha1_final.
+ */
+typedef struct
+{
+    SHA1_CTX inner;
+    SHA1_CTX outer;
+} HMAC_SHA1_KEY;
+
+void hmac_sha1_key(HMAC_SHA1_KEY *hkey, const uint8_t *key, int key_len);
+void hmac_sha1_final(const HMAC_SHA1_KEY *hkey, SHA1_CTX *ctx,
+        uint8_t *digest);
 
 /**************************************************************************
  * RSA declarations 
@@ -191,15 +291,16 @@ void RSA_pub_key_new(RSA_CTX **rsa_ctx,
         const uint8_t *modulus, int mod_len,
         const uint8_t *pub_exp, int pub_len);
 void RSA_free(RSA_CTX *ctx);
+RSA_CTX *RSA_clone(const RSA_CTX *ctx);
 int RSA_decrypt(const RSA_CTX *ctx, const uint8_t *in_data, uint8_t *out_data,
         int is_decryption);
 bigint *RSA_private(const RSA_CTX *c, bigint *bi_msg);
-#if defined(CONFIG_SSL_CERT_VERIFICATION) || defined(CONFIG_SSL_GENERATE_X509_CERT)
-bigint *RSA_sign_verify(BI_CTX *ctx, const uint8_t *sig, int sig_len,
-        bigint *modulus, bigint *pub_exp);
 bigint *RSA_public(const RSA_CTX * c, bigint *bi_msg);
 int RSA_encrypt(const RSA_CTX *ctx, const uint8_t *in_data, uint16_t in_len, 
         uint8_t *out_data, int is_signing);
+#if defined(CONFIG_SSL_CERT_VERIFICATION) || defined(CONFIG_SSL_GENERATE_X509_CERT)
+bigint *RSA_sign_verify(BI_CTX *ctx, const uint8_t *sig, int sig_len,
+        bigint *modulus, bigint *pub_exp);
 void RSA_print(const RSA_CTX *ctx);
 #endif
 
@@ -0,0 +1,438 @@
+/**
+ *
+ * Copyright (c) 2010, Zed A. Shaw and Mongrel2 Project Contributors.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ *     * Neither the name of the Mongrel2 Project, Zed A. Shaw, nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * AES-GCM, as defined in NIST SP 800-38D, for the TLS 1.2 GCM suites.
+ * GHASH uses PCLMULQDQ when the CPU has it and Shoup's 4 bit tables when
+ * it doesn't.  The counter mode half is AES_ctr_encrypt().
+ */
+
+#include <string.h>
+#include "crypto.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONFIG_GCM_NI
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#define GCM_NI_TARGET __attribute__((target("pclmul,ssse3")))
+#endif
+
+/*
+ * CTR and GHASH take turns over a chunk this size, so the second pass reads
+ * what the first left in L1 rather than going back to memory.
+ */
+#define GCM_CHUNK_SIZE          4096
+
+static void GCM_ghash(const GCM_CTX *ctx, uint8_t *x, 
+        const uint8_t *data, int length);
+#ifdef CONFIG_GCM_NI
+static int GCM_ni_supported(void);
+static void GCM_ni_set_key(GCM_CTX *ctx, const uint8_t *h);
+static void GCM_ni_ghash(const GCM_CTX *ctx, uint8_t *x,
+        const uint8_t *data, int length);
+#endif
+
+static const uint64_t last4[16] =
+{
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/**
+ * Set up the AES key and work out the hash key H = E(K, 0^128).
+ */
+void GCM_set_key(GCM_CTX *ctx, const uint8_t *key, AES_MODE mode)
+{
+    uint8_t h[AES_BLOCKSIZE] = {0};
+    uint8_t ctr[AES_BLOCKSIZE] = {0};
+    uint64_t vh, vl;
+    int i, j;
+
+    AES_set_key(&ctx->aes, key, ctr, mode);
+    AES_ctr_encrypt(&ctx->aes, ctr, h, h, AES_BLOCKSIZE);
+
+    vh = vl = 0;
+
+    for (i = 0; i < 8; i++)
+    {
+        vh = (vh << 8) | h[i];
+        vl = (vl << 8) | h[i+8];
+    }
+
+    /* the multiples of H by each 4 bit value, in GCM's reflected order */
+    ctx->HL[8] = vl;
+    ctx->HH[8] = vh;
+    ctx->HL[0] = 0;
+    ctx->HH[0] = 0;
+
+    for (i = 4; i > 0; i >>= 1)
+    {
+        uint32_t T = (uint32_t)(vl & 1) * 0xe1000000U;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ ((uint64_t)T << 32);
+        ctx->HL[i] = vl;
+        ctx->HH[i] = vh;
+    }
+
+    for (i = 2; i <= 8; i *= 2)
+    {
+        for (j = 1; j < i; j++)
+        {
+            ctx->HH[i+j] = ctx->HH[i] ^ ctx->HH[j];
+            ctx->HL[i+j] = ctx->HL[i] ^ ctx->HL[j];
+        }
+    }
+
+#ifdef CONFIG_GCM_NI
+    ctx->ni = GCM_ni_supported();
+
+    if (ctx->ni)
+        GCM_ni_set_key(ctx, h);
+#else
+    ctx->ni = 0;
+#endif
+}
+
+/**
+ * Encrypt length bytes of msg into out and produce the tag over them and
+ * the additional data.
+ */
+void GCM_encrypt(GCM_CTX *ctx, const uint8_t *iv, 
+        const uint8_t *aad, int aad_len,
+        const uint8_t *msg, uint8_t *out, int length, uint8_t *tag)
+{
+    uint8_t j0[AES_BLOCKSIZE], ctr[AES_BLOCKSIZE];
+    uint8_t x[AES_BLOCKSIZE] = {0};
+    uint8_t lens[AES_BLOCKSIZE];
+    uint64_t aad_bits = (uint64_t)aad_len << 3, bits = (uint64_t)length << 3;
+    int i, n;
+
+    memcpy(j0, iv, GCM_IV_SIZE);
+    j0[12] = j0[13] = j0[14] = 0;
+    j0[15] = 1;
+    memcpy(ctr, j0, AES_BLOCKSIZE);
+    ctr[15] = 2;
+
+    GCM_ghash(ctx, x, aad, aad_len);
+
+    for (; length > 0; length -= n)
+    {
+        n = length < GCM_CHUNK_SIZE ? length : GCM_CHUNK_SIZE;
+        AES_ctr_encrypt(&ctx->aes, ctr, msg, out, n);
+        GCM_ghash(ctx, x, out, n);
+        msg += n;
+        out += n;
+    }
+
+    for (i = 0; i < 8; i++)
+    {
+        lens[i] = aad_bits >> (56 - 8*i);
+        lens[i+8] = bits >> (56 - 8*i);
+    }
+
+    GCM_ghash(ctx, x, lens, AES_BLOCKSIZE);
+    AES_ctr_encrypt(&ctx->aes, j0, x, tag, GCM_TAG_SIZE);
+}
+
+/**
+ * Decrypt length bytes of msg into out and check the tag.  out may trail
+ * msg, as when dropping an explicit nonce in place.  Returns 0 if the tag
+ * matched and -1 if it didn't, in which case out must be thrown away.
+ */
+int GCM_decrypt(GCM_CTX *ctx, const uint8_t *iv, 
+        const uint8_t *aad, int aad_len,
+        const uint8_t *msg, uint8_t *out, int length, const uint8_t *tag)
+{
+    uint8_t j0[AES_BLOCKSIZE], ctr[AES_BLOCKSIZE];
+    uint8_t x[AES_BLOCKSIZE] = {0};
+    uint8_t lens[AES_BLOCKSIZE];
+    uint64_t aad_bits = (uint64_t)aad_len << 3, bits = (uint64_t)length << 3;
+    uint8_t diff = 0;
+    int i, n;
+
+    memcpy(j0, iv, GCM_IV_SIZE);
+    j0[12] = j0[13] = j0[14] = 0;
+    j0[15] = 1;
+    memcpy(ctr, j0, AES_BLOCKSIZE);
+    ctr[15] = 2;
+
+    GCM_ghash(ctx, x, aad, aad_len);
+
+    /* hash each chunk before it is overwritten by a trailing out */
+    for (; length > 0; length -= n)
+    {
+        n = length < GCM_CHUNK_SIZE ? length : GCM_CHUNK_SIZE;
+        GCM_ghash(ctx, x, msg, n);
+        AES_ctr_encrypt(&ctx->aes, ctr, msg, out, n);
+        msg += n;
+        out += n;
+    }
+
+    for (i = 0; i < 8; i++)
+    {
+        lens[i] = aad_bits >> (56 - 8*i);
+        lens[i+8] = bits >> (56 - 8*i);
+    }
+
+    GCM_ghash(ctx, x, lens, AES_BLOCKSIZE);
+    AES_ctr_encrypt(&ctx->aes, j0, x, x, GCM_TAG_SIZE);
+
+    /* don't leak how much of the tag was right */
+    for (i = 0; i < GCM_TAG_SIZE; i++)
+        diff |= x[i] ^ tag[i];
+
+    return diff ? -1 : 0;
+}
+
+/**
+ * x = x * H in GF(2^128), using the 4 bit tables.
+ */
+static void GCM_mult(const GCM_CTX *ctx, uint8_t *x)
+{
+    uint64_t zh, zl;
+    uint8_t lo, hi, rem;
+    int i;
+
+    lo = x[15] & 0xf;
+    zh = ctx->HH[lo];
+    zl = ctx->HL[lo];
+
+    for (i = 15; i >= 0; i--)
+    {
+        lo = x[i] & 0xf;
+        hi = x[i] >> 4;
+
+        if (i != 15)
+        {
+            rem = (uint8_t)zl & 0xf;
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ (last4[rem] << 48);
+            zh ^= ctx->HH[lo];
+            zl ^= ctx->HL[lo];
+        }
+
+        rem = (uint8_t)zl & 0xf;
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ (last4[rem] << 48);
+        zh ^= ctx->HH[hi];
+        zl ^= ctx->HL[hi];
+    }
+
+    for (i = 0; i < 8; i++)
+    {
+        x[i] = zh >> (56 - 8*i);
+        x[i+8] = zl >> (56 - 8*i);
+    }
+}
+
+/**
+ * Fold data into the running hash x, padding a partial last block with
+ * zeros.
+ */
+static void GCM_ghash(const GCM_CTX *ctx, uint8_t *x, 
+        const uint8_t *data, int length)
+{
+    int i, n;
+
+#ifdef CONFIG_GCM_NI
+    if (ctx->ni)
+    {
+        GCM_ni_ghash(ctx, x, data, length);
+        return;
+    }
+#endif
+
+    for (; length > 0; length -= n, data += n)
+    {
+        n = length < AES_BLOCKSIZE ? length : AES_BLOCKSIZE;
+
+        for (i = 0; i < n; i++)
+            x[i] ^= data[i];
+
+        GCM_mult(ctx, x);
+    }
+}
+
+#ifdef CONFIG_GCM_NI
+static int GCM_ni_supported(void)
+{
+    static int supported = -1;
+    unsigned int eax, ebx, ecx, edx;
+
+    if (supported == -1)
+    {
+        supported = __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+                        (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+    }
+
+    return supported;
+}
+
+/*
+ * The carry-less multiply from Intel's "Carry-Less Multiplication and Its
+ * Usage for Computing the GCM Mode", split in two so that several products
+ * can be summed and then reduced once.  Operands are byte reversed; the
+ * one bit shift in the reduction takes care of the bit reflection.
+ */
+static inline GCM_NI_TARGET void GCM_ni_clmul(__m128i a, __m128i b,
+        __m128i *lo, __m128i *hi)
+{
+    __m128i t3, t4, t5, t6;
+
+    t3 = _mm_clmulepi64_si128(a, b, 0x00);
+    t4 = _mm_clmulepi64_si128(a, b, 0x10);
+    t5 = _mm_clmulepi64_si128(a, b, 0x01);
+    t6 = _mm_clmulepi64_si128(a, b, 0x11);
+    t4 = _mm_xor_si128(t4, t5);
+    t5 = _mm_slli_si128(t4, 8);
+    t4 = _mm_srli_si128(t4, 8);
+    *lo = _mm_xor_si128(*lo, _mm_xor_si128(t3, t5));
+    *hi = _mm_xor_si128(*hi, _mm_xor_si128(t6, t4));
+}
+
+static inline GCM_NI_TARGET __m128i GCM_ni_reduce(__m128i t3, __m128i t6)
+{
+    __m128i t2, t4, t5, t7, t8, t9;
+
+    /* shift the 256 bit product left by one */
+    t7 = _mm_srli_epi32(t3, 31);
+    t8 = _mm_srli_epi32(t6, 31);
+    t3 = _mm_slli_epi32(t3, 1);
+    t6 = _mm_slli_epi32(t6, 1);
+    t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    t3 = _mm_or_si128(t3, t7);
+    t6 = _mm_or_si128(t6, t8);
+    t6 = _mm_or_si128(t6, t9);
+
+    /* and reduce modulo x^128 + x^7 + x^2 + x + 1 */
+    t7 = _mm_slli_epi32(t3, 31);
+    t8 = _mm_slli_epi32(t3, 30);
+    t9 = _mm_slli_epi32(t3, 25);
+    t7 = _mm_xor_si128(t7, t8);
+    t7 = _mm_xor_si128(t7, t9);
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    t3 = _mm_xor_si128(t3, t7);
+    t2 = _mm_srli_epi32(t3, 1);
+    t4 = _mm_srli_epi32(t3, 2);
+    t5 = _mm_srli_epi32(t3, 7);
+    t2 = _mm_xor_si128(t2, t4);
+    t2 = _mm_xor_si128(t2, t5);
+    t2 = _mm_xor_si128(t2, t8);
+    t3 = _mm_xor_si128(t3, t2);
+
+    return _mm_xor_si128(t6, t3);
+}
+
+static inline GCM_NI_TARGET __m128i GCM_ni_mult(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_setzero_si128(), hi = lo;
+
+    GCM_ni_clmul(a, b, &lo, &hi);
+    return GCM_ni_reduce(lo, hi);
+}
+
+static GCM_NI_TARGET void GCM_ni_set_key(GCM_CTX *ctx, const uint8_t *h)
+{
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                       8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i h1, hn;
+    int i;
+
+    h1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)h), bswap);
+    hn = h1;
+    _mm_storeu_si128((__m128i *)ctx->ni_h[0], h1);
+
+    for (i = 1; i < 4; i++)
+    {
+        hn = GCM_ni_mult(hn, h1);
+        _mm_storeu_si128((__m128i *)ctx->ni_h[i], hn);
+    }
+}
+
+/**
+ * Four blocks at a time are multiplied by H^4..H and reduced together,
+ * which takes the reduction off the critical path.
+ */
+static GCM_NI_TARGET void GCM_ni_ghash(const GCM_CTX *ctx, uint8_t *x,
+        const uint8_t *data, int length)
+{
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                       8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i h1, h2, h3, h4, X, d0, d1, d2, d3, lo, hi;
+    uint8_t last[AES_BLOCKSIZE];
+
+    h1 = _mm_loadu_si128((const __m128i *)ctx->ni_h[0]);
+    h2 = _mm_loadu_si128((const __m128i *)ctx->ni_h[1]);
+    h3 = _mm_loadu_si128((const __m128i *)ctx->ni_h[2]);
+    h4 = _mm_loadu_si128((const __m128i *)ctx->ni_h[3]);
+    X = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)x), bswap);
+
+    for (; length >= 4*AES_BLOCKSIZE; length -= 4*AES_BLOCKSIZE)
+    {
+        d0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), bswap);
+        d1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), bswap);
+        d2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), bswap);
+        d3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), bswap);
+
+        lo = hi = _mm_setzero_si128();
+        GCM_ni_clmul(_mm_xor_si128(X, d0), h4, &lo, &hi);
+        GCM_ni_clmul(d1, h3, &lo, &hi);
+        GCM_ni_clmul(d2, h2, &lo, &hi);
+        GCM_ni_clmul(d3, h1, &lo, &hi);
+        X = GCM_ni_reduce(lo, hi);
+
+        data += 4*AES_BLOCKSIZE;
+    }
+
+    for (; length > 0; length -= AES_BLOCKSIZE)
+    {
+        if (length < AES_BLOCKSIZE)
+        {
+            memset(last, 0, sizeof(last));
+            memcpy(last, data, length);
+            data = last;
+        }
+
+        d0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), bswap);
+        X = GCM_ni_mult(_mm_xor_si128(X, d0), h1);
+        data += AES_BLOCKSIZE;
+    }
+
+    _mm_storeu_si128((__m128i *)x, _mm_shuffle_epi8(X, bswap));
+}
+#endif
@@ -73,7 +73,20 @@ void hmac_md5(const uint8_t *msg, int length, const uint8_t *key,
 void hmac_sha1(const uint8_t *msg, int length, const uint8_t *key, 
         int key_len, uint8_t *digest)
 {
+    HMAC_SHA1_KEY hkey;
     SHA1_CTX context;
+
+    hmac_sha1_key(&hkey, key, key_len);
+    context = hkey.inner;
+    SHA1_Update(&context, msg, length);
+    hmac_sha1_final(&hkey, &context, digest);
+}
+
+/**
+ * Hash the padded key blocks once, for a key that will MAC many messages.
+ */
+void hmac_sha1_key(HMAC_SHA1_KEY *hkey, const uint8_t *key, int key_len)
+{
     uint8_t k_ipad[64];
     uint8_t k_opad[64];
     int i;
@@ -89,12 +102,84 @@ void hmac_sha1(const uint8_t *msg, int length, const uint8_t *key,
         k_opad[i] ^= 0x5c;
     }
 
-    SHA1_Init(&context);
-    SHA1_Update(&context, k_ipad, 64);
-    SHA1_Update(&context, msg, length);
-    SHA1_Final(digest, &context);
-    SHA1_Init(&context);
-    SHA1_Update(&context, k_opad, 64);
-    SHA1_Update(&context, digest, SHA1_SIZE);
-    SHA1_Final(digest, &context);
+    SHA1_Init(&hkey->inner);
+    SHA1_Update(&hkey->inner, k_ipad, 64);
+    SHA1_Init(&hkey->outer);
+    SHA1_Update(&hkey->outer, k_opad, 64);
+}
+
+/**
+ * Finish a MAC whose message has been fed into a copy of hkey->inner.
+ */
+void hmac_sha1_final(const HMAC_SHA1_KEY *hkey, SHA1_CTX *ctx,
+        uint8_t *digest)
+{
+    SHA1_Final(digest, ctx);
+    *ctx = hkey->outer;
+    SHA1_Update(ctx, digest, SHA1_SIZE);
+    SHA1_Final(digest, ctx);
+}
+
+/**
+ * Perform HMAC-SHA256
+ */
+void hmac_sha256(const uint8_t *msg, int length, const uint8_t *key, 
+        int key_len, uint8_t *digest)
+{
+    SHA256_CTX context;
+    uint8_t k_ipad[64];
+    uint8_t k_opad[64];
+    int i;
+
+    memset(k_ipad, 0, sizeof k_ipad);
+    memset(k_opad, 0, sizeof k_opad);
+    memcpy(k_ipad, key, key_len);
+    memcpy(k_opad, key, key_len);
+
+    for (i = 0; i < 64; i++) 
+    {
+        k_ipad[i] ^= 0x36;
+        k_opad[i] ^= 0x5c;
+    }
+
+    SHA256_Init(&context);
+    SHA256_Update(&context, k_ipad, 64);
+    SHA256_Update(&context, msg, length);
+    SHA256_Final(digest, &context);
+    SHA256_Init(&context);
+    SHA256_Update(&context, k_opad, 64);
+    SHA256_Update(&context, digest, SHA256_SIZE);
+    SHA256_Final(digest, &context);
+}
+
+/**
+ * Perform HMAC-SHA384, whose block is 128 bytes rather than 64
+ */
+void hmac_sha384(const uint8_t *msg, int length, const uint8_t *key, 
+        int key_len, uint8_t *digest)
+{
+    SHA384_CTX context;
+    uint8_t k_ipad[128];
+    uint8_t k_opad[128];
+    int i;
+
+    memset(k_ipad, 0, sizeof k_ipad);
+    memset(k_opad, 0, sizeof k_opad);
+    memcpy(k_ipad, key, key_len);
+    memcpy(k_opad, key, key_len);
+
+    for (i = 0; i < 128; i++) 
+    {
+        k_ipad[i] ^= 0x36;
+        k_opad[i] ^= 0x5c;
+    }
+
+    SHA384_Init(&context);
+    SHA384_Update(&context, k_ipad, 128);
+    SHA384_Update(&context, msg, length);
+    SHA384_Final(digest, &context);
+    SHA384_Init(&context);
+    SHA384_Update(&context, k_opad, 128);
+    SHA384_Update(&context, digest, SHA384_SIZE);
+    SHA384_Final(digest, &context);
 }
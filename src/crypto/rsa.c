@@ -130,6 +130,48 @@ void RSA_free(RSA_CTX *rsa_ctx)
     free(rsa_ctx);
 }
 
+/**
+ * Copy a private key into a context with its own bigint context, so the
+ * copy can be used on another thread at the same time as the original.
+ */
+RSA_CTX *RSA_clone(const RSA_CTX *rsa_ctx)
+{
+#ifdef CONFIG_BIGINT_CRT
+    const bigint *parts[] = { rsa_ctx->m, rsa_ctx->e, rsa_ctx->d,
+        rsa_ctx->p, rsa_ctx->q, rsa_ctx->dP, rsa_ctx->dQ, rsa_ctx->qInv };
+#else
+    const bigint *parts[] = { rsa_ctx->m, rsa_ctx->e, rsa_ctx->d };
+#endif
+    const int num_parts = sizeof(parts)/sizeof(parts[0]);
+    uint8_t *data[sizeof(parts)/sizeof(parts[0])];
+    int len[sizeof(parts)/sizeof(parts[0])];
+    RSA_CTX *copy = NULL;
+    int i;
+
+    if (rsa_ctx->d == NULL)
+        return NULL;
+
+    for (i = 0; i < num_parts; i++)
+    {
+        len[i] = i == 0 ? rsa_ctx->num_octets : parts[i]->size*COMP_BYTE_SIZE;
+        data[i] = (uint8_t *)malloc(len[i]);
+        bi_export(rsa_ctx->bi_ctx, bi_clone(rsa_ctx->bi_ctx, parts[i]),
+                data[i], len[i]);
+    }
+
+    RSA_priv_key_new(&copy, data[0], len[0], data[1], len[1], data[2], len[2]
+#ifdef CONFIG_BIGINT_CRT
+            , data[3], len[3], data[4], len[4], data[5], len[5],
+            data[6], len[6], data[7], len[7]
+#endif
+            );
+
+    for (i = 0; i < num_parts; i++)
+        free(data[i]);
+
+    return copy;
+}
+
 /**
  * @brief Use PKCS1.5 for decryption/verification.
  * @param ctx [in] The context
@@ -216,7 +258,6 @@ void RSA_print(const RSA_CTX *rsa_ctx)
 }
 #endif
 
-#if defined(CONFIG_SSL_CERT_VERIFICATION) || defined(CONFIG_SSL_GENERATE_X509_CERT)
 /**
  * Performs c = m^e mod n
  */
@@ -264,5 +305,3 @@ int RSA_encrypt(const RSA_CTX *ctx, const uint8_t *in_data, uint16_t in_len,
     bi_clear_cache(ctx->bi_ctx);
     return byte_size;
 }
-
-#endif  /* CONFIG_SSL_CERT_VERIFICATION */
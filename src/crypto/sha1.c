@@ -36,6 +36,13 @@
 #include <string.h>
 #include "crypto.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONFIG_SHA1_NI
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA1_NI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+
 /*
  *  Define the SHA1 circular left shift macro
  */
@@ -45,6 +52,12 @@
 /* ----- static functions ----- */
 static void SHA1PadMessage(SHA1_CTX *ctx);
 static void SHA1ProcessMessageBlock(SHA1_CTX *ctx);
+static void SHA1ProcessBlocks(uint32_t *H, const uint8_t *msg, int blocks);
+#ifdef CONFIG_SHA1_NI
+static int SHA1_ni_supported(void);
+static void SHA1_ni_process_blocks(uint32_t *H, const uint8_t *msg,
+        int blocks);
+#endif
 
 /**
  * Initialize the SHA1 context 
@@ -59,6 +72,11 @@ void SHA1_Init(SHA1_CTX *ctx)
     ctx->Intermediate_Hash[2]   = 0x98BADCFE;
     ctx->Intermediate_Hash[3]   = 0x10325476;
     ctx->Intermediate_Hash[4]   = 0xC3D2E1F0;
+#ifdef CONFIG_SHA1_NI
+    ctx->ni                     = SHA1_ni_supported();
+#else
+    ctx->ni                     = 0;
+#endif
 }
 
 /**
@@ -66,18 +84,51 @@ void SHA1_Init(SHA1_CTX *ctx)
  */
 void SHA1_Update(SHA1_CTX *ctx, const uint8_t *msg, int len)
 {
-    while (len--)
+    uint32_t bits = (uint32_t)len << 3;
+    int n;
+
+    ctx->Length_Low += bits;
+
+    if (ctx->Length_Low < bits)
+        ctx->Length_High++;
+
+    ctx->Length_High += (uint32_t)len >> 29;
+
+    /* top up a partial block first */
+    if (ctx->Message_Block_Index)
     {
-        ctx->Message_Block[ctx->Message_Block_Index++] = (*msg & 0xFF);
-        ctx->Length_Low += 8;
+        n = 64 - ctx->Message_Block_Index;
 
-        if (ctx->Length_Low == 0)
-            ctx->Length_High++;
+        if (n > len)
+            n = len;
+
+        memcpy(&ctx->Message_Block[ctx->Message_Block_Index], msg, n);
+        ctx->Message_Block_Index += n;
+        msg += n;
+        len -= n;
 
         if (ctx->Message_Block_Index == 64)
             SHA1ProcessMessageBlock(ctx);
+    }
 
-        msg++;
+    /* whole blocks are hashed straight out of the caller's buffer */
+    if (len >= 64)
+    {
+#ifdef CONFIG_SHA1_NI
+        if (ctx->ni)
+            SHA1_ni_process_blocks(ctx->Intermediate_Hash, msg, len >> 6);
+        else
+#endif
+            SHA1ProcessBlocks(ctx->Intermediate_Hash, msg, len >> 6);
+
+        msg += len & ~63;
+        len &= 63;
+    }
+
+    if (len)
+    {
+        memcpy(ctx->Message_Block, msg, len);
+        ctx->Message_Block_Index = len;
     }
 }
 
@@ -103,6 +154,21 @@ void SHA1_Final(uint8_t *digest, SHA1_CTX *ctx)
  * Process the next 512 bits of the message stored in the array.
  */
 static void SHA1ProcessMessageBlock(SHA1_CTX *ctx)
+{
+#ifdef CONFIG_SHA1_NI
+    if (ctx->ni)
+        SHA1_ni_process_blocks(ctx->Intermediate_Hash, ctx->Message_Block, 1);
+    else
+#endif
+        SHA1ProcessBlocks(ctx->Intermediate_Hash, ctx->Message_Block, 1);
+
+    ctx->Message_Block_Index = 0;
+}
+
+/**
+ * Process a run of 512 bit blocks into the intermediate hash H.
+ */
+static void SHA1ProcessBlocks(uint32_t *H, const uint8_t *msg, int blocks)
 {
     const uint32_t K[] =    {       /* Constants defined in SHA-1   */
                             0x5A827999,
@@ -115,77 +181,79 @@ static void SHA1ProcessMessageBlock(SHA1_CTX *ctx)
     uint32_t      W[80];             /* Word sequence               */
     uint32_t      A, B, C, D, E;     /* Word buffers                */
 
-    /*
-     *  Initialize the first 16 words in the array W
-     */
-    for  (t = 0; t < 16; t++)
+    for (; blocks > 0; blocks--, msg += 64)
     {
-        W[t] = ctx->Message_Block[t * 4] << 24;
-        W[t] |= ctx->Message_Block[t * 4 + 1] << 16;
-        W[t] |= ctx->Message_Block[t * 4 + 2] << 8;
-        W[t] |= ctx->Message_Block[t * 4 + 3];
-    }
+        /*
+         *  Initialize the first 16 words in the array W
+         */
+        for  (t = 0; t < 16; t++)
+        {
+            W[t] = msg[t * 4] << 24;
+            W[t] |= msg[t * 4 + 1] << 16;
+            W[t] |= msg[t * 4 + 2] << 8;
+            W[t] |= msg[t * 4 + 3];
+        }
 
-    for (t = 16; t < 80; t++)
-    {
-       W[t] = SHA1CircularShift(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
-    }
+        for (t = 16; t < 80; t++)
+        {
+           W[t] = SHA1CircularShift(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
+        }
 
-    A = ctx->Intermediate_Hash[0];
-    B = ctx->Intermediate_Hash[1];
-    C = ctx->Intermediate_Hash[2];
-    D = ctx->Intermediate_Hash[3];
-    E = ctx->Intermediate_Hash[4];
+        A = H[0];
+        B = H[1];
+        C = H[2];
+        D = H[3];
+        E = H[4];
 
-    for (t = 0; t < 20; t++)
-    {
-        temp =  SHA1CircularShift(5,A) +
-                ((B & C) | ((~B) & D)) + E + W[t] + K[0];
-        E = D;
-        D = C;
-        C = SHA1CircularShift(30,B);
-
-        B = A;
-        A = temp;
-    }
+        for (t = 0; t < 20; t++)
+        {
+            temp =  SHA1CircularShift(5,A) +
+                    ((B & C) | ((~B) & D)) + E + W[t] + K[0];
+            E = D;
+            D = C;
+            C = SHA1CircularShift(30,B);
 
-    for (t = 20; t < 40; t++)
-    {
-        temp = SHA1CircularShift(5,A) + (B ^ C ^ D) + E + W[t] + K[1];
-        E = D;
-        D = C;
-        C = SHA1CircularShift(30,B);
-        B = A;
-        A = temp;
-    }
+            B = A;
+            A = temp;
+        }
 
-    for (t = 40; t < 60; t++)
-    {
-        temp = SHA1CircularShift(5,A) +
-               ((B & C) | (B & D) | (C & D)) + E + W[t] + K[2];
-        E = D;
-        D = C;
-        C = SHA1CircularShift(30,B);
-        B = A;
-        A = temp;
-    }
+        for (t = 20; t < 40; t++)
+        {
+            temp = SHA1CircularShift(5,A) + (B ^ C ^ D) + E + W[t] + K[1];
+            E = D;
+            D = C;
+            C = SHA1CircularShift(30,B);
+            B = A;
+            A = temp;
+        }
 
-    for (t = 60; t < 80; t++)
-    {
-        temp = SHA1CircularShift(5,A) + (B ^ C ^ D) + E + W[t] + K[3];
-        E = D;
-        D = C;
-        C = SHA1CircularShift(30,B);
-        B = A;
-        A = temp;
-    }
+        for (t = 40; t < 60; t++)
+        {
+            temp = SHA1CircularShift(5,A) +
+                   ((B & C) | (B & D) | (C & D)) + E + W[t] + K[2];
+            E = D;
+            D = C;
+            C = SHA1CircularShift(30,B);
+            B = A;
+            A = temp;
+        }
 
-    ctx->Intermediate_Hash[0] += A;
-    ctx->Intermediate_Hash[1] += B;
-    ctx->Intermediate_Hash[2] += C;
-    ctx->Intermediate_Hash[3] += D;
-    ctx->Intermediate_Hash[4] += E;
-    ctx->Message_Block_Index = 0;
+        for (t = 60; t < 80; t++)
+        {
+            temp = SHA1CircularShift(5,A) + (B ^ C ^ D) + E + W[t] + K[3];
+            E = D;
+            D = C;
+            C = SHA1CircularShift(30,B);
+            B = A;
+            A = temp;
+        }
+
+        H[0] += A;
+        H[1] += B;
+        H[2] += C;
+        H[3] += D;
+        H[4] += E;
+    }
 }
 
 /*
@@ -246,3 +314,95 @@ static void SHA1PadMessage(SHA1_CTX *ctx)
     ctx->Message_Block[63] = ctx->Length_Low;
     SHA1ProcessMessageBlock(ctx);
 }
+
+#ifdef CONFIG_SHA1_NI
+/**
+ * The SHA extensions arrived with Goldmont and Zen, well after AES-NI, so
+ * they get their own CPUID check.
+ */
+static int SHA1_ni_supported(void)
+{
+    static int supported = -1;
+    unsigned int eax, ebx, ecx, edx;
+
+    if (supported == -1)
+    {
+        supported = __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+                        (ecx & bit_SSSE3) && (ecx & bit_SSE4_1) &&
+                        __get_cpuid_max(0, NULL) >= 7;
+
+        if (supported)
+        {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            supported = (ebx & (1 << 29)) != 0;     /* SHA */
+        }
+    }
+
+    return supported;
+}
+
+/*
+ * One group of four rounds. W for the group is in m; m1..m3 hold the
+ * partially expanded schedule for the next three groups, which gets
+ * finished off here as far as the remaining rounds need it. g is always
+ * a literal so the range checks fold away.
+ */
+#define SHA1_NI_ROUNDS(g, e, e_next, m, m1, m2, m3)                     \
+    if (g < 4)                                                          \
+        m = _mm_shuffle_epi8(_mm_loadu_si128(                           \
+                    (const __m128i *)(msg + 16 * (g))), mask);          \
+    e = (g == 0) ? _mm_add_epi32(e, m) : _mm_sha1nexte_epu32(e, m);     \
+    e_next = abcd;                                                      \
+    if (g >= 3 && g <= 18)                                              \
+        m1 = _mm_sha1msg2_epu32(m1, m);                                 \
+    abcd = _mm_sha1rnds4_epu32(abcd, e, (g) / 5);                       \
+    if (g >= 1 && g <= 16)                                              \
+        m3 = _mm_sha1msg1_epu32(m3, m);                                 \
+    if (g >= 2 && g <= 17)                                              \
+        m2 = _mm_xor_si128(m2, m);
+
+static SHA1_NI_TARGET void SHA1_ni_process_blocks(uint32_t *H,
+        const uint8_t *msg, int blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+                                        0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcd_save, e0, e0_save, e1;
+    __m128i m0 = _mm_setzero_si128(), m1 = m0, m2 = m0, m3 = m0;
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)H), 0x1b);
+    e0 = _mm_set_epi32(H[4], 0, 0, 0);
+
+    for (; blocks > 0; blocks--, msg += 64)
+    {
+        abcd_save = abcd;
+        e0_save = e0;
+
+        SHA1_NI_ROUNDS( 0, e0, e1, m0, m1, m2, m3);
+        SHA1_NI_ROUNDS( 1, e1, e0, m1, m2, m3, m0);
+        SHA1_NI_ROUNDS( 2, e0, e1, m2, m3, m0, m1);
+        SHA1_NI_ROUNDS( 3, e1, e0, m3, m0, m1, m2);
+        SHA1_NI_ROUNDS( 4, e0, e1, m0, m1, m2, m3);
+        SHA1_NI_ROUNDS( 5, e1, e0, m1, m2, m3, m0);
+        SHA1_NI_ROUNDS( 6, e0, e1, m2, m3, m0, m1);
+        SHA1_NI_ROUNDS( 7, e1, e0, m3, m0, m1, m2);
+        SHA1_NI_ROUNDS( 8, e0, e1, m0, m1, m2, m3);
+        SHA1_NI_ROUNDS( 9, e1, e0, m1, m2, m3, m0);
+        SHA1_NI_ROUNDS(10, e0, e1, m2, m3, m0, m1);
+        SHA1_NI_ROUNDS(11, e1, e0, m3, m0, m1, m2);
+        SHA1_NI_ROUNDS(12, e0, e1, m0, m1, m2, m3);
+        SHA1_NI_ROUNDS(13, e1, e0, m1, m2, m3, m0);
+        SHA1_NI_ROUNDS(14, e0, e1, m2, m3, m0, m1);
+        SHA1_NI_ROUNDS(15, e1, e0, m3, m0, m1, m2);
+        SHA1_NI_ROUNDS(16, e0, e1, m0, m1, m2, m3);
+        SHA1_NI_ROUNDS(17, e1, e0, m1, m2, m3, m0);
+        SHA1_NI_ROUNDS(18, e0, e1, m2, m3, m0, m1);
+        SHA1_NI_ROUNDS(19, e1, e0, m3, m0, m1, m2);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *)H, _mm_shuffle_epi32(abcd, 0x1b));
+    H[4] = _mm_extract_epi32(e0, 3);
+}
+#endif
@@ -0,0 +1,509 @@
+/**
+ *
+ * Copyright (c) 2010, Zed A. Shaw and Mongrel2 Project Contributors.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ *     * Neither the name of the Mongrel2 Project, Zed A. Shaw, nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * X25519 Diffie-Hellman, as defined in RFC 7748, for ECDHE key exchange.
+ *
+ * Everything here runs in constant time: the ladder swaps with masks
+ * rather than branches and the inversion is a fixed chain of squarings,
+ * so nothing about the secret scalar shows up in timing or memory access.
+ * Field elements are five 51 bit limbs when the compiler has 128 bit
+ * integers, and sixteen 16 bit limbs otherwise.
+ */
+
+#include <string.h>
+#include "crypto.h"
+
+#ifdef __SIZEOF_INT128__
+
+typedef uint64_t fe[5];
+typedef unsigned __int128 uint128_t;
+
+#define MASK51      ((((uint64_t)1) << 51) - 1)
+
+static uint64_t load64(const uint8_t *in)
+{
+    uint64_t r = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--)
+        r = (r << 8) | in[i];
+
+    return r;
+}
+
+static void store64(uint8_t *out, uint64_t v)
+{
+    int i;
+
+    for (i = 0; i < 8; i++, v >>= 8)
+        out[i] = v & 0xff;
+}
+
+static void fe_frombytes(fe h, const uint8_t *s)
+{
+    h[0] = load64(s) & MASK51;
+    h[1] = (load64(s + 6) >> 3) & MASK51;
+    h[2] = (load64(s + 12) >> 6) & MASK51;
+    h[3] = (load64(s + 19) >> 1) & MASK51;
+    h[4] = (load64(s + 24) >> 12) & MASK51;     /* drops bit 255 */
+}
+
+static void fe_carry(fe h)
+{
+    h[1] += h[0] >> 51; h[0] &= MASK51;
+    h[2] += h[1] >> 51; h[1] &= MASK51;
+    h[3] += h[2] >> 51; h[2] &= MASK51;
+    h[4] += h[3] >> 51; h[3] &= MASK51;
+    h[0] += 19 * (h[4] >> 51); h[4] &= MASK51;
+}
+
+/*
+ * Fully reduce mod p = 2^255-19 and pack. Adding 19 and then 2^255-19
+ * (as 2^51-19, 2^51-1, ...) leaves h+19 reduced if h >= p, or h offset 
+ * by 2^255 if not, and the 2^255 falls off when the top limb is masked.
+ */
+static void fe_tobytes(uint8_t *s, const fe f)
+{
+    fe h;
+
+    memcpy(h, f, sizeof(fe));
+    fe_carry(h);
+    fe_carry(h);
+
+    h[0] += 19;
+    fe_carry(h);
+
+    h[0] += MASK51 + 1 - 19;
+    h[1] += MASK51;
+    h[2] += MASK51;
+    h[3] += MASK51;
+    h[4] += MASK51;
+
+    h[1] += h[0] >> 51; h[0] &= MASK51;
+    h[2] += h[1] >> 51; h[1] &= MASK51;
+    h[3] += h[2] >> 51; h[2] &= MASK51;
+    h[4] += h[3] >> 51; h[3] &= MASK51;
+    h[4] &= MASK51;
+
+    store64(s, h[0] | (h[1] << 51));
+    store64(s + 8, (h[1] >> 13) | (h[2] << 38));
+    store64(s + 16, (h[2] >> 26) | (h[3] << 25));
+    store64(s + 24, (h[3] >> 39) | (h[4] << 12));
+}
+
+static void fe_0(fe h)
+{
+    memset(h, 0, sizeof(fe));
+}
+
+static void fe_1(fe h)
+{
+    memset(h, 0, sizeof(fe));
+    h[0] = 1;
+}
+
+static void fe_add(fe h, const fe f, const fe g)
+{
+    int i;
+
+    for (i = 0; i < 5; i++)
+        h[i] = f[i] + g[i];
+}
+
+/* g's limbs must be under 2^53, which the output of fe_mul() always is */
+static void fe_sub(fe h, const fe f, const fe g)
+{
+    h[0] = f[0] + 4*(MASK51 - 18) - g[0];
+    h[1] = f[1] + 4*MASK51 - g[1];
+    h[2] = f[2] + 4*MASK51 - g[2];
+    h[3] = f[3] + 4*MASK51 - g[3];
+    h[4] = f[4] + 4*MASK51 - g[4];
+}
+
+static void fe_carry_wide(fe h, uint128_t r0, uint128_t r1, uint128_t r2,
+        uint128_t r3, uint128_t r4)
+{
+    uint64_t c;
+
+    r1 += (uint64_t)(r0 >> 51);
+    r2 += (uint64_t)(r1 >> 51);
+    r3 += (uint64_t)(r2 >> 51);
+    r4 += (uint64_t)(r3 >> 51);
+    c = (uint64_t)(r4 >> 51);
+
+    h[0] = ((uint64_t)r0 & MASK51) + 19 * c;
+    h[1] = (uint64_t)r1 & MASK51;
+    h[2] = (uint64_t)r2 & MASK51;
+    h[3] = (uint64_t)r3 & MASK51;
+    h[4] = (uint64_t)r4 & MASK51;
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+}
+
+static void fe_mul(fe h, const fe f, const fe g)
+{
+    uint64_t g1_19 = 19 * g[1], g2_19 = 19 * g[2];
+    uint64_t g3_19 = 19 * g[3], g4_19 = 19 * g[4];
+
+    fe_carry_wide(h,
+        (uint128_t)f[0]*g[0] + (uint128_t)f[1]*g4_19 + 
+            (uint128_t)f[2]*g3_19 + (uint128_t)f[3]*g2_19 + 
+            (uint128_t)f[4]*g1_19,
+        (uint128_t)f[0]*g[1] + (uint128_t)f[1]*g[0] + 
+            (uint128_t)f[2]*g4_19 + (uint128_t)f[3]*g3_19 + 
+            (uint128_t)f[4]*g2_19,
+        (uint128_t)f[0]*g[2] + (uint128_t)f[1]*g[1] + 
+            (uint128_t)f[2]*g[0] + (uint128_t)f[3]*g4_19 + 
+            (uint128_t)f[4]*g3_19,
+        (uint128_t)f[0]*g[3] + (uint128_t)f[1]*g[2] + 
+            (uint128_t)f[2]*g[1] + (uint128_t)f[3]*g[0] + 
+            (uint128_t)f[4]*g4_19,
+        (uint128_t)f[0]*g[4] + (uint128_t)f[1]*g[3] + 
+            (uint128_t)f[2]*g[2] + (uint128_t)f[3]*g[1] + 
+            (uint128_t)f[4]*g[0]);
+}
+
+static void fe_sq(fe h, const fe f)
+{
+    uint64_t f0_2 = 2 * f[0], f1_2 = 2 * f[1];
+    uint64_t f3_19 = 19 * f[3], f4_19 = 19 * f[4];
+
+    fe_carry_wide(h,
+        (uint128_t)f[0]*f[0] + (uint128_t)f1_2*f4_19 + 
+            (uint128_t)(2 * f[2])*f3_19,
+        (uint128_t)f0_2*f[1] + (uint128_t)(2 * f[2])*f4_19 + 
+            (uint128_t)f[3]*f3_19,
+        (uint128_t)f0_2*f[2] + (uint128_t)f[1]*f[1] + 
+            (uint128_t)(2 * f[3])*f4_19,
+        (uint128_t)f0_2*f[3] + (uint128_t)f1_2*f[2] + 
+            (uint128_t)f[4]*f4_19,
+        (uint128_t)f0_2*f[4] + (uint128_t)f1_2*f[3] + 
+            (uint128_t)f[2]*f[2]);
+}
+
+/* h = f * 121665, the (A-2)/4 of curve25519 */
+static void fe_mul_a24(fe h, const fe f)
+{
+    fe_carry_wide(h, (uint128_t)f[0]*121665, (uint128_t)f[1]*121665,
+            (uint128_t)f[2]*121665, (uint128_t)f[3]*121665, 
+            (uint128_t)f[4]*121665);
+}
+
+static void fe_cswap(fe f, fe g, unsigned int b)
+{
+    uint64_t mask = (uint64_t)0 - b, x;
+    int i;
+
+    for (i = 0; i < 5; i++)
+    {
+        x = mask & (f[i] ^ g[i]);
+        f[i] ^= x;
+        g[i] ^= x;
+    }
+}
+
+#else /* no 128 bit integers: sixteen 16 bit limbs, after TweetNaCl */
+
+typedef int64_t fe[16];
+
+static void fe_carry(fe h)
+{
+    int64_t c;
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        h[i] += (int64_t)1 << 16;
+        c = h[i] >> 16;
+
+        if (i < 15)
+            h[i+1] += c - 1;
+        else
+            h[0] += 38 * (c - 1);
+
+        h[i] -= c << 16;
+    }
+}
+
+static void fe_frombytes(fe h, const uint8_t *s)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+        h[i] = s[2*i] + ((int64_t)s[2*i+1] << 8);
+
+    h[15] &= 0x7fff;
+}
+
+static void fe_cswap(fe f, fe g, unsigned int b)
+{
+    int64_t mask = ~((int64_t)b - 1), x;
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        x = mask & (f[i] ^ g[i]);
+        f[i] ^= x;
+        g[i] ^= x;
+    }
+}
+
+static void fe_tobytes(uint8_t *s, const fe f)
+{
+    fe t, m;
+    int i, j;
+    int64_t b;
+
+    memcpy(t, f, sizeof(fe));
+    fe_carry(t);
+    fe_carry(t);
+    fe_carry(t);
+
+    /* subtract p twice, keeping the result whenever it didn't go negative */
+    for (j = 0; j < 2; j++)
+    {
+        m[0] = t[0] - 0xffed;
+
+        for (i = 1; i < 15; i++)
+        {
+            m[i] = t[i] - 0xffff - ((m[i-1] >> 16) & 1);
+            m[i-1] &= 0xffff;
+        }
+
+        m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+        b = (m[15] >> 16) & 1;
+        m[14] &= 0xffff;
+        fe_cswap(t, m, 1 - (unsigned int)b);
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        s[2*i] = t[i] & 0xff;
+        s[2*i+1] = t[i] >> 8;
+    }
+}
+
+static void fe_0(fe h)
+{
+    memset(h, 0, sizeof(fe));
+}
+
+static void fe_1(fe h)
+{
+    memset(h, 0, sizeof(fe));
+    h[0] = 1;
+}
+
+static void fe_add(fe h, const fe f, const fe g)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+        h[i] = f[i] + g[i];
+}
+
+static void fe_sub(fe h, const fe f, const fe g)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+        h[i] = f[i] - g[i];
+}
+
+static void fe_mul(fe h, const fe f, const fe g)
+{
+    int64_t t[31];
+    int i, j;
+
+    memset(t, 0, sizeof(t));
+
+    for (i = 0; i < 16; i++)
+        for (j = 0; j < 16; j++)
+            t[i+j] += f[i] * g[j];
+
+    for (i = 0; i < 15; i++)
+        t[i] += 38 * t[i+16];
+
+    memcpy(h, t, sizeof(fe));
+    fe_carry(h);
+    fe_carry(h);
+}
+
+static void fe_sq(fe h, const fe f)
+{
+    fe_mul(h, f, f);
+}
+
+static void fe_mul_a24(fe h, const fe f)
+{
+    static const fe a24 = { 0xdb41, 1 };    /* 121665 */
+    fe_mul(h, f, a24);
+}
+
+#endif
+
+/* h = z^(p-2) = 1/z */
+static void fe_invert(fe out, const fe z)
+{
+    fe z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+    int i;
+
+    fe_sq(z2, z);
+    fe_sq(t, z2);
+    fe_sq(t, t);
+    fe_mul(z9, t, z);
+    fe_mul(z11, z9, z2);
+    fe_sq(t, z11);
+    fe_mul(z2_5_0, t, z9);
+
+    fe_sq(t, z2_5_0);
+    for (i = 1; i < 5; i++)
+        fe_sq(t, t);
+    fe_mul(z2_10_0, t, z2_5_0);
+
+    fe_sq(t, z2_10_0);
+    for (i = 1; i < 10; i++)
+        fe_sq(t, t);
+    fe_mul(z2_20_0, t, z2_10_0);
+
+    fe_sq(t, z2_20_0);
+    for (i = 1; i < 20; i++)
+        fe_sq(t, t);
+    fe_mul(t, t, z2_20_0);
+
+    fe_sq(t, t);
+    for (i = 1; i < 10; i++)
+        fe_sq(t, t);
+    fe_mul(z2_50_0, t, z2_10_0);
+
+    fe_sq(t, z2_50_0);
+    for (i = 1; i < 50; i++)
+        fe_sq(t, t);
+    fe_mul(z2_100_0, t, z2_50_0);
+
+    fe_sq(t, z2_100_0);
+    for (i = 1; i < 100; i++)
+        fe_sq(t, t);
+    fe_mul(t, t, z2_100_0);
+
+    fe_sq(t, t);
+    for (i = 1; i < 50; i++)
+        fe_sq(t, t);
+    fe_mul(t, t, z2_50_0);
+
+    fe_sq(t, t);
+    for (i = 1; i < 5; i++)
+        fe_sq(t, t);
+    fe_mul(out, t, z11);
+}
+
+/**
+ * Multiply the point with u coordinate point by scalar, with the scalar 
+ * clamped as RFC 7748 says. Returns -1 if the result is all zeros, which 
+ * means the peer sent a point of small order.
+ */
+int X25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point)
+{
+    uint8_t e[X25519_SIZE];
+    fe x1, x2, z2, x3, z3, a, aa, b, bb, c, d, da, cb, t;
+    unsigned int swap = 0, bit;
+    uint8_t zero = 0;
+    int pos, i;
+
+    memcpy(e, scalar, X25519_SIZE);
+    e[0] &= 248;
+    e[31] &= 127;
+    e[31] |= 64;
+
+    fe_frombytes(x1, point);
+    fe_1(x2);
+    fe_0(z2);
+    memcpy(x3, x1, sizeof(fe));
+    fe_1(z3);
+
+    /* the Montgomery ladder */
+    for (pos = 254; pos >= 0; pos--)
+    {
+        bit = (e[pos >> 3] >> (pos & 7)) & 1;
+        swap ^= bit;
+        fe_cswap(x2, x3, swap);
+        fe_cswap(z2, z3, swap);
+        swap = bit;
+
+        fe_add(a, x2, z2);
+        fe_sub(b, x2, z2);
+        fe_add(c, x3, z3);
+        fe_sub(d, x3, z3);
+        fe_sq(aa, a);
+        fe_sq(bb, b);
+        fe_mul(da, d, a);
+        fe_mul(cb, c, b);
+
+        fe_add(t, da, cb);
+        fe_sq(x3, t);
+        fe_sub(t, da, cb);
+        fe_sq(t, t);
+        fe_mul(z3, x1, t);
+
+        fe_mul(x2, aa, bb);
+        fe_sub(t, aa, bb);          /* E */
+        fe_mul_a24(z2, t);
+        fe_add(z2, z2, aa);
+        fe_mul(z2, z2, t);
+    }
+
+    fe_cswap(x2, x3, swap);
+    fe_cswap(z2, z3, swap);
+
+    fe_invert(z2, z2);
+    fe_mul(x2, x2, z2);
+    fe_tobytes(out, x2);
+    memset(e, 0, sizeof(e));
+
+    for (i = 0; i < X25519_SIZE; i++)
+        zero |= out[i];
+
+    return zero ? 0 : -1;
+}
+
+/**
+ * Work out the public key for a private one, the scalar times the base 
+ * point u=9.
+ */
+void X25519_public(uint8_t *out, const uint8_t *scalar)
+{
+    static const uint8_t base[X25519_SIZE] = { 9 };
+    X25519(out, scalar, base);
+}
@@ -44,14 +44,25 @@
 #include <response.h>
 #include "version.h"
 #include "setting.h"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#if defined(TCP_CORK)
+#define DIR_CORK TCP_CORK
+#elif defined(TCP_NOPUSH)
+#define DIR_CORK TCP_NOPUSH
+#endif
 
 int MAX_DIR_PATH = 0;
 int MAX_SEND_BUFFER = 0;
+int MAX_INLINE_FILE = -1;
 
 struct tagbstring ETAG_PATTERN = bsStatic("[a-e0-9]+-[a-e0-9]+");
 
-const char *RESPONSE_FORMAT = "HTTP/1.1 200 OK\r\n"
-    "Date: %s\r\n"
+struct tagbstring RESPONSE_PREFIX = bsStatic("HTTP/1.1 200 OK\r\nDate: ");
+
+// the Date comes from Response_date so the cached header starts after it
+const char *RESPONSE_FORMAT = "\r\n"
     "Content-Type: %s\r\n"
     "Content-Length: %d\r\n"
     "Last-Modified: %s\r\n"
@@ -65,9 +76,6 @@ const char *DIR_REDIRECT_FORMAT = "HTTP/1.1 301 Moved Permanently\r\n"
     "Server: " VERSION
     "\r\n\r\n";
 
-// TODO: confirm that we are actually doing the GMT time right
-const char *RFC_822_TIME = "%a, %d %b %Y %H:%M:%S GMT";
-
 static int filerecord_cache_lookup(void *data, void *key) {
     bstring request_path = (bstring) key;
     FileRecord *fr = (FileRecord *) data;
@@ -80,6 +88,37 @@ static void filerecord_cache_evict(void *data) {
 }
 
 
+/**
+ * Small files are kept in memory with their FileRecord so that the header
+ * and body go out in one write.  Failing to read just means we sendfile it.
+ */
+static inline bstring FileRecord_read_data(FileRecord *fr)
+{
+    ssize_t nread = 0;
+    bstring data = bfromcstralloc(fr->sb.st_size + 1, "");
+    check_mem(data);
+
+    nread = pread(fr->fd, data->data, fr->sb.st_size, 0);
+    check_debug(nread == (ssize_t)fr->sb.st_size, "Short read of small file %s, will sendfile it.",
+            bdata(fr->full_path));
+
+    data->slen = nread;
+    data->data[nread] = '\0';
+
+    return data;
+
+error:
+    bdestroy(data);
+    return NULL;
+}
+
+static inline void Dir_cork(int fd, int on)
+{
+#ifdef DIR_CORK
+    setsockopt(fd, IPPROTO_TCP, DIR_CORK, &on, sizeof(on));
+#endif
+}
+
 FileRecord *Dir_find_file(bstring path, bstring default_type)
 {
     FileRecord *fr = calloc(sizeof(FileRecord), 1);
@@ -114,14 +153,19 @@ FileRecord *Dir_find_file(bstring path, bstring default_type)
     // we own this now, not the caller
     fr->full_path = path;
 
-    time_t now = time(NULL);
+    fr->etag = bformat("%x-%x", fr->sb.st_mtime, fr->sb.st_size);
 
-    fr->date = bStrfTime(RFC_822_TIME, gmtime(&now));
+    // settings load after the dirs are created, so read it on first use
+    if(MAX_INLINE_FILE == -1) {
+        MAX_INLINE_FILE = Setting_get_int("limits.dir_inline_file", 8 * 1024);
+        log_info("MAX limits.dir_inline_file=%d", MAX_INLINE_FILE);
+    }
 
-    fr->etag = bformat("%x-%x", fr->sb.st_mtime, fr->sb.st_size);
+    if(fr->sb.st_size <= MAX_INLINE_FILE) {
+        fr->data = FileRecord_read_data(fr);
+    }
 
     fr->header = bformat(RESPONSE_FORMAT,
-        bdata(fr->date),
         bdata(fr->content_type),
         fr->sb.st_size,
         bdata(fr->last_mod),
@@ -136,9 +180,19 @@ error:
     return NULL;
 }
 
-static inline int Dir_send_header(FileRecord *file, Connection *conn)
+static inline int Dir_send_header(FileRecord *file, Connection *conn, bstring body)
 {
-    return conn->send(conn, bdata(file->header), blength(file->header)) == blength(file->header);
+    bstring date = Response_date();
+    int total = blength(&RESPONSE_PREFIX) + blength(date) +
+        blength(file->header) + blength(body);
+    struct iovec iov[4] = {
+        {bdata(&RESPONSE_PREFIX), blength(&RESPONSE_PREFIX)},
+        {bdata(date), blength(date)},
+        {bdata(file->header), blength(file->header)},
+        {bdata(body), blength(body)}
+    };
+
+    return conn->sendv(conn, iov, body ? 4 : 3) == total;
 }
 
 int Dir_stream_file(FileRecord *file, Connection *conn)
@@ -147,43 +201,59 @@ int Dir_stream_file(FileRecord *file, Connection *conn)
     size_t total = 0;
     off_t offset = 0;
     size_t block_size = MAX_SEND_BUFFER;
+    int rc = 0;
 
     // For the non-sendfile slowpath
     char *file_buffer = NULL;
     int nread = 0;
     int amt = 0;
-    int tempfd = -1;
+    int use_sendfile = conn->ssl == NULL || Connection_ktls(conn);
+
+    if(file->data) {
+        rc = Dir_send_header(file, conn, file->data);
+        check_debug(rc, "Failed to write small file to socket.");
+        return blength(file->data);
+    }
 
-    int rc = Dir_send_header(file, conn);
+    // hold the header back so it goes out with the first of the file
+    if(use_sendfile) Dir_cork(conn->fd, 1);
+
+    rc = Dir_send_header(file, conn, NULL);
     check_debug(rc, "Failed to write header to socket.");
 
-    if(conn->ssl == NULL) {
+    if(use_sendfile) {
         for(total = 0; fdwait(conn->fd, 'w') == 0 && total < file->sb.st_size;
             total += sent) {
             sent = Dir_send(conn->fd, file->fd, &offset, block_size);
             check_debug(sent > 0, "Failed to sendfile on socket: %d from "
                         "file %d", conn->fd, file->fd);
         }
+
+        Dir_cork(conn->fd, 0);
     }
     else {
-        // We have to reopen the file, so we don't get ourselves into seek
-        // position trouble
-        int tempfd = open((const char *)(file->full_path->data), O_RDONLY);
-        check(tempfd >= 0, "Could not reopen open file");
+        // pread leaves the shared fd's position alone, and whole records
+        // keep ssl_write from sending a runt one after every chunk
+        block_size = MAX_SEND_BUFFER < RT_MAX_PLAIN_LENGTH ?
+            RT_MAX_PLAIN_LENGTH : MAX_SEND_BUFFER - MAX_SEND_BUFFER % RT_MAX_PLAIN_LENGTH;
 
-        file_buffer = malloc(MAX_SEND_BUFFER);
+        file_buffer = malloc(block_size);
         check_mem(file_buffer);
 
-        while((nread = fdread(tempfd, file_buffer, MAX_SEND_BUFFER)) > 0) {
+        while((off_t)total < file->sb.st_size &&
+                (nread = pread(file->fd, file_buffer, block_size, total)) > 0)
+        {
             for(amt = 0, sent = 0; sent < nread; sent += amt) {
                 amt = conn->send(conn, file_buffer + sent, nread - sent);
                 check_debug(amt > 0, "Failed to send on socket: %d from "
-                            "file %d", conn->fd, tempfd);
+                            "file %d", conn->fd, file->fd);
             }
             total += nread;
         }
+        check(nread >= 0, "Failed to read file %s", bdata(file->full_path));
+
         free(file_buffer);
-        close(tempfd); tempfd = -1;
+        file_buffer = NULL;
     }
     
     check(total <= file->sb.st_size, 
@@ -198,7 +268,6 @@ int Dir_stream_file(FileRecord *file, Connection *conn)
 
 error:
     if(file_buffer) free(file_buffer);
-    if(tempfd >= 0) close(tempfd);
     return -1;
 }
 
@@ -267,10 +336,10 @@ void FileRecord_destroy(FileRecord *file)
     if(file) {
         if(!file->is_dir) {
             fdclose(file->fd);
-            bdestroy(file->date);
             bdestroy(file->last_mod);
             bdestroy(file->header);
             bdestroy(file->etag);
+            bdestroy(file->data);
         }
         bdestroy(file->full_path);
         // file->content_type is not owned by us
@@ -521,7 +590,7 @@ int Dir_serve_file(Dir *dir, Request *req, Connection *conn)
             req->response_size = rc;
             check_debug(rc == file->sb.st_size, "Didn't send all of the file, sent %d of %s.", rc, bdata(path));
         } else if(is_head) {
-            rc = Dir_send_header(file, conn);
+            rc = Dir_send_header(file, conn, NULL);
             check_debug(rc, "Failed to write header to socket.");
         } else {
             sentinel("How the hell did you get to here. Tell Zed.");
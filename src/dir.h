@@ -52,19 +52,20 @@
 
 extern int MAX_SEND_BUFFER;
 extern int MAX_DIR_PATH;
+extern int MAX_INLINE_FILE;
 
 typedef struct FileRecord {
     int is_dir;
     int fd;
     int users;
     time_t loaded;
-    bstring date;
     bstring last_mod;
     bstring content_type;
     bstring header;
     bstring request_path;
     bstring full_path;
     bstring etag;
+    bstring data;
     struct stat sb;
 } FileRecord;
 
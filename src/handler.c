@@ -42,6 +42,8 @@
 #include <connection.h>
 #include <assert.h>
 #include <register.h>
+#include <write_queue.h>
+#include <response_cache.h>
 
 #include "setting.h"
 
@@ -50,6 +52,7 @@ struct tagbstring LEAVE_MSG = bsStatic("{\"type\":\"disconnect\"}");
 
 
 int HANDLER_STACK;
+int HANDLER_BATCH;
 
 static void bstring_free(void *data, void *hint)
 {
@@ -94,40 +97,34 @@ error:
 
 }
 
-static inline void handler_cap_payload(bstring payload)
+static inline WriteBuffer *handler_encode_payload(bstring body)
 {
-    if(payload->data[payload->slen - 1] == '\0') {
-        btrunc(payload, blength(payload)-1);
-    } else if(payload->data[payload->slen] != '\0') {
-        bconchar(payload, '\0');
-    }
-}
+    struct tagbstring payload;
+    bstring encoded = NULL;
 
-static inline int deliver_payload(int raw, int fd, bstring payload)
-{
-    int rc = 0;
+    blk2tbstr(payload, bdata(body), blength(body));
 
-    if(raw) {
-        debug("Sending raw message to %d length %d", fd, blength(payload));
-        rc = Connection_deliver_raw(fd, payload);
-        check(rc != -1, "Error sending raw message to HTTP listener on FD %d, closing them.", fd);
-    } else {
-        debug("Sending BASE64 message to %d length %d", fd, blength(payload));
-        handler_cap_payload(payload);
-        rc = Connection_deliver(fd, payload);
-        check(rc != -1, "Error sending to MSG listener on FD %d, closing them.", fd);
+    // the body is shared across targets, so only ever shrink our view of it
+    if(blength(&payload) > 0 && payload.data[payload.slen - 1] == '\0') {
+        payload.slen--;
     }
 
-    return 0;
+    encoded = bBase64Encode(&payload);
+    check_mem(encoded);
+
+    // MSG sockets need the trailing \0 that frames each message
+    check(bconchar(encoded, '\0') == BSTR_OK, "Failed to terminate encoded message.");
+
+    return WriteBuffer_create(encoded);
+
 error:
-    return -1;
+    bdestroy(encoded);
+    return NULL;
 }
 
 static inline void handler_process_request(Handler *handler, int id,
-        int fd, int conn_type,
-        const char *body_start, size_t body_length)
+        int fd, int conn_type, WriteBuffer *raw, WriteBuffer **encoded)
 {
-    bstring payload = NULL;
     int rc = 0;
 
     // TODO: 0 length message will mean close connection
@@ -135,41 +132,96 @@ static inline void handler_process_request(Handler *handler, int id,
         log_err("Ident %d (fd %d) is no longer connected.", id, fd);
         Handler_notify_leave(handler, id);
     } else {
-        if(body_length == 0) {
-            rc = Register_disconnect(fd);
+        int elapsed = Register_elapsed(fd);
+        if(elapsed >= 0) Breaker_success(handler->breaker, elapsed);
+
+        if(blength(raw->data) == 0) {
+            ResponseCache_finish(fd);
+            rc = WriteQueue_disconnect(fd);
             check(rc != -1, "Register disconnect failed for: %d", fd);
+        } else if(conn_type == CONN_TYPE_MSG) {
+            // encoded the first time a MSG listener needs it, then shared
+            if(*encoded == NULL) {
+                *encoded = handler_encode_payload(raw->data);
+                check(*encoded, "Failed to encode message for MSG listeners.");
+            }
+
+            debug("Sending BASE64 message to %d length %d", fd, blength((*encoded)->data));
+            rc = WriteQueue_send_buffer(fd, *encoded);
+            check(rc != -1, "Error sending to MSG listener on FD %d, closing them.", fd);
         } else {
-            payload = blk2bstr(body_start, body_length);
-            rc = deliver_payload(conn_type != CONN_TYPE_MSG, fd, payload);
-            check(rc != -1, "Failed to deliver to connection %d on socket %d", id, fd);
+            debug("Sending raw message to %d length %d", fd, blength(raw->data));
+            ResponseCache_capture(fd, bdata(raw->data), blength(raw->data));
+            rc = WriteQueue_send_buffer(fd, raw);
+            check(rc != -1, "Error sending raw message to HTTP listener on FD %d, closing them.", fd);
         }
     }
 
-    bdestroy(payload);
     return;
 
 error:
-    bdestroy(payload);
+    WriteQueue_discard(fd);
     Register_disconnect(fd);  // return ignored
     return;
 }
 
-
-static inline int handler_recv_parse(Handler *handler, HandlerParser *parser)
+/**
+ * Every target shares one buffer that takes over the 0mq message, plus
+ * one base64 encoding of it if any of them are MSG listeners.  Queues
+ * that have to hold onto the reply just keep a reference.
+ */
+static inline void handler_process_targets(Handler *handler, HandlerParser *parser,
+        zmq_msg_t *inmsg)
 {
-    check(handler->running, "Called while handler wasn't running, that's not good.");
+    int i = 0;
+    WriteBuffer *raw = NULL;
+    WriteBuffer *encoded = NULL;
+    size_t offset = parser->body_start - (char *)zmq_msg_data(inmsg);
 
-    zmq_msg_t *inmsg = calloc(sizeof(zmq_msg_t), 1);
-    int rc = 0;
+    raw = WriteBuffer_from_msg(inmsg, offset, parser->body_length);
+    check(raw, "Failed to set up reply buffer.");
+
+    for(i = 0; i < parser->target_count; i++) {
+        int id = (int)parser->targets[i];
 
-    check_mem(inmsg);
+        if(id < 0 || id >= MAX_REGISTERED_FDS) {
+            log_err("Ident %d is out of range, skipping it.", id);
+            continue;
+        }
 
-    rc = zmq_msg_init(inmsg);
-    check(rc == 0, "Failed to initialize message.");
+        int fd = Register_fd_for_id(id);
+        int conn_type = Register_fd_exists(fd);
+
+        handler_process_request(handler, id, fd, conn_type, raw, &encoded);
+    }
+
+error:  // fallthrough
+    WriteBuffer_release(encoded);
+    WriteBuffer_release(raw);
+}
+
+
+/**
+ * Receives and parses one message.  The first message of a batch waits
+ * for the socket, the rest only take what's already there and return 1
+ * when it's empty.
+ */
+static inline int handler_recv_parse(Handler *handler, HandlerParser *parser,
+        zmq_msg_t *inmsg, int wait)
+{
+    int rc = 0;
+
+    check(handler->running, "Called while handler wasn't running, that's not good.");
 
     taskstate("recv");
 
-    rc = mqrecv(handler->recv_socket, inmsg, ZMQ_NOBLOCK);
+    if(wait) {
+        rc = mqrecv(handler->recv_socket, inmsg, ZMQ_NOBLOCK);
+    } else {
+        rc = zmq_recv(handler->recv_socket, inmsg, ZMQ_NOBLOCK);
+        if(rc != 0 && errno == EAGAIN) return 1;
+    }
+
     check(rc == 0, "Receive on handler socket failed.");
     check(handler->running, "Received shutdown notification, goodbye.");
 
@@ -182,7 +234,6 @@ static inline int handler_recv_parse(Handler *handler, HandlerParser *parser)
     return 0;
 
 error:
-    // it can leak the inmsg but only in severe error states, otherwise it's owned by zmq
     return -1;
 }
 
@@ -193,8 +244,17 @@ void Handler_task(void *v)
     int i = 0;
     Handler *handler = (Handler *)v;
     HandlerParser *parser = NULL;
-    int max_targets = Setting_get_int("limits.handler_targets", 128);
-    log_info("MAX allowing limits.handler_targets=%d", 128);
+    zmq_msg_t inmsg;
+    int max_targets = Setting_get_int("limits.handler_targets", MAX_REGISTERED_FDS);
+
+    // ids are indexes into the Register, so more targets than that can't help
+    if(max_targets > MAX_REGISTERED_FDS) max_targets = MAX_REGISTERED_FDS;
+    log_info("MAX allowing limits.handler_targets=%d", max_targets);
+
+    if(!HANDLER_BATCH) {
+        HANDLER_BATCH = Setting_get_int("limits.handler_batch", 64);
+        log_info("MAX limits.handler_batch=%d", HANDLER_BATCH);
+    }
 
     parser = HandlerParser_create(max_targets);
     check_mem(parser);
@@ -204,21 +264,22 @@ void Handler_task(void *v)
     while(handler->running) {
         taskstate("delivering");
 
-        rc = handler_recv_parse(handler, parser);
-        if(rc == -1 || parser->target_count == 0) {
-            continue;
-        }
+        // wait for one, then drain whatever else came in with it
+        for(i = 0; i < HANDLER_BATCH && handler->running; i++) {
+            rc = zmq_msg_init(&inmsg);
+            check(rc == 0, "Failed to initialize message.");
 
-        for(i = 0; i < parser->target_count; i++) {
-            int id = (int)parser->targets[i];
-            int fd = Register_fd_for_id(id);
-            int conn_type = Register_fd_exists(fd);
+            rc = handler_recv_parse(handler, parser, &inmsg, i == 0);
 
-            handler_process_request(handler, id, fd,
-                    conn_type, parser->body_start, parser->body_length);
-        }
+            if(rc == 0 && parser->target_count > 0) {
+                handler_process_targets(handler, parser, &inmsg);
+            }
+
+            HandlerParser_reset(parser);
+            zmq_msg_close(&inmsg);
 
-        HandlerParser_reset(parser);
+            if(rc == 1) break;
+        }
     }
 
     HandlerParser_destroy(parser);
@@ -329,10 +390,13 @@ Handler *Handler_create(const char *send_spec, const char *send_ident,
     handler->send_spec = bfromcstr(send_spec);
     handler->running = 0;
 
+    handler->breaker = Breaker_create(bfromcstr(send_spec));
+    check(handler->breaker, "Failed to create breaker for handler %s", send_spec);
+
     return handler;
 error:
 
-    if(handler) free(handler);
+    Handler_destroy(handler);
     return NULL;
 }
 
@@ -347,6 +411,7 @@ void Handler_destroy(Handler *handler)
         bdestroy(handler->recv_ident);
         bdestroy(handler->send_spec);
         bdestroy(handler->recv_spec);
+        Breaker_destroy(handler->breaker);
         free(handler);
     }
 }
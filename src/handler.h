@@ -38,8 +38,10 @@
 #include <stdlib.h>
 #include <bstring.h>
 #include <task/task.h>
+#include <breaker.h>
 
 extern int HANDLER_STACK;
+extern int HANDLER_BATCH;
 
 typedef struct Handler {
     void *send_socket;
@@ -50,6 +52,8 @@ typedef struct Handler {
     bstring send_spec;
     Task *task;
     int running;
+    int coalesce;
+    Breaker *breaker;
 } Handler;
 
 void Handler_task(void *v);
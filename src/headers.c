@@ -59,3 +59,7 @@ struct tagbstring HTTP_OPTIONS = bsStatic("OPTIONS");
 struct tagbstring HTTP_PATTERN = bsStatic("PATTERN");
 struct tagbstring HTTP_USER_AGENT = bsStatic("User-Agent");
 struct tagbstring HTTP_CONNECTION = bsStatic("Connection");
+struct tagbstring HTTP_AUTHORIZATION = bsStatic("Authorization");
+struct tagbstring HTTP_CACHE_CONTROL = bsStatic("Cache-Control");
+struct tagbstring HTTP_PRAGMA = bsStatic("Pragma");
+struct tagbstring HTTP_RANGE = bsStatic("Range");
@@ -60,5 +60,9 @@ extern struct tagbstring HTTP_OPTIONS;
 extern struct tagbstring HTTP_PATTERN;
 extern struct tagbstring HTTP_USER_AGENT;
 extern struct tagbstring HTTP_CONNECTION;
+extern struct tagbstring HTTP_AUTHORIZATION;
+extern struct tagbstring HTTP_CACHE_CONTROL;
+extern struct tagbstring HTTP_PRAGMA;
+extern struct tagbstring HTTP_RANGE;
 
 #endif
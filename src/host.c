@@ -84,6 +84,7 @@ void Host_destroy(Host *host)
     if(host) {
         bdestroy(host->name);
         RouteMap_destroy(host->routes);
+        ssl_ctx_free(host->ssl_ctx);
         h_free(host);
     }
 }
@@ -40,6 +40,7 @@
 #include <handler.h>
 #include <request.h>
 #include <routing.h>
+#include <ssl/ssl.h>
 
 extern int MAX_HOST_NAME;
 extern int MAX_URL_PATH;
@@ -48,6 +49,8 @@ extern int MAX_URL_PATH;
 typedef struct Host {
     RouteMap *routes;
     bstring name;
+    // only set when the host has its own certificate, for SNI
+    SSL_CTX *ssl_ctx;
 } Host;
 
 
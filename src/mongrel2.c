@@ -52,6 +52,9 @@
 #include "version.h"
 #include "control.h"
 #include "log.h"
+#include "response.h"
+#include "register.h"
+#include "breaker.h"
 
 FILE *LOG_FILE = NULL;
 
@@ -119,9 +122,12 @@ Server *load_server(const char *db_file, const char *server_uuid, int reuse_fd)
     rc = Config_load_settings();
     check(rc == 0, "Failed to load global settings.");
 
+    rc = Server_init_ssl(srv);
+    check(rc == 0, "Failed to load the SSL certificates.");
+
     if(reuse_fd == -1) {
-        srv->listen_fd = netannounce(TCP, 0, srv->port);
-        check(srv->listen_fd >= 0, "Can't announce on TCP port %d", srv->port);
+        srv->listen_fd = netannounce(TCP, bdata(srv->bind_addr), srv->port);
+        check(srv->listen_fd >= 0, "Can't announce on %s port %d", bdata(srv->bind_addr), srv->port);
         check(fdnoblock(srv->listen_fd) == 0, "Failed to set listening port %d nonblocking.", srv->port);
     } else {
         srv->listen_fd = dup(reuse_fd);
@@ -153,9 +159,10 @@ error:
 
 void tickertask(void *v)
 {
-    // this will be used later for timeouts
     while(1) {
-        taskdelay(10000);
+        Response_date_update(time(NULL));
+        Register_overdue(Breaker_timeout());
+        taskdelay(1000);
     }
 }
 
@@ -45,12 +45,29 @@
 #include <mem/halloc.h>
 #include <connection.h>
 #include <http11/httpclient_parser.h>
+#include <netdb.h>
+#include <time.h>
+#include <response_cache.h>
+#include <headers.h>
+#include <request.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "setting.h"
+
+int PROXY_DNS_TTL = -1;
+int PROXY_HEADER_MAX = 0;
 
 
 void Proxy_destroy(Proxy *proxy)
 {
     if(proxy) {
         if(proxy->server) bdestroy(proxy->server);
+        Breaker_destroy(proxy->breaker);
+        ProxyAddrs_release(proxy->addrs);
         h_free(proxy);
     }
 }
@@ -59,10 +76,13 @@ Proxy *Proxy_create(bstring server, int port)
 {
     Proxy *proxy = h_calloc(sizeof(Proxy), 1);
     check_mem(proxy);
-    
+
     proxy->server = server;
     proxy->port = port;
 
+    proxy->breaker = Breaker_create(bformat("%s:%d", bdata(server), port));
+    check(proxy->breaker, "Failed to create breaker for proxy %s:%d", bdata(server), port);
+
     return proxy;
 
 error:
@@ -71,13 +91,301 @@ error:
 }
 
 
+void ProxyAddrs_release(ProxyAddrs *addrs)
+{
+    if(addrs && --addrs->refcount <= 0) {
+        if(addrs->ai) freeaddrinfo(addrs->ai);
+        free(addrs);
+    }
+}
+
+/**
+ * Returns the backend's addresses with a reference the caller has to
+ * release.  They're cached for proxy.dns_ttl seconds, only one task
+ * does the lookup when they expire, and the old ones keep getting used
+ * for a bit if the resolver fails.
+ */
+ProxyAddrs *Proxy_resolve(Proxy *proxy)
+{
+    struct addrinfo *ai = NULL;
+    ProxyAddrs *addrs = NULL;
+    int rc = 0;
+
+    // settings load after the proxies are created, so read it on first use
+    if(PROXY_DNS_TTL == -1) {
+        PROXY_DNS_TTL = Setting_get_int("proxy.dns_ttl", 60);
+        log_info("MAX proxy.dns_ttl=%d", PROXY_DNS_TTL);
+    }
+
+    while(proxy->resolving) {
+        tasksleep(&proxy->resolved);
+    }
+
+    if(proxy->addrs == NULL || time(NULL) >= proxy->expires) {
+        proxy->resolving = 1;
+        rc = netgetaddrinfo(1, bdata(proxy->server), proxy->port, &ai);
+        proxy->resolving = 0;
+        taskwakeupall(&proxy->resolved);
+
+        if(rc == 0) {
+            addrs = calloc(sizeof(ProxyAddrs), 1);
+            check_mem(addrs);
+            addrs->refcount = 1;
+            addrs->ai = ai;
+            ai = NULL;
+
+            ProxyAddrs_release(proxy->addrs);
+            proxy->addrs = addrs;
+            proxy->expires = time(NULL) + PROXY_DNS_TTL;
+        } else {
+            check(proxy->addrs, "Failed to resolve proxy backend %s", bdata(proxy->server));
+            log_err("Failed to resolve proxy backend %s, using the old addresses.",
+                    bdata(proxy->server));
+            proxy->expires = time(NULL) + 1;
+        }
+    }
+
+    proxy->addrs->refcount++;
+    return proxy->addrs;
+
+error:
+    if(ai) freeaddrinfo(ai);
+    return NULL;
+}
+
+int Proxy_connect(Proxy *proxy)
+{
+    int fd = -1;
+    ProxyAddrs *addrs = NULL;
+
+    if(bchar(proxy->server, 0) == '/') {
+        // unix socket, nothing to look up
+        return netdial(TCP, bdata(proxy->server), 0);
+    }
+
+    addrs = Proxy_resolve(proxy);
+    check_debug(addrs, "No addresses for proxy backend %s", bdata(proxy->server));
+
+    fd = netdialai(addrs->ai);
+    ProxyAddrs_release(addrs);
+
+    return fd;
+
+error:
+    return -1;
+}
+
+/**
+ * GET and HEAD requests with no body can be sent to the backend again
+ * without hurting anything, so they're the only ones that get retried
+ * or hedged, and only if the proxy asks for it.
+ */
+int Proxy_idempotent(Proxy *proxy, Request *req)
+{
+    if(proxy->retries <= 0 && proxy->hedge_delay <= 0) return 0;
+
+    return Request_content_length(req) <= 0 &&
+        (biseq(req->request_method, &HTTP_GET) || biseq(req->request_method, &HTTP_HEAD));
+}
+
+int Proxy_connect_request(Proxy *proxy, Request *req)
+{
+    int fd = Proxy_connect(proxy);
+    int tries = 0;
+
+    for(tries = 0; fd == -1 && tries < proxy->retries && Proxy_idempotent(proxy, req); tries++) {
+        log_warn("Failed to connect to proxy backend %s:%d, trying again.",
+                bdata(proxy->server), proxy->port);
+
+        // the backend might have moved
+        proxy->expires = 0;
+        fd = Proxy_connect(proxy);
+    }
+
+    return fd;
+}
+
+/**
+ * Connects to a different address than Proxy_connect would if the
+ * backend has more than one, so a hedged request doesn't go to the same
+ * slow box.
+ */
+static inline int proxy_connect_other(Proxy *proxy)
+{
+    int fd = -1;
+    ProxyAddrs *addrs = NULL;
+
+    if(bchar(proxy->server, 0) == '/') {
+        return netdial(TCP, bdata(proxy->server), 0);
+    }
+
+    addrs = Proxy_resolve(proxy);
+    check_debug(addrs, "No addresses for proxy backend %s", bdata(proxy->server));
+
+    if(addrs->ai->ai_next) fd = netdialai(addrs->ai->ai_next);
+    if(fd == -1) fd = netdialai(addrs->ai);
+
+    ProxyAddrs_release(addrs);
+    return fd;
+
+error:
+    return -1;
+}
+
+#ifdef __linux__
+
+/**
+ * Waits for the backend to start answering.  If that takes longer than
+ * hedge_delay ms the request goes out again on a second connection and
+ * whichever answers first becomes conn->proxy_fd.  Both connections and
+ * a timer go in one epoll set so the task can wait on all of them at
+ * once.  Any trouble setting that up and we just go back to waiting on
+ * the one backend.
+ */
+static void proxy_hedge(Connection *conn, Proxy *proxy)
+{
+    int epfd = -1;
+    int timer = -1;
+    int hedge = -1;
+    int winner = -1;
+    int i = 0;
+    int n = 0;
+    struct itimerspec delay;
+    struct epoll_event ev;
+    struct epoll_event hits[3];
+
+    epfd = epoll_create(3);
+    check(epfd != -1, "Failed to make an epoll set for hedging.");
+
+    timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    check(timer != -1, "Failed to make a timer for hedging.");
+
+    memset(&delay, 0, sizeof(delay));
+    delay.it_value.tv_sec = proxy->hedge_delay / 1000;
+    delay.it_value.tv_nsec = (proxy->hedge_delay % 1000) * 1000000;
+    check(timerfd_settime(timer, 0, &delay, NULL) == 0, "Failed to set the hedging timer.");
+
+    ev.events = EPOLLIN;
+    ev.data.fd = conn->proxy_fd;
+    check(epoll_ctl(epfd, EPOLL_CTL_ADD, conn->proxy_fd, &ev) == 0, "Failed to watch the backend.");
+    ev.data.fd = timer;
+    check(epoll_ctl(epfd, EPOLL_CTL_ADD, timer, &ev) == 0, "Failed to watch the hedging timer.");
+
+    while(winner == -1) {
+        check(fdwait(epfd, 'r') != -1, "Failed waiting on the backend.");
+        n = epoll_wait(epfd, hits, 3, 0);
+
+        for(i = 0; i < n && winner == -1; i++) {
+            if(hits[i].data.fd != timer) {
+                winner = hits[i].data.fd;
+                continue;
+            }
+
+            epoll_ctl(epfd, EPOLL_CTL_DEL, timer, &ev);
+            debug("Proxy backend %s:%d is slow, hedging the request.", bdata(proxy->server), proxy->port);
+
+            hedge = proxy_connect_other(proxy);
+            if(hedge == -1) continue;
+
+            ev.data.fd = hedge;
+            if(fdsend(hedge, bdata(conn->proxy_req), blength(conn->proxy_req)) != blength(conn->proxy_req) ||
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, hedge, &ev) != 0) {
+                fdclose(hedge);
+                hedge = -1;
+            }
+        }
+    }
+
+    if(winner == hedge) {
+        debug("Hedged request to %s:%d answered first.", bdata(proxy->server), proxy->port);
+        fdclose(conn->proxy_fd);
+        conn->proxy_fd = hedge;
+    } else {
+        fdclose(hedge);
+    }
+
+    // fallthrough on purpose
+error:
+    fdclose(timer);
+    fdclose(epfd);
+}
+
+#else
+
+static inline void proxy_hedge(Connection *conn, Proxy *proxy)
+{
+    // without epoll and timerfd there's nothing to wait on both with
+}
+
+#endif
+
+/**
+ * Reads the backend's response header like Proxy_read_and_parse, but for
+ * requests Proxy_idempotent allows it hedges a slow backend and sends
+ * the request again on a fresh connection if the backend hangs up
+ * before saying anything, which is what a keep-alive connection the
+ * backend already timed out looks like.
+ */
+int Proxy_read_reply(Connection *conn, Proxy *proxy)
+{
+    int tries = 0;
+    int nread = 0;
+    int rc = 0;
+
+    if(conn->proxy_req == NULL) {
+        return Proxy_read_and_parse(conn, 0);
+    }
+
+    if(proxy->hedge_delay > 0) {
+        proxy_hedge(conn, proxy);
+    }
+
+    for(tries = 0; (nread = Proxy_read_and_parse(conn, 0)) == -1; tries++) {
+        check_debug(tries < proxy->retries, "Out of retries for proxy backend %s:%d.",
+                bdata(proxy->server), proxy->port);
+        check_debug(httpclient_parser_nread(conn->client) == 0 &&
+                !httpclient_parser_has_error(conn->client),
+                "Proxy backend %s:%d sent a bad response, not retrying.",
+                bdata(proxy->server), proxy->port);
+
+        log_warn("Proxy backend %s:%d hung up without answering, trying again.",
+                bdata(proxy->server), proxy->port);
+
+        fdclose(conn->proxy_fd);
+        conn->proxy_fd = Proxy_connect(proxy);
+        check(conn->proxy_fd != -1, "Failed to reconnect to proxy backend %s:%d",
+                bdata(proxy->server), proxy->port);
+
+        rc = fdsend(conn->proxy_fd, bdata(conn->proxy_req), blength(conn->proxy_req));
+        check(rc == blength(conn->proxy_req), "Failed to resend request to proxy backend.");
+    }
+
+    return nread;
+
+error:
+    return -1;
+}
+
+
+/**
+ * Everything from the backend goes to the client through here so the
+ * response cache gets to see it on the way by.
+ */
+int Proxy_send(Connection *conn, char *buf, int len)
+{
+    ResponseCache_capture(conn->fd, buf, len);
+    return conn->send(conn, buf, len);
+}
+
+
 int Proxy_stream_response(Connection *conn, int total, int nread)
 {
     int rc = 0;
     int remaining = total;
 
-    // send what we've read already right now
-    rc = conn->send(conn, conn->proxy_buf, nread);
+    // send what we've read already right now, header and all in one go
+    if(nread > total) nread = total;
+    rc = Proxy_send(conn, conn->proxy_buf, nread);
     check(rc == nread, "Failed to send all of the request: %d length.", nread);
 
     for(remaining -= nread; remaining > 0; remaining -= nread) {
@@ -86,7 +394,7 @@ int Proxy_stream_response(Connection *conn, int total, int nread)
 
         check(nread != -1, "Failed to read from proxy.");
 
-        rc = conn->send(conn, conn->proxy_buf, nread);
+        rc = Proxy_send(conn, conn->proxy_buf, nread);
         check(rc != -1, "Failed to send to client->");
     }
 
@@ -100,58 +408,75 @@ error:
 
 
 
-static inline int scan_chunks(Connection *conn, httpclient_parser *client, int nread, int from)
+static inline int proxy_read_some(Connection *conn, int start)
 {
-    int end = from;
-    int rc = 0;
-
-    do {
-        // find all the possible chunks we've got so far
-        httpclient_parser_init(client);
-        rc = httpclient_parser_execute(client, conn->proxy_buf, nread, end);
-        check(rc != -1, "Fatal error from httpclient parser parsing:\n-----\n%.*s", nread, conn->proxy_buf);
-        check(!httpclient_parser_has_error(client), "Parsing error from server.");
-
-        if(!client->chunked) {
-            return end;
-        } else {
-            end = client->body_start + client->content_len + 2; // +2 for the crlf
-        }
-    } while(!client->chunks_done && client->content_len > 0 && end < nread - 1);
-
-    return end;
+    int nread = fdrecv(conn->proxy_fd, conn->proxy_buf + start, conn->proxy_buf_size - start);
+    check(nread != -1, "Failed to read from the proxy backend.");
+    conn->proxy_buf[start + nread] = '\0';
 
+    return nread;
 error:
     return -1;
 }
 
-static inline int proxy_read_some(Connection *conn, int start)
+static inline int proxy_grow_buffer(Connection *conn, int max)
 {
-    int nread = fdrecv(conn->proxy_fd, conn->proxy_buf + start, BUFFER_SIZE - start);
-    check(nread != -1, "Failed to read from the proxy backend.");
-    conn->proxy_buf[nread] = '\0';
+    int size = conn->proxy_buf_size * 2;
+    char *buf = NULL;
 
-    return nread;
+    check_debug(conn->proxy_buf_size < max, "Proxy buffer is already at its %d limit.", max);
+
+    if(size > max) size = max;
+
+    buf = h_realloc(conn->proxy_buf, size + 1);
+    check_mem(buf);
+
+    conn->proxy_buf = buf;
+    conn->proxy_buf_size = size;
+
+    return size;
 error:
     return -1;
 }
 
+/**
+ * Reads from the backend until the parser has seen the whole header
+ * block, growing proxy_buf up to limits.proxy_header_size as needed.
+ * The parser picks up where it left off on each read so nothing gets
+ * scanned twice.  Returns how much is in proxy_buf, which is the full
+ * header plus whatever part of the body came in with it.
+ */
 int Proxy_read_and_parse(Connection *conn, int start)
 {
     httpclient_parser *client = conn->client;
-    int nread = 0;
-    int nparsed = 0;
+    int nread = start;
+    int rc = 0;
 
     assert(client && "httpclient_parser not configured.");
     httpclient_parser_init(client);
 
-    nread = proxy_read_some(conn, start);
-    check(nread != -1, "Failed to read from the proxy backend.");
+    if(!PROXY_HEADER_MAX) {
+        PROXY_HEADER_MAX = Setting_get_int("limits.proxy_header_size", 16 * 1024);
+        log_info("MAX limits.proxy_header_size=%d", PROXY_HEADER_MAX);
+    }
+
+    do {
+        if(nread >= conn->proxy_buf_size) {
+            rc = proxy_grow_buffer(conn, PROXY_HEADER_MAX);
+            check(rc != -1, "Proxy backend sent a header bigger than limits.proxy_header_size=%d",
+                    PROXY_HEADER_MAX);
+        }
 
-    nparsed = httpclient_parser_execute(client, conn->proxy_buf, nread, 0);
+        rc = proxy_read_some(conn, nread);
+        check(rc != -1, "Failed to read from the proxy backend.");
+        check(rc > 0, "Proxy backend closed before sending a full response header.");
+        nread += rc;
 
-    check(!httpclient_parser_has_error(client), "Parsing error from server.");
-    check(httpclient_parser_finish(client), "Parser didn't get a full response.");
+        rc = httpclient_parser_execute(client, conn->proxy_buf, nread,
+                httpclient_parser_nread(client));
+        check(rc != -1, "Fatal error from httpclient parser.");
+        check(!httpclient_parser_has_error(client), "Parsing error from server.");
+    } while(!httpclient_parser_is_finished(client));
 
     return nread;
 error:
@@ -159,35 +484,290 @@ error:
 }
 
 
+void ChunkParser_init(ChunkParser *parser)
+{
+    parser->state = CHUNK_SIZE;
+    parser->size = 0;
+    parser->digits = 0;
+}
+
+static inline int hex_value(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Runs the chunked framing state machine over the next len bytes of the
+ * body.  The state is kept in the parser between calls so a read that
+ * ends in the middle of a size line, a chunk, or the trailer just picks
+ * up on the next one, and the chunk data itself is skipped over without
+ * looking at it.  Returns how many bytes belong to the body, which is
+ * less than len only when the last chunk and trailer ended in this
+ * buffer, or -1 if the framing is broken.
+ */
+int ChunkParser_execute(ChunkParser *parser, const char *buf, int len)
+{
+    int i = 0;
+    int n = 0;
+    int digit = 0;
+    char c = 0;
+
+    for(i = 0; i < len && parser->state != CHUNK_DONE; i++) {
+        c = buf[i];
+
+        switch(parser->state) {
+            case CHUNK_SIZE:
+                digit = hex_value(c);
+
+                if(digit != -1) {
+                    check(++parser->digits <= CHUNK_MAX_DIGITS, "Chunk size is too big.");
+                    parser->size = parser->size * 16 + digit;
+                } else {
+                    check(parser->digits > 0, "Chunk size line has no size.");
+                    parser->state = c == '\n' ? CHUNK_SIZE_END : CHUNK_EXTENSION;
+                }
+                break;
+
+            case CHUNK_EXTENSION:
+                if(c == '\n') parser->state = CHUNK_SIZE_END;
+                break;
+
+            case CHUNK_DATA:
+                n = len - i;
+                if(n > parser->size) n = parser->size;
+                parser->size -= n;
+                i += n - 1;
+
+                if(parser->size == 0) parser->state = CHUNK_DATA_END;
+                break;
+
+            case CHUNK_DATA_END:
+                if(c == '\n') {
+                    parser->state = CHUNK_SIZE;
+                    parser->digits = 0;
+                } else {
+                    check(c == '\r', "Chunk isn't followed by a CRLF.");
+                }
+                break;
+
+            case CHUNK_TRAILER:
+                if(c == '\n') {
+                    parser->state = CHUNK_DONE;
+                } else if(c != '\r') {
+                    parser->state = CHUNK_TRAILER_LINE;
+                }
+                break;
+
+            case CHUNK_TRAILER_LINE:
+                if(c == '\n') parser->state = CHUNK_TRAILER;
+                break;
+
+            default:
+                sentinel("Invalid chunk parser state %d.", parser->state);
+        }
+
+        if(parser->state == CHUNK_SIZE_END) {
+            // the size line is done, so it's either data or the trailer next
+            parser->state = parser->size > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+        }
+    }
+
+    return i;
+
+error:
+    parser->state = CHUNK_ERROR;
+    return -1;
+}
+
 int Proxy_stream_chunks(Connection *conn, int nread)
 {
     int rc = 0;
-    int end = 0;
-    httpclient_parser *client = conn->client;
-    assert(client && "httpclient_parser not configured.");
+    int used = 0;
+    int body_start = conn->client->body_start;
+    ChunkParser chunks;
+
+    ChunkParser_init(&chunks);
+
+    // whatever chunks came in with the header go out with it
+    used = ChunkParser_execute(&chunks, conn->proxy_buf + body_start, nread - body_start);
+    check(used != -1, "Invalid chunked encoding from the proxy backend.");
+    used += body_start;
+
+    for(;;) {
+        rc = Proxy_send(conn, conn->proxy_buf, used);
+        check(rc == used, "Failed to send chunks to the client.");
 
-    while(!client->chunks_done) {
-        end = scan_chunks(conn, client, nread, client->body_start);
-        check(end != -1, "Error processing chunks in proxy stream.");
+        if(chunks.state == CHUNK_DONE) break;
 
-        rc = Proxy_stream_response(conn, end, end > nread ? nread : end);
-        check(rc == end, "Failed to stream available chunks to client->");
+        nread = fdrecv(conn->proxy_fd, conn->proxy_buf, conn->proxy_buf_size);
+        check(nread > 0, "Proxy backend closed in the middle of a chunked response.");
+
+        used = ChunkParser_execute(&chunks, conn->proxy_buf, nread);
+        check(used != -1, "Invalid chunked encoding from the proxy backend.");
+    }
+
+    return 1;
+
+error:
+    return -1;
+}
+
+
+/**
+ * Figures out how much of the len bytes in buf are part of the response
+ * body and sets done once the end of it has been seen.  Responses that
+ * run until close are never done here, the caller finds out on EOF.
+ */
+static inline int proxy_body_take(httpclient_parser *client, ChunkParser *chunks,
+        int *remaining, const char *buf, int len, int *done)
+{
+    int used = len;
+
+    if(client->chunked) {
+        used = ChunkParser_execute(chunks, buf, len);
+        *done = chunks->state == CHUNK_DONE;
+    } else if(client->content_len >= 0) {
+        if(used > *remaining) used = *remaining;
+        *remaining -= used;
+        *done = *remaining == 0;
+    }
+
+    return used;
+}
+
+static inline int proxy_spill_file()
+{
+    int fd = -1;
+    bstring temp_store = Setting_get_str("proxy.temp_store", NULL);
+    check_debug(temp_store, "No proxy.temp_store setting, streaming the rest of the response.");
+
+    temp_store = bstrcpy(temp_store); // Setting owns the original
+    check_mem(temp_store);
+
+    fd = mkstemp((char *)temp_store->data);
+    check(fd != -1, "Failed to create proxy tempfile %s, did you end it with XXXXXX?",
+            bdata(temp_store));
+
+    // nobody else needs to see it, and this way it goes away no matter what
+    unlink((char *)temp_store->data);
+    bdestroy(temp_store);
+
+    return fd;
+
+error:
+    bdestroy(temp_store);
+    return -1;
+}
+
+static inline int proxy_send_spilled(Connection *conn, int fd)
+{
+    int nread = 0;
+    int rc = 0;
+
+    check(lseek(fd, 0, SEEK_SET) == 0, "Failed to rewind the proxy tempfile.");
+
+    while((nread = read(fd, conn->proxy_buf, conn->proxy_buf_size)) > 0) {
+        rc = Proxy_send(conn, conn->proxy_buf, nread);
+        check(rc == nread, "Failed to send buffered response to the client.");
+    }
+
+    check(nread == 0, "Failed to read back the proxy tempfile.");
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * Reads the whole response off the backend as fast as it'll send it and
+ * then closes the backend connection before anything goes to the client,
+ * so a slow client doesn't hold up a backend worker.  proxy_buf grows up
+ * to the proxy's buffer_size, and past that the response goes to a file
+ * in proxy.temp_store.  Without a temp_store the buffered part is sent and
+ * the rest is streamed like normal.
+ */
+int Proxy_buffer_response(Connection *conn, Proxy *proxy, int nread)
+{
+    httpclient_parser *client = conn->client;
+    ChunkParser chunks;
+    int remaining = client->content_len;
+    int done = 0;
+    int used = 0;
+    int rc = 0;
+    int tmpfd = -1;
+    int spill = 1;
+
+    ChunkParser_init(&chunks);
+
+    used = proxy_body_take(client, &chunks, &remaining,
+            conn->proxy_buf + client->body_start, nread - client->body_start, &done);
+    check(used != -1, "Invalid chunked encoding from the proxy backend.");
+    nread = client->body_start + used;
+
+    while(!done) {
+        if(nread == conn->proxy_buf_size) {
+            if(proxy_grow_buffer(conn, proxy->buffer_size) == -1) {
+                if(tmpfd == -1 && spill) {
+                    tmpfd = proxy_spill_file();
+                    spill = tmpfd != -1;
+                }
+
+                if(spill) {
+                    rc = fdwrite(tmpfd, conn->proxy_buf, nread);
+                    check(rc == nread, "Failed to write to the proxy tempfile.");
+                } else {
+                    rc = Proxy_send(conn, conn->proxy_buf, nread);
+                    check(rc == nread, "Failed to send response to the client.");
+                }
 
-        if(!client->chunks_done) {
-            if(rc < nread - 1) {
-                memmove(conn->proxy_buf + rc, conn->proxy_buf, nread - rc);
-                nread = nread - rc;
-            } else {
                 nread = 0;
             }
+        }
 
-            client->body_start = 0; // scan_chunks uses this at the top
-            nread = proxy_read_some(conn, nread);
+        rc = fdrecv(conn->proxy_fd, conn->proxy_buf + nread, conn->proxy_buf_size - nread);
+        check(rc != -1, "Failed to read from the proxy backend.");
+
+        if(rc == 0) {
+            check(!client->chunked && client->content_len == -1,
+                    "Proxy backend closed before sending the whole response.");
+            break;
         }
+
+        used = proxy_body_take(client, &chunks, &remaining, conn->proxy_buf + nread, rc, &done);
+        check(used != -1, "Invalid chunked encoding from the proxy backend.");
+        nread += used;
     }
 
-    return 1;
+    // got it all, so the backend is free to go do something else
+    fdclose(conn->proxy_fd);
+    conn->proxy_fd = 0;
+
+    if(tmpfd != -1) {
+        rc = fdwrite(tmpfd, conn->proxy_buf, nread);
+        check(rc == nread, "Failed to write to the proxy tempfile.");
+
+        rc = proxy_send_spilled(conn, tmpfd);
+        check(rc == 0, "Failed to send the spilled response to the client.");
+    } else {
+        rc = Proxy_send(conn, conn->proxy_buf, nread);
+        check(rc == nread, "Failed to send buffered response to the client.");
+    }
+
+    if(conn->proxy_buf_size > BUFFER_SIZE) {
+        // don't hang on to a big buffer for the rest of a keep-alive connection
+        conn->proxy_buf = h_realloc(conn->proxy_buf, BUFFER_SIZE + 1);
+        check_mem(conn->proxy_buf);
+        conn->proxy_buf_size = BUFFER_SIZE;
+    }
+
+    fdclose(tmpfd);
+    return 0;
 
 error:
+    fdclose(tmpfd);
     return -1;
 }
@@ -36,21 +36,74 @@
 #define _proxy_h
 
 #include <bstring.h>
+#include <time.h>
+#include <task/task.h>
+#include <breaker.h>
+
+extern int PROXY_DNS_TTL;
+extern int PROXY_HEADER_MAX;
+
+typedef struct ProxyAddrs {
+    int refcount;
+    struct addrinfo *ai;
+} ProxyAddrs;
 
 typedef struct Proxy {
     bstring server;
     int port;
+    int buffer_size;
+    int retries;
+    int hedge_delay;
+    Breaker *breaker;
+    ProxyAddrs *addrs;
+    time_t expires;
+    int resolving;
+    Rendez resolved;
 } Proxy;
 
 Proxy *Proxy_create(bstring server, int port);
 
 void Proxy_destroy(Proxy *proxy);
 
+ProxyAddrs *Proxy_resolve(Proxy *proxy);
+
+void ProxyAddrs_release(ProxyAddrs *addrs);
+
+int Proxy_connect(Proxy *proxy);
+
+struct Request;
+int Proxy_idempotent(Proxy *proxy, struct Request *req);
+
+int Proxy_connect_request(Proxy *proxy, struct Request *req);
+
 struct Connection;
+int Proxy_send(struct Connection *conn, char *buf, int len);
+
 int Proxy_stream_response(struct Connection *conn, int total, int nread);
 
+enum {
+    CHUNK_SIZE, CHUNK_EXTENSION, CHUNK_SIZE_END, CHUNK_DATA, CHUNK_DATA_END,
+    CHUNK_TRAILER, CHUNK_TRAILER_LINE, CHUNK_DONE, CHUNK_ERROR
+};
+
+#define CHUNK_MAX_DIGITS 15
+
+typedef struct ChunkParser {
+    int state;
+    int digits;
+    long long size;
+} ChunkParser;
+
+void ChunkParser_init(ChunkParser *parser);
+
+int ChunkParser_execute(ChunkParser *parser, const char *buf, int len);
+
 int Proxy_stream_chunks(struct Connection *conn, int nread);
 
 int Proxy_read_and_parse(struct Connection *conn, int start);
 
+int Proxy_read_reply(struct Connection *conn, Proxy *proxy);
+
+int Proxy_buffer_response(struct Connection *conn, Proxy *proxy, int nread);
+
 #endif
@@ -56,6 +56,9 @@ static inline void Register_clear(Registration *reg)
 {
     reg->conn_type = 0;
     reg->last_ping = 0;
+    reg->sent_at = 0;
+    reg->breaker = NULL;
+    reg->ssl = NULL;
     REG_ID_TO_FD[reg->id] = 0;
 }
 
@@ -76,6 +79,9 @@ int Register_connect(int fd, int conn_type)
 
     reg->conn_type = conn_type;
     reg->last_ping = time(NULL);
+    reg->sent_at = 0;
+    reg->breaker = NULL;
+    reg->ssl = NULL;
     
     // purposefully want overflow on these
     reg->id = REG_COUNT++;
@@ -120,6 +126,103 @@ error:
 }
 
 
+static inline uint32_t Register_clock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // wraps every 49 days, which the unsigned math in Register_elapsed handles
+    uint32_t ms = (uint32_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    return ms ? ms : 1;
+}
+
+/**
+ * Stamps the time a request from this fd went to its backend, so the
+ * first reply can say how long the backend took with Register_elapsed.
+ * The breaker, if given, is charged if no reply ever comes, see
+ * Register_overdue.
+ */
+int Register_sent(int fd, Breaker *breaker)
+{
+    assert(fd < MAX_REGISTERED_FDS && "FD given to register is greater than max.");
+    Registration *reg = &REGISTRATIONS[fd];
+
+    check(reg->conn_type != 0, "Attempt to time an FD that isn't registered: %d", fd);
+
+    reg->sent_at = Register_clock();
+    reg->breaker = breaker;
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * Milliseconds since the last Register_sent, or -1 if nothing is
+ * outstanding.  Only the first reply counts, so this clears the stamp.
+ */
+int Register_elapsed(int fd)
+{
+    assert(fd < MAX_REGISTERED_FDS && "FD given to register is greater than max.");
+    Registration *reg = &REGISTRATIONS[fd];
+
+    if(reg->conn_type == 0 || reg->sent_at == 0) return -1;
+
+    int elapsed = (int)(Register_clock() - reg->sent_at);
+    reg->sent_at = 0;
+    reg->breaker = NULL;
+
+    return elapsed;
+}
+
+/**
+ * Counts a failure against the backend of every request that has waited
+ * more than timeout ms for its first reply, since a dead backend never
+ * gets to Register_elapsed.  Returns how many were overdue.
+ */
+int Register_overdue(int timeout)
+{
+    int i = 0;
+    int overdue = 0;
+    uint32_t now = Register_clock();
+    Registration *reg = NULL;
+
+    if(timeout <= 0) return 0;
+
+    for(i = 0; i < MAX_REGISTERED_FDS; i++) {
+        reg = &REGISTRATIONS[i];
+
+        if(reg->conn_type && reg->sent_at && reg->breaker &&
+                (int)(now - reg->sent_at) > timeout)
+        {
+            debug("FD %d waited over %d ms for its backend.", i, timeout);
+            Breaker_failure(reg->breaker);
+            reg->sent_at = 0;
+            reg->breaker = NULL;
+            overdue++;
+        }
+    }
+
+    return overdue;
+}
+
+/**
+ * Drops a breaker that's about to be destroyed from any outstanding
+ * requests, so a reload doesn't leave them pointing at freed memory.
+ */
+void Register_forget(Breaker *breaker)
+{
+    int i = 0;
+
+    for(i = 0; i < MAX_REGISTERED_FDS; i++) {
+        if(REGISTRATIONS[i].breaker == breaker) {
+            REGISTRATIONS[i].sent_at = 0;
+            REGISTRATIONS[i].breaker = NULL;
+        }
+    }
+}
+
+
 int Register_fd_exists(int fd)
 {
     assert(fd < MAX_REGISTERED_FDS && "FD given to register is greater than max.");
@@ -128,6 +231,30 @@ int Register_fd_exists(int fd)
 }
 
 
+/**
+ * Says which SSL anything written to this fd from outside its connection
+ * has to be encrypted with, or NULL once the kernel does that itself.
+ */
+int Register_ssl(int fd, SSL *ssl)
+{
+    assert(fd < MAX_REGISTERED_FDS && "FD given to register is greater than max.");
+    Registration *reg = &REGISTRATIONS[fd];
+
+    check(reg->conn_type != 0, "Attempt to set the SSL of an FD that isn't registered: %d", fd);
+
+    reg->ssl = ssl;
+    return 0;
+
+error:
+    return -1;
+}
+
+SSL *Register_ssl_for_fd(int fd)
+{
+    assert(fd < MAX_REGISTERED_FDS && "FD given to register is greater than max.");
+    return REGISTRATIONS[fd].ssl;
+}
+
 int Register_fd_for_id(int id)
 {
     assert(id < MAX_REGISTERED_FDS && "Ident (id) given to register is greater than max.");
@@ -38,6 +38,8 @@
 #include <time.h>
 #include <stdint.h>
 #include <bstring.h>
+#include <breaker.h>
+#include <ssl/ssl.h>
 
 enum {
     CONN_TYPE_HTTP=1,
@@ -51,6 +53,9 @@ typedef struct Registration {
     uint8_t conn_type;
     uint16_t id;
     uint32_t last_ping;
+    uint32_t sent_at;
+    Breaker *breaker;
+    SSL *ssl;
 } Registration;
 
 int Register_connect(int fd, int conn_type);
@@ -61,6 +66,18 @@ int Register_ping(int fd);
 
 void Register_init();
 
+int Register_sent(int fd, Breaker *breaker);
+
+int Register_elapsed(int fd);
+
+int Register_overdue(int timeout);
+
+void Register_forget(Breaker *breaker);
+
+int Register_ssl(int fd, SSL *ssl);
+
+SSL *Register_ssl_for_fd(int fd);
+
 int Register_fd_exists(int fd);
 
 int Register_id_for_fd(int fd);
@@ -39,6 +39,14 @@
 #include <assert.h>
 #include "version.h"
 
+#define DATE_LENGTH 64
+
+// TODO: confirm that we are actually doing the GMT time right
+const char *RFC_822_TIME = "%a, %d %b %Y %H:%M:%S GMT";
+
+static char DATE_BUFFER[DATE_LENGTH];
+static struct tagbstring DATE_HEADER = {-1, 0, (unsigned char *)DATE_BUFFER};
+
 
 // TODO: for now these are full error responses, but let people change them
 
@@ -127,6 +135,27 @@ int Response_send_status(Connection *conn, bstring error)
     return conn->send(conn, bdata(error), blength(error));
 }
 
+int Response_send_unavailable(Connection *conn, int retry_after)
+{
+    int rc = 0;
+    bstring response = bformat("HTTP/1.1 503 Service Unavailable\r\n"
+        "Content-Type: text/plain\r\n"
+        "Connection: close\r\n"
+        "Retry-After: %d\r\n"
+        "Content-Length: 19\r\n"
+        "Server: " VERSION
+        "\r\n\r\n"
+        "Service Unavailable", retry_after);
+    check_mem(response);
+
+    rc = conn->send(conn, bdata(response), blength(response));
+    bdestroy(response);
+    return rc;
+
+error:
+    return -1;
+}
+
 
 int Response_send_socket_policy(Connection *conn)
 {
@@ -137,3 +166,25 @@ int Response_send_socket_policy(Connection *conn)
 }
 
 
+/**
+ * The ticker calls this once a second so that every response shares
+ * one formatted Date header instead of calling strftime per request.
+ */
+void Response_date_update(time_t now)
+{
+    struct tm tm;
+
+    gmtime_r(&now, &tm);
+    DATE_HEADER.slen = strftime(DATE_BUFFER, DATE_LENGTH, RFC_822_TIME, &tm);
+}
+
+bstring Response_date()
+{
+    // the ticker might not have run yet, or at all in the tests
+    if(DATE_HEADER.slen == 0) {
+        Response_date_update(time(NULL));
+    }
+
+    return &DATE_HEADER;
+}
+
@@ -37,6 +37,7 @@
 
 #include <bstring.h>
 #include <connection.h>
+#include <time.h>
 
 extern struct tagbstring HTTP_304;
 extern struct tagbstring HTTP_400;
@@ -50,8 +51,16 @@ extern struct tagbstring HTTP_502;
 
 extern struct tagbstring FLASH_RESPONSE;
 
+extern const char *RFC_822_TIME;
+
 int Response_send_status(Connection *conn, bstring error);
 
+int Response_send_unavailable(Connection *conn, int retry_after);
+
 int Response_send_socket_policy(Connection *conn);
 
+bstring Response_date();
+
+void Response_date_update(time_t now);
+
 #endif
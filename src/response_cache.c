@@ -0,0 +1,766 @@
+/**
+ *
+ * Copyright (c) 2010, Zed A. Shaw and Mongrel2 Project Contributors.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ *     * Neither the name of the Mongrel2 Project, Zed A. Shaw, nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <response_cache.h>
+#include <connection.h>
+#include <register.h>
+#include <headers.h>
+#include <request.h>
+#include <response.h>
+#include <log.h>
+#include <adt/hash.h>
+#include <dbg.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "setting.h"
+
+int CACHE_MAX_SIZE = -1;
+int CACHE_MAX_ENTRY = 0;
+int CACHE_DEFAULT_TTL = 0;
+int CACHE_STALE_TTL = 0;
+
+static hash_t *SLOTS = NULL;
+static CacheFill *FILLS[MAX_REGISTERED_FDS];
+static CacheEntry *LRU_HEAD = NULL;
+static CacheEntry *LRU_TAIL = NULL;
+static size_t CACHE_USED = 0;
+
+
+static inline void ResponseCache_init()
+{
+    if(CACHE_MAX_SIZE == -1) {
+        CACHE_MAX_SIZE = Setting_get_int("cache.max_size", 0);
+        CACHE_MAX_ENTRY = Setting_get_int("cache.max_entry", 1024 * 1024);
+        CACHE_DEFAULT_TTL = Setting_get_int("cache.default_ttl", 0);
+        CACHE_STALE_TTL = Setting_get_int("cache.stale_ttl", 10);
+        log_info("MAX cache.max_size=%d, cache.max_entry=%d, cache.default_ttl=%d, cache.stale_ttl=%d",
+                CACHE_MAX_SIZE, CACHE_MAX_ENTRY, CACHE_DEFAULT_TTL, CACHE_STALE_TTL);
+
+        if(CACHE_MAX_SIZE > 0 && CACHE_MAX_ENTRY > CACHE_MAX_SIZE) {
+            CACHE_MAX_ENTRY = CACHE_MAX_SIZE;
+        }
+    }
+
+    if(SLOTS == NULL) {
+        SLOTS = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+    }
+}
+
+size_t ResponseCache_used()
+{
+    return CACHE_USED;
+}
+
+
+static inline void lru_unlink(CacheEntry *entry)
+{
+    if(entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else LRU_HEAD = entry->lru_next;
+
+    if(entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else LRU_TAIL = entry->lru_prev;
+
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static inline void lru_push(CacheEntry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = LRU_HEAD;
+
+    if(LRU_HEAD) LRU_HEAD->lru_prev = entry;
+    else LRU_TAIL = entry;
+
+    LRU_HEAD = entry;
+}
+
+static inline void CacheSlot_unshare(CacheSlot *slot)
+{
+    if(slot->shared) {
+        WriteBuffer_release(slot->shared->response);
+        bdestroy(slot->shared->variant);
+        free(slot->shared);
+        slot->shared = NULL;
+    }
+
+    bdestroy(slot->shared_vary);
+    slot->shared_vary = NULL;
+}
+
+static inline void CacheSlot_maybe_destroy(CacheSlot *slot)
+{
+    hnode_t *node = NULL;
+
+    if(slot->entries || slot->fill || slot->waiting) return;
+
+    node = hash_lookup(SLOTS, bdata(slot->key));
+    if(node) hash_delete_free(SLOTS, node);
+
+    CacheSlot_unshare(slot);
+    bdestroy(slot->key);
+    bdestroy(slot->vary);
+    free(slot);
+}
+
+static void CacheEntry_remove(CacheEntry *entry)
+{
+    CacheSlot *slot = entry->slot;
+    CacheEntry **e = NULL;
+
+    for(e = &slot->entries; *e; e = &(*e)->next) {
+        if(*e == entry) {
+            *e = entry->next;
+            break;
+        }
+    }
+
+    lru_unlink(entry);
+    CACHE_USED -= entry->size;
+
+    WriteBuffer_release(entry->response);
+    bdestroy(entry->variant);
+    free(entry);
+
+    CacheSlot_maybe_destroy(slot);
+}
+
+static inline void ResponseCache_evict()
+{
+    while(CACHE_USED > (size_t)CACHE_MAX_SIZE && LRU_TAIL) {
+        CacheEntry_remove(LRU_TAIL);
+    }
+}
+
+
+static inline bstring header_value(bstring name, Request *req, struct bstrList *headers)
+{
+    int i = 0;
+
+    if(req) return Request_get(req, name);
+
+    for(i = 0; i + 1 < headers->qty; i += 2) {
+        if(bstricmp(headers->entry[i], name) == 0) return headers->entry[i + 1];
+    }
+
+    return NULL;
+}
+
+/**
+ * The variant is just the values of the headers the response said it
+ * varies on, one per line, so two requests get the same cached copy
+ * only when they'd have gotten the same response.
+ */
+static bstring cache_variant(bstring vary, Request *req, struct bstrList *headers)
+{
+    int i = 0;
+    bstring variant = bfromcstr("");
+    struct bstrList *names = NULL;
+    bstring value = NULL;
+
+    if(vary == NULL) return variant;
+
+    names = bsplit(vary, ',');
+    check_mem(names);
+
+    for(i = 0; i < names->qty; i++) {
+        btrimws(names->entry[i]);
+        value = header_value(names->entry[i], req, headers);
+        bformata(variant, "%s\n", value ? bdata(value) : "");
+    }
+
+    bstrListDestroy(names);
+    return variant;
+
+error:
+    bdestroy(variant);
+    return NULL;
+}
+
+static inline CacheEntry *CacheSlot_find(CacheSlot *slot, Request *req)
+{
+    CacheEntry *entry = NULL;
+    bstring variant = NULL;
+
+    // a pass entry covers every variant
+    for(entry = slot->entries; entry; entry = entry->next) {
+        if(entry->response == NULL) return entry;
+    }
+
+    variant = cache_variant(slot->vary, req, NULL);
+    check(variant, "Failed to work out the request's variant.");
+
+    for(entry = slot->entries; entry; entry = entry->next) {
+        if(biseq(entry->variant, variant)) break;
+    }
+
+    bdestroy(variant);
+    return entry;
+
+error:
+    return NULL;
+}
+
+
+static inline int cache_control_has(bstring cc, const char *directive)
+{
+    return cc && strcasestr((const char *)cc->data, directive) != NULL;
+}
+
+static inline int cache_control_int(bstring cc, const char *directive, int def)
+{
+    char *at = NULL;
+
+    if(cc && (at = strcasestr((const char *)cc->data, directive)) != NULL) {
+        return atoi(at + strlen(directive));
+    }
+
+    return def;
+}
+
+/**
+ * How many seconds a response can be used for, going by its
+ * Cache-Control and Expires headers, or cache.default_ttl when it has
+ * neither.  Anything 0 or less means it can't be cached.  The number of
+ * seconds it can be served stale while it's refreshed goes in stale.
+ */
+int ResponseCache_ttl(bstring cache_control, bstring expires, time_t now, int *stale)
+{
+    struct tm tm_val;
+
+    *stale = cache_control_int(cache_control, "stale-while-revalidate=", CACHE_STALE_TTL);
+
+    if(cache_control_has(cache_control, "no-store") ||
+            cache_control_has(cache_control, "no-cache") ||
+            cache_control_has(cache_control, "private")) {
+        return 0;
+    } else if(cache_control_has(cache_control, "s-maxage=")) {
+        return cache_control_int(cache_control, "s-maxage=", 0);
+    } else if(cache_control_has(cache_control, "max-age=")) {
+        return cache_control_int(cache_control, "max-age=", 0);
+    } else if(expires) {
+        memset(&tm_val, 0, sizeof(struct tm));
+
+        if(strptime(bdata(expires), RFC_822_TIME, &tm_val) == NULL) {
+            return 0;  // bad dates mean already expired
+        } else {
+            return (int)(timegm(&tm_val) - now);
+        }
+    } else {
+        return CACHE_DEFAULT_TTL;
+    }
+}
+
+static inline int cacheable_status(int status)
+{
+    return status == 200 || status == 203 || status == 300 ||
+        status == 301 || status == 404 || status == 410;
+}
+
+
+static void CacheFill_destroy(CacheFill *fill)
+{
+    if(fill) {
+        if(FILLS[fill->fd] == fill) FILLS[fill->fd] = NULL;
+
+        if(fill->slot) {
+            fill->slot->fill = NULL;
+            taskwakeupall(&fill->slot->filled);
+            CacheSlot_maybe_destroy(fill->slot);
+        }
+
+        if(fill->headers) bstrListDestroy(fill->headers);
+        bdestroy(fill->data);
+        bdestroy(fill->cache_control);
+        bdestroy(fill->expires);
+        bdestroy(fill->vary);
+        free(fill);
+    }
+}
+
+static void fill_field_cb(void *data, const char *field, size_t flen,
+        const char *value, size_t vlen)
+{
+    CacheFill *fill = (CacheFill *)data;
+
+    if(flen == 13 && strncasecmp(field, "Cache-Control", flen) == 0) {
+        bdestroy(fill->cache_control);
+        fill->cache_control = blk2bstr(value, vlen);
+    } else if(flen == 7 && strncasecmp(field, "Expires", flen) == 0) {
+        bdestroy(fill->expires);
+        fill->expires = blk2bstr(value, vlen);
+    } else if(flen == 4 && strncasecmp(field, "Vary", flen) == 0) {
+        bdestroy(fill->vary);
+        fill->vary = blk2bstr(value, vlen);
+    } else if(flen == 10 && strncasecmp(field, "Set-Cookie", flen) == 0) {
+        fill->set_cookie = 1;
+    }
+}
+
+static CacheFill *CacheFill_create(int fd, CacheSlot *slot, Request *req)
+{
+    dnode_t *node = NULL;
+    CacheFill *fill = calloc(sizeof(CacheFill), 1);
+    check_mem(fill);
+
+    fill->fd = fd;
+    fill->data = bfromcstralloc(1024, "");
+    check_mem(fill->data);
+
+    fill->headers = bstrListCreate();
+    check_mem(fill->headers);
+    bstrListAlloc(fill->headers, dict_count(req->headers) * 2 + 1);
+
+    // the response decides which headers matter, so keep them all till then
+    for(node = dict_first(req->headers); node != NULL; node = dict_next(req->headers, node)) {
+        fill->headers->entry[fill->headers->qty++] = bstrcpy((bstring)dnode_getkey(node));
+        fill->headers->entry[fill->headers->qty++] = bstrcpy((bstring)dnode_get(node));
+    }
+
+    httpclient_parser_init(&fill->parser);
+    fill->parser.http_field = fill_field_cb;
+    fill->parser.data = fill;
+    ChunkParser_init(&fill->chunks);
+
+    fill->slot = slot;
+    slot->fill = fill;
+    FILLS[fd] = fill;
+
+    return fill;
+
+error:
+    CacheFill_destroy(fill);
+    return NULL;
+}
+
+/**
+ * Hands a reply that isn't going in the cache to the requests that were
+ * waiting on it.  Each of them takes its own reference when it wakes up
+ * and the last one out drops the slot's.
+ */
+static void CacheSlot_share(CacheSlot *slot, CacheFill *fill, size_t len)
+{
+    CacheEntry *shared = NULL;
+
+    CacheSlot_unshare(slot);
+
+    shared = calloc(sizeof(CacheEntry), 1);
+    check_mem(shared);
+    shared->slot = slot;
+    shared->status = fill->parser.status;
+
+    shared->variant = cache_variant(fill->vary, NULL, fill->headers);
+    check(shared->variant, "Failed to work out the response's variant.");
+
+    btrunc(fill->data, len);
+    shared->response = WriteBuffer_create(fill->data);
+    fill->data = NULL;
+    check(shared->response, "Failed to make the shared response.");
+
+    slot->shared = shared;
+    slot->shared_vary = fill->vary;
+    fill->vary = NULL;
+    return;
+
+error:
+    if(shared) {
+        bdestroy(shared->variant);
+        free(shared);
+    }
+}
+
+/**
+ * The whole response is in, so it either goes in the cache or, if the
+ * backend doesn't want it cached, becomes a pass entry so the next
+ * requests for it go straight through instead of lining up behind one
+ * another.
+ */
+static void CacheFill_store(CacheFill *fill, size_t len)
+{
+    CacheSlot *slot = fill->slot;
+    CacheEntry *entry = NULL;
+    CacheEntry *old = NULL;
+    CacheEntry *next = NULL;
+    time_t now = time(NULL);
+    int stale = 0;
+    int ttl = ResponseCache_ttl(fill->cache_control, fill->expires, now, &stale);
+
+    int shareable = !fill->set_cookie && !cache_control_has(fill->cache_control, "private") &&
+        !(fill->vary && bstrchr(fill->vary, '*') != BSTR_ERR);
+
+    if(CACHE_MAX_SIZE <= 0 || !cacheable_status(fill->parser.status) || !shareable) {
+        ttl = 0;
+    }
+
+    if(ttl <= 0 && slot->coalesce && shareable) {
+        // not for the cache, but everyone who waited on it gets it anyway
+        if(slot->waiting) CacheSlot_share(slot, fill, len);
+        CacheFill_destroy(fill);
+        return;
+    }
+
+    entry = calloc(sizeof(CacheEntry), 1);
+    check_mem(entry);
+    entry->slot = slot;
+    entry->status = fill->parser.status;
+
+    if(ttl > 0) {
+        btrunc(fill->data, len);
+        entry->response = WriteBuffer_create(fill->data);
+        fill->data = NULL;
+        check(entry->response, "Failed to make the cached response.");
+
+        // a different Vary makes all the old variants meaningless
+        if(!(fill->vary == slot->vary || (fill->vary && slot->vary && biseq(fill->vary, slot->vary)))) {
+            while(slot->entries) CacheEntry_remove(slot->entries);
+            bdestroy(slot->vary);
+            slot->vary = fill->vary;
+            fill->vary = NULL;
+        }
+
+        entry->variant = cache_variant(slot->vary, NULL, fill->headers);
+        check(entry->variant, "Failed to work out the response's variant.");
+        entry->expires = now + ttl;
+        entry->stale = entry->expires + stale;
+    } else {
+        entry->variant = bfromcstr("");
+        entry->expires = entry->stale = now + 1;
+    }
+
+    entry->size = sizeof(CacheEntry) + blength(entry->variant) +
+        (entry->response ? blength(entry->response->data) : 0);
+
+    // the fill still holds the slot, so removing entries can't free it
+    for(old = slot->entries; old; old = next) {
+        next = old->next;
+
+        if(old->response == NULL || entry->response == NULL || biseq(old->variant, entry->variant)) {
+            CacheEntry_remove(old);
+        }
+    }
+
+    entry->next = slot->entries;
+    slot->entries = entry;
+    lru_push(entry);
+    CACHE_USED += entry->size;
+
+    CacheFill_destroy(fill);
+    ResponseCache_evict();
+    return;
+
+error:
+    if(entry) {
+        WriteBuffer_release(entry->response);
+        bdestroy(entry->variant);
+        free(entry);
+    }
+    CacheFill_destroy(fill);
+}
+
+
+/**
+ * Sends buf, which the caller has already taken a reference on for us,
+ * since whatever it came from can go away while we're blocked sending.
+ */
+static inline void ResponseCache_serve(Connection *conn, WriteBuffer *buf, int status)
+{
+    int rc = 0;
+
+    if(conn->req->action->type == BACKEND_HANDLER && !conn->ssl) {
+        // same road the handler's replies take, so they stay in order
+        rc = WriteQueue_send_buffer(conn->fd, buf);
+    } else {
+        rc = conn->send(conn, bdata(buf->data), blength(buf->data));
+    }
+
+    if(rc == -1) log_err("Failed to send cached response to %d.", conn->fd);
+
+    Log_request(conn, status, blength(buf->data));
+    WriteBuffer_release(buf);
+}
+
+/**
+ * Takes the reply the fill we waited on shared, if it's the variant this
+ * request wants.
+ */
+static inline WriteBuffer *CacheSlot_take_shared(CacheSlot *slot, Request *req, int *status)
+{
+    CacheEntry *shared = slot->shared;
+    bstring variant = NULL;
+    int match = 0;
+
+    if(shared == NULL) return NULL;
+
+    variant = cache_variant(slot->shared_vary, req, NULL);
+    match = variant && biseq(variant, shared->variant);
+    bdestroy(variant);
+
+    if(!match) return NULL;
+
+    shared->response->refcount++;
+    *status = shared->status;
+    return shared->response;
+}
+
+static inline int coalesce_request(Request *req)
+{
+    Handler *handler = NULL;
+
+    if(req->action == NULL || req->action->type != BACKEND_HANDLER) return 0;
+
+    handler = Request_get_action(req, handler);
+    return handler && handler->coalesce;
+}
+
+static inline int cacheable_request(Request *req)
+{
+    bstring cc = NULL;
+
+    if(!biseq(req->request_method, &HTTP_GET) || Request_content_length(req) > 0) {
+        return 0;
+    }
+
+    if(Request_get(req, &HTTP_AUTHORIZATION) || Request_get(req, &HTTP_RANGE)) {
+        return 0;
+    }
+
+    cc = Request_get(req, &HTTP_CACHE_CONTROL);
+    if(cache_control_has(cc, "no-cache") || cache_control_has(cc, "no-store")) {
+        return 0;
+    }
+
+    return !cache_control_has(Request_get(req, &HTTP_PRAGMA), "no-cache");
+}
+
+static inline int conditional_request(Request *req)
+{
+    return Request_get(req, &HTTP_IF_NONE_MATCH) || Request_get(req, &HTTP_IF_MODIFIED_SINCE) ||
+        Request_get(req, &HTTP_IF_MATCH) || Request_get(req, &HTTP_IF_UNMODIFIED_SINCE);
+}
+
+/**
+ * Called before a proxy or handler request goes to the backend.  A fresh
+ * cached copy gets sent right here and CACHE_HIT comes back.  Otherwise
+ * the first request for something becomes the one that fetches it
+ * (CACHE_MISS) and its reply gets captured as it goes by, while the rest
+ * that show up in the meantime get the stale copy if there is one, or
+ * wait for the fetch to finish.  A Handler with coalesce set gets the
+ * same treatment with no cache at all, and then its reply is handed to
+ * the waiting requests whether it can be cached or not.  CACHE_BYPASS
+ * means just do what you'd normally do.
+ */
+int ResponseCache_request(Connection *conn)
+{
+    Request *req = conn->req;
+    CacheSlot *slot = NULL;
+    CacheEntry *entry = NULL;
+    hnode_t *node = NULL;
+    bstring key = NULL;
+    time_t now = 0;
+    WriteBuffer *shared = NULL;
+    int status = 0;
+    int waited = 0;
+    int coalesce = 0;
+    int rc = CACHE_BYPASS;
+
+    ResponseCache_init();
+
+    if(!Request_is_http(req) || !cacheable_request(req)) {
+        return CACHE_BYPASS;
+    }
+
+    coalesce = coalesce_request(req);
+
+    if(CACHE_MAX_SIZE <= 0 && !coalesce) {
+        return CACHE_BYPASS;
+    }
+
+    if(conn->fd < 0 || conn->fd >= MAX_REGISTERED_FDS || FILLS[conn->fd]) {
+        // this connection's already waiting on a reply to go in the cache
+        return CACHE_BYPASS;
+    }
+
+    key = bformat("%p %s", req->target_host, bdata(req->uri));
+    check_mem(key);
+
+    for(;;) {
+        now = time(NULL);
+        node = hash_lookup(SLOTS, bdata(key));
+        slot = node ? hnode_get(node) : NULL;
+        entry = slot ? CacheSlot_find(slot, req) : NULL;
+
+        if(entry && entry->stale <= now) {
+            CacheEntry_remove(entry);
+            entry = NULL;
+            continue;  // the slot could be gone now
+        }
+
+        if(entry && entry->response == NULL) {
+            rc = CACHE_BYPASS;
+            break;
+        } else if(entry && (entry->expires > now || slot->fill)) {
+            // fresh, or stale but someone's already getting a new one
+            lru_unlink(entry);
+            lru_push(entry);
+            entry->response->refcount++;
+            ResponseCache_serve(conn, entry->response, entry->status);
+            rc = CACHE_HIT;
+            break;
+        } else if(slot && slot->fill) {
+            if(waited) {
+                // it didn't give us anything we can use, don't wait again
+                rc = CACHE_BYPASS;
+                break;
+            }
+
+            slot->waiting++;
+            tasksleep(&slot->filled);
+            slot->waiting--;
+            waited = 1;
+
+            shared = CacheSlot_take_shared(slot, req, &status);
+            if(slot->waiting == 0) CacheSlot_unshare(slot);
+            CacheSlot_maybe_destroy(slot);
+
+            if(shared) {
+                ResponseCache_serve(conn, shared, status);
+                rc = CACHE_HIT;
+                break;
+            }
+        } else if(conditional_request(req)) {
+            // a 304 is no good to anyone else
+            rc = CACHE_BYPASS;
+            break;
+        } else {
+            if(slot == NULL) {
+                slot = calloc(sizeof(CacheSlot), 1);
+                check_mem(slot);
+                slot->key = key;
+                key = NULL;
+                check(hash_alloc_insert(SLOTS, bdata(slot->key), slot), "Failed to add cache slot.");
+            }
+
+            slot->coalesce = coalesce;
+            check(CacheFill_create(conn->fd, slot, req), "Failed to start filling the cache.");
+            rc = CACHE_MISS;
+            break;
+        }
+    }
+
+    bdestroy(key);
+    return rc;
+
+error:
+    if(slot) CacheSlot_maybe_destroy(slot);
+    bdestroy(key);
+    return CACHE_BYPASS;
+}
+
+/**
+ * Watches the bytes of a reply as they go out to fd and puts the
+ * response in the cache once the whole thing has gone by.  Does nothing
+ * unless fd's request was a CACHE_MISS.
+ */
+void ResponseCache_capture(int fd, const char *data, int len)
+{
+    CacheFill *fill = NULL;
+    httpclient_parser *parser = NULL;
+    int used = 0;
+    int rc = 0;
+    size_t end = 0;
+
+    if(fd < 0 || fd >= MAX_REGISTERED_FDS || (fill = FILLS[fd]) == NULL) return;
+
+    parser = &fill->parser;
+
+    check_debug(blength(fill->data) + len <= CACHE_MAX_ENTRY, "Response is too big to cache.");
+    check(bcatblk(fill->data, data, len) == BSTR_OK, "Failed to capture response.");
+
+    if(!httpclient_parser_is_finished(parser)) {
+        rc = httpclient_parser_execute(parser, bdata(fill->data), blength(fill->data),
+                httpclient_parser_nread(parser));
+        check_debug(rc != -1 && !httpclient_parser_has_error(parser), "Can't parse response to cache.");
+
+        if(!httpclient_parser_is_finished(parser)) return;
+
+        fill->scanned = parser->body_start;
+    }
+
+    if(parser->chunked) {
+        used = ChunkParser_execute(&fill->chunks, bdata(fill->data) + fill->scanned,
+                blength(fill->data) - fill->scanned);
+        check_debug(used != -1, "Bad chunked encoding in response to cache.");
+        fill->scanned += used;
+
+        if(fill->chunks.state == CHUNK_DONE) CacheFill_store(fill, fill->scanned);
+    } else if(parser->content_len >= 0) {
+        end = parser->body_start + parser->content_len;
+        if((size_t)blength(fill->data) >= end) CacheFill_store(fill, end);
+    }
+
+    return;
+
+error:
+    CacheFill_destroy(fill);
+}
+
+/**
+ * The backend's done with fd's reply, so one that runs until close is
+ * complete now, and anything else that isn't finished never will be.
+ */
+void ResponseCache_finish(int fd)
+{
+    CacheFill *fill = NULL;
+
+    if(fd < 0 || fd >= MAX_REGISTERED_FDS || (fill = FILLS[fd]) == NULL) return;
+
+    if(httpclient_parser_is_finished(&fill->parser) &&
+            !fill->parser.chunked && fill->parser.content_len < 0) {
+        CacheFill_store(fill, blength(fill->data));
+    } else {
+        CacheFill_destroy(fill);
+    }
+}
+
+void ResponseCache_abandon(int fd)
+{
+    if(fd >= 0 && fd < MAX_REGISTERED_FDS && FILLS[fd]) {
+        CacheFill_destroy(FILLS[fd]);
+    }
+}
@@ -0,0 +1,110 @@
+/**
+ *
+ * Copyright (c) 2010, Zed A. Shaw and Mongrel2 Project Contributors.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ *     * Neither the name of the Mongrel2 Project, Zed A. Shaw, nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _response_cache_h
+#define _response_cache_h
+
+#include <bstring.h>
+#include <time.h>
+#include <task/task.h>
+#include <write_queue.h>
+#include <proxy.h>
+#include <http11/httpclient_parser.h>
+
+extern int CACHE_MAX_SIZE;
+extern int CACHE_MAX_ENTRY;
+extern int CACHE_DEFAULT_TTL;
+extern int CACHE_STALE_TTL;
+
+enum {
+    CACHE_BYPASS = 0,
+    CACHE_MISS,
+    CACHE_HIT
+};
+
+struct CacheSlot;
+struct Connection;
+
+typedef struct CacheEntry {
+    struct CacheSlot *slot;
+    bstring variant;
+    WriteBuffer *response;      // NULL means don't cache it, just pass it through
+    int status;
+    time_t expires;
+    time_t stale;
+    size_t size;
+    struct CacheEntry *next;    // next variant in the slot
+    struct CacheEntry *lru_prev;
+    struct CacheEntry *lru_next;
+} CacheEntry;
+
+typedef struct CacheFill {
+    int fd;
+    struct CacheSlot *slot;
+    struct bstrList *headers;   // the request's headers, for working out the variant
+    bstring data;
+    httpclient_parser parser;
+    ChunkParser chunks;
+    size_t scanned;
+    bstring cache_control;
+    bstring expires;
+    bstring vary;
+    int set_cookie;
+} CacheFill;
+
+typedef struct CacheSlot {
+    bstring key;
+    bstring vary;
+    CacheEntry *entries;
+    CacheFill *fill;
+    int coalesce;               // waiters get the reply even if it can't be cached
+    CacheEntry *shared;         // that reply, until the last waiter takes it
+    bstring shared_vary;
+    int waiting;
+    Rendez filled;
+} CacheSlot;
+
+int ResponseCache_request(struct Connection *conn);
+
+void ResponseCache_capture(int fd, const char *data, int len);
+
+void ResponseCache_finish(int fd);
+
+void ResponseCache_abandon(int fd);
+
+int ResponseCache_ttl(bstring cache_control, bstring expires, time_t now, int *stale);
+
+size_t ResponseCache_used();
+
+#endif
@@ -57,8 +57,8 @@ void host_destroy_cb(Route *r, RouteMap *map)
 }
 
 Server *Server_create(const char *uuid, const char *default_host,
-        const char *port, const char *chroot, const char *access_log,
-        const char *error_log, const char *pid_file)
+        const char *port, const char *bind_addr, const char *chroot,
+        const char *access_log, const char *error_log, const char *pid_file)
 {
     Server *srv = h_calloc(sizeof(Server), 1);
     check_mem(srv);
@@ -69,6 +69,8 @@ Server *Server_create(const char *uuid, const char *default_host,
     srv->port = atoi(port);
     check(port > 0, "Can't bind to the given port: %s", port);
 
+    srv->bind_addr = bfromcstr(bind_addr ? bind_addr : "0.0.0.0"); check_mem(srv->bind_addr);
+
     srv->listen_fd = 0;
 
     srv->uuid = bfromcstr(uuid); check_mem(srv->uuid);
@@ -78,9 +80,8 @@ Server *Server_create(const char *uuid, const char *default_host,
     srv->pid_file = bfromcstr(pid_file); check_mem(srv->pid_file);
     srv->default_hostname = bfromcstr(default_host);
 
+    srv->use_ssl = 0;
     srv->ssl_ctx = NULL;
-    // For a sneak peak of ssl, uncomment the following line
-    // srv->ssl_ctx = ssl_ctx_new(0, 0);
 
     return srv;
 
@@ -96,10 +97,12 @@ void Server_destroy(Server *srv)
     if(srv) {
         RouteMap_destroy(srv->hosts);
         bdestroy(srv->uuid);
+        bdestroy(srv->bind_addr);
         bdestroy(srv->chroot);
         bdestroy(srv->access_log);
         bdestroy(srv->error_log);
         bdestroy(srv->pid_file);
+        ssl_ctx_free(srv->ssl_ctx);
 
         fdclose(srv->listen_fd);
         h_free(srv);
@@ -123,6 +126,124 @@ void Server_init()
 }
 
 
+static SSL_CTX *Server_load_ssl_ctx(bstring cert, bstring key)
+{
+    int rc = 0;
+    int spares = Setting_get_int("limits.task_threads", 2);
+    SSL_CTX *ssl_ctx = ssl_ctx_new(SSL_NO_DEFAULT_KEY, SSL_DEFAULT_SVR_SESS);
+    check(ssl_ctx, "Failed to create an SSL context for %s.", bdata(cert));
+
+    rc = ssl_obj_load(ssl_ctx, SSL_OBJ_X509_CERT, bdata(cert), NULL);
+    check(rc == SSL_OK, "Failed to load the certificate %s.", bdata(cert));
+
+    rc = ssl_obj_load(ssl_ctx, SSL_OBJ_RSA_KEY, bdata(key), NULL);
+    check(rc == SSL_OK, "Failed to load the private key %s.", bdata(key));
+
+    // the key is parsed once here, and each task thread gets a copy now
+    rc = fill_rsa_spares(ssl_ctx, spares > 0 ? spares : 1);
+    check(rc == SSL_OK, "Failed to copy the private key %s.", bdata(key));
+
+    log_info("Loaded SSL certificate %s and key %s", bdata(cert), bdata(key));
+    return ssl_ctx;
+
+error:
+    ssl_ctx_free(ssl_ctx);
+    return NULL;
+}
+
+typedef struct HostSSL {
+    bstring certdir;
+    int rc;
+} HostSSL;
+
+static void Server_load_host_ssl_cb(void *value, void *data)
+{
+    Route *route = (Route *)value;
+    Host *host = (Host *)route->data;
+    HostSSL *hs = (HostSSL *)data;
+    bstring cert = NULL;
+    bstring key = NULL;
+
+    // a host can be under more than one pattern
+    if(host == NULL || host->ssl_ctx != NULL) return;
+
+    cert = bformat("%s%s.crt", bdata(hs->certdir), bdata(host->name));
+    key = bformat("%s%s.key", bdata(hs->certdir), bdata(host->name));
+    check_mem(cert);
+    check_mem(key);
+
+    // hosts without their own certificate just use the server's
+    if(access((const char *)cert->data, F_OK) == 0) {
+        host->ssl_ctx = Server_load_ssl_ctx(cert, key);
+        check(host->ssl_ctx, "Host %s has an unusable certificate.", bdata(host->name));
+    }
+
+    bdestroy(cert);
+    bdestroy(key);
+    return;
+
+error:
+    hs->rc = -1;
+    bdestroy(cert);
+    bdestroy(key);
+}
+
+static SSL_CTX *Server_sni_cb(const char *host_name, void *arg)
+{
+    Server *srv = (Server *)arg;
+    bstring target = bfromcstr(host_name);
+    Host *host = NULL;
+
+    check_mem(target);
+    btolower(target);
+
+    host = Server_match_backend(srv, target);
+    bdestroy(target);
+
+    return host ? host->ssl_ctx : NULL;
+
+error:
+    return NULL;
+}
+
+/**
+ * Loads the server's certificate and key, named for its uuid, and any
+ * host's that has one named for it, all from the certdir setting.  This
+ * happens once when the config is loaded, and SNI picks between them.
+ */
+int Server_init_ssl(Server *srv)
+{
+    struct tagbstring DEFAULT_CERTDIR = bsStatic("./certs/");
+    bstring cert = NULL;
+    bstring key = NULL;
+    HostSSL hs = {.certdir = NULL, .rc = 0};
+
+    if(!srv->use_ssl) return 0;
+
+    hs.certdir = Setting_get_str("certdir", &DEFAULT_CERTDIR);
+
+    cert = bformat("%s%s.crt", bdata(hs.certdir), bdata(srv->uuid));
+    key = bformat("%s%s.key", bdata(hs.certdir), bdata(srv->uuid));
+
+    srv->ssl_ctx = Server_load_ssl_ctx(cert, key);
+    check(srv->ssl_ctx, "Server %s has use_ssl set but no usable certificate.", bdata(srv->uuid));
+
+    tst_traverse(srv->hosts->routes, Server_load_host_ssl_cb, &hs);
+    check(hs.rc == 0, "Failed to load a host certificate from %s.", bdata(hs.certdir));
+
+    ssl_ctx_set_sni(srv->ssl_ctx, Server_sni_cb, srv);
+
+    bdestroy(cert);
+    bdestroy(key);
+    return 0;
+
+error:
+    bdestroy(cert);
+    bdestroy(key);
+    return -1;
+}
+
+
 void Server_start(Server *srv)
 {
     int cfd;
@@ -133,7 +254,7 @@ void Server_start(Server *srv)
 
     taskname("SERVER");
 
-    log_info("Starting server on port %d", srv->port);
+    log_info("Starting server on %s port %d", bdata(srv->bind_addr), srv->port);
 
     Config_start_handlers();
 
@@ -143,7 +264,11 @@ void Server_start(Server *srv)
 
         Connection *conn = Connection_create(srv, cfd, rport, remote,
                                              srv->ssl_ctx);
-        Connection_accept(conn);
+        if(conn) {
+            Connection_accept(conn);
+        } else {
+            fdclose(cfd);
+        }
     }
 
     debug("SERVER EXITED with error: %s and return value: %d", strerror(errno), cfd);
@@ -42,11 +42,13 @@
 #include <ssl/ssl.h>
 
 enum {
-    IPADDR_SIZE = 16
+    // big enough for an IPv6 address
+    IPADDR_SIZE = 46
 };
 
 typedef struct Server {
     int port;
+    bstring bind_addr;
     int listen_fd;
     Host *default_host;
     RouteMap *hosts;
@@ -56,18 +58,21 @@ typedef struct Server {
     bstring error_log;
     bstring pid_file;
     bstring default_hostname;
+    int use_ssl;
     SSL_CTX *ssl_ctx;
 } Server;
 
 
 Server *Server_create(const char *uuid, const char *default_host,
-        const char *port, const char *chroot, const char *access_log,
-        const char *error_log, const char *pid_file);
+        const char *port, const char *bind_addr, const char *chroot,
+        const char *access_log, const char *error_log, const char *pid_file);
 
 void Server_destroy(Server *srv);
 
 void Server_init();
 
+int Server_init_ssl(Server *srv);
+
 void Server_start(Server *srv);
 
 int Server_add_host(Server *srv, bstring pattern, Host *host);
@@ -427,14 +427,19 @@ int load_key_certs(SSL_CTX *ssl_ctx)
 
     /* now load the certificate */
 #ifdef CONFIG_SSL_GENERATE_X509_CERT 
-    if ((cert_size = ssl_x509_create(ssl_ctx, 0, dn, &cert_data)) < 0)
+    /* no key to sign it with, the application loads its own */
+    if (!(options & SSL_NO_DEFAULT_KEY))
     {
-        ret = cert_size;
-        goto error;
-    }
+        if ((cert_size = ssl_x509_create(ssl_ctx, 0, dn, &cert_data)) < 0)
+        {
+            ret = cert_size;
+            goto error;
+        }
 
-    ssl_obj_memory_load(ssl_ctx, SSL_OBJ_X509_CERT, cert_data, cert_size, NULL);
-    free(cert_data);
+        ssl_obj_memory_load(ssl_ctx, SSL_OBJ_X509_CERT, 
+                cert_data, cert_size, NULL);
+        free(cert_data);
+    }
 #else
     if (strlen(CONFIG_SSL_X509_CERT_LOCATION))
     {
@@ -132,15 +132,9 @@ void SSL_free(SSL *ssl)
 
 int SSL_read(SSL *ssl, void *buf, int num)
 {
-    uint8_t *read_buf;
     int ret;
 
-    while ((ret = ssl_read(ssl, &read_buf)) == SSL_OK);
-
-    if (ret > SSL_OK)
-    {
-        memcpy(buf, read_buf, ret > num ? num : ret);
-    }
+    while ((ret = ssl_read_buf(ssl, (uint8_t *)buf, num)) == SSL_OK);
 
     return ret;
 }
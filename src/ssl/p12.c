@@ -146,6 +146,7 @@ static int p8_add_key(SSL_CTX *ssl_ctx, uint8_t *priv_key)
             (len = asn1_next_obj(buf, &offset, ASN1_OCTET_STRING)) < 0)
         goto error;
 
+    free_rsa_spares(ssl_ctx);
     ret = asn1_get_private_key(&buf[offset], len, &ssl_ctx->rsa_ctx);
 
 error:
@@ -68,6 +68,7 @@ extern "C" {
 #endif
 
 #include <time.h>
+#include <sys/uio.h>
 //#include "crypto.h"
 
 /* need to predefine before ssl_lib.h gets to it */
@@ -83,6 +84,7 @@ extern "C" {
 #define SSL_DISPLAY_BYTES                       0x00100000
 #define SSL_DISPLAY_CERTS                       0x00200000
 #define SSL_DISPLAY_RSA                         0x00400000
+#define SSL_NO_SESSION_TICKETS                  0x00800000
 
 /* errors that can be generated */
 #define SSL_OK                                  0
@@ -122,6 +124,12 @@ extern "C" {
 #define SSL_AES256_SHA                          0x35
 #define SSL_RC4_128_SHA                         0x05
 #define SSL_RC4_128_MD5                         0x04
+#define SSL_AES128_GCM_SHA256                   0x9c
+#define SSL_AES256_GCM_SHA384                   0x9d
+#define SSL_ECDHE_RSA_AES128_SHA                0xc013
+#define SSL_ECDHE_RSA_AES256_SHA                0xc014
+#define SSL_ECDHE_RSA_AES128_GCM_SHA256         0xc02f
+#define SSL_ECDHE_RSA_AES256_GCM_SHA384         0xc030
 
 /* build mode ids' */
 #define SSL_BUILD_SKELETON_MODE                 0x01
@@ -137,7 +145,7 @@ extern "C" {
 #define SSL_HAS_PEM                             3
 
 /* default session sizes */
-#define SSL_DEFAULT_SVR_SESS                    5
+#define SSL_DEFAULT_SVR_SESS                    4096
 #define SSL_DEFAULT_CLNT_SESS                   1
 
 /* X.509/X.520 distinguished name types */
@@ -192,9 +200,12 @@ extern "C" {
  * are passed during a handshake.
  * - SSL_DISPLAY_RSA (full mode build only): Display the RSA key details that
  * are passed during a handshake.
+ * - SSL_NO_SESSION_TICKETS (server only): Don't give clients RFC 5077 session
+ * tickets. Otherwise they can resume without any server state.
  *
  * @param num_sessions [in] The number of sessions to be used for session
- * caching. If this value is 0, then there is no session caching. This option
+ * caching. If this value is 0, then there is no session caching. The cache
+ * is hashed on the session id, so thousands of entries are fine. This option
  * is not used in skeleton mode.
  * @return A client/server context.
  */
@@ -209,6 +220,30 @@ EXP_FUNC SSL_CTX * STDCALL ssl_ctx_new(uint32_t options, int num_sessions);
  */
 EXP_FUNC void STDCALL ssl_ctx_free(SSL_CTX *ssl_ctx);
 
+/**
+ * @brief (server only) Choose a context from the client's server name.
+ *
+ * When a client hello carries an RFC 6066 server_name, the callback is
+ * given the host name and can return another server context to do the
+ * handshake with, so each virtual host can have its own key and
+ * certificate. Returning NULL keeps this context.
+ * @param ssl_ctx [in] The server context connections are created with.
+ * @param cb [in] The callback, or NULL to ignore server names.
+ * @param arg [in] Passed through to the callback.
+ */
+EXP_FUNC void STDCALL ssl_ctx_set_sni(SSL_CTX *ssl_ctx, ssl_sni_cb cb, void *arg);
+
+/**
+ * @brief (server only) Limit the private key work waiting on task threads.
+ *
+ * Each handshake's RSA decrypt or signature is queued for a task thread.
+ * Once this many are queued or running, further handshakes fail at that
+ * step instead of waiting, so a connection only counts against the limit
+ * while its handshake actually needs the key.
+ * @param max_jobs [in] The most jobs at once, or 0 for no limit.
+ */
+EXP_FUNC void STDCALL ssl_set_max_private_jobs(int max_jobs);
+
 /**
  * @brief (server only) Establish a new SSL connection to an SSL client.
  *
@@ -265,6 +300,22 @@ EXP_FUNC void STDCALL ssl_free(SSL *ssl);
  */
 EXP_FUNC int STDCALL ssl_read(SSL *ssl, uint8_t **in_data);
 
+/**
+ * @brief Read the SSL data stream into a buffer of your own.
+ *
+ * A record that fits in out_data is decrypted straight into it. The part of
+ * a bigger one that doesn't fit is kept with the connection and comes back
+ * from the next calls before anything more is read off the socket, so no
+ * data is lost however small out_len is. Don't mix this with ssl_read() on
+ * the same connection.
+ * @param ssl [in] An SSL object reference.
+ * @param out_data [out] Where the decrypted data goes.
+ * @param out_len [in] The size of out_data.
+ * @return The number of bytes put in out_data, or the same SSL_OK and error
+ * codes as ssl_read().
+ */
+EXP_FUNC int STDCALL ssl_read_buf(SSL *ssl, uint8_t *out_data, int out_len);
+
 /**
  * @brief Write to the SSL data stream. 
  * The socket must be in blocking mode.
@@ -276,6 +327,75 @@ EXP_FUNC int STDCALL ssl_read(SSL *ssl, uint8_t **in_data);
  */
 EXP_FUNC int STDCALL ssl_write(SSL *ssl, const uint8_t *out_data, int out_len);
 
+/**
+ * @brief Write a gathered buffer to the SSL data stream.
+ * Packs the iovecs into as few records as possible (up to 16kB of plaintext
+ * each) rather than one record per buffer.
+ * @param ssl [in] An SSL obect reference.
+ * @param iov [in] The buffers to be written.
+ * @param iovcnt [in] The number of buffers in iov.
+ * @return The number of bytes sent, or if < 0 if an error.
+ * @see ssl_write()
+ */
+EXP_FUNC int STDCALL ssl_writev(SSL *ssl, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Buffer data for the SSL data stream.
+ *
+ * Small writes are packed together and a record only goes out once it is
+ * full, so call ssl_flush() before waiting on the peer. Records start about
+ * one TCP segment long and grow to 16kB as the connection keeps sending.
+ * @param ssl [in] An SSL obect reference.
+ * @param out_data [in] The data to be written
+ * @param out_len [in] The number of bytes to be written.
+ * @return out_len once it is all buffered or sent, or < 0 if an error.
+ * @see ssl_write()
+ */
+EXP_FUNC int STDCALL ssl_write_buf(SSL *ssl, const uint8_t *out_data,
+        int out_len);
+
+/**
+ * @brief Send whatever ssl_write_buf() is still holding as one record.
+ * Does nothing if it's called again while it's already sending.
+ * @param ssl [in] An SSL obect reference.
+ * @return SSL_OK, or < 0 if an error.
+ */
+EXP_FUNC int STDCALL ssl_flush(SSL *ssl);
+
+/**
+ * @brief Encrypt application data into records without sending them.
+ *
+ * Whatever ssl_write_buf() is holding goes first.  The caller has to send
+ * the records before anything else is written on the connection, but it 
+ * can do that without blocking, say from a queue.
+ * @param ssl [in] An SSL obect reference whose handshake is complete.
+ * @param in_data [in] The data to be encrypted.
+ * @param in_len [in] The number of bytes to be encrypted.
+ * @param out [out] Where the records go, with room for ssl_seal_size() bytes.
+ * @return The number of bytes in out, 0 if a record is still being sent and
+ * nothing was done, or < 0 if an error.
+ */
+EXP_FUNC int STDCALL ssl_seal(SSL *ssl, const uint8_t *in_data, int in_len,
+        uint8_t *out);
+
+/**
+ * @brief The most ssl_seal() can write for in_len bytes.
+ * @param ssl [in] An SSL obect reference.
+ * @param in_len [in] The number of bytes to be encrypted.
+ */
+EXP_FUNC int STDCALL ssl_seal_size(const SSL *ssl, int in_len);
+
+/**
+ * @brief Hand the encryption of outgoing records to the kernel (kTLS).
+ * Once this succeeds, plain writes, sendfile() and splice() on the socket
+ * all produce TLS records.
+ * @param ssl [in] An SSL obect reference whose handshake is complete.
+ * @return SSL_OK if the kernel took over, or SSL_ERROR_NOT_SUPPORTED if the
+ * kernel or the negotiated cipher can't do it, in which case ssl_write()
+ * carries on as before.
+ */
+EXP_FUNC int STDCALL ssl_ktls_tx(SSL *ssl);
+
 /**
  * @brief Find an ssl object based on a file descriptor.
  *
@@ -316,8 +436,14 @@ EXP_FUNC uint8_t STDCALL ssl_get_session_id_size(const SSL *ssl);
  * - SSL_AES256_SHA (0x35)
  * - SSL_RC4_128_SHA (0x05)
  * - SSL_RC4_128_MD5 (0x04)
+ * - SSL_AES128_GCM_SHA256 (0x9c)
+ * - SSL_AES256_GCM_SHA384 (0x9d)
+ * - SSL_ECDHE_RSA_AES128_SHA (0xc013)
+ * - SSL_ECDHE_RSA_AES256_SHA (0xc014)
+ * - SSL_ECDHE_RSA_AES128_GCM_SHA256 (0xc02f)
+ * - SSL_ECDHE_RSA_AES256_GCM_SHA384 (0xc030)
  */
-EXP_FUNC uint8_t STDCALL ssl_get_cipher_id(const SSL *ssl);
+EXP_FUNC uint16_t STDCALL ssl_get_cipher_id(const SSL *ssl);
 
 /**
  * @brief Return the status of the handshake.
@@ -38,8 +38,17 @@
 #include <stdarg.h>
 #include "ssl.h"
 
-/* The session expiry time */
-#define SSL_EXPIRY_TIME     (CONFIG_SSL_EXPIRY_TIME*3600)
+#ifdef __linux__
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS     282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP     31
+#endif
+#endif
 
 static const uint8_t g_hello_request[] = { HS_HELLO_REQUEST, 0, 0, 0 };
 static const uint8_t g_chg_cipher_spec_pkt[] = { 1 };
@@ -50,25 +59,36 @@ static int do_handshake(SSL *ssl, uint8_t *buf, int read_len);
 static int set_key_block(SSL *ssl, int is_write);
 static int verify_digest(SSL *ssl, int mode, const uint8_t *buf, int read_len);
 static void *crypt_new(SSL *ssl, uint8_t *key, uint8_t *iv, int is_decrypt);
-static int send_raw_packet(SSL *ssl, uint8_t protocol);
+static int send_raw_packet(SSL *ssl, uint8_t protocol, int prefix);
+static int seal_prefix(SSL *ssl);
+static int seal_packet(SSL *ssl, uint8_t protocol, uint8_t *data, int length);
+static int read_alert(SSL *ssl, int ret);
 
 /**
  * The server will pick the cipher based on the order that the order that the
  * ciphers are listed. This order is defined at compile time.
  */
 #ifdef CONFIG_SSL_SKELETON_MODE
-const uint8_t ssl_prot_prefs[NUM_PROTOCOLS] = 
+const uint16_t ssl_prot_prefs[NUM_PROTOCOLS] = 
 { SSL_RC4_128_SHA };
 #else
-static void session_free(SSL_SESSION *ssl_sessions[], int sess_index);
 
-const uint8_t ssl_prot_prefs[NUM_PROTOCOLS] = 
+const uint16_t ssl_prot_prefs[NUM_PROTOCOLS] = 
 #ifdef CONFIG_SSL_PROT_LOW                  /* low security, fast speed */
-{ SSL_RC4_128_SHA, SSL_AES128_SHA, SSL_AES256_SHA, SSL_RC4_128_MD5 };
+{ SSL_ECDHE_RSA_AES128_GCM_SHA256, SSL_ECDHE_RSA_AES128_SHA,
+  SSL_AES128_GCM_SHA256, SSL_RC4_128_SHA, SSL_AES128_SHA, 
+  SSL_ECDHE_RSA_AES256_GCM_SHA384, SSL_ECDHE_RSA_AES256_SHA,
+  SSL_AES256_GCM_SHA384, SSL_AES256_SHA, SSL_RC4_128_MD5 };
 #elif CONFIG_SSL_PROT_MEDIUM                /* medium security, medium speed */
-{ SSL_AES128_SHA, SSL_AES256_SHA, SSL_RC4_128_SHA, SSL_RC4_128_MD5 };    
+{ SSL_ECDHE_RSA_AES128_GCM_SHA256, SSL_ECDHE_RSA_AES256_GCM_SHA384, 
+  SSL_ECDHE_RSA_AES128_SHA, SSL_ECDHE_RSA_AES256_SHA,
+  SSL_AES128_GCM_SHA256, SSL_AES256_GCM_SHA384, SSL_AES128_SHA, 
+  SSL_AES256_SHA, SSL_RC4_128_SHA, SSL_RC4_128_MD5 };    
 #else /* CONFIG_SSL_PROT_HIGH */            /* high security, low speed */
-{ SSL_AES256_SHA, SSL_AES128_SHA, SSL_RC4_128_SHA, SSL_RC4_128_MD5 };
+{ SSL_ECDHE_RSA_AES256_GCM_SHA384, SSL_ECDHE_RSA_AES128_GCM_SHA256, 
+  SSL_ECDHE_RSA_AES256_SHA, SSL_ECDHE_RSA_AES128_SHA,
+  SSL_AES256_GCM_SHA384, SSL_AES128_GCM_SHA256, SSL_AES256_SHA, 
+  SSL_AES128_SHA, SSL_RC4_128_SHA, SSL_RC4_128_MD5 };
 #endif
 #endif /* CONFIG_SSL_SKELETON_MODE */
 
@@ -87,7 +107,10 @@ static const cipher_info_t cipher_info[NUM_PROTOCOLS] =
         SHA1_SIZE,                      /* digest size */
         hmac_sha1,                      /* hmac algorithm */
         (crypt_func)RC4_crypt,          /* encrypt */
-        (crypt_func)RC4_crypt           /* decrypt */
+        (crypt_func)RC4_crypt,          /* decrypt */
+        SHA256_SIZE,                    /* TLS 1.2 prf hash */
+        0,                              /* not aead */
+        0                               /* rsa key exchange */
     },
 };
 #else
@@ -102,7 +125,10 @@ static const cipher_info_t cipher_info[NUM_PROTOCOLS] =
         SHA1_SIZE,                      /* digest size */
         hmac_sha1,                      /* hmac algorithm */
         (crypt_func)AES_cbc_encrypt,    /* encrypt */
-        (crypt_func)AES_cbc_decrypt     /* decrypt */
+        (crypt_func)AES_cbc_decrypt,    /* decrypt */
+        SHA256_SIZE,                    /* TLS 1.2 prf hash */
+        0,                              /* not aead */
+        0                               /* rsa key exchange */
     },
     {   /* AES256-SHA */
         SSL_AES256_SHA,                 /* AES256-SHA */
@@ -113,7 +139,10 @@ static const cipher_info_t cipher_info[NUM_PROTOCOLS] =
         SHA1_SIZE,                      /* digest size */
         hmac_sha1,                      /* hmac algorithm */
         (crypt_func)AES_cbc_encrypt,    /* encrypt */
-        (crypt_func)AES_cbc_decrypt     /* decrypt */
+        (crypt_func)AES_cbc_decrypt,    /* decrypt */
+        SHA256_SIZE,                    /* TLS 1.2 prf hash */
+        0,                              /* not aead */
+        0                               /* rsa key exchange */
     },       
     {   /* RC4-SHA */
         SSL_RC4_128_SHA,                /* RC4-SHA */
@@ -124,7 +153,10 @@ static const cipher_info_t cipher_info[NUM_PROTOCOLS] =
         SHA1_SIZE,                      /* digest size */
         hmac_sha1,                      /* hmac algorithm */
         (crypt_func)RC4_crypt,          /* encrypt */
-        (crypt_func)RC4_crypt           /* decrypt */
+        (crypt_func)RC4_crypt,          /* decrypt */
+        SHA256_SIZE,                    /* TLS 1.2 prf hash */
+        0,                              /* not aead */
+        0                               /* rsa key exchange */
     },
     /*
      * This protocol is from SSLv2 days and is unlikely to be used - but was
@@ -139,14 +171,108 @@ static const cipher_info_t cipher_info[NUM_PROTOCOLS] =
         MD5_SIZE,                       /* digest size */
         hmac_md5,                       /* hmac algorithm */
         (crypt_func)RC4_crypt,          /* encrypt */
-        (crypt_func)RC4_crypt           /* decrypt */
+        (crypt_func)RC4_crypt,          /* decrypt */
+        SHA256_SIZE,                    /* TLS 1.2 prf hash */
+        0,                              /* not aead */
+        0                               /* rsa key exchange */
+    },
+    /*
+     * TLS 1.2 only. The record carries an explicit nonce and a tag in
+     * place of the MAC and padding, see encrypt_gcm()/decrypt_gcm().
+     */
+    {   /* AES128-GCM-SHA256 */
+        SSL_AES128_GCM_SHA256,          /* AES128-GCM-SHA256 */
+        16,                             /* key size */
+        4,                              /* implicit nonce size */ 
+        2*(16+4),                       /* key block size */
+        0,                              /* no padding */
+        0,                              /* no digest, the tag does it */
+        NULL,                           /* no hmac */
+        NULL,                           /* encrypt_gcm() */
+        NULL,                           /* decrypt_gcm() */
+        SHA256_SIZE,                    /* TLS 1.2 prf hash */
+        1,                              /* aead */
+        0                               /* rsa key exchange */
+    },
+    {   /* AES256-GCM-SHA384 */
+        SSL_AES256_GCM_SHA384,          /* AES256-GCM-SHA384 */
+        32,                             /* key size */
+        4,                              /* implicit nonce size */ 
+        2*(32+4),                       /* key block size */
+        0,                              /* no padding */
+        0,                              /* no digest, the tag does it */
+        NULL,                           /* no hmac */
+        NULL,                           /* encrypt_gcm() */
+        NULL,                           /* decrypt_gcm() */
+        SHA384_SIZE,                    /* TLS 1.2 prf hash */
+        1,                              /* aead */
+        0                               /* rsa key exchange */
+    },
+    /*
+     * The same ciphers again, keyed by an X25519 exchange that the server 
+     * signs with its RSA key, see send_server_key_xchg().
+     */
+    {   /* ECDHE-RSA-AES128-SHA */
+        SSL_ECDHE_RSA_AES128_SHA,       /* ECDHE-RSA-AES128-SHA */
+        16,                             /* key size */
+        16,                             /* iv size */ 
+        2*(SHA1_SIZE+16+16),            /* key block size */
+        16,                             /* block padding size */
+        SHA1_SIZE,                      /* digest size */
+        hmac_sha1,                      /* hmac algorithm */
+        (crypt_func)AES_cbc_encrypt,    /* encrypt */
+        (crypt_func)AES_cbc_decrypt,    /* decrypt */
+        SHA256_SIZE,                    /* TLS 1.2 prf hash */
+        0,                              /* not aead */
+        1                               /* ecdhe key exchange */
+    },
+    {   /* ECDHE-RSA-AES256-SHA */
+        SSL_ECDHE_RSA_AES256_SHA,       /* ECDHE-RSA-AES256-SHA */
+        32,                             /* key size */
+        16,                             /* iv size */ 
+        2*(SHA1_SIZE+32+16),            /* key block size */
+        16,                             /* block padding size */
+        SHA1_SIZE,                      /* digest size */
+        hmac_sha1,                      /* hmac algorithm */
+        (crypt_func)AES_cbc_encrypt,    /* encrypt */
+        (crypt_func)AES_cbc_decrypt,    /* decrypt */
+        SHA256_SIZE,                    /* TLS 1.2 prf hash */
+        0,                              /* not aead */
+        1                               /* ecdhe key exchange */
+    },
+    {   /* ECDHE-RSA-AES128-GCM-SHA256 */
+        SSL_ECDHE_RSA_AES128_GCM_SHA256,/* ECDHE-RSA-AES128-GCM-SHA256 */
+        16,                             /* key size */
+        4,                              /* implicit nonce size */ 
+        2*(16+4),                       /* key block size */
+        0,                              /* no padding */
+        0,                              /* no digest, the tag does it */
+        NULL,                           /* no hmac */
+        NULL,                           /* encrypt_gcm() */
+        NULL,                           /* decrypt_gcm() */
+        SHA256_SIZE,                    /* TLS 1.2 prf hash */
+        1,                              /* aead */
+        1                               /* ecdhe key exchange */
+    },
+    {   /* ECDHE-RSA-AES256-GCM-SHA384 */
+        SSL_ECDHE_RSA_AES256_GCM_SHA384,/* ECDHE-RSA-AES256-GCM-SHA384 */
+        32,                             /* key size */
+        4,                              /* implicit nonce size */ 
+        2*(32+4),                       /* key block size */
+        0,                              /* no padding */
+        0,                              /* no digest, the tag does it */
+        NULL,                           /* no hmac */
+        NULL,                           /* encrypt_gcm() */
+        NULL,                           /* decrypt_gcm() */
+        SHA384_SIZE,                    /* TLS 1.2 prf hash */
+        1,                              /* aead */
+        1                               /* ecdhe key exchange */
     },
 };
 #endif
 
-static void prf(const uint8_t *sec, int sec_len, uint8_t *seed, int seed_len,
-        uint8_t *out, int olen);
-static const cipher_info_t *get_cipher_info(uint8_t cipher);
+static void prf(const SSL *ssl, const uint8_t *sec, int sec_len, 
+        uint8_t *seed, int seed_len, uint8_t *out, int olen);
 static void increment_read_sequence(SSL *ssl);
 static void increment_write_sequence(SSL *ssl);
 static void add_hmac_digest(SSL *ssl, int snd, uint8_t *hmac_header,
@@ -172,17 +298,17 @@ EXP_FUNC SSL_CTX *STDCALL ssl_ctx_new(uint32_t options, int num_sessions)
         return NULL;
     }
 
-#ifndef CONFIG_SSL_SKELETON_MODE
-    ssl_ctx->num_sessions = num_sessions;
-#endif
-
     SSL_CTX_MUTEX_INIT(ssl_ctx->mutex);
 
 #ifndef CONFIG_SSL_SKELETON_MODE
-    if (num_sessions)
+    if (num_sessions > 0)
     {
-        ssl_ctx->ssl_sessions = (SSL_SESSION **)
-                        calloc(1, num_sessions*sizeof(SSL_SESSION *));
+        /* round up to whole buckets */
+        num_sessions = (num_sessions + SSL_SESSION_WAYS-1) & 
+                                            ~(SSL_SESSION_WAYS-1);
+        ssl_ctx->num_sessions = num_sessions;
+        ssl_ctx->ssl_sessions = (SSL_SESSION *)
+                        calloc(num_sessions, sizeof(SSL_SESSION));
     }
 #endif
 
@@ -212,10 +338,14 @@ EXP_FUNC void STDCALL ssl_ctx_free(SSL_CTX *ssl_ctx)
 
 #ifndef CONFIG_SSL_SKELETON_MODE
     /* clear out all the sessions */
-    for (i = 0; i < ssl_ctx->num_sessions; i++)
-        session_free(ssl_ctx->ssl_sessions, i);
+    if (ssl_ctx->ssl_sessions)
+    {
+        memset(ssl_ctx->ssl_sessions, 0, 
+                ssl_ctx->num_sessions*sizeof(SSL_SESSION));
+        free(ssl_ctx->ssl_sessions);
+    }
 
-    free(ssl_ctx->ssl_sessions);
+    memset(ssl_ctx->ticket_keys, 0, sizeof(ssl_ctx->ticket_keys));
 #endif
 
     i = 0;
@@ -230,11 +360,21 @@ EXP_FUNC void STDCALL ssl_ctx_free(SSL_CTX *ssl_ctx)
 #endif
     ssl_ctx->chain_length = 0;
     SSL_CTX_MUTEX_DESTROY(ssl_ctx->mutex);
+    free_rsa_spares(ssl_ctx);
     RSA_free(ssl_ctx->rsa_ctx);
     RNG_terminate();
     free(ssl_ctx);
 }
 
+/*
+ * Let the client's server_name choose the context.
+ */
+EXP_FUNC void STDCALL ssl_ctx_set_sni(SSL_CTX *ssl_ctx, ssl_sni_cb cb, void *arg)
+{
+    ssl_ctx->sni_cb = cb;
+    ssl_ctx->sni_arg = arg;
+}
+
 /*
  * Free any used resources used by this connection.
  */
@@ -268,6 +408,8 @@ EXP_FUNC void STDCALL ssl_free(SSL *ssl)
     /* may already be free - but be sure */
     free(ssl->encrypt_ctx);
     free(ssl->decrypt_ctx);
+    free(ssl->carry);
+    free(ssl->wbuf);
     disposable_free(ssl);
 #ifdef CONFIG_SSL_CERT_VERIFICATION
     x509_free(ssl->x509_ctx);
@@ -281,8 +423,53 @@ EXP_FUNC void STDCALL ssl_free(SSL *ssl)
  */
 EXP_FUNC int STDCALL ssl_read(SSL *ssl, uint8_t **in_data)
 {
-    int ret = basic_read(ssl, in_data);
+    return read_alert(ssl, basic_read(ssl, in_data, NULL, 0));
+}
+
+/*
+ * Read application data into the caller's buffer. Whatever part of a 
+ * record doesn't fit waits in the carry buffer for the next call.
+ */
+EXP_FUNC int STDCALL ssl_read_buf(SSL *ssl, uint8_t *out_data, int out_len)
+{
+    uint8_t *in_data = NULL;
+    int ret;
+
+    if (out_len <= 0)
+        return SSL_OK;
+
+    if (ssl->carry_len == 0)
+    {
+        ret = read_alert(ssl, basic_read(ssl, &in_data, out_data, out_len));
 
+        if (ret <= SSL_OK || in_data == out_data)
+            return ret;
+
+        /* unencrypted, or too big for out_data */
+        if (in_data != ssl->carry)
+        {
+            if (ssl->carry == NULL)
+                ssl->carry = (uint8_t *)malloc(RT_MAX_PLAIN_LENGTH+RT_EXTRA);
+
+            memcpy(ssl->carry, in_data, ret);
+        }
+
+        ssl->carry_index = 0;
+        ssl->carry_len = ret;
+    }
+
+    ret = out_len < ssl->carry_len ? out_len : ssl->carry_len;
+    memcpy(out_data, &ssl->carry[ssl->carry_index], ret);
+    ssl->carry_index += ret;
+    ssl->carry_len -= ret;
+    return ret;
+}
+
+/*
+ * Send an alert for anything a read went wrong with.
+ */
+static int read_alert(SSL *ssl, int ret)
+{
     /* check for return code so we can send an alert */
     if (ret < SSL_OK)
     {
@@ -291,7 +478,7 @@ EXP_FUNC int STDCALL ssl_read(SSL *ssl, uint8_t **in_data)
             send_alert(ssl, ret);
 #ifndef CONFIG_SSL_SKELETON_MODE
             /* something nasty happened, so get rid of this session */
-            kill_ssl_session(ssl->ssl_ctx->ssl_sessions, ssl);
+            kill_ssl_session(ssl);
 #endif
         }
     }
@@ -306,6 +493,10 @@ EXP_FUNC int STDCALL ssl_write(SSL *ssl, const uint8_t *out_data, int out_len)
 {
     int n = out_len, nw, i, tot = 0;
 
+    /* anything buffered has to go first */
+    if ((i = ssl_flush(ssl)) < 0)
+        return i;
+
     /* maximum size of a TLS packet is around 16kB, so fragment */
     do 
     {
@@ -328,6 +519,250 @@ EXP_FUNC int STDCALL ssl_write(SSL *ssl, const uint8_t *out_data, int out_len)
     return out_len;
 }
 
+/*
+ * Write a set of buffers, filling each record up to the maximum plaintext
+ * size before it is sent.
+ */
+EXP_FUNC int STDCALL ssl_writev(SSL *ssl, const struct iovec *iov, int iovcnt)
+{
+    int i, ret, nw = 0, tot = 0;
+    size_t off = 0;
+
+    if ((ret = ssl_flush(ssl)) < 0)
+        return ret;
+
+    for (i = 0; i < iovcnt; )
+    {
+        int avail = RT_MAX_PLAIN_LENGTH - nw;
+        int left = iov[i].iov_len - off;
+        int n = left < avail ? left : avail;
+
+        memcpy(&ssl->bm_data[nw], (const uint8_t *)iov[i].iov_base + off, n);
+        nw += n;
+        off += n;
+
+        if (off == iov[i].iov_len)
+        {
+            i++;
+            off = 0;
+        }
+
+        /* record is full or we're out of buffers, so send it */
+        if (nw > 0 && (nw == RT_MAX_PLAIN_LENGTH || i == iovcnt))
+        {
+            if ((ret = send_packet(ssl, PT_APP_PROTOCOL_DATA, NULL, nw)) <= 0)
+                return ret;
+
+            tot += nw;
+            nw = 0;
+        }
+    }
+
+    return tot;
+}
+
+/*
+ * Buffer application data, sending records as they fill up.  The records 
+ * are built in wbuf rather than bm_data, as a flush can happen while a read
+ * is waiting on the rest of a record there.
+ */
+EXP_FUNC int STDCALL ssl_write_buf(SSL *ssl, const uint8_t *out_data, 
+        int out_len)
+{
+    int n, ret, tot = 0;
+
+    if (ssl->wbuf == NULL)
+    {
+        ssl->wbuf = (uint8_t *)malloc(RT_MAX_PLAIN_LENGTH+RT_EXTRA);
+        ssl->wrec_size = SSL_RAMP_RECORD_SIZE;
+    }
+
+    /* after a quiet spell the client is waiting on the first bytes again */
+    if (ssl->wbuf_len == 0 && 
+            time(NULL) - ssl->last_write >= SSL_RAMP_IDLE_TIME)
+        ssl->wrec_size = SSL_RAMP_RECORD_SIZE;
+
+    while (tot < out_len)
+    {
+        n = ssl->wrec_size - ssl->wbuf_len;
+
+        if (n > out_len - tot)
+            n = out_len - tot;
+
+        memcpy(&ssl->wbuf[BM_RECORD_OFFSET+ssl->wbuf_len], &out_data[tot], n);
+        ssl->wbuf_len += n;
+        tot += n;
+
+        if (ssl->wbuf_len == ssl->wrec_size)
+        {
+            if ((ret = ssl_flush(ssl)) < 0)
+                return ret;
+
+            ssl->wrec_size = ssl->wrec_size*2 < RT_MAX_PLAIN_LENGTH ? 
+                                ssl->wrec_size*2 : RT_MAX_PLAIN_LENGTH;
+        }
+    }
+
+    return out_len;
+}
+
+/*
+ * Send what ssl_write_buf() has buffered.  send_packet() works on bm_data,
+ * so point that at wbuf for the one record and put the read side's state 
+ * back afterwards.
+ */
+EXP_FUNC int STDCALL ssl_flush(SSL *ssl)
+{
+    uint8_t *bm_data = ssl->bm_data;
+    uint16_t bm_index = ssl->bm_index;
+    uint32_t need_record = IS_SET_SSL_FLAG(SSL_NEED_RECORD);
+    int ret;
+
+    /* a record that's partly out already can't have another cut into it */
+    if (ssl->wbuf_len == 0 || IS_SET_SSL_FLAG(SSL_TX_SENDING))
+        return SSL_OK;
+
+    ssl->bm_data = &ssl->wbuf[BM_RECORD_OFFSET];
+    ret = send_packet(ssl, PT_APP_PROTOCOL_DATA, NULL, ssl->wbuf_len);
+    ssl->bm_data = bm_data;
+    ssl->bm_index = bm_index;
+
+    if (!need_record)
+        CLR_SSL_FLAG(SSL_NEED_RECORD);
+
+    ssl->wbuf_len = 0;
+    ssl->last_write = time(NULL);
+    return ret < 0 ? ret : SSL_OK;
+}
+
+/*
+ * Room ssl_seal() needs for in_len bytes plus whatever is buffered.
+ */
+EXP_FUNC int STDCALL ssl_seal_size(const SSL *ssl, int in_len)
+{
+    int len = ssl->wbuf_len + in_len;
+    return len + (len/RT_MAX_PLAIN_LENGTH + 2)*RT_EXTRA;
+}
+
+/*
+ * Encrypt what ssl_write_buf() has buffered and then in_data into whole
+ * records at out, for a caller that sends them itself and so never waits
+ * in here.  That can't happen while a record is partly sent, so then it
+ * returns 0 and the caller tries again once the socket is writable.
+ */
+EXP_FUNC int STDCALL ssl_seal(SSL *ssl, const uint8_t *in_data, int in_len,
+        uint8_t *out)
+{
+    int n, prefix, sealed, tot = 0, out_len = 0;
+    uint8_t *rec_buf, *data;
+
+    if (ssl->hs_status != SSL_OK)
+        return SSL_ERROR_CONN_LOST;
+
+    if (IS_SET_SSL_FLAG(SSL_TX_SENDING))
+        return 0;
+
+    while (ssl->wbuf_len || tot < in_len)
+    {
+        prefix = seal_prefix(ssl);
+        rec_buf = &out[out_len];
+        data = &rec_buf[SSL_RECORD_SIZE+prefix];
+
+        if (ssl->wbuf_len)
+        {
+            n = ssl->wbuf_len;
+            memcpy(data, &ssl->wbuf[BM_RECORD_OFFSET], n);
+            ssl->wbuf_len = 0;
+        }
+        else
+        {
+            n = in_len - tot < RT_MAX_PLAIN_LENGTH ? 
+                                in_len - tot : RT_MAX_PLAIN_LENGTH;
+            memcpy(data, &in_data[tot], n);
+            tot += n;
+        }
+
+        sealed = prefix + seal_packet(ssl, PT_APP_PROTOCOL_DATA, data, n);
+        rec_buf[0] = PT_APP_PROTOCOL_DATA;
+        rec_buf[1] = 0x03;
+        rec_buf[2] = ssl->version;
+        rec_buf[3] = sealed >> 8;
+        rec_buf[4] = sealed & 0xff;
+        out_len += SSL_RECORD_SIZE+sealed;
+    }
+
+    ssl->last_write = time(NULL);
+    return out_len;
+}
+
+/*
+ * Let the kernel encrypt outgoing records.  Linux only offloads AEAD
+ * suites, so the CBC and RC4 ones we negotiate stay in userspace.  The
+ * kernel carries on from our write sequence, which is also what we use
+ * as the explicit nonce.
+ */
+EXP_FUNC int STDCALL ssl_ktls_tx(SSL *ssl)
+{
+#ifdef __linux__
+    SSL_GCM_CTX *gcm_ctx = (SSL_GCM_CTX *)ssl->encrypt_ctx;
+#endif
+
+    if (ssl->hs_status != SSL_OK || ssl_flush(ssl) < 0)
+        return SSL_ERROR_NOT_SUPPORTED;
+
+    switch (ssl->cipher)
+    {
+#ifdef __linux__
+        case SSL_AES128_GCM_SHA256:
+        case SSL_ECDHE_RSA_AES128_GCM_SHA256:
+            {
+                struct tls12_crypto_info_aes_gcm_128 ci;
+
+                memset(&ci, 0, sizeof(ci));
+                ci.info.version = TLS_1_2_VERSION;
+                ci.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+                memcpy(ci.iv, ssl->write_sequence, sizeof(ci.iv));
+                memcpy(ci.key, gcm_ctx->key, sizeof(ci.key));
+                memcpy(ci.salt, gcm_ctx->salt, sizeof(ci.salt));
+                memcpy(ci.rec_seq, ssl->write_sequence, sizeof(ci.rec_seq));
+
+                if (setsockopt(ssl->client_fd, 
+                                SOL_TCP, TCP_ULP, "tls", sizeof("tls")) ||
+                    setsockopt(ssl->client_fd, 
+                                SOL_TLS, TLS_TX, &ci, sizeof(ci)))
+                    return SSL_ERROR_NOT_SUPPORTED;
+
+                return SSL_OK;
+            }
+
+        case SSL_AES256_GCM_SHA384:
+        case SSL_ECDHE_RSA_AES256_GCM_SHA384:
+            {
+                struct tls12_crypto_info_aes_gcm_256 ci;
+
+                memset(&ci, 0, sizeof(ci));
+                ci.info.version = TLS_1_2_VERSION;
+                ci.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+                memcpy(ci.iv, ssl->write_sequence, sizeof(ci.iv));
+                memcpy(ci.key, gcm_ctx->key, sizeof(ci.key));
+                memcpy(ci.salt, gcm_ctx->salt, sizeof(ci.salt));
+                memcpy(ci.rec_seq, ssl->write_sequence, sizeof(ci.rec_seq));
+
+                if (setsockopt(ssl->client_fd, 
+                                SOL_TCP, TCP_ULP, "tls", sizeof("tls")) ||
+                    setsockopt(ssl->client_fd, 
+                                SOL_TLS, TLS_TX, &ci, sizeof(ci)))
+                    return SSL_ERROR_NOT_SUPPORTED;
+
+                return SSL_OK;
+            }
+#endif
+
+        default:
+            return SSL_ERROR_NOT_SUPPORTED;
+    }
+}
+
 /**
  * Add a certificate to the certificate chain.
  */
@@ -532,7 +967,7 @@ EXP_FUNC int STDCALL ssl_renegotiate(SSL *ssl)
  * @param iv_size   [out]   The iv size for the cipher
  * @return  The amount of key information we need.
  */
-static const cipher_info_t *get_cipher_info(uint8_t cipher)
+const cipher_info_t *get_cipher_info(uint16_t cipher)
 {
     int i;
 
@@ -547,6 +982,21 @@ static const cipher_info_t *get_cipher_info(uint8_t cipher)
     return NULL;  /* error */
 }
 
+/*
+ * Can this cipher be used at the version we're talking? The GCM suites
+ * need TLS 1.2, and the ECDHE ones a client hello that asked for X25519
+ * (so never on the client side, which doesn't do them).
+ */
+int cipher_allowed(const SSL *ssl, uint16_t cipher)
+{
+    const cipher_info_t *ciph_info = get_cipher_info(cipher);
+
+    return ciph_info != NULL && 
+        (!ciph_info->aead || ssl->version >= SSL_PROTOCOL_VERSION_1_2) &&
+        (!ciph_info->ecdhe || (ssl->dc && ssl->dc->ecdhe_ok &&
+                               !IS_SET_SSL_FLAG(SSL_IS_CLIENT)));
+}
+
 /*
  * Get a new ssl context for a new connection.
  */
@@ -559,6 +1009,7 @@ SSL *ssl_new(SSL_CTX *ssl_ctx, int client_fd)
     ssl->flag = SSL_NEED_RECORD;
     ssl->bm_data = ssl->bm_all_data+BM_RECORD_OFFSET; /* space at the start */
     ssl->hs_status = SSL_NOT_OK;            /* not connected */
+    ssl->version = SSL_PROTOCOL_MIN_VERSION;/* until the hellos say more */
 #ifdef CONFIG_ENABLE_VERIFICATION
     ssl->ca_cert_ctx = ssl_ctx->ca_cert_ctx;
 #endif
@@ -592,6 +1043,7 @@ int add_private_key(SSL_CTX *ssl_ctx, SSLObjLoader *ssl_obj)
     int ret = SSL_OK;
 
     /* get the private key details */
+    free_rsa_spares(ssl_ctx);
     if (asn1_get_private_key(ssl_obj->buf, ssl_obj->len, &ssl_ctx->rsa_ctx))
     {
         ret = SSL_ERROR_INVALID_KEY;
@@ -602,6 +1054,120 @@ error:
     return ret;
 }
 
+/*
+ * Make the private key copies up front, so the first handshakes on each 
+ * task thread don't have to.
+ */
+int fill_rsa_spares(SSL_CTX *ssl_ctx, int count)
+{
+    int ret = SSL_OK;
+
+    if (count > SSL_RSA_SPARES)
+        count = SSL_RSA_SPARES;
+
+    SSL_CTX_LOCK(ssl_ctx->mutex);
+
+    while (ssl_ctx->rsa_ctx && ssl_ctx->num_rsa_spares < count)
+    {
+        RSA_CTX *rsa_ctx = RSA_clone(ssl_ctx->rsa_ctx);
+
+        if (rsa_ctx == NULL)
+        {
+            ret = SSL_ERROR_INVALID_KEY;
+            break;
+        }
+
+        ssl_ctx->rsa_spares[ssl_ctx->num_rsa_spares++] = rsa_ctx;
+    }
+
+    SSL_CTX_UNLOCK(ssl_ctx->mutex);
+    return ret;
+}
+
+/*
+ * Drop the private key copies, they're made again from a new key.
+ */
+void free_rsa_spares(SSL_CTX *ssl_ctx)
+{
+    while (ssl_ctx->num_rsa_spares > 0)
+        RSA_free(ssl_ctx->rsa_spares[--ssl_ctx->num_rsa_spares]);
+}
+
+typedef struct
+{
+    RSA_CTX *rsa_ctx;
+    const uint8_t *in_data;
+    uint16_t in_len;
+    uint8_t *out_data;
+    int is_signing;
+    int ret;
+} rsa_job_t;
+
+static void rsa_private_job(void *arg)
+{
+    rsa_job_t *job = (rsa_job_t *)arg;
+
+    if (job->is_signing)
+        job->ret = RSA_encrypt(job->rsa_ctx, job->in_data, job->in_len,
+                job->out_data, 1);
+    else
+        job->ret = RSA_decrypt(job->rsa_ctx, job->in_data, job->out_data, 1);
+}
+
+static int rsa_jobs = 0;
+static int max_rsa_jobs = 0;
+
+/**
+ * Limit the private key jobs queued or running on task threads.
+ */
+EXP_FUNC void STDCALL ssl_set_max_private_jobs(int max_jobs)
+{
+    max_rsa_jobs = max_jobs;
+}
+
+/*
+ * Decrypt or sign with our private key on a task thread, so the other
+ * connections keep going during the bigint math.  A bigint context can't
+ * be shared between threads, so each job borrows its own copy of the key.
+ * Past the job limit the handshake fails rather than queue more work.
+ */
+int ssl_rsa_private(SSL *ssl, const uint8_t *in_data, uint16_t in_len,
+        uint8_t *out_data, int is_signing)
+{
+    SSL_CTX *ssl_ctx = ssl->ssl_ctx;
+    rsa_job_t job;
+
+    if (max_rsa_jobs > 0 && rsa_jobs >= max_rsa_jobs)
+        return -1;
+
+    SSL_CTX_LOCK(ssl_ctx->mutex);
+    job.rsa_ctx = ssl_ctx->num_rsa_spares > 0 ?
+        ssl_ctx->rsa_spares[--ssl_ctx->num_rsa_spares] :
+        RSA_clone(ssl_ctx->rsa_ctx);
+    SSL_CTX_UNLOCK(ssl_ctx->mutex);
+
+    if (job.rsa_ctx == NULL)
+        return -1;
+
+    job.in_data = in_data;
+    job.in_len = in_len;
+    job.out_data = out_data;
+    job.is_signing = is_signing;
+    job.ret = -1;
+    rsa_jobs++;
+    taskthread(rsa_private_job, &job);
+    rsa_jobs--;
+
+    SSL_CTX_LOCK(ssl_ctx->mutex);
+    if (ssl_ctx->num_rsa_spares < SSL_RSA_SPARES)
+        ssl_ctx->rsa_spares[ssl_ctx->num_rsa_spares++] = job.rsa_ctx;
+    else
+        RSA_free(job.rsa_ctx);
+    SSL_CTX_UNLOCK(ssl_ctx->mutex);
+
+    return job.ret;
+}
+
 /** 
  * Increment the read sequence number (as a 64 bit endian indepenent #)
  */     
@@ -637,10 +1203,29 @@ static void add_hmac_digest(SSL *ssl, int mode, uint8_t *hmac_header,
         const uint8_t *buf, int buf_len, uint8_t *hmac_buf)
 {
     int hmac_len = buf_len + 8 + SSL_RECORD_SIZE;
-    uint8_t *t_buf = (uint8_t *)alloca(hmac_len+10);
+    const uint8_t *seq = (mode == SSL_SERVER_WRITE || 
+            mode == SSL_CLIENT_WRITE) ? 
+                ssl->write_sequence : ssl->read_sequence;
+    uint8_t *t_buf;
+
+    /* the SHA1 suites MAC straight from the record, with the key's
+       pads already hashed by set_key_block() */
+    if (ssl->cipher_info->hmac == hmac_sha1)
+    {
+        const HMAC_SHA1_KEY *hkey = 
+            (mode == SSL_SERVER_WRITE || mode == SSL_CLIENT_READ) ? 
+                &ssl->server_hmac : &ssl->client_hmac;
+        SHA1_CTX ctx = hkey->inner;
 
-    memcpy(t_buf, (mode == SSL_SERVER_WRITE || mode == SSL_CLIENT_WRITE) ? 
-                    ssl->write_sequence : ssl->read_sequence, 8);
+        SHA1_Update(&ctx, seq, 8);
+        SHA1_Update(&ctx, hmac_header, SSL_RECORD_SIZE);
+        SHA1_Update(&ctx, buf, buf_len);
+        hmac_sha1_final(hkey, &ctx, hmac_buf);
+        return;
+    }
+
+    t_buf = (uint8_t *)alloca(hmac_len+10);
+    memcpy(t_buf, seq, 8);
     memcpy(&t_buf[8], hmac_header, SSL_RECORD_SIZE);
     memcpy(&t_buf[8+SSL_RECORD_SIZE], buf, buf_len);
 
@@ -718,6 +1303,8 @@ void add_packet(SSL *ssl, const uint8_t *pkt, int len)
 {
     MD5_Update(&ssl->dc->md5_ctx, pkt, len);
     SHA1_Update(&ssl->dc->sha1_ctx, pkt, len);
+    SHA256_Update(&ssl->dc->sha256_ctx, pkt, len);
+    SHA384_Update(&ssl->dc->sha384_ctx, pkt, len);
 }
 
 /**
@@ -776,17 +1363,59 @@ static void p_hash_sha1(const uint8_t *sec, int sec_len,
     }
 }
 
+/**
+ * Work out the TLS 1.2 PRF, P_SHA256 or P_SHA384 depending on the suite.
+ */
+static void p_hash_sha2(hmac_func hmac, int size, const uint8_t *sec, 
+        int sec_len, uint8_t *seed, int seed_len, uint8_t *out, int olen)
+{
+    uint8_t a1[SHA384_SIZE+128];
+    uint8_t tmp[SHA384_SIZE];
+
+    /* A(1) */
+    hmac(seed, seed_len, sec, sec_len, a1);
+    memcpy(&a1[size], seed, seed_len);
+
+    while (olen > 0)
+    {
+        int n = olen < size ? olen : size;
+
+        /* work out the actual hash */
+        hmac(a1, size+seed_len, sec, sec_len, tmp);
+        memcpy(out, tmp, n);
+        out += n;
+        olen -= n;
+
+        /* A(N) */
+        hmac(a1, size, sec, sec_len, tmp);
+        memcpy(a1, tmp, size);
+    }
+}
+
 /**
  * Work out the PRF.
  */
-static void prf(const uint8_t *sec, int sec_len, uint8_t *seed, int seed_len,
-        uint8_t *out, int olen)
+static void prf(const SSL *ssl, const uint8_t *sec, int sec_len, 
+        uint8_t *seed, int seed_len, uint8_t *out, int olen)
 {
     int len, i;
     const uint8_t *S1, *S2;
     uint8_t xbuf[256]; /* needs to be > the amount of key data */
     uint8_t ybuf[256]; /* needs to be > the amount of key data */
 
+    if (ssl->version >= SSL_PROTOCOL_VERSION_1_2)
+    {
+        const cipher_info_t *ciph_info = get_cipher_info(ssl->cipher);
+
+        if (ciph_info && ciph_info->prf_size == SHA384_SIZE)
+            p_hash_sha2(hmac_sha384, SHA384_SIZE, 
+                    sec, sec_len, seed, seed_len, out, olen);
+        else
+            p_hash_sha2(hmac_sha256, SHA256_SIZE, 
+                    sec, sec_len, seed, seed_len, out, olen);
+        return;
+    }
+
     len = sec_len/2;
     S1 = sec;
     S2 = &sec[len];
@@ -803,27 +1432,30 @@ static void prf(const uint8_t *sec, int sec_len, uint8_t *seed, int seed_len,
  * Generate a master secret based on the client/server random data and the
  * premaster secret.
  */
-void generate_master_secret(SSL *ssl, const uint8_t *premaster_secret)
+void generate_master_secret(SSL *ssl, 
+        const uint8_t *premaster_secret, int premaster_size)
 {
     uint8_t buf[128];   /* needs to be > 13+32+32 in size */
     strcpy((char *)buf, "master secret");
     memcpy(&buf[13], ssl->dc->client_random, SSL_RANDOM_SIZE);
     memcpy(&buf[45], ssl->dc->server_random, SSL_RANDOM_SIZE);
-    prf(premaster_secret, SSL_SECRET_SIZE, buf, 77, ssl->dc->master_secret,
-            SSL_SECRET_SIZE);
+    prf(ssl, premaster_secret, premaster_size, buf, 77, 
+            ssl->dc->master_secret, SSL_SECRET_SIZE);
 }
 
 /**
  * Generate a 'random' blob of data used for the generation of keys.
  */
-static void generate_key_block(uint8_t *client_random, uint8_t *server_random,
+static void generate_key_block(const SSL *ssl, 
+        uint8_t *client_random, uint8_t *server_random,
         uint8_t *master_secret, uint8_t *key_block, int key_block_size)
 {
     uint8_t buf[128];
     strcpy((char *)buf, "key expansion");
     memcpy(&buf[13], server_random, SSL_RANDOM_SIZE);
     memcpy(&buf[45], client_random, SSL_RANDOM_SIZE);
-    prf(master_secret, SSL_SECRET_SIZE, buf, 77, key_block, key_block_size);
+    prf(ssl, master_secret, SSL_SECRET_SIZE, buf, 77, 
+            key_block, key_block_size);
 }
 
 /** 
@@ -843,6 +1475,29 @@ void finished_digest(SSL *ssl, const char *label, uint8_t *digest)
         q += strlen(label);
     }
 
+    /* TLS 1.2 runs the PRF over a single hash of the handshake */
+    if (label && ssl->version >= SSL_PROTOCOL_VERSION_1_2)
+    {
+        const cipher_info_t *ciph_info = get_cipher_info(ssl->cipher);
+
+        if (ciph_info && ciph_info->prf_size == SHA384_SIZE)
+        {
+            SHA384_CTX sha384_ctx = ssl->dc->sha384_ctx;
+            SHA384_Final(q, &sha384_ctx);
+            q += SHA384_SIZE;
+        }
+        else
+        {
+            SHA256_CTX sha256_ctx = ssl->dc->sha256_ctx;
+            SHA256_Final(q, &sha256_ctx);
+            q += SHA256_SIZE;
+        }
+
+        prf(ssl, ssl->dc->master_secret, SSL_SECRET_SIZE, 
+                mac_buf, (int)(q-mac_buf), digest, SSL_FINISHED_HASH_SIZE);
+        return;
+    }
+
     MD5_Final(q, &md5_ctx);
     q += MD5_SIZE;
     
@@ -851,8 +1506,8 @@ void finished_digest(SSL *ssl, const char *label, uint8_t *digest)
 
     if (label)
     {
-        prf(ssl->dc->master_secret, SSL_SECRET_SIZE, mac_buf, (int)(q-mac_buf),
-            digest, SSL_FINISHED_HASH_SIZE);
+        prf(ssl, ssl->dc->master_secret, SSL_SECRET_SIZE, 
+            mac_buf, (int)(q-mac_buf), digest, SSL_FINISHED_HASH_SIZE);
     }
     else    /* for use in a certificate verify */
     {
@@ -876,6 +1531,7 @@ static void *crypt_new(SSL *ssl, uint8_t *key, uint8_t *iv, int is_decrypt)
     {
 #ifndef CONFIG_SSL_SKELETON_MODE
         case SSL_AES128_SHA:
+        case SSL_ECDHE_RSA_AES128_SHA:
             {
                 AES_CTX *aes_ctx = (AES_CTX *)malloc(sizeof(AES_CTX));
                 AES_set_key(aes_ctx, key, iv, AES_MODE_128);
@@ -889,6 +1545,7 @@ static void *crypt_new(SSL *ssl, uint8_t *key, uint8_t *iv, int is_decrypt)
             }
 
         case SSL_AES256_SHA:
+        case SSL_ECDHE_RSA_AES256_SHA:
             {
                 AES_CTX *aes_ctx = (AES_CTX *)malloc(sizeof(AES_CTX));
                 AES_set_key(aes_ctx, key, iv, AES_MODE_256);
@@ -901,6 +1558,22 @@ static void *crypt_new(SSL *ssl, uint8_t *key, uint8_t *iv, int is_decrypt)
                 return (void *)aes_ctx;
             }
 
+        case SSL_AES128_GCM_SHA256:
+        case SSL_AES256_GCM_SHA384:
+        case SSL_ECDHE_RSA_AES128_GCM_SHA256:
+        case SSL_ECDHE_RSA_AES256_GCM_SHA384:
+            {
+                SSL_GCM_CTX *gcm_ctx = 
+                    (SSL_GCM_CTX *)malloc(sizeof(SSL_GCM_CTX));
+                int key_size = get_cipher_info(ssl->cipher)->key_size;
+
+                GCM_set_key(&gcm_ctx->gcm, key, key_size == 16 ? 
+                                        AES_MODE_128 : AES_MODE_256);
+                memcpy(gcm_ctx->key, key, key_size);
+                memcpy(gcm_ctx->salt, iv, sizeof(gcm_ctx->salt));
+                return (void *)gcm_ctx;
+            }
+
         case SSL_RC4_128_MD5:
 #endif
         case SSL_RC4_128_SHA:
@@ -915,28 +1588,31 @@ static void *crypt_new(SSL *ssl, uint8_t *key, uint8_t *iv, int is_decrypt)
 }
 
 /**
- * Send a packet over the socket.
+ * Send a packet over the socket. The record is the prefix bytes (an
+ * explicit IV or nonce) sitting just before bm_data, followed by bm_index 
+ * bytes of bm_data.
  */
-static int send_raw_packet(SSL *ssl, uint8_t protocol)
+static int send_raw_packet(SSL *ssl, uint8_t protocol, int prefix)
 {
-    uint8_t *rec_buf = ssl->bm_all_data;
-    int pkt_size = SSL_RECORD_SIZE+ssl->bm_index;
+    uint8_t *rec_buf = ssl->bm_data - prefix - SSL_RECORD_SIZE;
+    int rec_len = prefix + ssl->bm_index;
+    int pkt_size = SSL_RECORD_SIZE+rec_len;
     int sent = 0;
     int ret = SSL_OK;
 
     rec_buf[0] = protocol;
-    rec_buf[1] = 0x03;      /* version = 3.1 (TLS) */
-    rec_buf[2] = 0x01;
-    rec_buf[3] = ssl->bm_index >> 8;
-    rec_buf[4] = ssl->bm_index & 0xff;
+    rec_buf[1] = 0x03;      /* version = 3.x (TLS 1.x) */
+    rec_buf[2] = ssl->version;
+    rec_buf[3] = rec_len >> 8;
+    rec_buf[4] = rec_len & 0xff;
 
-    DISPLAY_BYTES(ssl, "sending %d bytes", ssl->bm_all_data, 
-                             pkt_size, pkt_size);
+    DISPLAY_BYTES(ssl, "sending %d bytes", rec_buf, pkt_size, pkt_size);
+    SET_SSL_FLAG(SSL_TX_SENDING);
 
     while (sent < pkt_size)
     {
         if ((ret = SOCKET_WRITE(ssl->client_fd, 
-                        &ssl->bm_all_data[sent], pkt_size)) < 0)
+                        &rec_buf[sent], pkt_size-sent)) < 0)
         {
             ret = SSL_ERROR_CONN_LOST;
             break;
@@ -959,6 +1635,7 @@ static int send_raw_packet(SSL *ssl, uint8_t protocol)
         }
     }
 
+    CLR_SSL_FLAG(SSL_TX_SENDING);
     SET_SSL_FLAG(SSL_NEED_RECORD);  /* reset for next time */
     ssl->bm_index = 0;
 
@@ -972,84 +1649,170 @@ static int send_raw_packet(SSL *ssl, uint8_t protocol)
 }
 
 /**
- * Send an encrypted packet with padding bytes if necessary.
+ * Seal a record with AES-GCM (RFC 5288). The explicit part of the nonce
+ * is our write sequence number and goes in front of data, the tag goes 
+ * after the ciphertext.
  */
-int send_packet(SSL *ssl, uint8_t protocol, const uint8_t *in, int length)
+static void encrypt_gcm(SSL *ssl, uint8_t *data, 
+        const uint8_t *hmac_header, int length)
+{
+    SSL_GCM_CTX *gcm_ctx = (SSL_GCM_CTX *)ssl->encrypt_ctx;
+    uint8_t nonce[GCM_IV_SIZE];
+    uint8_t aad[8+SSL_RECORD_SIZE];
+
+    memcpy(nonce, gcm_ctx->salt, 4);
+    memcpy(&nonce[4], ssl->write_sequence, SSL_GCM_EXPLICIT_SIZE);
+    memcpy(data-SSL_GCM_EXPLICIT_SIZE, 
+                    ssl->write_sequence, SSL_GCM_EXPLICIT_SIZE);
+    memcpy(aad, ssl->write_sequence, 8);
+    memcpy(&aad[8], hmac_header, SSL_RECORD_SIZE);
+
+    GCM_encrypt(&gcm_ctx->gcm, nonce, aad, sizeof(aad), 
+            data, data, length, &data[length]);
+}
+
+/**
+ * Open an AES-GCM record into out, which can be buf itself. Returns the 
+ * plaintext length.
+ */
+static int decrypt_gcm(SSL *ssl, uint8_t *buf, int read_len, uint8_t *out)
+{
+    SSL_GCM_CTX *gcm_ctx = (SSL_GCM_CTX *)ssl->decrypt_ctx;
+    uint8_t nonce[GCM_IV_SIZE];
+    uint8_t aad[8+SSL_RECORD_SIZE];
+    int length = read_len - SSL_GCM_EXPLICIT_SIZE - GCM_TAG_SIZE;
+
+    if (length < 0)
+        return SSL_ERROR_INVALID_HMAC;
+
+    ssl->hmac_header[3] = length >> 8;      /* insert size */
+    ssl->hmac_header[4] = length & 0xff;
+    memcpy(nonce, gcm_ctx->salt, 4);
+    memcpy(&nonce[4], buf, SSL_GCM_EXPLICIT_SIZE);
+    memcpy(aad, ssl->read_sequence, 8);
+    memcpy(&aad[8], ssl->hmac_header, SSL_RECORD_SIZE);
+
+    if (GCM_decrypt(&gcm_ctx->gcm, nonce, aad, sizeof(aad), 
+                &buf[SSL_GCM_EXPLICIT_SIZE], out, length, 
+                &buf[SSL_GCM_EXPLICIT_SIZE+length]))
+        return SSL_ERROR_INVALID_HMAC;
+
+    return length;
+}
+
+/**
+ * How many bytes of explicit IV or nonce go in front of the next record.
+ */
+static int seal_prefix(SSL *ssl)
+{
+    if (!IS_SET_SSL_FLAG(SSL_TX_ENCRYPTED))
+        return 0;
+
+    if (ssl->cipher_info->aead)
+        return SSL_GCM_EXPLICIT_SIZE;
+
+    if (ssl->version >= SSL_PROTOCOL_VERSION_1_1 && ssl->cipher_info->iv_size)
+        return ssl->cipher_info->iv_size;
+
+    return 0;
+}
+
+/**
+ * Encrypt length bytes of data in place, adding the digest and padding 
+ * after it and the explicit IV or nonce (seal_prefix() bytes) in front. 
+ * Returns how many bytes there are from data on.
+ */
+static int seal_packet(SSL *ssl, uint8_t protocol, uint8_t *data, int length)
 {
     int msg_length = length;
-    int ret, pad_bytes = 0;
-    ssl->bm_index = msg_length;
+    int pad_bytes = 0, prefix = seal_prefix(ssl);
+    int mode = IS_SET_SSL_FLAG(SSL_IS_CLIENT) ? 
+                        SSL_CLIENT_WRITE : SSL_SERVER_WRITE;
+    uint8_t hmac_header[SSL_RECORD_SIZE];
 
-    /* if our state is bad, don't bother */
-    if (ssl->hs_status == SSL_ERROR_DEAD)
-        return SSL_ERROR_CONN_LOST;
+    if (!IS_SET_SSL_FLAG(SSL_TX_ENCRYPTED))
+        return length;
 
-    if (in) /* has the buffer already been initialised? */
+    hmac_header[0] = protocol;
+    hmac_header[1] = 0x03;
+    hmac_header[2] = ssl->version;
+    hmac_header[3] = length >> 8; 
+    hmac_header[4] = length & 0xff;
+
+    if (ssl->cipher_info->aead)
     {
-        memcpy(ssl->bm_data, in, length);
+        encrypt_gcm(ssl, data, hmac_header, length);
+        increment_write_sequence(ssl);
+        return length + GCM_TAG_SIZE;
     }
 
-    if (IS_SET_SSL_FLAG(SSL_TX_ENCRYPTED))
-    {
-        int mode = IS_SET_SSL_FLAG(SSL_IS_CLIENT) ? 
-                            SSL_CLIENT_WRITE : SSL_SERVER_WRITE;
-        uint8_t hmac_header[SSL_RECORD_SIZE];
+    /* add the packet digest */
+    msg_length += ssl->cipher_info->digest_size;
+    add_hmac_digest(ssl, mode, hmac_header, data, length, &data[length]);
 
-        hmac_header[0] = protocol;
-        hmac_header[1] = 0x03;
-        hmac_header[2] = 0x01;
-        hmac_header[3] = length >> 8; 
-        hmac_header[4] = length & 0xff;
+    /* add padding? */
+    if (ssl->cipher_info->padding_size)
+    {
+        int last_blk_size = msg_length%ssl->cipher_info->padding_size;
+        pad_bytes = ssl->cipher_info->padding_size - last_blk_size;
 
-        if (protocol == PT_HANDSHAKE_PROTOCOL)
-        {
-            DISPLAY_STATE(ssl, 1, ssl->bm_data[0], 0);
+        /* ensure we always have at least 1 padding byte */
+        if (pad_bytes == 0)
+            pad_bytes += ssl->cipher_info->padding_size;
 
-            if (ssl->bm_data[0] != HS_HELLO_REQUEST)
-            {
-                add_packet(ssl, ssl->bm_data, ssl->bm_index);
-            }
-        }
+        memset(&data[msg_length], pad_bytes-1, pad_bytes);
+        msg_length += pad_bytes;
+    }
 
-        /* add the packet digest */
-        msg_length += ssl->cipher_info->digest_size;
-        ssl->bm_index = msg_length;
-        add_hmac_digest(ssl, mode, hmac_header, ssl->bm_data, length, 
-                                                &ssl->bm_data[length]);
+    DISPLAY_BYTES(ssl, "unencrypted write", data, msg_length);
+    increment_write_sequence(ssl);
 
-        /* add padding? */
-        if (ssl->cipher_info->padding_size)
-        {
-            int last_blk_size = msg_length%ssl->cipher_info->padding_size;
-            pad_bytes = ssl->cipher_info->padding_size - last_blk_size;
+    /* 
+     * TLS 1.1+ wants an explicit IV per record. Chaining on from the
+     * last record and encrypting one more block in front of it works 
+     * out the same, as the receiver just throws that block away.
+     */
+    if (prefix)
+    {
+        memcpy(data-prefix, ssl->write_sequence, 8);
+        memset(data-prefix+8, 0, prefix-8);
+    }
 
-            /* ensure we always have at least 1 padding byte */
-            if (pad_bytes == 0)
-                pad_bytes += ssl->cipher_info->padding_size;
+    /* now encrypt the packet */
+    ssl->cipher_info->encrypt(ssl->encrypt_ctx, data-prefix, 
+                            data-prefix, prefix+msg_length);
+    return msg_length;
+}
 
-            memset(&ssl->bm_data[msg_length], pad_bytes-1, pad_bytes);
-            msg_length += pad_bytes;
-            ssl->bm_index = msg_length;
-        }
+/**
+ * Send an encrypted packet with padding bytes if necessary.
+ */
+int send_packet(SSL *ssl, uint8_t protocol, const uint8_t *in, int length)
+{
+    int ret, prefix = seal_prefix(ssl);
 
-        DISPLAY_BYTES(ssl, "unencrypted write", ssl->bm_data, msg_length);
-        increment_write_sequence(ssl);
+    /* if our state is bad, don't bother */
+    if (ssl->hs_status == SSL_ERROR_DEAD)
+        return SSL_ERROR_CONN_LOST;
 
-        /* now encrypt the packet */
-        ssl->cipher_info->encrypt(ssl->encrypt_ctx, ssl->bm_data, 
-                                            ssl->bm_data, msg_length);
+    if (in) /* has the buffer already been initialised? */
+    {
+        memcpy(ssl->bm_data, in, length);
     }
-    else if (protocol == PT_HANDSHAKE_PROTOCOL)
+
+    if (protocol == PT_HANDSHAKE_PROTOCOL)
     {
         DISPLAY_STATE(ssl, 1, ssl->bm_data[0], 0);
 
         if (ssl->bm_data[0] != HS_HELLO_REQUEST)
         {
-            add_packet(ssl, ssl->bm_data, ssl->bm_index);
+            add_packet(ssl, ssl->bm_data, length);
         }
     }
 
-    if ((ret = send_raw_packet(ssl, protocol)) <= 0)
+    ssl->bm_index = seal_packet(ssl, protocol, ssl->bm_data, length);
+
+    if ((ret = send_raw_packet(ssl, protocol, prefix)) <= 0)
         return ret;
 
     return length;  /* just return what we wanted to send */
@@ -1080,7 +1843,8 @@ static int set_key_block(SSL *ssl, int is_write)
         print_blob("server", ssl->dc->server_random, 32);
         print_blob("master", ssl->dc->master_secret, SSL_SECRET_SIZE);
 #endif
-        generate_key_block(ssl->dc->client_random, ssl->dc->server_random,
+        generate_key_block(ssl, 
+            ssl->dc->client_random, ssl->dc->server_random,
             ssl->dc->master_secret, ssl->dc->key_block, 
             ciph_info->key_block_size);
 #if 0
@@ -1093,6 +1857,9 @@ static int set_key_block(SSL *ssl, int is_write)
     if ((is_client && is_write) || (!is_client && !is_write))
     {
         memcpy(ssl->client_mac, q, ciph_info->digest_size);
+
+        if (ciph_info->hmac == hmac_sha1)
+            hmac_sha1_key(&ssl->client_hmac, q, SHA1_SIZE);
     }
 
     q += ciph_info->digest_size;
@@ -1100,6 +1867,9 @@ static int set_key_block(SSL *ssl, int is_write)
     if ((!is_client && is_write) || (is_client && !is_write))
     {
         memcpy(ssl->server_mac, q, ciph_info->digest_size);
+
+        if (ciph_info->hmac == hmac_sha1)
+            hmac_sha1_key(&ssl->server_hmac, q, SHA1_SIZE);
     }
 
     q += ciph_info->digest_size;
@@ -1145,13 +1915,16 @@ static int set_key_block(SSL *ssl, int is_write)
 }
 
 /**
- * Read the SSL connection.
+ * Read the SSL connection. Application data is decrypted straight into 
+ * out when it's given and the whole record fits, or else into the carry
+ * buffer, and *in_data says which. Everything else stays in bm_data.
  */
-int basic_read(SSL *ssl, uint8_t **in_data)
+int basic_read(SSL *ssl, uint8_t **in_data, uint8_t *out, int out_len)
 {
     int ret = SSL_OK;
     int read_len, is_client = IS_SET_SSL_FLAG(SSL_IS_CLIENT);
     uint8_t *buf = ssl->bm_data;
+    uint8_t *plain = buf;
 
     read_len = SOCKET_READ(ssl->client_fd, &buf[ssl->bm_read_index], 
                             ssl->need_bytes-ssl->got_bytes);
@@ -1215,9 +1988,54 @@ int basic_read(SSL *ssl, uint8_t **in_data)
     /* decrypt if we need to */
     if (IS_SET_SSL_FLAG(SSL_RX_ENCRYPTED))
     {
-        ssl->cipher_info->decrypt(ssl->decrypt_ctx, buf, buf, read_len);
-        read_len = verify_digest(ssl, 
-                is_client ? SSL_CLIENT_READ : SSL_SERVER_READ, buf, read_len);
+        /* the plaintext is never longer than the record */
+        if (out && ssl->record_type == PT_APP_PROTOCOL_DATA)
+        {
+            if (read_len <= out_len)
+                plain = out;
+            else 
+            {
+                if (ssl->carry == NULL)
+                    ssl->carry = (uint8_t *)
+                        malloc(RT_MAX_PLAIN_LENGTH+RT_EXTRA);
+
+                plain = ssl->carry;
+            }
+        }
+
+        if (ssl->cipher_info->aead)
+        {
+            read_len = decrypt_gcm(ssl, buf, read_len, plain);
+        }
+        else
+        {
+            int iv_size = 0;
+
+            /* 
+             * TLS 1.1+ sends the IV as the first block of the record. The
+             * CBC decrypt loads each block before writing the one behind
+             * it, so the plaintext can land over the IV.
+             */
+            if (ssl->version >= SSL_PROTOCOL_VERSION_1_1 && 
+                                    ssl->cipher_info->iv_size)
+            {
+                iv_size = ssl->cipher_info->iv_size;
+
+                if (read_len < iv_size)
+                {
+                    ret = SSL_ERROR_INVALID_HMAC;
+                    goto error;
+                }
+
+                memcpy(((AES_CTX *)ssl->decrypt_ctx)->iv, buf, iv_size);
+                read_len -= iv_size;
+            }
+
+            ssl->cipher_info->decrypt(ssl->decrypt_ctx, &buf[iv_size], 
+                                                        plain, read_len);
+            read_len = verify_digest(ssl, 
+                is_client ? SSL_CLIENT_READ : SSL_SERVER_READ, plain, read_len);
+        }
 
         /* does the hmac work? */
         if (read_len < 0)
@@ -1226,7 +2044,7 @@ int basic_read(SSL *ssl, uint8_t **in_data)
             goto error;
         }
 
-        DISPLAY_BYTES(ssl, "decrypted", buf, read_len);
+        DISPLAY_BYTES(ssl, "decrypted", plain, read_len);
         increment_read_sequence(ssl);
     }
 
@@ -1267,8 +2085,10 @@ int basic_read(SSL *ssl, uint8_t **in_data)
         case PT_APP_PROTOCOL_DATA:
             if (in_data)
             {
-                *in_data = ssl->bm_data;   /* point to the work buffer */
-                (*in_data)[read_len] = 0;  /* null terminate just in case */
+                *in_data = plain;           /* work, carry or caller's buffer */
+
+                if (plain == buf)
+                    (*in_data)[read_len] = 0;  /* null terminate just in case */
             }
 
             ret = read_len;
@@ -1376,11 +2196,20 @@ int send_finished(SSL *ssl)
                     client_finished : server_finished, &buf[4]);
 
 #ifndef CONFIG_SSL_SKELETON_MODE
-    /* store in the session cache */
-    if (!IS_SET_SSL_FLAG(SSL_SESSION_RESUME) && ssl->ssl_ctx->num_sessions)
+    /* store in the session cache, unless the client has it in a ticket */
+    if (!IS_SET_SSL_FLAG(SSL_SESSION_RESUME) && !ssl->dc->new_ticket &&
+            ssl->ssl_ctx->num_sessions && ssl->sess_id_size)
     {
-        memcpy(ssl->session->master_secret,
-                ssl->dc->master_secret, SSL_SECRET_SIZE);
+        SSL_SESSION session;
+
+        memset(&session, 0, sizeof(session));
+        session.conn_time = time(NULL);
+        session.cipher = ssl->cipher;
+        session.version = ssl->version;
+        memcpy(session.session_id, ssl->session_id, ssl->sess_id_size);
+        memcpy(session.master_secret, ssl->dc->master_secret, SSL_SECRET_SIZE);
+        ssl_session_store(ssl->ssl_ctx, &session);
+        memset(session.master_secret, 0, SSL_SECRET_SIZE);
     }
 #endif
 
@@ -1480,7 +2309,12 @@ int process_finished(SSL *ssl, int hs_len)
 
     if ((!is_client && !resume) || (is_client && resume))
     {
-        if ((ret = send_change_cipher_spec(ssl)) == SSL_OK)
+#ifndef CONFIG_SSL_SKELETON_MODE
+        if (!is_client && ssl->dc->new_ticket)
+            ret = send_session_ticket(ssl);
+#endif
+
+        if (ret == SSL_OK && (ret = send_change_cipher_spec(ssl)) == SSL_OK)
             ret = send_finished(ssl);
     }
 
@@ -1538,6 +2372,8 @@ void disposable_new(SSL *ssl)
         ssl->dc = (DISPOSABLE_CTX *)calloc(1, sizeof(DISPOSABLE_CTX));
         MD5_Init(&ssl->dc->md5_ctx);
         SHA1_Init(&ssl->dc->sha1_ctx);
+        SHA256_Init(&ssl->dc->sha256_ctx);
+        SHA384_Init(&ssl->dc->sha384_ctx);
     }
 }
 
@@ -1557,107 +2393,234 @@ void disposable_free(SSL *ssl)
 }
 
 #ifndef CONFIG_SSL_SKELETON_MODE     /* no session resumption in this mode */
+/*
+ * The session ids are random, so their first bytes pick the bucket.
+ */
+static SSL_SESSION *session_bucket(SSL_CTX *ssl_ctx, const uint8_t *session_id)
+{
+    uint32_t hash = (session_id[0] << 24) | (session_id[1] << 16) | 
+                    (session_id[2] << 8) | session_id[3];
+    int num_buckets = ssl_ctx->num_sessions/SSL_SESSION_WAYS;
+
+    return &ssl_ctx->ssl_sessions[(hash % num_buckets)*SSL_SESSION_WAYS];
+}
+
 /**
- * Find if an existing session has the same session id. If so, use the
- * master secret from this session for session resumption.
+ * Find an unexpired session with this (32 byte) session id and copy it into
+ * session. Returns SSL_OK if there was one.
  */
-SSL_SESSION *ssl_session_update(int max_sessions, SSL_SESSION *ssl_sessions[], 
-        SSL *ssl, const uint8_t *session_id)
+int ssl_session_find(SSL_CTX *ssl_ctx, const uint8_t *session_id,
+        SSL_SESSION *session)
 {
     time_t tm = time(NULL);
-    time_t oldest_sess_time = tm;
-    SSL_SESSION *oldest_sess = NULL;
-    int i;
+    SSL_SESSION *bucket;
+    int i, ret = SSL_NOT_OK;
 
     /* no sessions? Then bail */
-    if (max_sessions == 0)
-        return NULL;
+    if (ssl_ctx->num_sessions == 0)
+        return SSL_NOT_OK;
 
-    SSL_CTX_LOCK(ssl->ssl_ctx->mutex);
-    if (session_id)
+    SSL_CTX_LOCK(ssl_ctx->mutex);
+    bucket = session_bucket(ssl_ctx, session_id);
+
+    for (i = 0; i < SSL_SESSION_WAYS; i++)
     {
-        for (i = 0; i < max_sessions; i++)
+        if (bucket[i].conn_time && 
+                tm <= bucket[i].conn_time + SSL_EXPIRY_TIME &&
+                memcmp(bucket[i].session_id, session_id, 
+                                            SSL_SESSION_ID_SIZE) == 0)
         {
-            if (ssl_sessions[i])
-            {
-                /* kill off any expired sessions */
-                if (tm > ssl_sessions[i]->conn_time + SSL_EXPIRY_TIME)
-                {
-                    session_free(ssl_sessions, i);
-                    continue;
-                }
-
-                /* if the session id matches, it must still be less than 
-                   the expiry time */
-                if (memcmp(ssl_sessions[i]->session_id, session_id,
-                                                SSL_SESSION_ID_SIZE) == 0)
-                {
-                    ssl->session_index = i;
-                    memcpy(ssl->dc->master_secret, 
-                            ssl_sessions[i]->master_secret, SSL_SECRET_SIZE);
-                    SET_SSL_FLAG(SSL_SESSION_RESUME);
-                    SSL_CTX_UNLOCK(ssl->ssl_ctx->mutex);
-                    return ssl_sessions[i];  /* a session was found */
-                }
-            }
+            memcpy(session, &bucket[i], sizeof(SSL_SESSION));
+            ret = SSL_OK;
+            break;
         }
     }
 
-    /* If we've got here, no matching session was found - so create one */
-    for (i = 0; i < max_sessions; i++)
+    SSL_CTX_UNLOCK(ssl_ctx->mutex);
+    return ret;
+}
+
+/**
+ * Put a session in the cache. It takes the place of an empty or expired
+ * entry in its bucket, or else of the oldest one.
+ */
+void ssl_session_store(SSL_CTX *ssl_ctx, const SSL_SESSION *session)
+{
+    time_t tm = time(NULL);
+    SSL_SESSION *bucket, *slot;
+    int i;
+
+    if (ssl_ctx->num_sessions == 0)
+        return;
+
+    SSL_CTX_LOCK(ssl_ctx->mutex);
+    bucket = session_bucket(ssl_ctx, session->session_id);
+    slot = bucket;
+
+    for (i = 0; i < SSL_SESSION_WAYS; i++)
     {
-        if (ssl_sessions[i] == NULL)
+        if (bucket[i].conn_time == 0 || 
+                tm > bucket[i].conn_time + SSL_EXPIRY_TIME ||
+                memcmp(bucket[i].session_id, session->session_id,
+                                            SSL_SESSION_ID_SIZE) == 0)
         {
-            /* perfect, this will do */
-            ssl_sessions[i] = (SSL_SESSION *)calloc(1, sizeof(SSL_SESSION));
-            ssl_sessions[i]->conn_time = tm;
-            ssl->session_index = i;
-            SSL_CTX_UNLOCK(ssl->ssl_ctx->mutex);
-            return ssl_sessions[i]; /* return the session object */
-        }
-        else if (ssl_sessions[i]->conn_time <= oldest_sess_time)
-        {
-            /* find the oldest session */
-            oldest_sess_time = ssl_sessions[i]->conn_time;
-            oldest_sess = ssl_sessions[i];
-            ssl->session_index = i;
+            slot = &bucket[i];
+            break;
         }
+
+        if (bucket[i].conn_time < slot->conn_time)
+            slot = &bucket[i];
     }
 
-    /* ok, we've used up all of our sessions. So blow the oldest session away */
-    oldest_sess->conn_time = tm;
-    memset(oldest_sess->session_id, 0, sizeof(SSL_SESSION_ID_SIZE));
-    memset(oldest_sess->master_secret, 0, sizeof(SSL_SECRET_SIZE));
-    SSL_CTX_UNLOCK(ssl->ssl_ctx->mutex);
-    return oldest_sess;
+    memcpy(slot, session, sizeof(SSL_SESSION));
+    SSL_CTX_UNLOCK(ssl_ctx->mutex);
 }
 
 /**
- * Free an existing session.
+ * This ssl object doesn't want its session anymore.
+ */
+void kill_ssl_session(SSL *ssl)
+{
+    SSL_CTX *ssl_ctx = ssl->ssl_ctx;
+    SSL_SESSION *bucket;
+    int i;
+
+    if (ssl_ctx->num_sessions == 0 || ssl->sess_id_size == 0)
+        return;
+
+    SSL_CTX_LOCK(ssl_ctx->mutex);
+    bucket = session_bucket(ssl_ctx, ssl->session_id);
+
+    for (i = 0; i < SSL_SESSION_WAYS; i++)
+    {
+        if (memcmp(bucket[i].session_id, ssl->session_id,
+                                        SSL_SESSION_ID_SIZE) == 0)
+            memset(&bucket[i], 0, sizeof(SSL_SESSION));
+    }
+
+    SSL_CTX_UNLOCK(ssl_ctx->mutex);
+}
+
+/*
+ * The newest ticket key seals tickets and the older ones still open them.
+ * A new key comes in often enough that any ticket young enough to use
+ * still has its key around.
  */
-static void session_free(SSL_SESSION *ssl_sessions[], int sess_index)
+#define SSL_TICKET_ROTATE   (SSL_EXPIRY_TIME/(SSL_TICKET_KEYS-1))
+
+static SSL_TICKET_KEY *ticket_key(SSL_CTX *ssl_ctx, time_t tm)
 {
-    if (ssl_sessions[sess_index])
+    SSL_TICKET_KEY *keys = ssl_ctx->ticket_keys;
+    uint8_t key[16];
+
+    if (keys[0].created == 0 || tm >= keys[0].created + SSL_TICKET_ROTATE)
     {
-        free(ssl_sessions[sess_index]);
-        ssl_sessions[sess_index] = NULL;
+        memmove(&keys[1], &keys[0], (SSL_TICKET_KEYS-1)*sizeof(SSL_TICKET_KEY));
+        get_random(SSL_TICKET_NAME_SIZE, keys[0].name);
+        get_random(sizeof(key), key);
+        GCM_set_key(&keys[0].gcm_ctx, key, AES_MODE_128);
+        keys[0].created = tm;
+        memset(key, 0, sizeof(key));
     }
+
+    return &keys[0];
 }
 
 /**
- * This ssl object doesn't want this session anymore.
+ * Seal a session into an RFC 5077 ticket of SSL_TICKET_SIZE bytes: the key
+ * name, a GCM nonce, then the version, cipher, master secret and start time
+ * encrypted and tagged with that key.
  */
-void kill_ssl_session(SSL_SESSION **ssl_sessions, SSL *ssl)
+int ssl_ticket_seal(SSL_CTX *ssl_ctx, const SSL_SESSION *session,
+        uint8_t *ticket)
 {
-    SSL_CTX_LOCK(ssl->ssl_ctx->mutex);
+    uint8_t state[SSL_TICKET_STATE_SIZE];
+    uint8_t *iv = &ticket[SSL_TICKET_NAME_SIZE];
+    uint8_t *enc = &iv[GCM_IV_SIZE];
+    uint64_t conn_time = session->conn_time;
+    SSL_TICKET_KEY *key;
+    int i;
+
+    state[0] = session->version;
+    state[1] = session->cipher >> 8;
+    state[2] = session->cipher & 0xff;
+    memcpy(&state[3], session->master_secret, SSL_SECRET_SIZE);
+
+    for (i = 0; i < 8; i++)
+        state[3+SSL_SECRET_SIZE+i] = conn_time >> (56 - 8*i);
+
+    SSL_CTX_LOCK(ssl_ctx->mutex);
+    key = ticket_key(ssl_ctx, time(NULL));
+    memcpy(ticket, key->name, SSL_TICKET_NAME_SIZE);
+    get_random(GCM_IV_SIZE, iv);
+    GCM_encrypt(&key->gcm_ctx, iv, ticket, SSL_TICKET_NAME_SIZE, 
+            state, enc, SSL_TICKET_STATE_SIZE, &enc[SSL_TICKET_STATE_SIZE]);
+    SSL_CTX_UNLOCK(ssl_ctx->mutex);
 
-    if (ssl->ssl_ctx->num_sessions)
+    memset(state, 0, sizeof(state));
+    return SSL_TICKET_SIZE;
+}
+
+/**
+ * Open a ticket from ssl_ticket_seal() into session. Returns SSL_OK, or 1 if
+ * it was sealed with an older key and the client should get a new one, or
+ * SSL_NOT_OK if it's not ours, has been tampered with, or is too old.
+ */
+int ssl_ticket_open(SSL_CTX *ssl_ctx, const uint8_t *ticket, int len,
+        SSL_SESSION *session)
+{
+    uint8_t state[SSL_TICKET_STATE_SIZE];
+    const uint8_t *iv = &ticket[SSL_TICKET_NAME_SIZE];
+    const uint8_t *enc = &iv[GCM_IV_SIZE];
+    time_t tm = time(NULL);
+    uint64_t conn_time = 0;
+    int i, ret = SSL_NOT_OK;
+
+    if (len != SSL_TICKET_SIZE)
+        return SSL_NOT_OK;
+
+    SSL_CTX_LOCK(ssl_ctx->mutex);
+
+    for (i = 0; i < SSL_TICKET_KEYS; i++)
     {
-        session_free(ssl_sessions, ssl->session_index);
-        ssl->session = NULL;
+        SSL_TICKET_KEY *key = &ssl_ctx->ticket_keys[i];
+
+        if (key->created && 
+                memcmp(key->name, ticket, SSL_TICKET_NAME_SIZE) == 0)
+        {
+            if (GCM_decrypt(&key->gcm_ctx, iv, ticket, SSL_TICKET_NAME_SIZE,
+                    enc, state, SSL_TICKET_STATE_SIZE, 
+                    &enc[SSL_TICKET_STATE_SIZE]) == 0)
+            {
+                ret = (i == 0 && tm < key->created + SSL_TICKET_ROTATE) ? 
+                                                                SSL_OK : 1;
+            }
+
+            break;
+        }
     }
 
-    SSL_CTX_UNLOCK(ssl->ssl_ctx->mutex);
+    SSL_CTX_UNLOCK(ssl_ctx->mutex);
+
+    if (ret == SSL_NOT_OK)
+        return SSL_NOT_OK;
+
+    for (i = 0; i < 8; i++)
+        conn_time = (conn_time << 8) | state[3+SSL_SECRET_SIZE+i];
+
+    if ((time_t)conn_time > tm || tm > (time_t)conn_time + SSL_EXPIRY_TIME)
+        ret = SSL_NOT_OK;
+    else
+    {
+        memset(session, 0, sizeof(SSL_SESSION));
+        session->conn_time = conn_time;
+        session->version = state[0];
+        session->cipher = (state[1] << 8) + state[2];
+        memcpy(session->master_secret, &state[3], SSL_SECRET_SIZE);
+    }
+
+    memset(state, 0, sizeof(state));
+    return ret;
 }
 #endif /* CONFIG_SSL_SKELETON_MODE */
 
@@ -1680,7 +2643,7 @@ EXP_FUNC uint8_t STDCALL ssl_get_session_id_size(const SSL *ssl)
 /*
  * Return the cipher id (in the SSL form).
  */
-EXP_FUNC uint8_t STDCALL ssl_get_cipher_id(const SSL *ssl)
+EXP_FUNC uint16_t STDCALL ssl_get_cipher_id(const SSL *ssl)
 {
     return ssl->cipher;
 }
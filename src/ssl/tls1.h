@@ -51,6 +51,42 @@
 #define SSL_CLIENT_READ             2
 #define SSL_CLIENT_WRITE            3
 #define SSL_HS_HDR_SIZE             4
+#define SSL_GCM_EXPLICIT_SIZE       8
+#define SSL_RSA_SPARES              16
+
+/* minor versions of 3.x, TLS 1.0 through TLS 1.2 */
+#define SSL_PROTOCOL_MIN_VERSION    0x01
+#define SSL_PROTOCOL_VERSION_1_1    0x02
+#define SSL_PROTOCOL_VERSION_1_2    0x03
+#define SSL_PROTOCOL_MAX_VERSION    SSL_PROTOCOL_VERSION_1_2
+
+/* the hello extensions and values ECDHE needs */
+#define SSL_EXT_SUPPORTED_GROUPS    0x000a
+#define SSL_EXT_SIG_ALGS            0x000d
+#define SSL_GROUP_X25519            0x001d
+#define SSL_CURVE_TYPE_NAMED        3
+#define SIG_HASH_SHA1               2
+#define SIG_HASH_SHA256             4
+#define SIG_ALG_RSA                 1
+
+/* RFC 6066 server name indication */
+#define SSL_EXT_SERVER_NAME         0x0000
+#define SSL_SERVER_NAME_HOST        0
+#define SSL_MAX_HOST_NAME           255
+
+/* RFC 5077 session tickets */
+#define SSL_EXT_SESSION_TICKET      0x0023
+#define SSL_TICKET_KEYS             4
+#define SSL_TICKET_NAME_SIZE        16
+#define SSL_TICKET_STATE_SIZE       (1+2+SSL_SECRET_SIZE+8)
+#define SSL_TICKET_SIZE             (SSL_TICKET_NAME_SIZE+GCM_IV_SIZE+\
+                                        SSL_TICKET_STATE_SIZE+GCM_TAG_SIZE)
+
+/* The session expiry time */
+#define SSL_EXPIRY_TIME             (CONFIG_SSL_EXPIRY_TIME*3600)
+
+/* the session cache is split into buckets of this many entries */
+#define SSL_SESSION_WAYS            4
 
 /* the flags we use while establishing a connection */
 #define SSL_NEED_RECORD             0x0001
@@ -59,6 +95,7 @@
 #define SSL_SESSION_RESUME          0x0008
 #define SSL_IS_CLIENT               0x0010
 #define SSL_HAS_CERT_REQ            0x0020
+#define SSL_TX_SENDING              0x0040
 
 /* some macros to muck around with flag bits */
 #define SET_SSL_FLAG(A)             (ssl->flag |= A)
@@ -68,12 +105,21 @@
 #define MAX_KEY_BYTE_SIZE           512     /* for a 4096 bit key */
 #define RT_MAX_PLAIN_LENGTH         16384
 #define RT_EXTRA                    1024
-#define BM_RECORD_OFFSET            5
+#define BM_RECORD_OFFSET            (SSL_RECORD_SIZE+AES_BLOCKSIZE)
+                                    /* room for an explicit IV too */
+
+/* 
+ * Buffered writes start with records that fit one TCP segment, so the first
+ * bytes can be decrypted as soon as they land, and double up to the full
+ * size from there.  A connection that goes quiet starts small again.
+ */
+#define SSL_RAMP_RECORD_SIZE        1360
+#define SSL_RAMP_IDLE_TIME          1       /* seconds */
 
 #ifdef CONFIG_SSL_SKELETON_MODE
 #define NUM_PROTOCOLS               1
 #else
-#define NUM_PROTOCOLS               4
+#define NUM_PROTOCOLS               10
 #endif
 
 #define PARANOIA_CHECK(A, B)        if (A < B) { \
@@ -94,6 +140,7 @@ enum
     HS_HELLO_REQUEST,
     HS_CLIENT_HELLO,
     HS_SERVER_HELLO,
+    HS_NEW_SESSION_TICKET = 4,
     HS_CERTIFICATE = 11,
     HS_SERVER_KEY_XCHG,
     HS_CERT_REQ,
@@ -105,7 +152,7 @@ enum
 
 typedef struct 
 {
-    uint8_t cipher;
+    uint16_t cipher;
     uint8_t key_size;
     uint8_t iv_size;
     uint8_t key_block_size;
@@ -114,8 +161,18 @@ typedef struct
     hmac_func hmac;
     crypt_func encrypt;
     crypt_func decrypt;
+    uint8_t prf_size;           /* the TLS 1.2 PRF hash, SHA256 or SHA384 */
+    uint8_t aead;               /* GCM: explicit nonce and tag, no MAC */
+    uint8_t ecdhe;              /* X25519 key exchange signed with RSA */
 } cipher_info_t;
 
+typedef struct
+{
+    GCM_CTX gcm;
+    uint8_t key[32];            /* kept for handing over to the kernel */
+    uint8_t salt[4];            /* the implicit part of the nonce */
+} SSL_GCM_CTX;
+
 struct _SSLObjLoader 
 {
     uint8_t *buf;
@@ -126,11 +183,20 @@ typedef struct _SSLObjLoader SSLObjLoader;
 
 typedef struct 
 {
-    time_t conn_time;
+    time_t conn_time;               /* 0 for an empty cache entry */
+    uint16_t cipher;                /* a resumption has to use the same */
+    uint8_t version;
     uint8_t session_id[SSL_SESSION_ID_SIZE];
     uint8_t master_secret[SSL_SECRET_SIZE];
 } SSL_SESSION;
 
+typedef struct
+{
+    time_t created;
+    uint8_t name[SSL_TICKET_NAME_SIZE];
+    GCM_CTX gcm_ctx;
+} SSL_TICKET_KEY;
+
 typedef struct
 {
     uint8_t *buf;
@@ -141,6 +207,15 @@ typedef struct
 {
     MD5_CTX md5_ctx;
     SHA1_CTX sha1_ctx;
+    SHA256_CTX sha256_ctx;
+    SHA384_CTX sha384_ctx;
+    uint8_t client_version[2];  /* from the hello, for the premaster */
+    uint8_t ecdhe_ok;           /* the client can do X25519 */
+    uint8_t sig_hash;           /* TLS 1.2 hash for RSA signatures */
+    uint8_t ticket_ok;          /* the client takes session tickets */
+    uint8_t new_ticket;         /* so send it one */
+    time_t session_time;        /* when a resumed session started */
+    uint8_t ecdh_key[X25519_SIZE];  /* our ephemeral private key */
     uint8_t final_finish_mac[SSL_FINISHED_HASH_SIZE];
     uint8_t *key_block;
     uint8_t master_secret[SSL_SECRET_SIZE];
@@ -155,7 +230,8 @@ struct _SSL
     uint16_t need_bytes;
     uint16_t got_bytes;
     uint8_t record_type;
-    uint8_t cipher;
+    uint16_t cipher;
+    uint8_t version;            /* negotiated minor version */
     uint8_t sess_id_size;
     int16_t next_state;
     int16_t hs_status;
@@ -168,13 +244,16 @@ struct _SSL
     uint8_t *bm_data;
     uint16_t bm_index;
     uint16_t bm_read_index;
+    uint8_t *carry;                 /* app data that didn't fit the reader */
+    uint16_t carry_index;
+    uint16_t carry_len;
+    uint8_t *wbuf;                  /* app data waiting for a full record */
+    uint16_t wbuf_len;
+    uint16_t wrec_size;             /* how full a record gets before it goes */
+    time_t last_write;
     struct _SSL *next;                  /* doubly linked list */
     struct _SSL *prev;
     struct _SSL_CTX *ssl_ctx;           /* back reference to a clnt/svr ctx */
-#ifndef CONFIG_SSL_SKELETON_MODE
-    uint16_t session_index;
-    SSL_SESSION *session;
-#endif
 #ifdef CONFIG_SSL_CERT_VERIFICATION
     X509_CTX *x509_ctx;
 #endif
@@ -182,6 +261,8 @@ struct _SSL
     uint8_t session_id[SSL_SESSION_ID_SIZE]; 
     uint8_t client_mac[SHA1_SIZE];  /* for HMAC verification */
     uint8_t server_mac[SHA1_SIZE];  /* for HMAC verification */
+    HMAC_SHA1_KEY client_hmac;      /* client_mac with its pads hashed */
+    HMAC_SHA1_KEY server_hmac;      /* server_mac with its pads hashed */
     uint8_t read_sequence[8];       /* 64 bit sequence number */
     uint8_t write_sequence[8];      /* 64 bit sequence number */
     uint8_t hmac_header[SSL_RECORD_SIZE];    /* rx hmac */
@@ -189,6 +270,9 @@ struct _SSL
 
 typedef struct _SSL SSL;
 
+/* picks the context for the server_name a client asked for, or NULL */
+typedef struct _SSL_CTX *(*ssl_sni_cb)(const char *host_name, void *arg);
+
 struct _SSL_CTX
 {
     uint32_t options;
@@ -200,9 +284,14 @@ struct _SSL_CTX
     SSL *head;
     SSL *tail;
     SSL_CERT certs[CONFIG_SSL_MAX_CERTS];
+    RSA_CTX *rsa_spares[SSL_RSA_SPARES];    /* key copies for task threads */
+    int num_rsa_spares;
+    ssl_sni_cb sni_cb;
+    void *sni_arg;
 #ifndef CONFIG_SSL_SKELETON_MODE
-    uint16_t num_sessions;
-    SSL_SESSION **ssl_sessions;
+    int num_sessions;
+    SSL_SESSION *ssl_sessions;      /* num_sessions/SSL_SESSION_WAYS buckets */
+    SSL_TICKET_KEY ticket_keys[SSL_TICKET_KEYS];    /* newest first */
 #endif
 #ifdef CONFIG_SSL_CTX_MUTEXING
     SSL_CTX_MUTEX_TYPE mutex;
@@ -217,9 +306,15 @@ typedef struct _SSL_CTX SSL_CTX;
 /* backwards compatibility */
 typedef struct _SSL_CTX SSLCTX;
 
-extern const uint8_t ssl_prot_prefs[NUM_PROTOCOLS];
+extern const uint16_t ssl_prot_prefs[NUM_PROTOCOLS];
 
 SSL *ssl_new(SSL_CTX *ssl_ctx, int client_fd);
+const cipher_info_t *get_cipher_info(uint16_t cipher);
+int cipher_allowed(const SSL *ssl, uint16_t cipher);
+int ssl_rsa_private(SSL *ssl, const uint8_t *in_data, uint16_t in_len,
+        uint8_t *out_data, int is_signing);
+int fill_rsa_spares(SSL_CTX *ssl_ctx, int count);
+void free_rsa_spares(SSL_CTX *ssl_ctx);
 void disposable_new(SSL *ssl);
 void disposable_free(SSL *ssl);
 int send_packet(SSL *ssl, uint8_t protocol, 
@@ -231,10 +326,11 @@ int process_sslv23_client_hello(SSL *ssl);
 int send_alert(SSL *ssl, int error_code);
 int send_finished(SSL *ssl);
 int send_certificate(SSL *ssl);
-int basic_read(SSL *ssl, uint8_t **in_data);
+int basic_read(SSL *ssl, uint8_t **in_data, uint8_t *out, int out_len);
 int send_change_cipher_spec(SSL *ssl);
 void finished_digest(SSL *ssl, const char *label, uint8_t *digest);
-void generate_master_secret(SSL *ssl, const uint8_t *premaster_secret);
+void generate_master_secret(SSL *ssl, 
+        const uint8_t *premaster_secret, int premaster_size);
 void add_packet(SSL *ssl, const uint8_t *pkt, int len);
 int add_cert(SSL_CTX *ssl_ctx, const uint8_t *buf, int len);
 int add_private_key(SSL_CTX *ssl_ctx, SSLObjLoader *ssl_obj);
@@ -274,10 +370,15 @@ void DISPLAY_BYTES(SSL *ssl, const char *format,/* win32 has no variadic macros
 int process_certificate(SSL *ssl, X509_CTX **x509_ctx);
 #endif
 
-SSL_SESSION *ssl_session_update(int max_sessions, 
-        SSL_SESSION *ssl_sessions[], SSL *ssl,
-        const uint8_t *session_id);
-void kill_ssl_session(SSL_SESSION **ssl_sessions, SSL *ssl);
+int ssl_session_find(SSL_CTX *ssl_ctx, const uint8_t *session_id,
+        SSL_SESSION *session);
+void ssl_session_store(SSL_CTX *ssl_ctx, const SSL_SESSION *session);
+void kill_ssl_session(SSL *ssl);
+int ssl_ticket_seal(SSL_CTX *ssl_ctx, const SSL_SESSION *session,
+        uint8_t *ticket);
+int ssl_ticket_open(SSL_CTX *ssl_ctx, const uint8_t *ticket, int len,
+        SSL_SESSION *session);
+int send_session_ticket(SSL *ssl);
 
 
 #endif 
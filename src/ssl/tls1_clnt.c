@@ -150,7 +150,7 @@ int do_client_connect(SSL *ssl)
     /* sit in a loop until it all looks good */
     while (ssl->hs_status != SSL_OK)
     {
-        ret = basic_read(ssl, NULL);
+        ret = basic_read(ssl, NULL, NULL, 0);
         
         if (ret < SSL_OK)
         { 
@@ -160,7 +160,7 @@ int do_client_connect(SSL *ssl)
                 if (send_alert(ssl, ret))
                 {
                     /* something nasty happened, so get rid of it */
-                    kill_ssl_session(ssl->ssl_ctx->ssl_sessions, ssl);
+                    kill_ssl_session(ssl);
                 }
             }
 
@@ -180,7 +180,7 @@ static int send_client_hello(SSL *ssl)
     uint8_t *buf = ssl->bm_data;
     time_t tm = time(NULL);
     uint8_t *tm_ptr = &buf[6]; /* time will go here */
-    int i, offset;
+    int i, offset, cs_offset;
 
     buf[0] = HS_CLIENT_HELLO;
     buf[1] = 0;
@@ -212,16 +212,23 @@ static int send_client_hello(SSL *ssl)
         buf[offset++] = 0;
     }
 
-    buf[offset++] = 0;              /* number of ciphers */
-    buf[offset++] = NUM_PROTOCOLS*2;/* number of ciphers */
+    cs_offset = offset;
+    offset += 2;                    /* number of ciphers, filled in below */
 
-    /* put all our supported protocols in our request */
+    /* put all our supported protocols in our request, the client only 
+       speaks TLS 1.0 so the TLS 1.2 suites are left out */
     for (i = 0; i < NUM_PROTOCOLS; i++)
     {
-        buf[offset++] = 0;          /* cipher we are using */
-        buf[offset++] = ssl_prot_prefs[i];
+        if (!cipher_allowed(ssl, ssl_prot_prefs[i]))
+            continue;
+
+        buf[offset++] = ssl_prot_prefs[i] >> 8; /* cipher we are using */
+        buf[offset++] = ssl_prot_prefs[i] & 0xff;
     }
 
+    buf[cs_offset] = 0;             /* number of ciphers */
+    buf[cs_offset+1] = offset - cs_offset - 2;
+
     buf[offset++] = 1;              /* no compression */
     buf[offset++] = 0;
     buf[3] = offset - 4;            /* handshake size */
@@ -250,26 +257,32 @@ static int process_server_hello(SSL *ssl)
     offset = 6 + SSL_RANDOM_SIZE; /* skip of session id size */
     sess_id_size = buf[offset++];
 
-    if (num_sessions)
+    if (sess_id_size > SSL_SESSION_ID_SIZE)
+        return SSL_ERROR_INVALID_SESSION;
+
+    /* pad the rest with 0's */
+    memset(ssl->session_id, 0, SSL_SESSION_ID_SIZE);
+    memcpy(ssl->session_id, &buf[offset], sess_id_size);
+    ssl->sess_id_size = sess_id_size;
+    offset += sess_id_size;
+
+    /* the server knows this session too, so resume it */
+    if (num_sessions && sess_id_size)
     {
-        ssl->session = ssl_session_update(num_sessions,
-                ssl->ssl_ctx->ssl_sessions, ssl, &buf[offset]);
-        memcpy(ssl->session->session_id, &buf[offset], sess_id_size);
+        SSL_SESSION session;
 
-        /* pad the rest with 0's */
-        if (sess_id_size < SSL_SESSION_ID_SIZE)
+        if (ssl_session_find(ssl->ssl_ctx, ssl->session_id, 
+                                                &session) == SSL_OK)
         {
-            memset(&ssl->session->session_id[sess_id_size], 0,
-                SSL_SESSION_ID_SIZE-sess_id_size);
+            memcpy(ssl->dc->master_secret, 
+                    session.master_secret, SSL_SECRET_SIZE);
+            SET_SSL_FLAG(SSL_SESSION_RESUME);
         }
     }
 
-    memcpy(ssl->session_id, &buf[offset], sess_id_size);
-    ssl->sess_id_size = sess_id_size;
-    offset += sess_id_size;
-
     /* get the real cipher we are using */
-    ssl->cipher = buf[++offset];
+    ssl->cipher = (buf[offset] << 8) + buf[offset+1];
+    offset++;
     ssl->next_state = IS_SET_SSL_FLAG(SSL_SESSION_RESUME) ? 
                                         HS_FINISHED : HS_CERTIFICATE;
 
@@ -318,7 +331,7 @@ static int send_client_key_xchg(SSL *ssl)
     buf[4] = enc_secret_size >> 8;
     buf[5] = enc_secret_size & 0xff;
 
-    generate_master_secret(ssl, premaster_secret);
+    generate_master_secret(ssl, premaster_secret, SSL_SECRET_SIZE);
     return send_packet(ssl, PT_HANDSHAKE_PROTOCOL, NULL, enc_secret_size+6);
 }
 
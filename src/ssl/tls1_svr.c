@@ -41,6 +41,8 @@ static int send_server_hello_sequence(SSL *ssl);
 static int send_server_hello(SSL *ssl);
 static int send_server_hello_done(SSL *ssl);
 static int process_client_key_xchg(SSL *ssl);
+static int send_server_key_xchg(SSL *ssl);
+static int process_ecdhe_key_xchg(SSL *ssl);
 #ifdef CONFIG_SSL_CERT_VERIFICATION
 static int send_certificate_request(SSL *ssl);
 static int process_cert_verify(SSL *ssl);
@@ -111,19 +113,210 @@ int do_svr_handshake(SSL *ssl, int handshake_type, uint8_t *buf, int hs_len)
     return ret;
 }
 
+/*
+ * Pick the highest version we both speak. Client certificate verify is 
+ * still the TLS 1.0/1.1 MD5+SHA1 style here, so client auth stops at 1.1.
+ */
+static void set_version(SSL *ssl, uint8_t major, uint8_t minor)
+{
+    uint8_t max = SSL_PROTOCOL_MAX_VERSION;
+
+    if (ssl->ssl_ctx->options & SSL_CLIENT_AUTHENTICATION)
+        max = SSL_PROTOCOL_VERSION_1_1;
+
+    ssl->version = (major > 0x03 || minor > max) ? max : minor;
+}
+
+/*
+ * Move the connection over to the context for the host name the client
+ * asked for. Nothing has touched the old context's key, sessions or 
+ * tickets yet, so the whole handshake happens with the new one.
+ */
+static void use_server_name(SSL *ssl, const uint8_t *ext, int ext_len)
+{
+    SSL_CTX *old_ctx = ssl->ssl_ctx, *new_ctx;
+    char host_name[SSL_MAX_HOST_NAME+1];
+    int name_len;
+
+    /* a list, but only one host_name is allowed, RFC 6066 3 */
+    if (old_ctx->sni_cb == NULL || ext_len < 5 || 
+            2 + ((ext[0] << 8) + ext[1]) > ext_len ||
+            ext[2] != SSL_SERVER_NAME_HOST)
+        return;
+
+    name_len = (ext[3] << 8) + ext[4];
+
+    if (name_len == 0 || name_len > SSL_MAX_HOST_NAME || 
+            5 + name_len > ext_len || memchr(&ext[5], 0, name_len))
+        return;
+
+    memcpy(host_name, &ext[5], name_len);
+    host_name[name_len] = 0;
+    new_ctx = old_ctx->sni_cb(host_name, old_ctx->sni_arg);
+
+    if (new_ctx == NULL || new_ctx == old_ctx)
+        return;
+
+    SSL_CTX_LOCK(old_ctx->mutex);
+
+    if (ssl->prev)
+        ssl->prev->next = ssl->next;
+    else
+        old_ctx->head = ssl->next;
+
+    if (ssl->next)
+        ssl->next->prev = ssl->prev;
+    else
+        old_ctx->tail = ssl->prev;
+
+    SSL_CTX_UNLOCK(old_ctx->mutex);
+    SSL_CTX_LOCK(new_ctx->mutex);
+
+    ssl->next = NULL;
+    ssl->prev = new_ctx->tail;
+
+    if (new_ctx->tail)
+        new_ctx->tail->next = ssl;
+    else
+        new_ctx->head = ssl;
+
+    new_ctx->tail = ssl;
+    SSL_CTX_UNLOCK(new_ctx->mutex);
+    ssl->ssl_ctx = new_ctx;
+}
+
+/*
+ * Look through the hello extensions for what ECDHE needs: X25519 in the
+ * supported groups, and at TLS 1.2 a hash we can sign RSA with. Anything
+ * that doesn't add up just leaves ECDHE off. A session ticket extension,
+ * even an empty one, means the client takes tickets. A server name can
+ * switch the context, so it's dealt with before anything looks at it.
+ */
+static void process_hello_extensions(SSL *ssl, const uint8_t *buf, int len,
+        const uint8_t **ticket, int *ticket_len)
+{
+    int x25519 = 0, sig_algs = 0, sha1 = 0, sha256 = 0;
+    int offset = 2, end;
+
+    if (len < 2 || (end = 2 + ((buf[0] << 8) + buf[1])) > len)
+        return;
+
+    while (offset + 4 <= end)
+    {
+        int type = (buf[offset] << 8) + buf[offset+1];
+        int ext_len = (buf[offset+2] << 8) + buf[offset+3];
+        const uint8_t *ext = &buf[offset+4];
+        int i;
+
+        offset += 4 + ext_len;
+
+        if (offset > end)
+            return;
+
+        if (type == SSL_EXT_SERVER_NAME)
+        {
+            use_server_name(ssl, ext, ext_len);
+        }
+        else if (type == SSL_EXT_SUPPORTED_GROUPS && ext_len >= 2)
+        {
+            for (i = 2; i + 1 < ext_len; i += 2)
+            {
+                if (((ext[i] << 8) + ext[i+1]) == SSL_GROUP_X25519)
+                    x25519 = 1;
+            }
+        }
+        else if (type == SSL_EXT_SIG_ALGS && ext_len >= 2)
+        {
+            sig_algs = 1;
+
+            for (i = 2; i + 1 < ext_len; i += 2)
+            {
+                if (ext[i+1] != SIG_ALG_RSA)
+                    continue;
+
+                if (ext[i] == SIG_HASH_SHA256)
+                    sha256 = 1;
+                else if (ext[i] == SIG_HASH_SHA1)
+                    sha1 = 1;
+            }
+        }
+#ifndef CONFIG_SSL_SKELETON_MODE
+        else if (type == SSL_EXT_SESSION_TICKET && 
+                !(ssl->ssl_ctx->options & 
+                    (SSL_NO_SESSION_TICKETS|SSL_CLIENT_AUTHENTICATION)))
+        {
+            ssl->dc->ticket_ok = 1;
+            *ticket = ext;
+            *ticket_len = ext_len;
+        }
+#endif
+    }
+
+    /* no signature_algorithms means SHA1, RFC 5246 7.4.1.4.1 */
+    ssl->dc->sig_hash = sha256 ? SIG_HASH_SHA256 : 
+                (sha1 || !sig_algs) ? SIG_HASH_SHA1 : 0;
+    ssl->dc->ecdhe_ok = x25519 && ssl->ssl_ctx->rsa_ctx &&
+        (ssl->version < SSL_PROTOCOL_VERSION_1_2 || ssl->dc->sig_hash);
+}
+
+#ifndef CONFIG_SSL_SKELETON_MODE
+/*
+ * Pick up the session from the client's ticket, or else from the session 
+ * cache, as long as it was for this version and the client still offers 
+ * its cipher. Anything else gets a full handshake.
+ */
+static void resume_session(SSL *ssl, const uint8_t *session_id, int id_len,
+        const uint8_t *cs, int cs_len, const uint8_t *ticket, int ticket_len)
+{
+    SSL_SESSION session;
+    int i, ret = SSL_NOT_OK;
+
+    /* the client sends some id with a ticket, so it sees it come back */
+    if (ticket_len && id_len)
+        ret = ssl_ticket_open(ssl->ssl_ctx, ticket, ticket_len, &session);
+
+    if (ret == SSL_NOT_OK && id_len == SSL_SESSION_ID_SIZE &&
+            ssl_session_find(ssl->ssl_ctx, session_id, &session) == SSL_OK)
+        ret = SSL_OK;
+
+    if (ret == SSL_NOT_OK || session.version != ssl->version)
+        return;
+
+    for (i = 0; i + 1 < cs_len; i += 2)
+    {
+        if (((cs[i] << 8) + cs[i+1]) == session.cipher)
+            break;
+    }
+
+    if (i + 1 >= cs_len || get_cipher_info(session.cipher) == NULL)
+        return;
+
+    ssl->cipher = session.cipher;
+    memcpy(ssl->dc->master_secret, session.master_secret, SSL_SECRET_SIZE);
+    memset(ssl->session_id, 0, SSL_SESSION_ID_SIZE);
+    memcpy(ssl->session_id, session_id, id_len);
+    ssl->sess_id_size = id_len;
+    ssl->dc->session_time = session.conn_time;
+    ssl->dc->new_ticket = ret == 1;     /* sealed with an old key */
+    memset(session.master_secret, 0, SSL_SECRET_SIZE);
+    SET_SSL_FLAG(SSL_SESSION_RESUME);
+}
+#endif
+
 /* 
  * Process a client hello message.
  */
 static int process_client_hello(SSL *ssl)
 {
     uint8_t *buf = ssl->bm_data;
-    uint8_t *record_buf = ssl->hmac_header;
     int pkt_size = ssl->bm_index;
-    int i, j, cs_len, id_len, offset = 6 + SSL_RANDOM_SIZE;
-    int version = (record_buf[1] << 4) + record_buf[2];
+    int i, j, cs_len, id_len, comp_len, offset = 6 + SSL_RANDOM_SIZE;
+    int version = (buf[4] << 4) + buf[5];
+    const uint8_t *session_id, *ticket = NULL;
+    int ticket_len = 0;
     int ret = SSL_OK;
     
-    /* should be v3.1 (TLSv1) or better - we'll send in v3.1 mode anyway */
+    /* should be v3.1 (TLSv1) or better */
     if (version < 0x31) 
     {
         ret = SSL_ERROR_INVALID_VERSION;
@@ -131,6 +324,8 @@ static int process_client_hello(SSL *ssl)
         goto error;
     }
 
+    memcpy(ssl->dc->client_version, &buf[4], 2);
+    set_version(ssl, buf[4], buf[5]);
     memcpy(ssl->dc->client_random, &buf[6], SSL_RANDOM_SIZE);
 
     /* process the session id */
@@ -140,23 +335,30 @@ static int process_client_hello(SSL *ssl)
         return SSL_ERROR_INVALID_SESSION;
     }
 
-#ifndef CONFIG_SSL_SKELETON_MODE
-    ssl->session = ssl_session_update(ssl->ssl_ctx->num_sessions,
-            ssl->ssl_ctx->ssl_sessions, ssl, id_len ? &buf[offset] : NULL);
-#endif
-
+    session_id = &buf[offset];
     offset += id_len;
     cs_len = (buf[offset]<<8) + buf[offset+1];
-    offset += 3;        /* add 1 due to all cipher suites being 8 bit */
+    offset += 2;
 
-    PARANOIA_CHECK(pkt_size, offset);
+    PARANOIA_CHECK(pkt_size, offset+cs_len+1);
+
+    /* the extensions come after the compression methods */
+    comp_len = buf[offset+cs_len];
+    if (offset+cs_len+1+comp_len < pkt_size)
+    {
+        process_hello_extensions(ssl, &buf[offset+cs_len+1+comp_len], 
+                pkt_size-(offset+cs_len+1+comp_len), &ticket, &ticket_len);
+    }
 
     /* work out what cipher suite we are going to use */
     for (j = 0; j < NUM_PROTOCOLS; j++)
     {
-        for (i = 0; i < cs_len; i += 2)
+        for (i = 0; i + 1 < cs_len; i += 2)
         {
-            if (ssl_prot_prefs[j] == buf[offset+i])   /* got a match? */
+            uint16_t cipher = (buf[offset+i] << 8) + buf[offset+i+1];
+
+            if (ssl_prot_prefs[j] == cipher &&      /* got a match? */
+                    cipher_allowed(ssl, cipher))
             {
                 ssl->cipher = ssl_prot_prefs[j];
                 goto do_state;
@@ -166,8 +368,17 @@ static int process_client_hello(SSL *ssl)
 
     /* ouch! protocol is not supported */
     ret = SSL_ERROR_NO_CIPHER;
+    goto error;
 
 do_state:
+#ifndef CONFIG_SSL_SKELETON_MODE
+    resume_session(ssl, session_id, id_len, &buf[offset], cs_len, 
+            ticket, ticket_len);
+
+    if (!IS_SET_SSL_FLAG(SSL_SESSION_RESUME))
+        ssl->dc->new_ticket = ssl->dc->ticket_ok;
+#endif
+
 error:
     return ret;
 }
@@ -182,9 +393,13 @@ int process_sslv23_client_hello(SSL *ssl)
     int bytes_needed = ((buf[0] & 0x7f) << 8) + buf[1];
     int version = (buf[3] << 4) + buf[4];
     int ret = SSL_OK;
+    int read_len;
+
+    memcpy(ssl->dc->client_version, &buf[3], 2);
+    set_version(ssl, buf[3], buf[4]);
 
     /* we have already read 3 extra bytes so far */
-    int read_len = SOCKET_READ(ssl->client_fd, buf, bytes_needed-3);
+    read_len = SOCKET_READ(ssl->client_fd, buf, bytes_needed-3);
     int cs_len = buf[1];
     int id_len = buf[3];
     int ch_len = buf[5];
@@ -212,7 +427,10 @@ int process_sslv23_client_hello(SSL *ssl)
     {
         for (i = 0; i < cs_len; i += 3)
         {
-            if (ssl_prot_prefs[j] == buf[offset+i])
+            uint16_t cipher = (buf[offset+i-1] << 8) + buf[offset+i];
+
+            if (buf[offset+i-2] == 0 && ssl_prot_prefs[j] == cipher &&
+                    cipher_allowed(ssl, cipher))
             {
                 ssl->cipher = ssl_prot_prefs[j];
                 goto server_hello;
@@ -227,10 +445,6 @@ int process_sslv23_client_hello(SSL *ssl)
 server_hello:
     /* get the session id */
     offset += cs_len - 2;   /* we've gone 2 bytes past the end */
-#ifndef CONFIG_SSL_SKELETON_MODE
-    ssl->session = ssl_session_update(ssl->ssl_ctx->num_sessions,
-            ssl->ssl_ctx->ssl_sessions, ssl, id_len ? &buf[offset] : NULL);
-#endif
 
     /* get the client random data */
     offset += id_len;
@@ -263,7 +477,9 @@ static int send_server_hello_sequence(SSL *ssl)
         /* resume handshake? */
         if (IS_SET_SSL_FLAG(SSL_SESSION_RESUME))
         {
-            if ((ret = send_change_cipher_spec(ssl)) == SSL_OK)
+            if ((!ssl->dc->new_ticket || 
+                        (ret = send_session_ticket(ssl)) == SSL_OK) &&
+                    (ret = send_change_cipher_spec(ssl)) == SSL_OK)
             {
                 ret = send_finished(ssl);
                 ssl->next_state = HS_FINISHED;
@@ -271,7 +487,9 @@ static int send_server_hello_sequence(SSL *ssl)
         }
         else 
 #endif
-        if ((ret = send_certificate(ssl)) == SSL_OK)
+        if ((ret = send_certificate(ssl)) == SSL_OK &&
+                (!get_cipher_info(ssl->cipher)->ecdhe || 
+                 (ret = send_server_key_xchg(ssl)) == SSL_OK))
         {
 #ifdef CONFIG_SSL_CERT_VERIFICATION
             /* ask the client for its certificate */
@@ -308,7 +526,7 @@ static int send_server_hello(SSL *ssl)
     buf[2] = 0;
     /* byte 3 is calculated later */
     buf[4] = 0x03;
-    buf[5] = 0x01;
+    buf[5] = ssl->version;
 
     /* server random value */
     get_random(SSL_RANDOM_SIZE, &buf[6]);
@@ -318,12 +536,10 @@ static int send_server_hello(SSL *ssl)
 #ifndef CONFIG_SSL_SKELETON_MODE
     if (IS_SET_SSL_FLAG(SSL_SESSION_RESUME))
     {
-        /* retrieve id from session cache */
-        buf[offset++] = SSL_SESSION_ID_SIZE;
-        memcpy(&buf[offset], ssl->session->session_id, SSL_SESSION_ID_SIZE);
-        memcpy(ssl->session_id, ssl->session->session_id, SSL_SESSION_ID_SIZE);
-        ssl->sess_id_size = SSL_SESSION_ID_SIZE;
-        offset += SSL_SESSION_ID_SIZE;
+        /* send back the id the client resumed with */
+        buf[offset++] = ssl->sess_id_size;
+        memcpy(&buf[offset], ssl->session_id, ssl->sess_id_size);
+        offset += ssl->sess_id_size;
     }
     else    /* generate our own session id */
 #endif
@@ -333,27 +549,70 @@ static int send_server_hello(SSL *ssl)
         get_random(SSL_SESSION_ID_SIZE, &buf[offset]);
         memcpy(ssl->session_id, &buf[offset], SSL_SESSION_ID_SIZE);
         ssl->sess_id_size = SSL_SESSION_ID_SIZE;
-
-        /* store id in session cache */
-        if (ssl->ssl_ctx->num_sessions)
-        {
-            memcpy(ssl->session->session_id, 
-                    ssl->session_id, SSL_SESSION_ID_SIZE);
-        }
-
         offset += SSL_SESSION_ID_SIZE;
 #else
         buf[offset++] = 0;  /* don't bother with session id in skelton mode */
 #endif
     }
 
-    buf[offset++] = 0;      /* cipher we are using */
-    buf[offset++] = ssl->cipher;
+    buf[offset++] = ssl->cipher >> 8;   /* cipher we are using */
+    buf[offset++] = ssl->cipher & 0xff;
     buf[offset++] = 0;      /* no compression */
+
+#ifndef CONFIG_SSL_SKELETON_MODE
+    if (ssl->dc->new_ticket)    /* an empty session ticket extension */
+    {
+        buf[offset++] = 0;
+        buf[offset++] = 4;
+        buf[offset++] = SSL_EXT_SESSION_TICKET >> 8;
+        buf[offset++] = SSL_EXT_SESSION_TICKET & 0xff;
+        buf[offset++] = 0;
+        buf[offset++] = 0;
+    }
+#endif
+
     buf[3] = offset - 4;    /* handshake size */
     return send_packet(ssl, PT_HANDSHAKE_PROTOCOL, NULL, offset);
 }
 
+#ifndef CONFIG_SSL_SKELETON_MODE
+/*
+ * Give the client its session as a ticket, RFC 5077 3.3. A renewed ticket
+ * keeps the time the session started, so renewing doesn't keep the same 
+ * master secret going forever.
+ */
+int send_session_ticket(SSL *ssl)
+{
+    uint8_t *buf = ssl->bm_data;
+    uint32_t lifetime = SSL_EXPIRY_TIME;
+    SSL_SESSION session;
+    int offset = 4, ticket_len;
+
+    memset(&session, 0, sizeof(session));
+    session.conn_time = ssl->dc->session_time ? 
+                                ssl->dc->session_time : time(NULL);
+    session.cipher = ssl->cipher;
+    session.version = ssl->version;
+    memcpy(session.master_secret, ssl->dc->master_secret, SSL_SECRET_SIZE);
+
+    buf[offset++] = lifetime >> 24;
+    buf[offset++] = (lifetime >> 16) & 0xff;
+    buf[offset++] = (lifetime >> 8) & 0xff;
+    buf[offset++] = lifetime & 0xff;
+    ticket_len = ssl_ticket_seal(ssl->ssl_ctx, &session, &buf[offset+2]);
+    buf[offset++] = ticket_len >> 8;
+    buf[offset++] = ticket_len & 0xff;
+    offset += ticket_len;
+    memset(session.master_secret, 0, SSL_SECRET_SIZE);
+
+    buf[0] = HS_NEW_SESSION_TICKET;
+    buf[1] = 0;
+    buf[2] = (offset - 4) >> 8;
+    buf[3] = (offset - 4) & 0xff;
+    return send_packet(ssl, PT_HANDSHAKE_PROTOCOL, NULL, offset);
+}
+#endif
+
 /*
  * Send the server hello done message.
  */
@@ -363,6 +622,137 @@ static int send_server_hello_done(SSL *ssl)
                             g_hello_done, sizeof(g_hello_done));
 }
 
+/*
+ * Send our ephemeral X25519 key, signed with the RSA key of our certificate
+ * over both randoms so it can't be replayed. TLS 1.2 signs a DigestInfo of 
+ * the hash the client asked for, earlier versions MD5 and SHA1 side by side.
+ */
+static int send_server_key_xchg(SSL *ssl)
+{
+    static const uint8_t sha1_info[] = { 0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 
+        0x2b, 0x0e, 0x03, 0x02, 0x1a, 0x05, 0x00, 0x04, 0x14 };
+    static const uint8_t sha256_info[] = { 0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 
+        0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 
+        0x04, 0x20 };
+    uint8_t *buf = ssl->bm_data;
+    uint8_t dgst[sizeof(sha256_info)+SHA256_SIZE];
+    int offset = 4, params_len, dgst_len, sig_len;
+
+    get_random(X25519_SIZE, ssl->dc->ecdh_key);
+
+    buf[offset++] = SSL_CURVE_TYPE_NAMED;
+    buf[offset++] = SSL_GROUP_X25519 >> 8;
+    buf[offset++] = SSL_GROUP_X25519 & 0xff;
+    buf[offset++] = X25519_SIZE;
+    X25519_public(&buf[offset], ssl->dc->ecdh_key);
+    offset += X25519_SIZE;
+    params_len = offset - 4;
+
+    if (ssl->version >= SSL_PROTOCOL_VERSION_1_2)
+    {
+        const uint8_t *info = ssl->dc->sig_hash == SIG_HASH_SHA256 ? 
+                                        sha256_info : sha1_info;
+        int info_len = ssl->dc->sig_hash == SIG_HASH_SHA256 ? 
+                            sizeof(sha256_info) : sizeof(sha1_info);
+
+        memcpy(dgst, info, info_len);
+        dgst_len = info_len;
+
+        if (ssl->dc->sig_hash == SIG_HASH_SHA256)
+        {
+            SHA256_CTX sha256_ctx;
+            SHA256_Init(&sha256_ctx);
+            SHA256_Update(&sha256_ctx, ssl->dc->client_random, SSL_RANDOM_SIZE);
+            SHA256_Update(&sha256_ctx, ssl->dc->server_random, SSL_RANDOM_SIZE);
+            SHA256_Update(&sha256_ctx, &buf[4], params_len);
+            SHA256_Final(&dgst[dgst_len], &sha256_ctx);
+            dgst_len += SHA256_SIZE;
+        }
+        else
+        {
+            SHA1_CTX sha1_ctx;
+            SHA1_Init(&sha1_ctx);
+            SHA1_Update(&sha1_ctx, ssl->dc->client_random, SSL_RANDOM_SIZE);
+            SHA1_Update(&sha1_ctx, ssl->dc->server_random, SSL_RANDOM_SIZE);
+            SHA1_Update(&sha1_ctx, &buf[4], params_len);
+            SHA1_Final(&dgst[dgst_len], &sha1_ctx);
+            dgst_len += SHA1_SIZE;
+        }
+
+        buf[offset++] = ssl->dc->sig_hash;
+        buf[offset++] = SIG_ALG_RSA;
+    }
+    else
+    {
+        MD5_CTX md5_ctx;
+        SHA1_CTX sha1_ctx;
+
+        MD5_Init(&md5_ctx);
+        MD5_Update(&md5_ctx, ssl->dc->client_random, SSL_RANDOM_SIZE);
+        MD5_Update(&md5_ctx, ssl->dc->server_random, SSL_RANDOM_SIZE);
+        MD5_Update(&md5_ctx, &buf[4], params_len);
+        MD5_Final(dgst, &md5_ctx);
+
+        SHA1_Init(&sha1_ctx);
+        SHA1_Update(&sha1_ctx, ssl->dc->client_random, SSL_RANDOM_SIZE);
+        SHA1_Update(&sha1_ctx, ssl->dc->server_random, SSL_RANDOM_SIZE);
+        SHA1_Update(&sha1_ctx, &buf[4], params_len);
+        SHA1_Final(&dgst[MD5_SIZE], &sha1_ctx);
+        dgst_len = MD5_SIZE + SHA1_SIZE;
+    }
+
+    sig_len = ssl_rsa_private(ssl, dgst, dgst_len, &buf[offset+2], 1);
+
+    if (sig_len < 0)
+        return SSL_ERROR_NO_CERT_DEFINED;
+
+    buf[offset++] = sig_len >> 8;
+    buf[offset++] = sig_len & 0xff;
+    offset += sig_len;
+
+    buf[0] = HS_SERVER_KEY_XCHG;
+    buf[1] = 0;
+    buf[2] = (offset - 4) >> 8;
+    buf[3] = (offset - 4) & 0xff;
+    return send_packet(ssl, PT_HANDSHAKE_PROTOCOL, NULL, offset);
+}
+
+/*
+ * The client's half of an X25519 exchange. The shared secret is the 
+ * premaster secret as it is, 32 bytes rather than 48.
+ */
+static int process_ecdhe_key_xchg(SSL *ssl)
+{
+    uint8_t *buf = &ssl->bm_data[ssl->dc->bm_proc_index];
+    int pkt_size = ssl->bm_index;
+    uint8_t premaster_secret[X25519_SIZE];
+    int ret = SSL_OK;
+
+    PARANOIA_CHECK(pkt_size, ssl->dc->bm_proc_index+5+X25519_SIZE);
+
+    /* a point of small order gives an all zero secret, so refuse it */
+    if (buf[4] != X25519_SIZE || 
+            X25519(premaster_secret, ssl->dc->ecdh_key, &buf[5]) < 0)
+    {
+        ret = SSL_ERROR_INVALID_HANDSHAKE;
+        goto error;
+    }
+
+    generate_master_secret(ssl, premaster_secret, X25519_SIZE);
+    memset(premaster_secret, 0, sizeof(premaster_secret));
+    memset(ssl->dc->ecdh_key, 0, X25519_SIZE);
+
+#ifdef CONFIG_SSL_CERT_VERIFICATION
+    ssl->next_state = IS_SET_SSL_FLAG(SSL_CLIENT_AUTHENTICATION) ?  
+                                            HS_CERT_VERIFY : HS_FINISHED;
+#else
+    ssl->next_state = HS_FINISHED; 
+#endif
+    ssl->dc->bm_proc_index += 5+X25519_SIZE;
+error:
+    return ret;
+}
+
 /*
  * Pull apart a client key exchange message. Decrypt the pre-master key (using
  * our RSA private key) and then work out the master key. Initialise the
@@ -377,6 +767,9 @@ static int process_client_key_xchg(SSL *ssl)
     RSA_CTX *rsa_ctx = ssl->ssl_ctx->rsa_ctx;
     int offset = 4;
     int ret = SSL_OK;
+
+    if (get_cipher_info(ssl->cipher)->ecdhe)
+        return process_ecdhe_key_xchg(ssl);
     
     if (rsa_ctx == NULL)
     {
@@ -390,14 +783,12 @@ static int process_client_key_xchg(SSL *ssl)
 
     PARANOIA_CHECK(pkt_size, rsa_ctx->num_octets+offset);
 
-    /* rsa_ctx->bi_ctx is not thread-safe */
-    SSL_CTX_LOCK(ssl->ssl_ctx->mutex);
-    premaster_size = RSA_decrypt(rsa_ctx, &buf[offset], premaster_secret, 1);
-    SSL_CTX_UNLOCK(ssl->ssl_ctx->mutex);
+    premaster_size = ssl_rsa_private(ssl, &buf[offset], 0, premaster_secret, 0);
 
     if (premaster_size != SSL_SECRET_SIZE || 
-            premaster_secret[0] != 0x03 ||  /* check version is 3.1 (TLS) */
-            premaster_secret[1] != 0x01)
+            /* check the version is the one the client offered */
+            premaster_secret[0] != ssl->dc->client_version[0] ||
+            premaster_secret[1] != ssl->dc->client_version[1])
     {
         /* guard against a Bleichenbacher attack */
         memset(premaster_secret, 0, SSL_SECRET_SIZE);
@@ -408,7 +799,7 @@ static int process_client_key_xchg(SSL *ssl)
     print_blob("pre-master", premaster_secret, SSL_SECRET_SIZE);
 #endif
 
-    generate_master_secret(ssl, premaster_secret);
+    generate_master_secret(ssl, premaster_secret, SSL_SECRET_SIZE);
 
 #ifdef CONFIG_SSL_CERT_VERIFICATION
     ssl->next_state = IS_SET_SSL_FLAG(SSL_CLIENT_AUTHENTICATION) ?  
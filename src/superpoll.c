@@ -79,6 +79,7 @@ static inline int SuperPoll_arm_idle_fd(SuperPoll *sp);
 static inline int SuperPoll_setup_idle(SuperPoll *sp, int total_open_fd);
 static inline int SuperPoll_add_idle(SuperPoll *sp, void *data, int fd, int rw);
 static inline int SuperPoll_add_idle_hits(SuperPoll *sp, PollResult *result);
+static inline int SuperPoll_del_idle(SuperPoll *sp, void *data);
 
 
 SuperPoll *SuperPoll_create()
@@ -177,6 +178,25 @@ void SuperPoll_compact_down(SuperPoll *sp, int i)
     sp->hot_data[i] = sp->hot_data[sp->nfd_hot];
 }
 
+/**
+ * Takes whoever is waiting with data out of the poll, wherever it went.
+ * The fd has to still be open, as closing it is what the idle set would
+ * otherwise have to notice.  Returns 0 if it was found, -1 if not.
+ */
+int SuperPoll_del(SuperPoll *sp, void *data)
+{
+    int i = 0;
+
+    for(i = 0; i < sp->nfd_hot; i++) {
+        if(sp->hot_data[i] == data) {
+            SuperPoll_compact_down(sp, i);
+            return 0;
+        }
+    }
+
+    return SuperPoll_del_idle(sp, data);
+}
+
 static inline void SuperPoll_add_hit(PollResult *result, zmq_pollitem_t *p, void *data)
 {
     result->hits[result->nhits].ev = *p;
@@ -312,6 +332,11 @@ static inline int SuperPoll_add_idle_hits(SuperPoll *sp, PollResult *result)
     return 0;
 }
 
+static inline int SuperPoll_del_idle(SuperPoll *sp, void *data)
+{
+    return -1;
+}
+
 #else
 
 #include <sys/epoll.h>
@@ -456,4 +481,31 @@ error:
     return -1;
 }
 
+static inline int SuperPoll_del_idle(SuperPoll *sp, void *data)
+{
+    lnode_t *node = NULL;
+    IdleData *id = NULL;
+    int rc = 0;
+
+    for(node = list_first(sp->idle_active); node != NULL;
+            node = list_next(sp->idle_active, node))
+    {
+        id = lnode_get(node);
+
+        if(id->data == data) {
+            // the slot goes back either way, a closed fd already left epoll
+            rc = epoll_ctl(sp->idle_fd, EPOLL_CTL_DEL, id->fd, NULL);
+            if(rc == -1 && errno != ENOENT && errno != EBADF) {
+                log_err("Failed to remove fd %d from epoll.", id->fd);
+            }
+
+            node = list_delete(sp->idle_active, node);
+            list_append(sp->idle_free, node);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
 #endif  // HAS_EPOLL
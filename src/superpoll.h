@@ -88,6 +88,8 @@ int SuperPoll_add(SuperPoll *sp, void *data, void *socket, int fd, int rw, int h
 
 void SuperPoll_compact_down(SuperPoll *sp, int i);
 
+int SuperPoll_del(SuperPoll *sp, void *data);
+
 int SuperPoll_poll(SuperPoll *sp, PollResult *result, int ms);
 
 int SuperPoll_get_max_fd();
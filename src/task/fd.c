@@ -116,17 +116,17 @@ error:
 }
 
 
+/*
+ * Takes a task out of the poll, hot or idle, so the caller can taskready
+ * it.  Returns -1 if it wasn't waiting on an fd.
+ */
 int tasknuke(int id)
 {
     int i = 0;
-    Task *target = NULL;
 
-    for(i = 0; i < SuperPoll_active_hot(POLL); i++) {
-        target = (Task *)SuperPoll_data(POLL, i);
-
-        if(target && target->id == id) {
-            SuperPoll_compact_down(POLL, i);
-            return 0;
+    for(i = 0; i < nalltask; i++) {
+        if(alltask[i]->id == id) {
+            return SuperPoll_del(POLL, alltask[i]);
         }
     }
 
@@ -160,6 +160,7 @@ taskdelay(uint ms)
     uvlong when, now;
     Task *t;
    
+    taskwillswitch();
     startfdtask();
 
     now = nsec();
@@ -196,6 +197,7 @@ taskdelay(uint ms)
 int
 _wait(void *socket, int fd, int rw)
 {
+    taskwillswitch();
     startfdtask();
     int max = 0;
     int hot_add = SuperPoll_active_hot(POLL) < SuperPoll_max_hot(POLL);
@@ -339,6 +341,44 @@ fdsend(int fd, void *buf, int n)
     return tot;
 }
 
+/* Like fdsend but gathers the iovecs into as few send calls as possible.
+ * The iovec array is consumed as it goes so callers can't reuse it. */
+int
+fdsendv(int fd, struct iovec *iov, int iovcnt)
+{
+    int m, tot;
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    for(tot = 0; msg.msg_iovlen > 0; tot += m){
+        while((m=sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EAGAIN) {
+            if(fdwait(fd, 'w') == -1) {
+                return -1;
+            }
+        }
+
+        if(m < 0) return m;
+        if(m == 0) break;
+
+        /* skip what went out and trim the partially sent one */
+        int left = m;
+        while(msg.msg_iovlen > 0 && left >= (int)msg.msg_iov->iov_len) {
+            left -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+
+        if(msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + left;
+            msg.msg_iov->iov_len -= left;
+        }
+    }
+    return tot;
+}
+
 int
 fdnoblock(int fd)
 {
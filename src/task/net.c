@@ -1,48 +1,98 @@
 #include "taskimpl.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/poll.h>
+#include <stdio.h>
+#include <pthread.h>
+
+/*
+ * Addresses that start with a / are unix socket paths.
+ */
+static int
+netunixaddr(char *path, struct sockaddr_un *su)
+{
+    if(path == nil || path[0] != '/')
+        return 0;
+    if(strlen(path) >= sizeof su->sun_path)
+        return -1;
+
+    memset(su, 0, sizeof *su);
+    su->sun_family = AF_UNIX;
+    strcpy(su->sun_path, path);
+    return 1;
+}
 
 int
 netannounce(int istcp, char *server, int port)
 {
-    int fd = 0, n = 0, proto = 0;
-    struct sockaddr_in sa;
-    socklen_t sn;
-    uint32_t ip;
+    int fd = 0, n = 0, proto = 0, isunix = 0;
+    struct sockaddr_un su;
+    struct addrinfo hints, *ai = nil;
+    struct sockaddr *sa;
+    socklen_t sn, salen;
+    struct stat st;
+    char service[16];
 
     taskstate("netannounce");
     proto = istcp ? SOCK_STREAM : SOCK_DGRAM;
-    memset(&sa, 0, sizeof sa);
-    sa.sin_family = AF_INET;
-    if(server != nil && strcmp(server, "*") != 0){
-        if(netlookup(server, &ip) < 0){
+
+    if((isunix = netunixaddr(server, &su)) < 0){
+        taskstate("unix socket path too long");
+        return -1;
+    }
+
+    if(isunix){
+        /* a socket left over from the last run would make bind fail */
+        if(stat(server, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(server);
+        sa = (struct sockaddr*)&su;
+        salen = sizeof su;
+    }else{
+        memset(&hints, 0, sizeof hints);
+        hints.ai_socktype = proto;
+        hints.ai_flags = AI_PASSIVE;
+        if(server == nil || strcmp(server, "*") == 0){
+            server = nil;
+            hints.ai_family = AF_INET;
+        }else{
+            hints.ai_family = AF_UNSPEC;
+        }
+        snprintf(service, sizeof service, "%d", port);
+
+        if(getaddrinfo(server, service, &hints, &ai) != 0){
             taskstate("netlookup failed");
             return -1;
         }
-        memmove(&sa.sin_addr, &ip, 4);
+        sa = ai->ai_addr;
+        salen = ai->ai_addrlen;
     }
-    sa.sin_port = htons(port);
-    if((fd = socket(AF_INET, proto, 0)) < 0){
+
+    if((fd = socket(sa->sa_family, proto, 0)) < 0){
         taskstate("socket failed");
+        if(ai) freeaddrinfo(ai);
         return -1;
     }
     
     /* set reuse flag for tcp */
     sn = sizeof(n);
-    if(istcp && getsockopt(fd, SOL_SOCKET, SO_TYPE, (void*)&n, &sn) >= 0){
+    if(istcp && !isunix && getsockopt(fd, SOL_SOCKET, SO_TYPE, (void*)&n, &sn) >= 0){
         n = 1;
         setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char*)&n, sizeof n);
     }
 
-    if(bind(fd, (struct sockaddr*)&sa, sizeof sa) < 0){
+    if(bind(fd, sa, salen) < 0){
         taskstate("bind failed");
         fdclose(fd);
+        if(ai) freeaddrinfo(ai);
         return -1;
     }
+    if(ai) freeaddrinfo(ai);
 
     if(proto == SOCK_STREAM)
         listen(fd, 16);
@@ -52,12 +102,18 @@ netannounce(int istcp, char *server, int port)
     return fd;
 }
 
+/*
+ * server needs room for INET6_ADDRSTRLEN chars.  IPv4 clients on an
+ * IPv6 socket show up as plain IPv4 addresses and unix socket ones as
+ * "unix:".
+ */
 int
 netaccept(int fd, char *server, int *port)
 {
     int cfd, one;
-    struct sockaddr_in sa;
-    uchar *ip;
+    struct sockaddr_storage ss;
+    struct sockaddr_in *sin = (struct sockaddr_in*)&ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&ss;
     socklen_t len;
     
     if(fdwait(fd, 'r') == -1) {
@@ -65,20 +121,36 @@ netaccept(int fd, char *server, int *port)
     }
 
     taskstate("netaccept");
-    len = sizeof sa;
-    if((cfd = accept(fd, (void*)&sa, &len)) < 0){
+    len = sizeof ss;
+    if((cfd = accept(fd, (void*)&ss, &len)) < 0){
         taskstate("accept failed");
         return -1;
     }
-    if(server){
-        ip = (uchar*)&sa.sin_addr;
-        snprint(server, 16, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
-    }
+
+    if(server)
+        strcpy(server, "unix:");
     if(port)
-        *port = ntohs(sa.sin_port);
+        *port = 0;
+
+    if(ss.ss_family == AF_INET){
+        if(server)
+            inet_ntop(AF_INET, &sin->sin_addr, server, INET6_ADDRSTRLEN);
+        if(port)
+            *port = ntohs(sin->sin_port);
+    }else if(ss.ss_family == AF_INET6){
+        if(server && IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr))
+            inet_ntop(AF_INET, &sin6->sin6_addr.s6_addr[12], server, INET6_ADDRSTRLEN);
+        else if(server)
+            inet_ntop(AF_INET6, &sin6->sin6_addr, server, INET6_ADDRSTRLEN);
+        if(port)
+            *port = ntohs(sin6->sin6_port);
+    }
+
     fdnoblock(cfd);
-    one = 1;
-    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, (char*)&one, sizeof one);
+    if(ss.ss_family != AF_UNIX){
+        one = 1;
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, (char*)&one, sizeof one);
+    }
     taskstate("netaccept succeeded");
     return cfd;
 }
@@ -152,47 +224,116 @@ netlookup(char *name, uint32_t *ip)
     return -1;
 }
 
+/*
+ * getaddrinfo blocks, so it runs on a thread of its own and pokes a
+ * pipe when it's done.  Only the task waiting on that pipe stops.
+ */
+typedef struct Lookup Lookup;
+struct Lookup
+{
+    char *name;
+    char service[16];
+    struct addrinfo hints;
+    struct addrinfo *res;
+    int err;
+    int fds[2];
+};
+
+static void*
+lookupthread(void *v)
+{
+    Lookup *l = v;
+
+    l->err = getaddrinfo(l->name, l->service, &l->hints, &l->res);
+    while(write(l->fds[1], "x", 1) < 0 && errno == EINTR)
+        ;
+    return nil;
+}
+
 int
-netdial(int istcp, char *server, int port)
+netgetaddrinfo(int istcp, char *name, int port, struct addrinfo **res)
 {
-    int proto, fd, n;
-    uint32_t ip;
-    struct sockaddr_in sa;
-    socklen_t sn;
-    
-    if(netlookup(server, &ip) < 0)
+    Lookup l;
+    pthread_t thread;
+    char c;
+
+    memset(&l, 0, sizeof l);
+    l.name = name;
+    snprintf(l.service, sizeof l.service, "%d", port);
+    l.hints.ai_family = AF_UNSPEC;
+    l.hints.ai_socktype = istcp ? SOCK_STREAM : SOCK_DGRAM;
+
+    /* numeric addresses don't need the resolver at all */
+    l.hints.ai_flags = AI_NUMERICHOST;
+    if(getaddrinfo(name, l.service, &l.hints, res) == 0)
+        return 0;
+    l.hints.ai_flags = 0;
+
+    taskstate("netgetaddrinfo");
+    if(pipe(l.fds) < 0)
+        return -1;
+    fdnoblock(l.fds[0]);
+
+    if(pthread_create(&thread, nil, lookupthread, &l) != 0){
+        close(l.fds[0]);
+        close(l.fds[1]);
         return -1;
+    }
+
+    /* if we can't wait just block, the thread still has our Lookup */
+    while(read(l.fds[0], &c, 1) < 0 && errno == EAGAIN)
+        if(fdwait(l.fds[0], 'r') == -1)
+            break;
+
+    pthread_join(thread, nil);
+    close(l.fds[0]);
+    close(l.fds[1]);
+
+    if(l.err != 0){
+        taskstate("netgetaddrinfo failed: %s", gai_strerror(l.err));
+        return -1;
+    }
+
+    taskstate("netgetaddrinfo succeeded");
+    *res = l.res;
+    return 0;
+}
+
+static int
+netconnect(struct addrinfo *ai)
+{
+    int fd, n;
+    struct sockaddr_storage ss;
+    socklen_t sn;
 
     taskstate("netdial");
-    proto = istcp ? SOCK_STREAM : SOCK_DGRAM;
-    if((fd = socket(AF_INET, proto, 0)) < 0){
+    if((fd = socket(ai->ai_family, ai->ai_socktype, 0)) < 0){
         taskstate("socket failed");
         return -1;
     }
     fdnoblock(fd);
 
     /* for udp */
-    if(!istcp){
+    if(ai->ai_socktype == SOCK_DGRAM){
         n = 1;
         setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &n, sizeof n);
     }
     
     /* start connecting */
-    memset(&sa, 0, sizeof sa);
-    memmove(&sa.sin_addr, &ip, 4);
-    sa.sin_family = AF_INET;
-    sa.sin_port = htons(port);
-    if(connect(fd, (struct sockaddr*)&sa, sizeof sa) < 0 && errno != EINPROGRESS){
+    if(connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS){
         taskstate("connect failed");
         fdclose(fd);
         return -1;
     }
 
     /* wait for finish */    
-    if(fdwait(fd, 'w') == -1) return -1;
+    if(fdwait(fd, 'w') == -1){
+        fdclose(fd);
+        return -1;
+    }
 
-    sn = sizeof sa;
-    if(getpeername(fd, (struct sockaddr*)&sa, &sn) >= 0){
+    sn = sizeof ss;
+    if(getpeername(fd, (struct sockaddr*)&ss, &sn) >= 0){
         taskstate("connect succeeded");
         return fd;
     }
@@ -208,3 +349,44 @@ netdial(int istcp, char *server, int port)
     return -1;
 }
 
+/*
+ * Tries each address in turn until one of them connects.
+ */
+int
+netdialai(struct addrinfo *ai)
+{
+    int fd;
+
+    for(fd = -1; ai != nil && fd < 0; ai = ai->ai_next)
+        fd = netconnect(ai);
+
+    return fd;
+}
+
+int
+netdial(int istcp, char *server, int port)
+{
+    int fd, isunix;
+    struct addrinfo *ai, uai;
+    struct sockaddr_un su;
+
+    if((isunix = netunixaddr(server, &su)) < 0)
+        return -1;
+
+    if(isunix){
+        memset(&uai, 0, sizeof uai);
+        uai.ai_family = AF_UNIX;
+        uai.ai_socktype = istcp ? SOCK_STREAM : SOCK_DGRAM;
+        uai.ai_addr = (struct sockaddr*)&su;
+        uai.ai_addrlen = sizeof su;
+        return netconnect(&uai);
+    }
+    
+    if(netgetaddrinfo(istcp, server, port, &ai) < 0)
+        return -1;
+
+    fd = netdialai(ai);
+    freeaddrinfo(ai);
+    return fd;
+}
+
@@ -6,6 +6,7 @@
 void
 tasksleep(Rendez *r)
 {
+    taskwillswitch();
     addtask(&r->waiting, taskrunning);
     if(r->l)
         qunlock(r->l);
@@ -135,6 +135,36 @@ taskswitch(void)
     contextswitch(&taskrunning->context, &taskschedcontext);
 }
 
+/*
+ * Runs fn(arg) each time the current task is about to block, whether it
+ * yields, sleeps or waits on a descriptor or a worker thread.  The hook 
+ * mustn't change itself.
+ */
+void
+taskonswitch(void (*fn)(void*), void *arg)
+{
+    taskrunning->switchfn = fn;
+    taskrunning->switcharg = arg;
+}
+
+/*
+ * Called before a task queues itself anywhere, as the hook may block too.
+ */
+void
+taskwillswitch(void)
+{
+    Task *t;
+    void (*fn)(void*);
+
+    t = taskrunning;
+    fn = t->switchfn;
+    if(fn){
+        t->switchfn = nil;
+        fn(t->switcharg);
+        t->switchfn = fn;
+    }
+}
+
 void
 taskready(Task *t)
 {
@@ -147,6 +177,7 @@ taskyield(void)
 {
     int n;
     
+    taskwillswitch();
     n = tasknswitch;
     taskready(taskrunning);
     taskstate("yield");
@@ -11,6 +11,7 @@ extern "C" {
 #include <unistd.h>
 #include <inttypes.h>
 #include <zmq.h>
+#include <sys/uio.h>
 
 #include "bstring.h"
 
@@ -44,6 +45,7 @@ int taskwaiting();
 void taskready(Task *t);
 Task *taskself();
 void taskswitch();
+void taskonswitch(void (*fn)(void*), void *arg);  /* nil fn to clear */
 
 struct Tasklist  /* used internally */
 {
@@ -111,6 +113,7 @@ int fdread1(int, void*, int);  /* always uses fdwait */
 int fdrecv1(int, void*, int);  /* always uses fdwait */
 int fdwrite(int, void*, int);
 int fdsend(int, void*, int);
+int fdsendv(int, struct iovec*, int);
 int fdrecv(int, void*, int);
 int fdwait(int, int);
 int fdnoblock(int);
@@ -119,6 +122,11 @@ int fdnoblock(int);
 
 void    fdtask(void*);
 
+/*
+ * Worker threads, for CPU bound work that shouldn't stall the scheduler.
+ */
+int taskthread(void (*fn)(void*), void *arg);  /* only blocks the task */
+
 /*
  * 0mq Integration.
  */
@@ -144,6 +152,10 @@ int    netaccept(int, char*, int*);
 int    netdial(int, char*, int);
 int    netlookup(char*, uint32_t*);  /* blocks entire program! */
 
+struct addrinfo;
+int    netgetaddrinfo(int, char*, int, struct addrinfo**);  /* only blocks the task */
+int    netdialai(struct addrinfo*);
+
 #ifdef __cplusplus
 }
 #endif
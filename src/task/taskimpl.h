@@ -44,6 +44,7 @@
 
 #define nil ((void*)0)
 #define nelem(x) (sizeof(x)/sizeof((x)[0]))
+#define USED(x) if(x){}else{}
 
 #define ulong task_ulong
 #define uint task_uint
@@ -162,13 +163,18 @@ struct Task
     void    (*startfn)(void*);
     void    *startarg;
     void    *udata;
+    void    (*switchfn)(void*);
+    void    *switcharg;
 };
 
 void    taskready(Task*);
 void    taskswitch(void);
+void    taskwillswitch(void);
 
 void    addtask(Tasklist*, Task*);
 void    deltask(Tasklist*, Task*);
 
 extern Task    *taskrunning;
 extern int    taskcount;
+extern Task    **alltask;
+extern int    nalltask;
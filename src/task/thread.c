@@ -0,0 +1,182 @@
+#include "taskimpl.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <dbg.h>
+#include "setting.h"
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+/*
+ * A small pool of threads for work that would otherwise stall the
+ * scheduler, like RSA private key operations.  The calling task parks
+ * until its Work is done, and the workers wake it up through one
+ * eventfd that worktask waits on in the poller like any other fd.
+ */
+typedef struct Work Work;
+struct Work
+{
+    void (*fn)(void*);
+    void *arg;
+    Task *task;
+    Work *next;
+};
+
+static int WORKERS = -1;
+static int workfd[2] = {-1, -1};
+static pthread_mutex_t worklock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workcond = PTHREAD_COND_INITIALIZER;
+static Work *pending;
+static Work *pendingtail;
+static Work *done;
+
+static void
+workpoke(void)
+{
+    uint64_t one = 1;
+
+    while(write(workfd[1], &one, sizeof one) < 0 && errno == EINTR)
+        ;
+}
+
+static void
+workdrain(void)
+{
+    char buf[64];
+
+    while(read(workfd[0], buf, sizeof buf) > 0)
+        ;
+}
+
+static void*
+workthread(void *v)
+{
+    Work *w;
+
+    USED(v);
+    for(;;){
+        pthread_mutex_lock(&worklock);
+        while(pending == nil)
+            pthread_cond_wait(&workcond, &worklock);
+        w = pending;
+        pending = w->next;
+        if(pending == nil)
+            pendingtail = nil;
+        pthread_mutex_unlock(&worklock);
+
+        w->fn(w->arg);
+
+        pthread_mutex_lock(&worklock);
+        w->next = done;
+        done = w;
+        pthread_mutex_unlock(&worklock);
+        workpoke();
+    }
+    return nil;
+}
+
+static void
+worktask(void *v)
+{
+    Work *w, *next;
+
+    USED(v);
+    tasksystem();
+    taskname("worktask");
+
+    for(;;){
+        fdwait(workfd[0], 'r');
+        workdrain();
+
+        pthread_mutex_lock(&worklock);
+        w = done;
+        done = nil;
+        pthread_mutex_unlock(&worklock);
+
+        for(; w != nil; w = next){
+            next = w->next;
+            taskready(w->task);
+        }
+    }
+}
+
+/*
+ * worktask goes first so that any thread that does start has someone to
+ * wake.  If the eventfd or every thread fails, WORKERS stays 0 and
+ * taskthread just runs the work inline.
+ */
+static int
+workstart(void)
+{
+    int i = 0;
+    pthread_t thread;
+    int n = Setting_get_int("limits.task_threads", 2);
+
+    log_info("MAX limits.task_threads=%d", n);
+    WORKERS = 0;
+    if(n <= 0)
+        return 0;
+
+#ifdef __linux__
+    workfd[0] = workfd[1] = eventfd(0, EFD_NONBLOCK);
+    check(workfd[0] >= 0, "Failed to make the eventfd for task threads.");
+#else
+    check(pipe(workfd) == 0, "Failed to make the pipe for task threads.");
+    fdnoblock(workfd[0]);
+    fdnoblock(workfd[1]);
+#endif
+
+    taskcreate(worktask, nil, 32 * 1024);
+
+    for(i = 0; i < n; i++){
+        check(pthread_create(&thread, nil, workthread, nil) == 0,
+                "Failed to start task thread %d, running with %d.", i, WORKERS);
+        pthread_detach(thread);
+        WORKERS++;
+    }
+
+    return 0;
+
+error:
+    if(WORKERS == 0)
+        log_warn("No task threads, running their work inline instead.");
+    return -1;
+}
+
+/*
+ * Runs fn(arg) on a worker thread and only blocks the calling task until
+ * it returns.  With limits.task_threads=0 it just calls fn.
+ */
+int
+taskthread(void (*fn)(void*), void *arg)
+{
+    Work w;
+
+    if(WORKERS == -1)
+        workstart();
+
+    if(WORKERS == 0){
+        fn(arg);
+        return 0;
+    }
+
+    taskwillswitch();
+    w.fn = fn;
+    w.arg = arg;
+    w.task = taskrunning;
+    w.next = nil;
+
+    pthread_mutex_lock(&worklock);
+    if(pendingtail)
+        pendingtail->next = &w;
+    else
+        pending = &w;
+    pendingtail = &w;
+    pthread_cond_signal(&workcond);
+    pthread_mutex_unlock(&worklock);
+
+    taskstate("taskthread");
+    taskswitch();
+    return 0;
+}
@@ -0,0 +1,467 @@
+/**
+ *
+ * Copyright (c) 2010, Zed A. Shaw and Mongrel2 Project Contributors.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ *     * Neither the name of the Mongrel2 Project, Zed A. Shaw, nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <write_queue.h>
+#include <register.h>
+#include <dbg.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "setting.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+int WRITE_QUEUE_STACK = 0;
+int WRITE_QUEUE_MAX = 0;
+int WRITE_QUEUE_DROP = 0;
+
+struct tagbstring WRITE_QUEUE_DEFAULT_POLICY = bsStatic("disconnect");
+
+static WriteQueue *QUEUES[MAX_REGISTERED_FDS];
+
+
+static inline int WriteQueue_valid(WriteQueue *q)
+{
+    // the fd could have been closed and handed to someone else by now
+    return !q->dead && QUEUES[q->fd] == q &&
+        Register_fd_exists(q->fd) && Register_id_for_fd(q->fd) == q->id;
+}
+
+/**
+ * A WriteBuffer is shared by every queue that still has some of it to
+ * send, so a broadcast is held in memory once no matter how many slow
+ * clients it's waiting on.  It owns either a bstring or the 0mq message
+ * the data points into.
+ */
+WriteBuffer *WriteBuffer_create(bstring data)
+{
+    check(data, "Can't make a WriteBuffer out of NULL.");
+
+    WriteBuffer *buf = calloc(sizeof(WriteBuffer), 1);
+    check_mem(buf);
+
+    buf->refcount = 1;
+    buf->data = data;
+
+    return buf;
+
+error:
+    bdestroy(data);
+    return NULL;
+}
+
+WriteBuffer *WriteBuffer_from_msg(zmq_msg_t *msg, size_t offset, size_t len)
+{
+    int rc = 0;
+    WriteBuffer *buf = calloc(sizeof(WriteBuffer), 1);
+    check_mem(buf);
+
+    buf->msg = calloc(sizeof(zmq_msg_t), 1);
+    check_mem(buf->msg);
+
+    rc = zmq_msg_init(buf->msg);
+    check(rc == 0, "Failed to initialize message.");
+
+    rc = zmq_msg_move(buf->msg, msg);
+    check(rc == 0, "Failed to take over 0mq message.");
+
+    check(offset + len <= zmq_msg_size(buf->msg), "Buffer is outside the 0mq message.");
+
+    blk2tbstr(buf->view, (char *)zmq_msg_data(buf->msg) + offset, len);
+    buf->data = &buf->view;
+    buf->refcount = 1;
+
+    return buf;
+
+error:
+    WriteBuffer_release(buf);
+    return NULL;
+}
+
+void WriteBuffer_release(WriteBuffer *buf)
+{
+    if(buf && --buf->refcount <= 0) {
+        if(buf->msg) {
+            zmq_msg_close(buf->msg);
+            free(buf->msg);
+        } else {
+            bdestroy(buf->data);
+        }
+
+        free(buf);
+    }
+}
+
+static inline void WriteChunk_destroy(WriteChunk *chunk)
+{
+    if(chunk) {
+        WriteBuffer_release(chunk->buf);
+        free(chunk);
+    }
+}
+
+static void WriteQueue_destroy(WriteQueue *q)
+{
+    lnode_t *n = NULL;
+
+    if(q) {
+        if(q->chunks) {
+            while(!list_isempty(q->chunks)) {
+                n = list_del_first(q->chunks);
+                WriteChunk_destroy(lnode_get(n));
+                lnode_destroy(n);
+            }
+
+            list_destroy(q->chunks);
+        }
+
+        if(QUEUES[q->fd] == q) QUEUES[q->fd] = NULL;
+        taskwakeupall(&q->drained);
+        free(q);
+    }
+}
+
+
+/**
+ * Swaps a chunk for the TLS records of what's left of it, sealed with the
+ * connection's keys at the last moment so that they follow whatever the
+ * connection itself has sent.  Returns 0 if the connection is partway
+ * through sending a record and this has to wait.
+ */
+static inline int WriteQueue_seal(WriteQueue *q, WriteChunk *chunk, SSL *ssl)
+{
+    int rc = 0;
+    int len = blength(chunk->buf->data) - chunk->offset;
+    WriteBuffer *buf = NULL;
+    bstring sealed = bfromcstralloc(ssl_seal_size(ssl, len) + 1, "");
+    check_mem(sealed);
+
+    rc = ssl_seal(ssl, (const uint8_t *)bdataofs(chunk->buf->data, chunk->offset),
+            len, (uint8_t *)bdata(sealed));
+    check(rc >= 0, "Failed to encrypt %d bytes for %d: %d", len, q->fd, rc);
+
+    if(rc == 0) {
+        bdestroy(sealed);
+        return 0;
+    }
+
+    sealed->slen = rc;
+    sealed->data[rc] = '\0';
+
+    // the WriteBuffer owns it now, even if it failed
+    buf = WriteBuffer_create(sealed);
+    sealed = NULL;
+    check_mem(buf);
+
+    WriteBuffer_release(chunk->buf);
+    chunk->buf = buf;
+    chunk->offset = 0;
+    chunk->sealed = 1;
+    q->queued += rc - len;
+
+    return rc;
+
+error:
+    bdestroy(sealed);
+    return -1;
+}
+
+static void WriteQueue_task(void *v)
+{
+    WriteQueue *q = (WriteQueue *)v;
+    lnode_t *n = NULL;
+    WriteChunk *chunk = NULL;
+    SSL *ssl = NULL;
+    int rc = 0;
+
+    taskname("WriteQueue");
+    q->writer = taskself();
+
+    while(WriteQueue_valid(q) && !list_isempty(q->chunks)) {
+        n = list_first(q->chunks);
+        chunk = lnode_get(n);
+        ssl = Register_ssl_for_fd(q->fd);
+
+        if(ssl && !chunk->sealed) {
+            rc = WriteQueue_seal(q, chunk, ssl);
+            check_debug(rc != -1, "Failed to encrypt queued data for %d.", q->fd);
+
+            if(rc == 0) {
+                // the connection is partway through a record and waiting on the
+                // socket itself, and the poller only takes one task per fd
+                taskdelay(10);
+                continue;
+            }
+        }
+
+        rc = send(q->fd, bdataofs(chunk->buf->data, chunk->offset),
+                blength(chunk->buf->data) - chunk->offset, MSG_NOSIGNAL);
+
+        if(rc < 0 && errno == EAGAIN) {
+            // validity is checked again once we come back from the wait
+            check_debug(fdwait(q->fd, 'w') != -1, "Failed waiting to write %d.", q->fd);
+            continue;
+        }
+
+        check_debug(rc > 0, "Failed to write queued data to %d.", q->fd);
+
+        chunk->offset += rc;
+        q->queued -= rc;
+
+        if(chunk->offset == blength(chunk->buf->data)) {
+            list_delete(q->chunks, n);
+            WriteChunk_destroy(chunk);
+            lnode_destroy(n);
+        }
+    }
+
+    if(WriteQueue_valid(q) && q->closing) {
+        Register_disconnect(q->fd);
+    }
+
+    WriteQueue_destroy(q);
+    return;
+
+error:
+    if(WriteQueue_valid(q)) {
+        Register_disconnect(q->fd);
+    }
+
+    WriteQueue_destroy(q);
+}
+
+
+static inline void WriteQueue_configure()
+{
+    bstring policy = NULL;
+
+    if(!WRITE_QUEUE_STACK) {
+        WRITE_QUEUE_STACK = Setting_get_int("limits.write_queue_stack", 16 * 1024);
+        WRITE_QUEUE_MAX = Setting_get_int("limits.write_queue_max", 1024 * 1024);
+        log_info("MAX limits.write_queue_stack=%d, limits.write_queue_max=%d",
+                WRITE_QUEUE_STACK, WRITE_QUEUE_MAX);
+
+        policy = Setting_get_str("write_queue.overflow", &WRITE_QUEUE_DEFAULT_POLICY);
+        WRITE_QUEUE_DROP = biseqcstr(policy, "drop");
+
+        if(!WRITE_QUEUE_DROP && !biseqcstr(policy, "disconnect")) {
+            log_err("Unknown write_queue.overflow policy %s, using disconnect.", bdata(policy));
+        }
+
+        log_info("Write queues that overflow will %s.",
+                WRITE_QUEUE_DROP ? "drop messages" : "disconnect");
+    }
+}
+
+static inline WriteQueue *WriteQueue_create(int fd)
+{
+    WriteQueue *q = calloc(sizeof(WriteQueue), 1);
+    check_mem(q);
+
+    q->fd = fd;
+    q->id = Register_id_for_fd(fd);
+
+    q->chunks = list_create(LISTCOUNT_T_MAX);
+    check_mem(q->chunks);
+
+    QUEUES[fd] = q;
+
+    taskcreate(WriteQueue_task, q, WRITE_QUEUE_STACK);
+
+    return q;
+
+error:
+    WriteQueue_destroy(q);
+    return NULL;
+}
+
+static inline int WriteQueue_push(WriteQueue *q, const char *data, int len,
+        WriteBuffer *shared, int offset)
+{
+    WriteChunk *chunk = calloc(sizeof(WriteChunk), 1);
+    check_mem(chunk);
+
+    if(shared) {
+        shared->refcount++;
+        chunk->buf = shared;
+        chunk->offset = offset;
+    } else {
+        chunk->buf = WriteBuffer_create(blk2bstr(data + offset, len - offset));
+        check_mem(chunk->buf);
+    }
+
+    lnode_t *n = lnode_create(chunk);
+    check_mem(n);
+
+    list_append(q->chunks, n);
+    q->queued += len - offset;
+
+    return 0;
+
+error:
+    WriteChunk_destroy(chunk);
+    return -1;
+}
+
+
+/**
+ * Sends what the socket will take right now and queues the rest for a
+ * writer task, so the caller never waits on a slow client.  Returns len
+ * once everything is either sent or queued, 0 if the overflow policy
+ * dropped it, or -1 on error (which includes the disconnect policy).
+ *
+ * A queue holds at most limits.write_queue_max bytes, except that a
+ * single message is always taken when nothing else is waiting.
+ */
+static inline int WriteQueue_write(int fd, const char *data, int len, WriteBuffer *shared)
+{
+    assert(fd < MAX_REGISTERED_FDS && "FD given to write queue is greater than max.");
+    WriteQueue *q = QUEUES[fd];
+    int rc = 0;
+
+    WriteQueue_configure();
+    if(len == 0) return 0;
+
+    if(q && !WriteQueue_valid(q)) {
+        WriteQueue_discard(fd);
+        q = NULL;
+    }
+
+    if(q && q->queued + len > (size_t)WRITE_QUEUE_MAX) {
+        if(WRITE_QUEUE_DROP) {
+            debug("Write queue for %d is full at %d bytes, dropping %d.",
+                    fd, (int)q->queued, len);
+            return 0;
+        } else {
+            WriteQueue_discard(fd);
+            sentinel("Write queue for %d is full at %d bytes, disconnecting.",
+                    fd, (int)q->queued);
+        }
+    }
+
+    if(q == NULL) {
+        // TLS records have to be sealed in order, which the writer does
+        if(Register_ssl_for_fd(fd) == NULL) {
+            // nothing waiting ahead of this so try to get it out right away
+            rc = send(fd, data, len, MSG_NOSIGNAL);
+
+            if(rc == len) return len;
+
+            check(rc >= 0 || errno == EAGAIN, "Failed to send to %d.", fd);
+            if(rc < 0) rc = 0;
+        }
+
+        q = WriteQueue_create(fd);
+        check(q, "Failed to create write queue for %d.", fd);
+    }
+
+    check(WriteQueue_push(q, data, len, shared, rc) == 0,
+            "Failed to queue %d bytes for %d.", len - rc, fd);
+
+    return len;
+
+error:
+    return -1;
+}
+
+int WriteQueue_send(int fd, const char *data, int len)
+{
+    return WriteQueue_write(fd, data, len, NULL);
+}
+
+/**
+ * Same as WriteQueue_send, but anything that has to wait keeps a
+ * reference to buf instead of a copy.
+ */
+int WriteQueue_send_buffer(int fd, WriteBuffer *buf)
+{
+    return WriteQueue_write(fd, bdata(buf->data), blength(buf->data), buf);
+}
+
+int WriteQueue_pending(int fd)
+{
+    assert(fd < MAX_REGISTERED_FDS && "FD given to write queue is greater than max.");
+    WriteQueue *q = QUEUES[fd];
+
+    return q && WriteQueue_valid(q) ? (int)q->queued : 0;
+}
+
+/**
+ * Disconnects the fd once anything queued for it is out.
+ */
+int WriteQueue_disconnect(int fd)
+{
+    assert(fd < MAX_REGISTERED_FDS && "FD given to write queue is greater than max.");
+
+    if(WriteQueue_pending(fd)) {
+        QUEUES[fd]->closing = 1;
+        return 0;
+    } else {
+        return Register_disconnect(fd);
+    }
+}
+
+void WriteQueue_discard(int fd)
+{
+    assert(fd < MAX_REGISTERED_FDS && "FD given to write queue is greater than max.");
+    WriteQueue *q = QUEUES[fd];
+
+    if(q) {
+        q->dead = 1;
+        QUEUES[fd] = NULL;
+
+        // the writer cleans up after itself once it sees the queue is dead
+        if(q->writer && tasknuke(taskgetid(q->writer)) == 0) {
+            taskready(q->writer);
+        }
+    }
+}
+
+/**
+ * Parks the calling task until nothing is queued for the fd, so that a
+ * connection writing to it directly doesn't cut into the queue's records.
+ */
+void WriteQueue_wait(int fd)
+{
+    assert(fd < MAX_REGISTERED_FDS && "FD given to write queue is greater than max.");
+    WriteQueue *q = NULL;
+
+    while((q = QUEUES[fd]) != NULL && WriteQueue_valid(q)) {
+        tasksleep(&q->drained);
+    }
+}
@@ -0,0 +1,88 @@
+/**
+ *
+ * Copyright (c) 2010, Zed A. Shaw and Mongrel2 Project Contributors.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ *     * Neither the name of the Mongrel2 Project, Zed A. Shaw, nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _write_queue_h
+#define _write_queue_h
+
+#include <bstring.h>
+#include <adt/list.h>
+#include <task/task.h>
+
+extern int WRITE_QUEUE_STACK;
+extern int WRITE_QUEUE_MAX;
+extern int WRITE_QUEUE_DROP;
+
+typedef struct WriteBuffer {
+    int refcount;
+    bstring data;
+    zmq_msg_t *msg;
+    struct tagbstring view;
+} WriteBuffer;
+
+typedef struct WriteChunk {
+    WriteBuffer *buf;
+    int offset;
+    int sealed;
+} WriteChunk;
+
+typedef struct WriteQueue {
+    int fd;
+    int id;
+    int closing;
+    int dead;
+    size_t queued;
+    list_t *chunks;
+    Task *writer;
+    Rendez drained;
+} WriteQueue;
+
+WriteBuffer *WriteBuffer_create(bstring data);
+
+WriteBuffer *WriteBuffer_from_msg(zmq_msg_t *msg, size_t offset, size_t len);
+
+void WriteBuffer_release(WriteBuffer *buf);
+
+int WriteQueue_send(int fd, const char *data, int len);
+
+int WriteQueue_send_buffer(int fd, WriteBuffer *buf);
+
+int WriteQueue_pending(int fd);
+
+int WriteQueue_disconnect(int fd);
+
+void WriteQueue_discard(int fd);
+
+void WriteQueue_wait(int fd);
+
+#endif
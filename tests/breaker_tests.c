@@ -0,0 +1,150 @@
+#include "minunit.h"
+#include <breaker.h>
+#include <string.h>
+
+FILE *LOG_FILE = NULL;
+
+char *test_Breaker_create_destroy()
+{
+    Breaker *breaker = Breaker_create(bfromcstr("127.0.0.1:80"));
+    mu_assert(breaker != NULL, "Failed to create breaker.");
+    mu_assert(breaker->state == BREAKER_CLOSED, "Should start closed.");
+
+    // off by default, so failures are only counted
+    Breaker_failure(breaker);
+    Breaker_failure(breaker);
+    mu_assert(BREAKER_FAILURES == 0, "Breakers should be off by default.");
+    mu_assert(breaker->failures == 2, "Should count failures.");
+    mu_assert(Breaker_allow(breaker), "Should allow when breakers are off.");
+
+    Breaker_destroy(breaker);
+
+    return NULL;
+}
+
+char *test_Breaker_trip_and_probe()
+{
+    BREAKER_FAILURES = 3;
+    BREAKER_RESET = 10;
+    Breaker *breaker = Breaker_create(bfromcstr("127.0.0.1:81"));
+
+    Breaker_failure(breaker);
+    Breaker_failure(breaker);
+    Breaker_success(breaker, 5);
+    mu_assert(breaker->failures == 0, "Success should reset the count.");
+
+    Breaker_failure(breaker);
+    Breaker_failure(breaker);
+    mu_assert(Breaker_allow(breaker), "Should still allow under the limit.");
+    Breaker_failure(breaker);
+
+    mu_assert(breaker->state == BREAKER_OPEN, "Should trip on the third failure.");
+    mu_assert(breaker->trips == 1, "Should count the trip.");
+    mu_assert(!Breaker_allow(breaker), "Open breaker should fail fast.");
+    mu_assert(Breaker_retry_after(breaker) > 0, "Should say when to retry.");
+    mu_assert(Breaker_retry_after(breaker) <= BREAKER_RESET, "Retry-After too far out.");
+
+    // pretend the reset timeout has passed
+    breaker->opened_at -= BREAKER_RESET;
+    mu_assert(Breaker_allow(breaker), "Should let a probe through.");
+    mu_assert(breaker->state == BREAKER_HALF_OPEN, "Should be half open.");
+    mu_assert(!Breaker_allow(breaker), "Only one probe at a time.");
+
+    Breaker_failure(breaker);
+    mu_assert(breaker->state == BREAKER_OPEN, "Failed probe should reopen.");
+    mu_assert(breaker->trips == 1, "A failed probe isn't a new trip.");
+    mu_assert(!Breaker_allow(breaker), "Reopened breaker should fail fast.");
+
+    breaker->opened_at -= BREAKER_RESET;
+    mu_assert(Breaker_allow(breaker), "Should probe again.");
+
+    // a probe that never reports back doesn't wedge the breaker
+    breaker->probe_at -= BREAKER_RESET;
+    mu_assert(Breaker_allow(breaker), "Should send another probe after a lost one.");
+
+    Breaker_success(breaker, 5);
+    mu_assert(breaker->state == BREAKER_CLOSED, "Good probe should close it.");
+    mu_assert(Breaker_allow(breaker), "Closed breaker should allow.");
+
+    Breaker_destroy(breaker);
+    BREAKER_FAILURES = 0;
+
+    return NULL;
+}
+
+char *test_Breaker_latency()
+{
+    BREAKER_FAILURES = 2;
+    BREAKER_LATENCY = 100;
+    Breaker *breaker = Breaker_create(bfromcstr("127.0.0.1:82"));
+
+    Breaker_success(breaker, 50);
+    mu_assert(breaker->failures == 0, "Fast reply isn't a failure.");
+
+    Breaker_success(breaker, 500);
+    Breaker_success(breaker, 500);
+    mu_assert(breaker->failures == 2, "Slow replies should count as failures.");
+    mu_assert(breaker->state == BREAKER_OPEN, "Slow replies should trip it.");
+    mu_assert(breaker->latency > 50, "Should track the latency.");
+
+    Breaker_destroy(breaker);
+    BREAKER_FAILURES = 0;
+    BREAKER_LATENCY = 0;
+
+    return NULL;
+}
+
+char *test_Breaker_timeout()
+{
+    mu_assert(Breaker_timeout() == 0, "No timeout when breakers are off.");
+
+    BREAKER_FAILURES = 2;
+    mu_assert(Breaker_timeout() == BREAKER_TIMEOUT * 1000, "Should default to breaker.timeout.");
+
+    BREAKER_LATENCY = 100;
+    mu_assert(Breaker_timeout() == 100, "Anything slower than breaker.latency is a failure.");
+
+    BREAKER_FAILURES = 0;
+    BREAKER_LATENCY = 0;
+
+    return NULL;
+}
+
+char *test_Breaker_info()
+{
+    Breaker *first = Breaker_create(bfromcstr("127.0.0.1:83"));
+    Breaker *second = Breaker_create(bfromcstr("tcp://127.0.0.1:9999"));
+    second->state = BREAKER_OPEN;
+
+    bstring info = Breaker_info();
+    mu_assert(info != NULL, "Failed to get the breaker info.");
+    mu_assert(strstr((char *)info->data, "{\"name\":\"127.0.0.1:83\",\"state\":\"closed\"") != NULL,
+            "Missing the first breaker.");
+    mu_assert(strstr((char *)info->data, "{\"name\":\"tcp://127.0.0.1:9999\",\"state\":\"open\"") != NULL,
+            "Missing the second breaker.");
+    mu_assert(strstr((char *)info->data, "], \"total\": 2}") != NULL, "Wrong total.");
+    bdestroy(info);
+
+    Breaker_destroy(second);
+    Breaker_destroy(first);
+
+    info = Breaker_info();
+    mu_assert(biseqcstr(info, "{\"backends\": [], \"total\": 0}"), "Destroy should unregister breakers.");
+    bdestroy(info);
+
+    return NULL;
+}
+
+char * all_tests() {
+    mu_suite_start();
+
+    mu_run_test(test_Breaker_create_destroy);
+    mu_run_test(test_Breaker_trip_and_probe);
+    mu_run_test(test_Breaker_latency);
+    mu_run_test(test_Breaker_timeout);
+    mu_run_test(test_Breaker_info);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,438 @@
+/**
+ * Throughput of the bundled crypto, run with "make bench".  Not a test,
+ * so runtests.sh leaves it alone.  The RSA and handshake numbers use
+ * tests/certs/bench.key, so run it from the top of the tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <dbg.h>
+#include <crypto/crypto.h>
+#include <ssl/ssl.h>
+#include <task/task.h>
+
+FILE *LOG_FILE = NULL;
+
+#define BENCH_SECONDS 0.5
+
+static const int BENCH_SIZES[] = {64, 1024, 16384};
+#define BENCH_SIZE_COUNT (int)(sizeof(BENCH_SIZES) / sizeof(int))
+#define BENCH_MAX_SIZE 16384
+
+typedef void (*bench_func)(void *ctx, uint8_t *buf, int len);
+
+static double bench_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Calls func until BENCH_SECONDS are up, returning how long it took and
+ * how many calls that was in count.
+ */
+static double bench_loop(bench_func func, void *ctx, uint8_t *buf, int len, long long *count)
+{
+    double start = bench_now();
+    double elapsed = 0;
+
+    *count = 0;
+    do {
+        func(ctx, buf, len);
+        (*count)++;
+        elapsed = bench_now() - start;
+    } while(elapsed < BENCH_SECONDS);
+
+    return elapsed;
+}
+
+/**
+ * Runs func over len bytes until BENCH_SECONDS are up and prints MB/s.
+ */
+static void bench_run(const char *name, bench_func func, void *ctx, uint8_t *buf, int len)
+{
+    long long count = 0;
+    double elapsed = bench_loop(func, ctx, buf, len, &count);
+
+    printf("%-24s %6d bytes %10.1f MB/s\n", name, len, count * len / elapsed / (1024 * 1024));
+}
+
+/**
+ * For the things that cost the same whatever the data, prints calls/s.
+ */
+static void bench_ops(const char *name, bench_func func, void *ctx, uint8_t *buf)
+{
+    long long count = 0;
+    double elapsed = bench_loop(func, ctx, buf, 0, &count);
+
+    printf("%-24s %23.1f ops/s\n", name, count / elapsed);
+}
+
+static void bench_aes_encrypt(void *ctx, uint8_t *buf, int len)
+{
+    AES_cbc_encrypt((AES_CTX *)ctx, buf, buf, len);
+}
+
+static void bench_aes_decrypt(void *ctx, uint8_t *buf, int len)
+{
+    AES_cbc_decrypt((AES_CTX *)ctx, buf, buf, len);
+}
+
+static void bench_aes(uint8_t *buf)
+{
+    static const uint8_t key[32] = {0};
+    static const uint8_t iv[16] = {0};
+    AES_MODE modes[2] = {AES_MODE_128, AES_MODE_256};
+    const char *names[2][2][2] = {
+        {{"aes-128-cbc encrypt", "aes-128-cbc decrypt"},
+         {"aes-128-cbc encrypt ni", "aes-128-cbc decrypt ni"}},
+        {{"aes-256-cbc encrypt", "aes-256-cbc decrypt"},
+         {"aes-256-cbc encrypt ni", "aes-256-cbc decrypt ni"}}
+    };
+    AES_CTX ctx;
+    int m = 0, ni = 0, i = 0;
+
+    for(m = 0; m < 2; m++) {
+        for(ni = 0; ni < 2; ni++) {
+            AES_set_key(&ctx, key, iv, modes[m]);
+            if(ni && !ctx.ni) continue;
+            ctx.ni = ni;
+
+            for(i = 0; i < BENCH_SIZE_COUNT; i++) {
+                bench_run(names[m][ni][0], bench_aes_encrypt, &ctx, buf, BENCH_SIZES[i]);
+            }
+
+            AES_convert_key(&ctx);
+
+            for(i = 0; i < BENCH_SIZE_COUNT; i++) {
+                bench_run(names[m][ni][1], bench_aes_decrypt, &ctx, buf, BENCH_SIZES[i]);
+            }
+        }
+    }
+}
+
+static void bench_gcm_encrypt(void *ctx, uint8_t *buf, int len)
+{
+    static const uint8_t iv[GCM_IV_SIZE] = {0};
+    uint8_t aad[13] = {0};
+    uint8_t tag[GCM_TAG_SIZE];
+    GCM_encrypt((GCM_CTX *)ctx, iv, aad, sizeof(aad), buf, buf, len, tag);
+}
+
+static void bench_gcm_decrypt(void *ctx, uint8_t *buf, int len)
+{
+    static const uint8_t iv[GCM_IV_SIZE] = {0};
+    uint8_t aad[13] = {0};
+    uint8_t tag[GCM_TAG_SIZE] = {0};
+    // the tag never matches, but the whole record is still worked through
+    GCM_decrypt((GCM_CTX *)ctx, iv, aad, sizeof(aad), buf, buf, len, tag);
+}
+
+static void bench_gcm(uint8_t *buf)
+{
+    static const uint8_t key[32] = {0};
+    AES_MODE modes[2] = {AES_MODE_128, AES_MODE_256};
+    const char *names[2][2][2] = {
+        {{"aes-128-gcm encrypt", "aes-128-gcm decrypt"},
+         {"aes-128-gcm encrypt ni", "aes-128-gcm decrypt ni"}},
+        {{"aes-256-gcm encrypt", "aes-256-gcm decrypt"},
+         {"aes-256-gcm encrypt ni", "aes-256-gcm decrypt ni"}}
+    };
+    GCM_CTX ctx;
+    int m = 0, ni = 0, i = 0;
+
+    for(m = 0; m < 2; m++) {
+        for(ni = 0; ni < 2; ni++) {
+            GCM_set_key(&ctx, key, modes[m]);
+            if(ni && !ctx.ni) continue;
+            ctx.ni = ctx.aes.ni = ni;
+
+            for(i = 0; i < BENCH_SIZE_COUNT; i++) {
+                bench_run(names[m][ni][0], bench_gcm_encrypt, &ctx, buf, BENCH_SIZES[i]);
+            }
+
+            for(i = 0; i < BENCH_SIZE_COUNT; i++) {
+                bench_run(names[m][ni][1], bench_gcm_decrypt, &ctx, buf, BENCH_SIZES[i]);
+            }
+        }
+    }
+}
+
+static void bench_rc4_crypt(void *ctx, uint8_t *buf, int len)
+{
+    RC4_crypt((RC4_CTX *)ctx, buf, buf, len);
+}
+
+static void bench_rc4(uint8_t *buf)
+{
+    static const uint8_t key[16] = {0};
+    RC4_CTX ctx;
+    int i = 0;
+
+    RC4_setup(&ctx, key, sizeof(key));
+
+    for(i = 0; i < BENCH_SIZE_COUNT; i++) {
+        bench_run("rc4", bench_rc4_crypt, &ctx, buf, BENCH_SIZES[i]);
+    }
+}
+
+static void bench_md5_digest(void *ctx, uint8_t *buf, int len)
+{
+    MD5_CTX md5;
+    MD5_Init(&md5);
+    MD5_Update(&md5, buf, len);
+    MD5_Final(buf, &md5);
+}
+
+static void bench_md5(uint8_t *buf)
+{
+    int i = 0;
+
+    for(i = 0; i < BENCH_SIZE_COUNT; i++) {
+        bench_run("md5", bench_md5_digest, NULL, buf, BENCH_SIZES[i]);
+    }
+}
+
+static void bench_sha1_digest(void *ctx, uint8_t *buf, int len)
+{
+    SHA1_CTX sha1 = *(SHA1_CTX *)ctx;
+    SHA1_Update(&sha1, buf, len);
+    SHA1_Final(buf, &sha1);
+}
+
+static void bench_hmac_sha1(void *ctx, uint8_t *buf, int len)
+{
+    hmac_sha1(buf, len, (const uint8_t *)ctx, SHA1_SIZE, buf);
+}
+
+static void bench_hmac_sha1_key(void *ctx, uint8_t *buf, int len)
+{
+    HMAC_SHA1_KEY *hkey = (HMAC_SHA1_KEY *)ctx;
+    SHA1_CTX sha1 = hkey->inner;
+    SHA1_Update(&sha1, buf, len);
+    hmac_sha1_final(hkey, &sha1, buf);
+}
+
+static void bench_sha1(uint8_t *buf)
+{
+    static const uint8_t key[SHA1_SIZE] = {0};
+    const char *names[2][3] = {
+        {"sha1", "hmac-sha1", "hmac-sha1 cached key"},
+        {"sha1 ni", "hmac-sha1 ni", "hmac-sha1 cached key ni"}
+    };
+    SHA1_CTX ctx;
+    HMAC_SHA1_KEY hkey;
+    int ni = 0, i = 0, has_ni = 0;
+
+    SHA1_Init(&ctx);
+    has_ni = ctx.ni;
+
+    for(ni = 0; ni <= has_ni; ni++) {
+        ctx.ni = ni;
+
+        for(i = 0; i < BENCH_SIZE_COUNT; i++) {
+            bench_run(names[ni][0], bench_sha1_digest, &ctx, buf, BENCH_SIZES[i]);
+        }
+
+        // hmac_sha1() picks the fastest block function itself
+        if(ni == has_ni) {
+            for(i = 0; i < BENCH_SIZE_COUNT; i++) {
+                bench_run(names[ni][1], bench_hmac_sha1, (void *)key, buf, BENCH_SIZES[i]);
+            }
+        }
+
+        hmac_sha1_key(&hkey, key, SHA1_SIZE);
+        hkey.inner.ni = hkey.outer.ni = ni;
+
+        for(i = 0; i < BENCH_SIZE_COUNT; i++) {
+            bench_run(names[ni][2], bench_hmac_sha1_key, &hkey, buf, BENCH_SIZES[i]);
+        }
+    }
+}
+
+static void bench_sha256_digest(void *ctx, uint8_t *buf, int len)
+{
+    SHA256_CTX sha256;
+    SHA256_Init(&sha256);
+    SHA256_Update(&sha256, buf, len);
+    SHA256_Final(buf, &sha256);
+}
+
+static void bench_sha384_digest(void *ctx, uint8_t *buf, int len)
+{
+    SHA384_CTX sha384;
+    SHA384_Init(&sha384);
+    SHA384_Update(&sha384, buf, len);
+    SHA384_Final(buf, &sha384);
+}
+
+static void bench_sha2(uint8_t *buf)
+{
+    int i = 0;
+
+    for(i = 0; i < BENCH_SIZE_COUNT; i++) {
+        bench_run("sha256", bench_sha256_digest, NULL, buf, BENCH_SIZES[i]);
+    }
+
+    for(i = 0; i < BENCH_SIZE_COUNT; i++) {
+        bench_run("sha384", bench_sha384_digest, NULL, buf, BENCH_SIZES[i]);
+    }
+}
+
+// the padded block goes after the message in buf
+#define BENCH_RSA_OUT 1024
+
+static void bench_rsa_public(void *ctx, uint8_t *buf, int len)
+{
+    RSA_encrypt((RSA_CTX *)ctx, buf, SSL_SECRET_SIZE, &buf[BENCH_RSA_OUT], 0);
+}
+
+static void bench_rsa_private(void *ctx, uint8_t *buf, int len)
+{
+    RSA_encrypt((RSA_CTX *)ctx, buf, SHA256_SIZE, &buf[BENCH_RSA_OUT], 1);
+}
+
+/**
+ * Both are down to bi_mod_power: the public one with the small exponent,
+ * the private one twice over the halves of the key for the CRT.
+ */
+static void bench_rsa(SSL_CTX *ssl_ctx, uint8_t *buf)
+{
+    char name[64];
+    int bits = ssl_ctx->rsa_ctx->num_octets * 8;
+
+    snprintf(name, sizeof(name), "rsa-%d public", bits);
+    bench_ops(name, bench_rsa_public, ssl_ctx->rsa_ctx, buf);
+
+    snprintf(name, sizeof(name), "rsa-%d private", bits);
+    bench_ops(name, bench_rsa_private, ssl_ctx->rsa_ctx, buf);
+}
+
+typedef struct BenchTLS {
+    SSL_CTX *server;
+    SSL_CTX *client;
+    int resume;
+    uint8_t session_id[SSL_SESSION_ID_SIZE];
+    uint8_t session_id_size;
+} BenchTLS;
+
+typedef struct BenchServer {
+    SSL_CTX *ssl_ctx;
+    int fd;
+} BenchServer;
+
+static void bench_tls_server(void *arg)
+{
+    BenchServer *srv = (BenchServer *)arg;
+    SSL *ssl = ssl_server_new(srv->ssl_ctx, srv->fd);
+    uint8_t *data = NULL;
+    int rc = SSL_OK;
+
+    while(rc >= SSL_OK && ssl_handshake_status(ssl) != SSL_OK) {
+        rc = ssl_read(ssl, &data);
+    }
+
+    ssl_free(ssl);
+    close(srv->fd);
+    free(srv);
+}
+
+/**
+ * One handshake between the bundled client and a server task over a
+ * socketpair, so the RSA work goes to the task threads like it does in
+ * the server.
+ */
+static void bench_tls_handshake(void *ctx, uint8_t *buf, int len)
+{
+    BenchTLS *tls = (BenchTLS *)ctx;
+    BenchServer *srv = NULL;
+    SSL *ssl = NULL;
+    int fds[2] = {-1, -1};
+
+    check(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Failed to make a socketpair.");
+
+    srv = malloc(sizeof(BenchServer));
+    check_mem(srv);
+    srv->ssl_ctx = tls->server;
+    srv->fd = fds[1];
+    fdnoblock(srv->fd);
+    taskcreate(bench_tls_server, srv, 64 * 1024);
+
+    ssl = ssl_client_new(tls->client, fds[0],
+            tls->resume ? tls->session_id : NULL, tls->session_id_size);
+    check(ssl_handshake_status(ssl) == SSL_OK, "Handshake failed: %d",
+            ssl_handshake_status(ssl));
+    check(!tls->resume || (ssl->flag & SSL_SESSION_RESUME),
+            "The session wasn't resumed.");
+
+    tls->session_id_size = ssl_get_session_id_size(ssl);
+    memcpy(tls->session_id, ssl_get_session_id(ssl), tls->session_id_size);
+
+    ssl_free(ssl);
+    close(fds[0]);
+    return;
+
+error:
+    exit(1);
+}
+
+static void bench_tls(SSL_CTX *server, uint8_t *buf)
+{
+    BenchTLS tls = {.server = server};
+
+    tls.client = ssl_ctx_new(SSL_SERVER_VERIFY_LATER | SSL_NO_DEFAULT_KEY,
+            SSL_DEFAULT_CLNT_SESS);
+    check_mem(tls.client);
+
+    bench_ops("tls handshake", bench_tls_handshake, &tls, buf);
+
+    tls.resume = 1;
+    bench_ops("tls resumed handshake", bench_tls_handshake, &tls, buf);
+
+    ssl_ctx_free(tls.client);
+    return;
+
+error:
+    exit(1);
+}
+
+void taskmain(int argc, char *argv[])
+{
+    uint8_t *buf = calloc(BENCH_MAX_SIZE, 1);
+    SSL_CTX *server = NULL;
+    check_mem(buf);
+
+    LOG_FILE = stderr;
+    // the task threads and poller log as they start, keep the lines whole
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    bench_aes(buf);
+    bench_gcm(buf);
+    bench_rc4(buf);
+    bench_md5(buf);
+    bench_sha1(buf);
+    bench_sha2(buf);
+
+    server = ssl_ctx_new(SSL_NO_DEFAULT_KEY, SSL_DEFAULT_SVR_SESS);
+    check_mem(server);
+    check(ssl_obj_load(server, SSL_OBJ_X509_CERT, "tests/certs/bench.crt", NULL) == SSL_OK,
+            "Failed to load tests/certs/bench.crt, run this from the top of the tree.");
+    check(ssl_obj_load(server, SSL_OBJ_RSA_KEY, "tests/certs/bench.key", NULL) == SSL_OK,
+            "Failed to load tests/certs/bench.key.");
+    fill_rsa_spares(server, 2);
+
+    bench_rsa(server, buf);
+    bench_tls(server, buf);
+
+    ssl_ctx_free(server);
+    free(buf);
+    exit(0);
+
+error:
+    exit(1);
+}
@@ -0,0 +1,533 @@
+#include "minunit.h"
+#include <crypto/crypto.h>
+#include <task/task.h>
+#include <string.h>
+#include <stdlib.h>
+
+FILE *LOG_FILE = NULL;
+
+static const uint8_t AES_KEY[32] = {
+    0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,
+    0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,0x18,0x19,0x1a,0x1b,0x1c,0x1d,0x1e,0x1f
+};
+
+static const uint8_t AES_PLAIN[16] = {
+    0x00,0x11,0x22,0x33,0x44,0x55,0x66,0x77,0x88,0x99,0xaa,0xbb,0xcc,0xdd,0xee,0xff
+};
+
+// FIPS-197 appendix C, which is one CBC block with a zero IV
+static const uint8_t AES_128_CIPHER[16] = {
+    0x69,0xc4,0xe0,0xd8,0x6a,0x7b,0x04,0x30,0xd8,0xcd,0xb7,0x80,0x70,0xb4,0xc5,0x5a
+};
+
+static const uint8_t AES_256_CIPHER[16] = {
+    0x8e,0xa2,0xb7,0xca,0x51,0x67,0x45,0xbf,0xea,0xfc,0x49,0x90,0x4b,0x49,0x60,0x89
+};
+
+static const uint8_t ZERO_IV[16] = {0};
+
+static char *check_vector(AES_MODE mode, const uint8_t *expected, int ni)
+{
+    AES_CTX ctx;
+    uint8_t out[16];
+
+    AES_set_key(&ctx, AES_KEY, ZERO_IV, mode);
+    if(!ni) ctx.ni = 0;
+
+    AES_cbc_encrypt(&ctx, AES_PLAIN, out, sizeof(out));
+    mu_assert(memcmp(out, expected, sizeof(out)) == 0, "Wrong AES ciphertext.");
+
+    AES_set_key(&ctx, AES_KEY, ZERO_IV, mode);
+    if(!ni) ctx.ni = 0;
+    AES_convert_key(&ctx);
+
+    AES_cbc_decrypt(&ctx, expected, out, sizeof(out));
+    mu_assert(memcmp(out, AES_PLAIN, sizeof(out)) == 0, "Wrong AES plaintext.");
+
+    return NULL;
+}
+
+char *test_AES_vectors()
+{
+    AES_CTX probe;
+    AES_set_key(&probe, AES_KEY, ZERO_IV, AES_MODE_128);
+
+    mu_assert(check_vector(AES_MODE_128, AES_128_CIPHER, 0) == NULL, "AES-128 failed.");
+    mu_assert(check_vector(AES_MODE_256, AES_256_CIPHER, 0) == NULL, "AES-256 failed.");
+
+    if(probe.ni) {
+        mu_assert(check_vector(AES_MODE_128, AES_128_CIPHER, 1) == NULL, "AES-NI AES-128 failed.");
+        mu_assert(check_vector(AES_MODE_256, AES_256_CIPHER, 1) == NULL, "AES-NI AES-256 failed.");
+    }
+
+    return NULL;
+}
+
+char *test_AES_cbc_same_output()
+{
+    AES_MODE modes[2] = {AES_MODE_128, AES_MODE_256};
+    // odd block counts exercise both the 4 block and single block loops
+    int lengths[4] = {16, 64, 7 * 16, 1024 + 3 * 16};
+    uint8_t iv[16];
+    uint8_t plain[1024 + 3 * 16];
+    uint8_t slow[sizeof(plain)];
+    uint8_t fast[sizeof(plain)];
+    AES_CTX slow_ctx, fast_ctx;
+    int m = 0, l = 0;
+    size_t i = 0;
+
+    for(i = 0; i < sizeof(plain); i++) plain[i] = random();
+    for(i = 0; i < sizeof(iv); i++) iv[i] = random();
+
+    AES_set_key(&fast_ctx, AES_KEY, iv, AES_MODE_128);
+    if(!fast_ctx.ni) {
+        debug("No AES-NI on this CPU, only the portable code is tested.");
+    }
+
+    for(m = 0; m < 2; m++) {
+        for(l = 0; l < 4; l++) {
+            int len = lengths[l];
+
+            AES_set_key(&slow_ctx, AES_KEY, iv, modes[m]);
+            slow_ctx.ni = 0;
+            AES_set_key(&fast_ctx, AES_KEY, iv, modes[m]);
+
+            // twice, so the iv carried between calls is checked too
+            AES_cbc_encrypt(&slow_ctx, plain, slow, len);
+            AES_cbc_encrypt(&fast_ctx, plain, fast, len);
+            mu_assert(memcmp(slow, fast, len) == 0, "Encryption differs.");
+            AES_cbc_encrypt(&slow_ctx, plain, slow, len);
+            AES_cbc_encrypt(&fast_ctx, plain, fast, len);
+            mu_assert(memcmp(slow, fast, len) == 0, "Encryption differs on the second call.");
+            mu_assert(memcmp(slow_ctx.iv, fast_ctx.iv, 16) == 0, "Final iv differs.");
+
+            // decrypt the first ciphertext, in place like tls1.c does
+            AES_set_key(&fast_ctx, AES_KEY, iv, modes[m]);
+            AES_convert_key(&fast_ctx);
+            AES_set_key(&slow_ctx, AES_KEY, iv, modes[m]);
+            slow_ctx.ni = 0;
+            AES_cbc_encrypt(&slow_ctx, plain, slow, len);
+            memcpy(fast, slow, len);
+
+            AES_set_key(&slow_ctx, AES_KEY, iv, modes[m]);
+            slow_ctx.ni = 0;
+            AES_convert_key(&slow_ctx);
+
+            AES_cbc_decrypt(&slow_ctx, slow, slow, len);
+            AES_cbc_decrypt(&fast_ctx, fast, fast, len);
+            mu_assert(memcmp(slow, plain, len) == 0, "Portable decryption is wrong.");
+            mu_assert(memcmp(fast, plain, len) == 0, "Decryption differs.");
+            mu_assert(memcmp(slow_ctx.iv, fast_ctx.iv, 16) == 0, "Final decrypt iv differs.");
+        }
+    }
+
+    return NULL;
+}
+
+// FIPS 180-2 appendix A
+static const uint8_t SHA1_ABC[SHA1_SIZE] = {
+    0xa9,0x99,0x3e,0x36,0x47,0x06,0x81,0x6a,0xba,0x3e,
+    0x25,0x71,0x78,0x50,0xc2,0x6c,0x9c,0xd0,0xd8,0x9d
+};
+
+static const uint8_t SHA1_MILLION_A[SHA1_SIZE] = {
+    0x34,0xaa,0x97,0x3c,0xd4,0xc4,0xda,0xa4,0xf6,0x1e,
+    0xeb,0x2b,0xdb,0xad,0x27,0x31,0x65,0x34,0x01,0x6f
+};
+
+// RFC 2202 test case 2
+static const uint8_t HMAC_SHA1_JEFE[SHA1_SIZE] = {
+    0xef,0xfc,0xdf,0x6a,0xe5,0xeb,0x2f,0xa2,0xd2,0x74,
+    0x16,0xd5,0xf1,0x84,0xdf,0x9c,0x25,0x9a,0x7c,0x79
+};
+
+static void sha1_chunked(const uint8_t *msg, int len, int chunk, int ni, uint8_t *digest)
+{
+    SHA1_CTX ctx;
+    int n = 0;
+
+    SHA1_Init(&ctx);
+    if(!ni) ctx.ni = 0;
+
+    for(; len > 0; len -= n, msg += n) {
+        n = len < chunk ? len : chunk;
+        SHA1_Update(&ctx, msg, n);
+    }
+
+    SHA1_Final(digest, &ctx);
+}
+
+char *test_SHA1_vectors()
+{
+    uint8_t digest[SHA1_SIZE];
+    uint8_t *million = malloc(1000000);
+    SHA1_CTX probe;
+    int ni = 0;
+
+    memset(million, 'a', 1000000);
+    SHA1_Init(&probe);
+
+    for(ni = 0; ni <= probe.ni; ni++) {
+        sha1_chunked((const uint8_t *)"abc", 3, 3, ni, digest);
+        mu_assert(memcmp(digest, SHA1_ABC, SHA1_SIZE) == 0, "Wrong SHA1 of abc.");
+
+        sha1_chunked(million, 1000000, 1000000, ni, digest);
+        mu_assert(memcmp(digest, SHA1_MILLION_A, SHA1_SIZE) == 0, "Wrong SHA1 of a million a's.");
+
+        sha1_chunked(million, 1000000, 1, ni, digest);
+        mu_assert(memcmp(digest, SHA1_MILLION_A, SHA1_SIZE) == 0, "Wrong SHA1 a byte at a time.");
+    }
+
+    free(million);
+    return NULL;
+}
+
+char *test_SHA1_same_output()
+{
+    uint8_t msg[4096];
+    uint8_t slow[SHA1_SIZE];
+    uint8_t fast[SHA1_SIZE];
+    // straddle the block boundary and the 55 byte padding cutoff
+    int lengths[8] = {0, 55, 56, 63, 64, 65, 1000, sizeof(msg)};
+    int chunks[3] = {1, 13, 4096};
+    int l = 0, c = 0;
+    size_t i = 0;
+
+    for(i = 0; i < sizeof(msg); i++) msg[i] = random();
+
+    for(l = 0; l < 8; l++) {
+        sha1_chunked(msg, lengths[l], 4096, 0, slow);
+
+        for(c = 0; c < 3; c++) {
+            sha1_chunked(msg, lengths[l], chunks[c], 1, fast);
+            mu_assert(memcmp(slow, fast, SHA1_SIZE) == 0, "SHA1 differs.");
+            sha1_chunked(msg, lengths[l], chunks[c], 0, fast);
+            mu_assert(memcmp(slow, fast, SHA1_SIZE) == 0, "Portable SHA1 differs by chunking.");
+        }
+    }
+
+    return NULL;
+}
+
+char *test_hmac_sha1_key()
+{
+    const char *msg = "what do ya want for nothing?";
+    uint8_t digest[SHA1_SIZE];
+    uint8_t cached[SHA1_SIZE];
+    HMAC_SHA1_KEY hkey;
+    SHA1_CTX ctx;
+
+    hmac_sha1((const uint8_t *)msg, strlen(msg), (const uint8_t *)"Jefe", 4, digest);
+    mu_assert(memcmp(digest, HMAC_SHA1_JEFE, SHA1_SIZE) == 0, "Wrong HMAC-SHA1.");
+
+    // a record MAC is fed in pieces, and the key gets reused
+    hmac_sha1_key(&hkey, (const uint8_t *)"Jefe", 4);
+
+    ctx = hkey.inner;
+    SHA1_Update(&ctx, (const uint8_t *)msg, 8);
+    SHA1_Update(&ctx, (const uint8_t *)msg + 8, strlen(msg) - 8);
+    hmac_sha1_final(&hkey, &ctx, cached);
+    mu_assert(memcmp(cached, HMAC_SHA1_JEFE, SHA1_SIZE) == 0, "Wrong cached HMAC-SHA1.");
+
+    ctx = hkey.inner;
+    SHA1_Update(&ctx, (const uint8_t *)msg, strlen(msg));
+    hmac_sha1_final(&hkey, &ctx, cached);
+    mu_assert(memcmp(cached, HMAC_SHA1_JEFE, SHA1_SIZE) == 0, "Reused HMAC key is wrong.");
+
+    return NULL;
+}
+
+static void unhex(const char *hex, uint8_t *out)
+{
+    for(; hex[0] && hex[1]; hex += 2) {
+        unsigned int byte = 0;
+        sscanf(hex, "%2x", &byte);
+        *out++ = byte;
+    }
+}
+
+static int hex_is(const uint8_t *buf, int len, const char *hex)
+{
+    uint8_t expected[128];
+
+    unhex(hex, expected);
+    return (int)strlen(hex) == len * 2 && memcmp(buf, expected, len) == 0;
+}
+
+char *test_SHA2_vectors()
+{
+    const char *msg = "what do ya want for nothing?";
+    uint8_t digest[SHA384_SIZE];
+    SHA256_CTX sha256;
+    SHA384_CTX sha384;
+
+    SHA256_Init(&sha256);
+    SHA256_Update(&sha256, (const uint8_t *)"abc", 3);
+    SHA256_Final(digest, &sha256);
+    mu_assert(hex_is(digest, SHA256_SIZE,
+                "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"),
+            "Wrong SHA256.");
+
+    SHA384_Init(&sha384);
+    SHA384_Update(&sha384, (const uint8_t *)"abc", 3);
+    SHA384_Final(digest, &sha384);
+    mu_assert(hex_is(digest, SHA384_SIZE,
+                "cb00753f45a35e8bb5a03d699ac65007272c32ab0eded163"
+                "1a8b605a43ff5bed8086072ba1e7cc2358baeca134c825a7"),
+            "Wrong SHA384.");
+
+    // RFC 4231 test case 2, what the TLS 1.2 PRF is built from
+    hmac_sha256((const uint8_t *)msg, strlen(msg), (const uint8_t *)"Jefe", 4, digest);
+    mu_assert(hex_is(digest, SHA256_SIZE,
+                "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"),
+            "Wrong HMAC-SHA256.");
+
+    hmac_sha384((const uint8_t *)msg, strlen(msg), (const uint8_t *)"Jefe", 4, digest);
+    mu_assert(hex_is(digest, SHA384_SIZE,
+                "af45d2e376484031617f78d2b58a6b1b9c7ef464f5a01b47"
+                "e42ec3736322445e8e2240ca5e69e2c78b3239ecfab21649"),
+            "Wrong HMAC-SHA384.");
+
+    return NULL;
+}
+
+// test cases 2, 3 and 14 from the GCM spec
+static char *check_gcm(const char *key_hex, AES_MODE mode, const char *iv_hex,
+        const char *plain_hex, const char *cipher_hex, const char *tag_hex, int ni)
+{
+    GCM_CTX ctx;
+    uint8_t key[32], iv[GCM_IV_SIZE], plain[64], out[64], tag[GCM_TAG_SIZE];
+    int len = strlen(plain_hex) / 2;
+
+    unhex(key_hex, key);
+    unhex(iv_hex, iv);
+    unhex(plain_hex, plain);
+
+    GCM_set_key(&ctx, key, mode);
+    if(!ni) ctx.ni = ctx.aes.ni = 0;
+
+    GCM_encrypt(&ctx, iv, NULL, 0, plain, out, len, tag);
+    mu_assert(hex_is(out, len, cipher_hex), "Wrong GCM ciphertext.");
+    mu_assert(hex_is(tag, GCM_TAG_SIZE, tag_hex), "Wrong GCM tag.");
+
+    mu_assert(GCM_decrypt(&ctx, iv, NULL, 0, out, out, len, tag) == 0, "GCM tag rejected.");
+    mu_assert(memcmp(out, plain, len) == 0, "Wrong GCM plaintext.");
+
+    tag[0] ^= 1;
+    mu_assert(GCM_decrypt(&ctx, iv, NULL, 0, out, out, len, tag) != 0, "Bad GCM tag accepted.");
+
+    return NULL;
+}
+
+static char *check_gcm_vectors(int ni)
+{
+    const char *zero128 = "00000000000000000000000000000000";
+    const char *zero256 = "0000000000000000000000000000000000000000000000000000000000000000";
+    const char *zero_iv = "000000000000000000000000";
+
+    mu_assert(check_gcm(zero128, AES_MODE_128, zero_iv, zero128,
+                "0388dace60b6a392f328c2b971b2fe78",
+                "ab6e47d42cec13bdf53a67b21257bddf", ni) == NULL, "GCM case 2 failed.");
+
+    mu_assert(check_gcm("feffe9928665731c6d6a8f9467308308", AES_MODE_128,
+                "cafebabefacedbaddecaf888",
+                "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+                "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+                "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+                "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+                "4d5c2af327cd64a62cf35abd2ba6fab4", ni) == NULL, "GCM case 3 failed.");
+
+    mu_assert(check_gcm(zero256, AES_MODE_256, zero_iv, zero128,
+                "cea7403d4d606b6e074ec5d3baf39d18",
+                "d0d1c8a799996bf0265b98b5d48ab919", ni) == NULL, "GCM case 14 failed.");
+
+    return NULL;
+}
+
+char *test_GCM_vectors()
+{
+    GCM_CTX probe;
+    GCM_set_key(&probe, AES_KEY, AES_MODE_128);
+
+    mu_assert(check_gcm_vectors(0) == NULL, "Portable GCM failed.");
+
+    if(probe.ni) {
+        mu_assert(check_gcm_vectors(1) == NULL, "PCLMULQDQ GCM failed.");
+    } else {
+        debug("No PCLMULQDQ on this CPU, only the portable GCM is tested.");
+    }
+
+    return NULL;
+}
+
+char *test_GCM_same_output()
+{
+    AES_MODE modes[2] = {AES_MODE_128, AES_MODE_256};
+    // partial blocks, the 4 block loops and more than one 4k chunk
+    int lengths[6] = {0, 1, 17, 64, 100, 9000};
+    uint8_t iv[GCM_IV_SIZE];
+    uint8_t aad[13];
+    uint8_t *plain = malloc(9000 + 8);
+    uint8_t *slow = malloc(9000);
+    uint8_t *fast = malloc(9000 + 8);
+    uint8_t slow_tag[GCM_TAG_SIZE], fast_tag[GCM_TAG_SIZE];
+    GCM_CTX slow_ctx, fast_ctx;
+    int m = 0, l = 0, i = 0;
+
+    for(i = 0; i < 9000 + 8; i++) plain[i] = random();
+    for(i = 0; i < GCM_IV_SIZE; i++) iv[i] = random();
+    for(i = 0; i < (int)sizeof(aad); i++) aad[i] = random();
+
+    for(m = 0; m < 2; m++) {
+        GCM_set_key(&slow_ctx, AES_KEY, modes[m]);
+        slow_ctx.ni = slow_ctx.aes.ni = 0;
+        GCM_set_key(&fast_ctx, AES_KEY, modes[m]);
+
+        for(l = 0; l < 6; l++) {
+            int len = lengths[l];
+
+            GCM_encrypt(&slow_ctx, iv, aad, sizeof(aad), plain, slow, len, slow_tag);
+            GCM_encrypt(&fast_ctx, iv, aad, sizeof(aad), plain, fast, len, fast_tag);
+            mu_assert(memcmp(slow, fast, len) == 0, "GCM encryption differs.");
+            mu_assert(memcmp(slow_tag, fast_tag, GCM_TAG_SIZE) == 0, "GCM tag differs.");
+
+            // tls1.c opens records over the 8 byte explicit nonce in front
+            memcpy(fast + 8, slow, len);
+            mu_assert(GCM_decrypt(&fast_ctx, iv, aad, sizeof(aad),
+                        fast + 8, fast, len, slow_tag) == 0, "GCM tag rejected.");
+            mu_assert(memcmp(fast, plain, len) == 0, "GCM decryption is wrong.");
+
+            memcpy(fast + 8, slow, len);
+            mu_assert(GCM_decrypt(&slow_ctx, iv, aad, sizeof(aad),
+                        fast + 8, fast, len, slow_tag) == 0, "Portable GCM tag rejected.");
+            mu_assert(memcmp(fast, plain, len) == 0, "Portable GCM decryption is wrong.");
+        }
+    }
+
+    free(plain);
+    free(slow);
+    free(fast);
+    return NULL;
+}
+
+// RFC 7748 section 5.2 and the Alice and Bob exchange from section 6.1
+char *test_X25519_vectors()
+{
+    uint8_t alice[X25519_SIZE], bob[X25519_SIZE], point[X25519_SIZE];
+    uint8_t alice_pub[X25519_SIZE], bob_pub[X25519_SIZE];
+    uint8_t out[X25519_SIZE], shared[X25519_SIZE];
+
+    unhex("a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4", alice);
+    unhex("e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c", point);
+    mu_assert(X25519(out, alice, point) == 0, "X25519 failed.");
+    mu_assert(hex_is(out, X25519_SIZE,
+                "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552"),
+            "Wrong X25519 result.");
+
+    unhex("77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a", alice);
+    unhex("5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb", bob);
+    X25519_public(alice_pub, alice);
+    X25519_public(bob_pub, bob);
+    mu_assert(hex_is(alice_pub, X25519_SIZE,
+                "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a"),
+            "Wrong X25519 public key.");
+
+    mu_assert(X25519(shared, alice, bob_pub) == 0, "X25519 failed.");
+    mu_assert(X25519(out, bob, alice_pub) == 0, "X25519 failed.");
+    mu_assert(memcmp(shared, out, X25519_SIZE) == 0, "X25519 sides disagree.");
+    mu_assert(hex_is(shared, X25519_SIZE,
+                "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742"),
+            "Wrong X25519 shared secret.");
+
+    // a point of small order has to be refused, not give a zero key
+    memset(point, 0, sizeof(point));
+    mu_assert(X25519(out, alice, point) == -1, "Zero X25519 secret accepted.");
+
+    return NULL;
+}
+
+// a throwaway 512 bit key, and what openssl signs the digest with it to
+static const char *RSA_PARTS[] = {
+    "bfa7a953b53e7cae91af41bfcafd181b316b3531ff3174f4d439a29c42de015c"
+    "cb96b3f8ed6157b23f546d91335686e4de36d90951b08fae9779051781c154a7",
+    "010001",
+    "0d6f414d5edd1c7c583602d3e0f4d0e5c7170ec98c6bf918d86f99d87e4f75a4"
+    "de6e6392d94e8638671af94122ae8495daa75726a562f04d9b5f84d6629c9d41",
+    "f1011b82e60baf5aa14460e5d1525f5a91ce1066c3dfa1f75cc91dcf025da197",
+    "cb947b14af19f26797a223d84cf8b74a2555d9215a9288b63e866eb32f892771",
+    "e5b9ce8599ceed99903b63b9ed2b7da51172c1039416298766b4766b8aafc185",
+    "6dfe065611995248383c2963c78aa5f550a0c694e7cbbe43c11a7f1b1f36da71",
+    "c66328b0079d909c3558de7f9264062a0e04ce33470b3203304dde6986ef8b52"
+};
+
+static const char *RSA_SIGNATURE =
+    "8b9ed1fb05a605fa2a7509fe50b299cfc3d5fb35aafc872a722ebcf6a9017737"
+    "605581525a2104c05c469462cb77882e5ea24a0a80366e6c89751bc76d110d4f";
+
+typedef struct RSAJob {
+    RSA_CTX *rsa_ctx;
+    uint8_t sig[64];
+    int sig_len;
+} RSAJob;
+
+static void rsa_sign_job(void *arg)
+{
+    RSAJob *job = arg;
+    job->sig_len = RSA_encrypt(job->rsa_ctx,
+            (const uint8_t *)"0123456789abcdefghij", 20, job->sig, 1);
+}
+
+char *test_RSA_clone()
+{
+    uint8_t parts[8][64];
+    int lens[8];
+    int i = 0;
+    RSA_CTX *rsa_ctx = NULL;
+    RSAJob job;
+
+    for(i = 0; i < 8; i++) {
+        lens[i] = strlen(RSA_PARTS[i]) / 2;
+        unhex(RSA_PARTS[i], parts[i]);
+    }
+
+    RSA_priv_key_new(&rsa_ctx, parts[0], lens[0], parts[1], lens[1],
+            parts[2], lens[2], parts[3], lens[3], parts[4], lens[4],
+            parts[5], lens[5], parts[6], lens[6], parts[7], lens[7]);
+
+    job.rsa_ctx = rsa_ctx;
+    rsa_sign_job(&job);
+    mu_assert(job.sig_len == 64, "Wrong RSA signature size.");
+    mu_assert(hex_is(job.sig, job.sig_len, RSA_SIGNATURE), "Wrong RSA signature.");
+
+    // the copy signs on a task thread while the original is still around
+    job.rsa_ctx = RSA_clone(rsa_ctx);
+    mu_assert(job.rsa_ctx != NULL, "Failed to clone the RSA key.");
+    memset(job.sig, 0, sizeof(job.sig));
+    mu_assert(taskthread(rsa_sign_job, &job) == 0, "Task thread failed.");
+    mu_assert(job.sig_len == 64, "Wrong RSA signature size from the copy.");
+    mu_assert(hex_is(job.sig, job.sig_len, RSA_SIGNATURE),
+            "Wrong RSA signature from the copy.");
+
+    RSA_free(job.rsa_ctx);
+    RSA_free(rsa_ctx);
+    return NULL;
+}
+
+char * all_tests() {
+    mu_suite_start();
+
+    mu_run_test(test_AES_vectors);
+    mu_run_test(test_AES_cbc_same_output);
+    mu_run_test(test_SHA1_vectors);
+    mu_run_test(test_SHA1_same_output);
+    mu_run_test(test_hmac_sha1_key);
+    mu_run_test(test_SHA2_vectors);
+    mu_run_test(test_GCM_vectors);
+    mu_run_test(test_GCM_same_output);
+    mu_run_test(test_X25519_vectors);
+    mu_run_test(test_RSA_clone);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -74,6 +74,11 @@ static ssize_t my_send(Connection *conn, char *buffer, int len)
     return -1;
 }
 
+static ssize_t my_sendv(Connection *conn, struct iovec *iov, int iovcnt)
+{
+    return -1;
+}
+
 char *test_Dir_serve_file()
 {
     int rc = 0;
@@ -84,6 +89,7 @@ char *test_Dir_serve_file()
     Connection conn = {0};
     conn.fd = 1;
     conn.send = my_send;
+    conn.sendv = my_sendv;
 
     req = fake_req("GET", "/sample.json");
     rc = Dir_serve_file(test, req, &conn);
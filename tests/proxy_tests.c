@@ -2,6 +2,12 @@
 #include <proxy.h>
 #include <stdlib.h>
 #include <mem/halloc.h>
+#include <task/task.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <connection.h>
+#include <http11/httpclient_parser.h>
+#include <setting.h>
 
 FILE *LOG_FILE = NULL;
 
@@ -16,10 +22,430 @@ char *test_Proxy_create_destroy()
     return NULL;
 }
 
+char *test_Proxy_resolve()
+{
+    Proxy *proxy = Proxy_create(bfromcstr("localhost"), 80);
+    mu_assert(proxy != NULL, "Didn't make the proxy.");
+
+    ProxyAddrs *addrs = Proxy_resolve(proxy);
+    mu_assert(addrs != NULL, "Failed to resolve localhost.");
+    mu_assert(addrs->ai != NULL, "Should have at least one address.");
+
+    ProxyAddrs *again = Proxy_resolve(proxy);
+    mu_assert(again == addrs, "Second lookup should come from the cache.");
+    mu_assert(addrs->refcount == 3, "Both callers and the proxy should hold it.");
+
+    ProxyAddrs_release(again);
+    ProxyAddrs_release(addrs);
+
+    // expire it and make sure it gets looked up again
+    proxy->expires = 0;
+    again = Proxy_resolve(proxy);
+    mu_assert(again != NULL, "Failed to resolve localhost after expiring.");
+    ProxyAddrs_release(again);
+
+    Proxy_destroy(proxy);
+
+    proxy = Proxy_create(bfromcstr("::1"), 80);
+    addrs = Proxy_resolve(proxy);
+    mu_assert(addrs != NULL, "Failed to resolve an IPv6 address.");
+    mu_assert(addrs->ai->ai_family == AF_INET6, "Should be an IPv6 address.");
+    ProxyAddrs_release(addrs);
+    Proxy_destroy(proxy);
+
+    proxy = Proxy_create(bfromcstr("nonexistent.invalid"), 80);
+    mu_assert(Proxy_resolve(proxy) == NULL, "Shouldn't resolve an invalid name.");
+    Proxy_destroy(proxy);
+
+    return NULL;
+}
+
+char *test_Proxy_connect()
+{
+    int port = 0;
+    int fd = netannounce(TCP, "127.0.0.1", 0);
+    mu_assert(fd >= 0, "Failed to listen.");
+
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    getsockname(fd, (struct sockaddr *)&ss, &len);
+    port = ntohs(((struct sockaddr_in *)&ss)->sin_port);
+
+    Proxy *proxy = Proxy_create(bfromcstr("127.0.0.1"), port);
+    int pfd = Proxy_connect(proxy);
+    mu_assert(pfd >= 0, "Failed to connect to the backend.");
+
+    close(pfd);
+    close(fd);
+    Proxy_destroy(proxy);
+
+    // same again over IPv6
+    fd = netannounce(TCP, "::1", 0);
+    mu_assert(fd >= 0, "Failed to listen on IPv6.");
+    len = sizeof(ss);
+    getsockname(fd, (struct sockaddr *)&ss, &len);
+    mu_assert(ss.ss_family == AF_INET6, "Should be listening on IPv6.");
+    port = ntohs(((struct sockaddr_in6 *)&ss)->sin6_port);
+
+    proxy = Proxy_create(bfromcstr("::1"), port);
+    pfd = Proxy_connect(proxy);
+    mu_assert(pfd >= 0, "Failed to connect to the IPv6 backend.");
+
+    close(pfd);
+    close(fd);
+    Proxy_destroy(proxy);
+
+    // and a unix socket, twice to be sure a stale one gets cleaned up
+    fd = netannounce(TCP, "/tmp/mongrel2_proxy_test.sock", 0);
+    mu_assert(fd >= 0, "Failed to listen on a unix socket.");
+    close(fd);
+    fd = netannounce(TCP, "/tmp/mongrel2_proxy_test.sock", 0);
+    mu_assert(fd >= 0, "Failed to listen on a stale unix socket.");
+
+    proxy = Proxy_create(bfromcstr("/tmp/mongrel2_proxy_test.sock"), 0);
+    pfd = Proxy_connect(proxy);
+    mu_assert(pfd >= 0, "Failed to connect to the unix socket backend.");
+
+    char remote[IPADDR_SIZE];
+    int cfd = netaccept(fd, remote, &port);
+    mu_assert(cfd >= 0, "Failed to accept on the unix socket.");
+    mu_assert(strcmp(remote, "unix:") == 0, "Wrong remote address for a unix socket.");
+
+    close(cfd);
+    close(pfd);
+    close(fd);
+    unlink("/tmp/mongrel2_proxy_test.sock");
+    Proxy_destroy(proxy);
+
+    return NULL;
+}
+
+char *test_Proxy_read_and_parse()
+{
+    int fds[2] = {-1, -1};
+    int i = 0;
+    int nread = 0;
+    bstring resp = bfromcstr("HTTP/1.1 200 OK\r\n");
+
+    // enough headers to overflow the starting buffer a few times
+    for(i = 0; i < 20; i++) {
+        bformata(resp, "X-Filler-%d: abcdefghijklmnopqrstuvwxyz\r\n", i);
+    }
+    bcatcstr(resp, "Content-Length: 5\r\n\r\nhello");
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Failed to make a socketpair.");
+
+    Proxy *proxy = Proxy_create(bfromcstr("127.0.0.1"), 80);
+    Connection *conn = h_calloc(sizeof(Connection), 1);
+    conn->proxy_fd = fds[0];
+    conn->proxy_buf_size = 64;
+    conn->proxy_buf = h_calloc(conn->proxy_buf_size + 1, 1);
+    hattach(conn->proxy_buf, conn);
+    conn->client = h_calloc(sizeof(httpclient_parser), 1);
+    hattach(conn->client, conn);
+
+    mu_assert(write(fds[1], bdata(resp), blength(resp)) == blength(resp), "Failed to write.");
+
+    nread = Proxy_read_and_parse(conn, 0);
+    mu_assert(nread == blength(resp), "Should have read the whole response.");
+    mu_assert(conn->proxy_buf_size > 64, "Should have grown the buffer.");
+    mu_assert(conn->client->status == 200, "Wrong status.");
+    mu_assert(conn->client->content_len == 5, "Wrong content length.");
+    mu_assert(conn->client->body_start == blength(resp) - 5, "Wrong body start.");
+
+    // a header that never ends has to hit limits.proxy_header_size
+    PROXY_HEADER_MAX = 128;
+    conn->proxy_buf_size = 64;
+    for(i = 0; i < 4; i++) {
+        write(fds[1], bdata(resp), 64);
+    }
+    mu_assert(Proxy_read_and_parse(conn, 0) == -1, "Should reject a huge header.");
+
+    close(fds[0]);
+    close(fds[1]);
+    h_free(conn);
+    bdestroy(resp);
+    Proxy_destroy(proxy);
+
+    return NULL;
+}
+
+#define BACKEND_SOCK "/tmp/mongrel2_proxy_retry.sock"
+
+static const char *REPLY = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+
+typedef struct FlakyBackend {
+    int listen_fd;
+    int first_fd;
+    int hang;
+} FlakyBackend;
+
+/* Gets the first connection wrong, either by hanging up or by never
+ * answering, then answers the second one properly. */
+static void backend_task(void *data)
+{
+    FlakyBackend *backend = data;
+    char buf[1024];
+    int fd = -1;
+
+    backend->first_fd = netaccept(backend->listen_fd, NULL, NULL);
+    if(!backend->hang) close(backend->first_fd);
+
+    fd = netaccept(backend->listen_fd, NULL, NULL);
+    fdrecv(fd, buf, sizeof(buf));
+    fdsend(fd, (char *)REPLY, strlen(REPLY));
+    close(fd);
+
+    taskexit(0);
+}
+
+static Connection *make_proxy_conn(Proxy *proxy)
+{
+    Connection *conn = h_calloc(sizeof(Connection), 1);
+    conn->proxy_fd = Proxy_connect(proxy);
+    conn->proxy_buf_size = 64;
+    conn->proxy_buf = h_calloc(conn->proxy_buf_size + 1, 1);
+    hattach(conn->proxy_buf, conn);
+    conn->client = h_calloc(sizeof(httpclient_parser), 1);
+    hattach(conn->client, conn);
+    conn->proxy_req = bfromcstr("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+
+    fdsend(conn->proxy_fd, bdata(conn->proxy_req), blength(conn->proxy_req));
+    return conn;
+}
+
+char *test_Proxy_read_reply()
+{
+    FlakyBackend backend = {.listen_fd = netannounce(TCP, BACKEND_SOCK, 0)};
+    Proxy *proxy = Proxy_create(bfromcstr(BACKEND_SOCK), 0);
+    Connection *conn = NULL;
+    int first_fd = 0;
+
+    mu_assert(backend.listen_fd >= 0, "Failed to listen.");
+
+    // the backend hangs up on the first try
+    proxy->retries = 1;
+    taskcreate(backend_task, &backend, 32 * 1024);
+    conn = make_proxy_conn(proxy);
+
+    mu_assert(Proxy_read_reply(conn, proxy) == (int)strlen(REPLY), "Retry should have gotten the reply.");
+    mu_assert(conn->client->status == 200, "Wrong status after retry.");
+
+    close(conn->proxy_fd);
+    bdestroy(conn->proxy_req);
+    h_free(conn);
+
+    // now it sits on the first one, so the hedged request has to win
+    proxy->retries = 0;
+    proxy->hedge_delay = 50;
+    backend.hang = 1;
+    taskcreate(backend_task, &backend, 32 * 1024);
+    conn = make_proxy_conn(proxy);
+    first_fd = conn->proxy_fd;
+
+    mu_assert(Proxy_read_reply(conn, proxy) == (int)strlen(REPLY), "Hedged request should have answered.");
+    mu_assert(conn->proxy_fd != first_fd, "Should be using the hedged connection.");
+
+    close(conn->proxy_fd);
+    close(backend.first_fd);
+    bdestroy(conn->proxy_req);
+    h_free(conn);
+
+    close(backend.listen_fd);
+    unlink(BACKEND_SOCK);
+    Proxy_destroy(proxy);
+
+    return NULL;
+}
+
+char *test_ChunkParser()
+{
+    ChunkParser chunks;
+    const char *body = "5\r\nhello\r\n1a;name=value\r\nabcdefghijklmnopqrstuvwxyz\r\n"
+        "0\r\nX-Trailer: yes\r\n\r\nEXTRA";
+    int len = strlen(body) - strlen("EXTRA");
+    int i = 0;
+    int rc = 0;
+
+    ChunkParser_init(&chunks);
+    rc = ChunkParser_execute(&chunks, body, strlen(body));
+    mu_assert(rc == len, "Should stop right after the trailer.");
+    mu_assert(chunks.state == CHUNK_DONE, "Should be done.");
+
+    // the same thing a byte at a time has to land in the same place
+    ChunkParser_init(&chunks);
+    for(i = 0; chunks.state != CHUNK_DONE; i++) {
+        mu_assert(i < len, "Went past the end of the chunks.");
+        rc = ChunkParser_execute(&chunks, body + i, 1);
+        mu_assert(rc == 1, "Should take every byte.");
+    }
+    mu_assert(i == len, "Finished in the wrong place.");
+
+    ChunkParser_init(&chunks);
+    rc = ChunkParser_execute(&chunks, "5\r\nhelloX\r\n", 11);
+    mu_assert(rc == -1, "Should reject a chunk without a CRLF.");
+
+    ChunkParser_init(&chunks);
+    rc = ChunkParser_execute(&chunks, "zz\r\n", 4);
+    mu_assert(rc == -1, "Should reject a bad chunk size.");
+
+    ChunkParser_init(&chunks);
+    rc = ChunkParser_execute(&chunks, "ffffffffffffffffff\r\n", 20);
+    mu_assert(rc == -1, "Should reject an enormous chunk size.");
+
+    return NULL;
+}
+
+static bstring SENT = NULL;
+static int SENDS = 0;
+
+static ssize_t my_send(Connection *conn, char *buffer, int len)
+{
+    bcatblk(SENT, buffer, len);
+    SENDS++;
+    return len;
+}
+
+char *test_Proxy_stream_chunks()
+{
+    int fds[2] = {-1, -1};
+    int i = 0;
+    int rc = 0;
+    bstring resp = bfromcstr("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+    bstring more = bfromcstr("");
+
+    for(i = 0; i < 100; i++) {
+        bcatcstr(i < 50 ? resp : more, "1\r\nx\r\n");
+    }
+    bcatcstr(more, "0\r\n\r\n");
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Failed to make a socketpair.");
+
+    Connection *conn = h_calloc(sizeof(Connection), 1);
+    conn->proxy_fd = fds[0];
+    conn->proxy_buf_size = 1024;
+    conn->proxy_buf = h_calloc(conn->proxy_buf_size + 1, 1);
+    hattach(conn->proxy_buf, conn);
+    conn->client = h_calloc(sizeof(httpclient_parser), 1);
+    hattach(conn->client, conn);
+    conn->send = my_send;
+    SENT = bfromcstr("");
+
+    write(fds[1], bdata(resp), blength(resp));
+    rc = Proxy_read_and_parse(conn, 0);
+    mu_assert(rc == blength(resp), "Should read the header and first chunks.");
+    mu_assert(conn->client->chunked, "Should be chunked.");
+
+    write(fds[1], bdata(more), blength(more));
+    rc = Proxy_stream_chunks(conn, rc);
+    mu_assert(rc == 1, "Failed to stream the chunks.");
+
+    bconcat(resp, more);
+    mu_assert(biseq(SENT, resp), "Didn't relay the response as is.");
+    mu_assert(SENDS == 2, "Should send once per read.");
+
+    close(fds[0]);
+    close(fds[1]);
+    h_free(conn);
+    bdestroy(resp);
+    bdestroy(more);
+    bdestroy(SENT);
+
+    return NULL;
+}
+
+static int buffer_response(Proxy *proxy, bstring resp)
+{
+    int fds[2] = {-1, -1};
+    int rc = 0;
+
+    check(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Failed to make a socketpair.");
+
+    Connection *conn = h_calloc(sizeof(Connection), 1);
+    conn->proxy_fd = fds[0];
+    conn->proxy_buf_size = 1024;
+    conn->proxy_buf = h_calloc(conn->proxy_buf_size + 1, 1);
+    hattach(conn->proxy_buf, conn);
+    conn->client = h_calloc(sizeof(httpclient_parser), 1);
+    hattach(conn->client, conn);
+    conn->send = my_send;
+
+    bassigncstr(SENT, "");
+    SENDS = 0;
+
+    check(write(fds[1], bdata(resp), blength(resp)) == blength(resp), "Failed to write.");
+    shutdown(fds[1], SHUT_WR);
+
+    rc = Proxy_read_and_parse(conn, 0);
+    check(rc != -1, "Failed to read the header.");
+
+    rc = Proxy_buffer_response(conn, proxy, rc);
+    check(rc == 0, "Failed to buffer the response.");
+    check(conn->proxy_fd == 0, "Should have let go of the backend.");
+    check(conn->proxy_buf_size <= BUFFER_SIZE, "Should shrink the buffer back down.");
+
+    h_free(conn);
+    close(fds[1]);
+    return 0;
+
+error:
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+}
+
+char *test_Proxy_buffer_response()
+{
+    int i = 0;
+    Proxy *proxy = Proxy_create(bfromcstr("127.0.0.1"), 80);
+    bstring resp = bfromcstr("HTTP/1.1 200 OK\r\nContent-Length: 20000\r\n\r\n");
+    bstring chunked = bfromcstr("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+
+    for(i = 0; i < 2000; i++) {
+        bcatcstr(resp, "0123456789");
+        bcatcstr(chunked, "a\r\n0123456789\r\n");
+    }
+    bcatcstr(chunked, "0\r\n\r\n");
+
+    SENT = bfromcstr("");
+    proxy->buffer_size = 64 * 1024;
+
+    mu_assert(buffer_response(proxy, resp) == 0, "Failed to buffer in memory.");
+    mu_assert(biseq(SENT, resp), "Buffered response is wrong.");
+    mu_assert(SENDS == 1, "Should go out in one send.");
+
+    mu_assert(buffer_response(proxy, chunked) == 0, "Failed to buffer chunks in memory.");
+    mu_assert(biseq(SENT, chunked), "Buffered chunked response is wrong.");
+
+    // no temp_store means what doesn't fit gets streamed
+    proxy->buffer_size = 4096;
+    mu_assert(buffer_response(proxy, resp) == 0, "Failed to buffer with no temp_store.");
+    mu_assert(biseq(SENT, resp), "Streamed response is wrong.");
+    mu_assert(SENDS > 1, "Should have streamed it.");
+
+    Setting_add("proxy.temp_store", "/tmp/mongrel2-proxy-test.XXXXXX");
+    mu_assert(buffer_response(proxy, chunked) == 0, "Failed to spill to a tempfile.");
+    mu_assert(biseq(SENT, chunked), "Spilled response is wrong.");
+
+    bdestroy(resp);
+    bdestroy(chunked);
+    bdestroy(SENT);
+    Proxy_destroy(proxy);
+
+    return NULL;
+}
+
 char * all_tests() {
     mu_suite_start();
 
     mu_run_test(test_Proxy_create_destroy);
+    mu_run_test(test_Proxy_resolve);
+    mu_run_test(test_Proxy_connect);
+    mu_run_test(test_Proxy_read_and_parse);
+    mu_run_test(test_Proxy_read_reply);
+    mu_run_test(test_ChunkParser);
+    mu_run_test(test_Proxy_stream_chunks);
+    mu_run_test(test_Proxy_buffer_response);
 
     return NULL;
 }
@@ -1,5 +1,6 @@
 #include "minunit.h"
 #include <register.h>
+#include <unistd.h>
 
 FILE *LOG_FILE = NULL;
 
@@ -54,6 +55,78 @@ char *test_Register_ping()
     return NULL;
 }
 
+char *test_Register_sent_elapsed()
+{
+    Register_connect(12233, CONN_TYPE_HTTP);
+    mu_assert(Register_elapsed(12233) == -1, "Nothing sent yet.");
+
+    mu_assert(Register_sent(12233, NULL) == 0, "Failed to stamp the send.");
+
+    int elapsed = Register_elapsed(12233);
+    mu_assert(elapsed >= 0, "Should time the reply.");
+    mu_assert(Register_elapsed(12233) == -1, "Only the first reply counts.");
+
+    Register_disconnect(12233);
+    mu_assert(Register_sent(12233, NULL) == -1, "Can't time a disconnected fd.");
+
+    return NULL;
+}
+
+char *test_Register_overdue()
+{
+    BREAKER_FAILURES = 2;
+    Breaker *breaker = Breaker_create(bfromcstr("tcp://127.0.0.1:9999"));
+
+    // a proxy that never replies
+    Register_connect(12234, CONN_TYPE_HTTP);
+    Register_sent(12234, breaker);
+    mu_assert(Register_overdue(1000) == 0, "Shouldn't be overdue yet.");
+
+    usleep(20 * 1000);
+    mu_assert(Register_overdue(10) == 1, "Should find the overdue request.");
+    mu_assert(breaker->failures == 1, "Overdue request should count as a failure.");
+    mu_assert(Register_overdue(10) == 0, "Should only count it once.");
+    mu_assert(Register_elapsed(12234) == -1, "A late reply shouldn't count either.");
+
+    // the client gives up first, which isn't the backend's fault
+    Register_sent(12234, breaker);
+    Register_disconnect(12234);
+    mu_assert(breaker->failures == 1, "Closing while waiting isn't a failure.");
+
+    // requests sent without a breaker, like handler long polls, are never overdue
+    Register_connect(12234, CONN_TYPE_HTTP);
+    Register_sent(12234, NULL);
+    usleep(20 * 1000);
+    mu_assert(Register_overdue(10) == 0, "Request without a breaker can't be overdue.");
+    mu_assert(Register_elapsed(12234) >= 0, "Should still time the reply.");
+    Register_disconnect(12234);
+
+    Register_connect(12234, CONN_TYPE_HTTP);
+    Register_sent(12234, breaker);
+    usleep(20 * 1000);
+    mu_assert(Register_overdue(10) == 1, "Should find the overdue request.");
+    mu_assert(breaker->state == BREAKER_OPEN, "Dead backend should trip the breaker.");
+    Register_disconnect(12234);
+
+    // a reply that does come in clears it
+    Register_connect(12234, CONN_TYPE_HTTP);
+    Register_sent(12234, breaker);
+    mu_assert(Register_elapsed(12234) >= 0, "Should time the reply.");
+    Register_disconnect(12234);
+    mu_assert(breaker->failures == 2, "Answered request isn't a failure.");
+
+    // destroying the breaker on a reload drops it from waiting requests
+    Register_connect(12234, CONN_TYPE_HTTP);
+    Register_sent(12234, breaker);
+    Breaker_destroy(breaker);
+    mu_assert(Register_elapsed(12234) == -1, "Should forget the destroyed breaker.");
+    Register_disconnect(12234);
+
+    BREAKER_FAILURES = 0;
+
+    return NULL;
+}
+
 
 char * all_tests() {
     mu_suite_start();
@@ -61,6 +134,8 @@ char * all_tests() {
     mu_run_test(test_Register_init);
     mu_run_test(test_Register_connect_disconnect);
     mu_run_test(test_Register_ping);
+    mu_run_test(test_Register_sent_elapsed);
+    mu_run_test(test_Register_overdue);
 
     return NULL;
 }
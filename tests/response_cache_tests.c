@@ -0,0 +1,236 @@
+#include "minunit.h"
+#include <response_cache.h>
+#include <connection.h>
+#include <request.h>
+#include <host.h>
+#include <setting.h>
+#include <mem/halloc.h>
+#include <task/task.h>
+#include <register.h>
+#include <sys/socket.h>
+
+FILE *LOG_FILE = NULL;
+
+static bstring SENT = NULL;
+
+static ssize_t my_send(Connection *conn, char *buffer, int len)
+{
+    bcatblk(SENT, buffer, len);
+    return len;
+}
+
+static Host HOST;
+static Backend BACKEND = {.type = BACKEND_PROXY};
+static Handler HANDLER = {.coalesce = 1};
+static Backend COALESCE = {.type = BACKEND_HANDLER, .target.handler = &HANDLER};
+
+static Connection *make_conn(int fd, const char *request)
+{
+    size_t nparsed = 0;
+    Connection *conn = h_calloc(sizeof(Connection), 1);
+
+    conn->fd = fd;
+    conn->send = my_send;
+    conn->req = Request_create();
+    Request_start(conn->req);
+    Request_parse(conn->req, (char *)request, strlen(request), &nparsed);
+    conn->req->target_host = &HOST;
+    Request_set_action(conn->req, &BACKEND);
+
+    return conn;
+}
+
+static void free_conn(Connection *conn)
+{
+    Request_destroy(conn->req);
+    h_free(conn);
+}
+
+static const char *GET_GZIP = "GET /hot?x=1 HTTP/1.1\r\nHost: localhost\r\nAccept-Encoding: gzip\r\n\r\n";
+static const char *GET_PLAIN = "GET /hot?x=1 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+static const char *RESPONSE = "HTTP/1.1 200 OK\r\nCache-Control: public, max-age=60\r\n"
+    "Vary: Accept-Encoding\r\nContent-Length: 5\r\n\r\nhello";
+
+
+char *test_ResponseCache_ttl()
+{
+    int stale = 0;
+    struct tagbstring cc = bsStatic("public, max-age=30, stale-while-revalidate=5");
+    struct tagbstring shared = bsStatic("max-age=30, s-maxage=90");
+    struct tagbstring nostore = bsStatic("no-store");
+    struct tagbstring priv = bsStatic("private, max-age=30");
+    struct tagbstring expires = bsStatic("Thu, 01 Jan 1970 00:01:40 GMT");
+
+    mu_assert(ResponseCache_ttl(&cc, NULL, 0, &stale) == 30, "Wrong max-age.");
+    mu_assert(stale == 5, "Wrong stale-while-revalidate.");
+    mu_assert(ResponseCache_ttl(&shared, NULL, 0, &stale) == 90, "s-maxage should win.");
+    mu_assert(ResponseCache_ttl(&nostore, NULL, 0, &stale) <= 0, "no-store is cacheable.");
+    mu_assert(ResponseCache_ttl(&priv, NULL, 0, &stale) <= 0, "private is cacheable.");
+    mu_assert(ResponseCache_ttl(NULL, &expires, 40, &stale) == 60, "Wrong Expires math.");
+    mu_assert(ResponseCache_ttl(NULL, NULL, 0, &stale) == CACHE_DEFAULT_TTL, "Should use the default.");
+
+    return NULL;
+}
+
+char *test_ResponseCache_fill_and_hit()
+{
+    Connection *filler = make_conn(10, GET_GZIP);
+    Connection *hit = make_conn(11, GET_GZIP);
+    Connection *other = make_conn(12, GET_PLAIN);
+    int len = strlen(RESPONSE);
+
+    SENT = bfromcstr("");
+
+    mu_assert(ResponseCache_request(filler) == CACHE_MISS, "First request should miss.");
+
+    // the reply can come in pieces
+    ResponseCache_capture(filler->fd, RESPONSE, 20);
+    mu_assert(ResponseCache_used() == 0, "Shouldn't store half a response.");
+    ResponseCache_capture(filler->fd, RESPONSE + 20, len - 20);
+    mu_assert(ResponseCache_used() > 0, "Should have stored the response.");
+
+    mu_assert(ResponseCache_request(hit) == CACHE_HIT, "Second request should hit.");
+    mu_assert(biseqcstr(SENT, RESPONSE), "Didn't send the cached response.");
+
+    mu_assert(ResponseCache_request(other) == CACHE_MISS, "Different Accept-Encoding is another variant.");
+    ResponseCache_abandon(other->fd);
+
+    free_conn(filler);
+    free_conn(hit);
+    free_conn(other);
+    bdestroy(SENT);
+
+    return NULL;
+}
+
+char *test_ResponseCache_pass()
+{
+    Connection *conn = make_conn(10, "GET /private HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    Connection *post = make_conn(11, "POST /private HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    const char *resp = "HTTP/1.1 200 OK\r\nCache-Control: private\r\nContent-Length: 2\r\n\r\nhi";
+
+    mu_assert(ResponseCache_request(post) == CACHE_BYPASS, "POST shouldn't be cached.");
+
+    mu_assert(ResponseCache_request(conn) == CACHE_MISS, "Should miss the first time.");
+    ResponseCache_capture(conn->fd, resp, strlen(resp));
+
+    mu_assert(ResponseCache_request(conn) == CACHE_BYPASS, "Private responses should pass.");
+
+    free_conn(conn);
+    free_conn(post);
+
+    return NULL;
+}
+
+static int WAITER_RESULT = -1;
+
+static void waiter(void *data)
+{
+    Connection *conn = data;
+    WAITER_RESULT = ResponseCache_request(conn);
+    taskexit(0);
+}
+
+char *test_ResponseCache_collapse()
+{
+    Connection *filler = make_conn(10, "GET /slow HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    Connection *waiting = make_conn(11, "GET /slow HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    const char *resp = "HTTP/1.1 200 OK\r\nCache-Control: max-age=10\r\nContent-Length: 4\r\n\r\nslow";
+
+    SENT = bfromcstr("");
+
+    mu_assert(ResponseCache_request(filler) == CACHE_MISS, "Should miss the first time.");
+
+    taskcreate(waiter, waiting, 32 * 1024);
+    taskyield();
+    mu_assert(WAITER_RESULT == -1, "Second request should be waiting on the first.");
+
+    ResponseCache_capture(filler->fd, resp, strlen(resp));
+    while(WAITER_RESULT == -1) taskyield();
+
+    mu_assert(WAITER_RESULT == CACHE_HIT, "Waiter should get the filled response.");
+    mu_assert(biseqcstr(SENT, resp), "Waiter got the wrong response.");
+
+    free_conn(filler);
+    free_conn(waiting);
+    bdestroy(SENT);
+
+    return NULL;
+}
+
+static Connection *WAITING[2] = {NULL};
+static int WAITER_RESULTS[2] = {-1, -1};
+
+static void coalesce_waiter(void *data)
+{
+    int i = data == WAITING[0] ? 0 : 1;
+    WAITER_RESULTS[i] = ResponseCache_request(WAITING[i]);
+    taskexit(0);
+}
+
+char *test_ResponseCache_coalesce()
+{
+    const char *req = "GET /live HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    const char *resp = "HTTP/1.1 200 OK\r\nCache-Control: no-store\r\nContent-Length: 4\r\n\r\nlive";
+    int len = strlen(resp);
+    Connection *filler = make_conn(10, req);
+    int fds[2][2];
+    char got[128];
+    int i = 0;
+
+    Request_set_action(filler->req, &COALESCE);
+
+    for(i = 0; i < 2; i++) {
+        mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]) == 0, "Failed to make socketpair.");
+        fdnoblock(fds[i][0]);
+        Register_connect(fds[i][0], CONN_TYPE_HTTP);
+
+        WAITING[i] = make_conn(fds[i][0], req);
+        Request_set_action(WAITING[i]->req, &COALESCE);
+    }
+
+    mu_assert(ResponseCache_request(filler) == CACHE_MISS, "Should miss the first time.");
+
+    for(i = 0; i < 2; i++) taskcreate(coalesce_waiter, WAITING[i], 32 * 1024);
+    taskyield();
+    mu_assert(WAITER_RESULTS[0] == -1 && WAITER_RESULTS[1] == -1, "Requests should be parked.");
+
+    ResponseCache_capture(filler->fd, resp, len);
+    while(WAITER_RESULTS[0] == -1 || WAITER_RESULTS[1] == -1) taskyield();
+
+    for(i = 0; i < 2; i++) {
+        mu_assert(WAITER_RESULTS[i] == CACHE_HIT, "Parked request didn't get the reply.");
+        mu_assert(recv(fds[i][1], got, sizeof(got), 0) == len, "Wrong amount sent.");
+        mu_assert(strncmp(got, resp, len) == 0, "Parked request got the wrong reply.");
+    }
+
+    // no-store means it wasn't kept, and there's no pass entry holding up the next one
+    mu_assert(ResponseCache_request(filler) == CACHE_MISS, "Uncacheable reply shouldn't be kept.");
+    ResponseCache_abandon(filler->fd);
+
+    for(i = 0; i < 2; i++) {
+        Register_disconnect(fds[i][0]);
+        close(fds[i][1]);
+        free_conn(WAITING[i]);
+    }
+    free_conn(filler);
+
+    return NULL;
+}
+
+char * all_tests() {
+    mu_suite_start();
+
+    Setting_add("cache.max_size", "1048576");
+    Request_init();
+
+    mu_run_test(test_ResponseCache_ttl);
+    mu_run_test(test_ResponseCache_fill_and_hit);
+    mu_run_test(test_ResponseCache_pass);
+    mu_run_test(test_ResponseCache_collapse);
+    mu_run_test(test_ResponseCache_coalesce);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
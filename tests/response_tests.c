@@ -34,11 +34,26 @@ char *test_Response_send_socket_policy()
 }
 
 
+char *test_Response_date()
+{
+    bstring date = Response_date();
+    mu_assert(blength(date) > 0, "Should have a date before the ticker runs.");
+
+    Response_date_update(0);
+    date = Response_date();
+    mu_assert(biseqcstr(date, "Thu, 01 Jan 1970 00:00:00 GMT"),
+            "Wrong date after update.");
+
+    return NULL;
+}
+
+
 char * all_tests() {
     mu_suite_start();
 
     mu_run_test(test_Response_send_status);
     mu_run_test(test_Response_send_socket_policy);
+    mu_run_test(test_Response_date);
 
     return NULL;
 }
@@ -2,6 +2,7 @@
 #include <server.h>
 #include <string.h>
 #include <task/task.h>
+#include <setting.h>
 
 FILE *LOG_FILE = NULL;
 
@@ -16,7 +17,7 @@ char *test_Server_init()
 
 char *test_Server_create_destroy()
 {
-    Server *server = Server_create("uuid", "localhost", "8080", "chroot", "access_log", "error_log", "pid_file");
+    Server *server = Server_create("uuid", "localhost", "8080", "0.0.0.0", "chroot", "access_log", "error_log", "pid_file");
     mu_assert(server != NULL, "Failed to make the server, something on 8090?");
 
     Server_destroy(server);
@@ -29,7 +30,7 @@ char *test_Server_adds()
 {
     int rc = 0;
 
-    Server *srv = Server_create("uuid", "localhost", "8080", "chroot", "access_log", "error_log", "pid_file");
+    Server *srv = Server_create("uuid", "localhost", "8080", "0.0.0.0", "chroot", "access_log", "error_log", "pid_file");
     mu_assert(srv != NULL, "Failed to make the server, something on 8090?");
 
     Host *host = Host_create("zedshaw.com");
@@ -48,6 +49,50 @@ char *test_Server_adds()
     return NULL;
 }
 
+char *test_Server_init_ssl()
+{
+    int rc = 0;
+
+    Server *srv = Server_create("uuid", "localhost", "8080", "0.0.0.0", "chroot", "access_log", "error_log", "pid_file");
+    mu_assert(srv != NULL, "Failed to make the server.");
+
+    Host *zedshaw = Host_create("zedshaw.com");
+    Host *local = Host_create("localhost");
+    Server_add_host(srv, bstrcpy(zedshaw->name), zedshaw);
+    Server_add_host(srv, bstrcpy(local->name), local);
+
+    rc = Server_init_ssl(srv);
+    mu_assert(rc == 0 && srv->ssl_ctx == NULL, "Shouldn't load anything without use_ssl.");
+
+    Setting_add("certdir", "tests/certs/");
+    srv->use_ssl = 1;
+    rc = Server_init_ssl(srv);
+    mu_assert(rc == 0, "Failed to load the test certificates.");
+    mu_assert(srv->ssl_ctx != NULL, "Server didn't get its certificate.");
+    mu_assert(srv->ssl_ctx->num_rsa_spares > 0, "Key copies should be made up front.");
+    mu_assert(zedshaw->ssl_ctx != NULL, "zedshaw.com has its own certificate.");
+    mu_assert(local->ssl_ctx == NULL, "localhost should use the server's.");
+
+    SSL_CTX *ctx = srv->ssl_ctx;
+    mu_assert(ctx->sni_cb("ZEDSHAW.com", ctx->sni_arg) == zedshaw->ssl_ctx,
+            "SNI didn't pick the zedshaw.com certificate.");
+    mu_assert(ctx->sni_cb("localhost", ctx->sni_arg) == NULL,
+            "localhost should stay on the server's certificate.");
+    mu_assert(ctx->sni_cb("NOWAY", ctx->sni_arg) == NULL,
+            "An unknown name should stay on the server's certificate.");
+
+    Server_destroy(srv);
+
+    srv = Server_create("nocert", "localhost", "8080", "0.0.0.0", "chroot", "access_log", "error_log", "pid_file");
+    srv->use_ssl = 1;
+    mu_assert(Server_init_ssl(srv) == -1, "Should fail without a certificate.");
+    Server_destroy(srv);
+
+    Setting_destroy();
+
+    return NULL;
+}
+
 
 char *all_tests() {
     mu_suite_start();
@@ -55,6 +100,7 @@ char *all_tests() {
     mu_run_test(test_Server_init);
     mu_run_test(test_Server_create_destroy);
     mu_run_test(test_Server_adds);
+    mu_run_test(test_Server_init_ssl);
     zmq_term(ZMQ_CTX);
 
     return NULL;
@@ -0,0 +1,181 @@
+#include "minunit.h"
+#include <ssl/ssl.h>
+#include <string.h>
+#include <sys/socket.h>
+
+FILE *LOG_FILE = NULL;
+
+static void make_session(SSL_SESSION *session, uint8_t first, uint8_t fill)
+{
+    memset(session, 0, sizeof(SSL_SESSION));
+    session->conn_time = time(NULL);
+    session->cipher = SSL_AES128_GCM_SHA256;
+    session->version = SSL_PROTOCOL_VERSION_1_2;
+    memset(session->session_id, fill, SSL_SESSION_ID_SIZE);
+    session->session_id[0] = first;
+    memset(session->master_secret, fill, SSL_SECRET_SIZE);
+}
+
+char *test_session_cache()
+{
+    SSL_CTX *ssl_ctx = ssl_ctx_new(0, 2);
+    SSL_SESSION session, found;
+    int i = 0;
+
+    mu_assert(ssl_ctx != NULL, "Failed to make an SSL_CTX.");
+    mu_assert(ssl_ctx->num_sessions == SSL_SESSION_WAYS,
+            "Cache should round up to a whole bucket.");
+
+    make_session(&session, 1, 0xaa);
+    mu_assert(ssl_session_find(ssl_ctx, session.session_id, &found) != SSL_OK,
+            "Found a session in an empty cache.");
+
+    ssl_session_store(ssl_ctx, &session);
+    mu_assert(ssl_session_find(ssl_ctx, session.session_id, &found) == SSL_OK,
+            "Didn't find the stored session.");
+    mu_assert(memcmp(&found, &session, sizeof(session)) == 0,
+            "Found the wrong session.");
+
+    // filling the bucket pushes out the oldest
+    session.conn_time -= 10;
+    ssl_session_store(ssl_ctx, &session);
+    for(i = 2; i <= SSL_SESSION_WAYS; i++) {
+        make_session(&found, i, i);
+        ssl_session_store(ssl_ctx, &found);
+    }
+    make_session(&found, 0x55, 0x55);
+    ssl_session_store(ssl_ctx, &found);
+
+    mu_assert(ssl_session_find(ssl_ctx, session.session_id, &found) != SSL_OK,
+            "The oldest session should have been replaced.");
+    make_session(&session, 0x55, 0x55);
+    mu_assert(ssl_session_find(ssl_ctx, session.session_id, &found) == SSL_OK,
+            "Didn't find the newest session.");
+
+    // expired sessions don't come back
+    make_session(&session, 7, 7);
+    session.conn_time = time(NULL) - SSL_EXPIRY_TIME - 1;
+    ssl_session_store(ssl_ctx, &session);
+    mu_assert(ssl_session_find(ssl_ctx, session.session_id, &found) != SSL_OK,
+            "Found an expired session.");
+
+    ssl_ctx_free(ssl_ctx);
+    return NULL;
+}
+
+char *test_session_tickets()
+{
+    SSL_CTX *ssl_ctx = ssl_ctx_new(0, 0);
+    SSL_SESSION session, opened;
+    uint8_t ticket[SSL_TICKET_SIZE];
+    int len = 0;
+
+    mu_assert(ssl_ctx != NULL, "Failed to make an SSL_CTX.");
+
+    make_session(&session, 3, 0x3c);
+    len = ssl_ticket_seal(ssl_ctx, &session, ticket);
+    mu_assert(len == SSL_TICKET_SIZE, "Wrong ticket size.");
+
+    mu_assert(ssl_ticket_open(ssl_ctx, ticket, len, &opened) == SSL_OK,
+            "Failed to open our own ticket.");
+    mu_assert(opened.cipher == session.cipher &&
+            opened.version == session.version &&
+            opened.conn_time == session.conn_time &&
+            memcmp(opened.master_secret, session.master_secret,
+                SSL_SECRET_SIZE) == 0, "Ticket came back different.");
+
+    mu_assert(ssl_ticket_open(ssl_ctx, ticket, len - 1, &opened) == SSL_NOT_OK,
+            "Opened a short ticket.");
+
+    ticket[SSL_TICKET_NAME_SIZE + GCM_IV_SIZE] ^= 1;
+    mu_assert(ssl_ticket_open(ssl_ctx, ticket, len, &opened) == SSL_NOT_OK,
+            "Opened a tampered ticket.");
+    ticket[SSL_TICKET_NAME_SIZE + GCM_IV_SIZE] ^= 1;
+
+    // an older key still opens it, but asks for a new ticket
+    ssl_ctx->ticket_keys[0].created -= SSL_EXPIRY_TIME;
+    mu_assert(ssl_ticket_open(ssl_ctx, ticket, len, &opened) == 1,
+            "A ticket from an old key should be renewed.");
+
+    session.conn_time = time(NULL) - SSL_EXPIRY_TIME - 1;
+    len = ssl_ticket_seal(ssl_ctx, &session, ticket);
+    mu_assert(ssl_ticket_open(ssl_ctx, ticket, len, &opened) == SSL_NOT_OK,
+            "Opened a ticket for an expired session.");
+
+    ssl_ctx_free(ssl_ctx);
+    return NULL;
+}
+
+// the length of the next record on fd, or -1 if nothing's been sent
+static int next_record(int fd)
+{
+    static uint8_t rec[RT_MAX_PLAIN_LENGTH + SSL_RECORD_SIZE];
+    int len = 0;
+
+    if(recv(fd, rec, SSL_RECORD_SIZE, MSG_DONTWAIT) != SSL_RECORD_SIZE) return -1;
+    len = (rec[3] << 8) + rec[4];
+    if(recv(fd, rec, len, MSG_WAITALL) != len) return -1;
+    return len;
+}
+
+char *test_write_buf()
+{
+    static uint8_t data[40000];
+    SSL_CTX *ssl_ctx = ssl_ctx_new(0, 0);
+    SSL *ssl = NULL;
+    int fds[2] = {0};
+    int i = 0;
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Failed to make a socketpair.");
+    ssl = ssl_new(ssl_ctx, fds[0]);
+
+    for(i = 0; i < 3; i++) {
+        mu_assert(ssl_write_buf(ssl, data, 100) == 100, "Failed to buffer.");
+    }
+    mu_assert(next_record(fds[1]) == -1, "Small writes shouldn't go out yet.");
+
+    mu_assert(ssl_flush(ssl) == SSL_OK, "Failed to flush.");
+    mu_assert(next_record(fds[1]) == 300, "Small writes should share a record.");
+    mu_assert(ssl_flush(ssl) == SSL_OK, "Failed to flush nothing.");
+    mu_assert(next_record(fds[1]) == -1, "Flushing nothing sent a record.");
+
+    // records start at a segment and double up to the limit
+    mu_assert(ssl_write_buf(ssl, data, sizeof(data)) == sizeof(data), "Failed to buffer.");
+    mu_assert(next_record(fds[1]) == SSL_RAMP_RECORD_SIZE, "First record is the wrong size.");
+    mu_assert(next_record(fds[1]) == SSL_RAMP_RECORD_SIZE * 2, "Record didn't grow.");
+    mu_assert(next_record(fds[1]) == SSL_RAMP_RECORD_SIZE * 4, "Record didn't grow.");
+    mu_assert(next_record(fds[1]) == SSL_RAMP_RECORD_SIZE * 8, "Record didn't grow.");
+    mu_assert(next_record(fds[1]) == RT_MAX_PLAIN_LENGTH, "Record isn't full size.");
+    mu_assert(next_record(fds[1]) == -1, "The rest should wait for a flush.");
+    ssl_flush(ssl);
+    mu_assert(next_record(fds[1]) == sizeof(data) - SSL_RAMP_RECORD_SIZE * 15 - RT_MAX_PLAIN_LENGTH,
+            "Flush sent the wrong amount.");
+
+    mu_assert(ssl_write_buf(ssl, data, 2000) == 2000, "Failed to buffer.");
+    mu_assert(next_record(fds[1]) == -1, "Should still be sending full records.");
+    ssl_flush(ssl);
+    mu_assert(next_record(fds[1]) == 2000, "Flush sent the wrong amount.");
+
+    // going quiet starts the ramp over
+    ssl->last_write -= SSL_RAMP_IDLE_TIME;
+    ssl_write_buf(ssl, data, 2000);
+    mu_assert(next_record(fds[1]) == SSL_RAMP_RECORD_SIZE, "Ramp didn't start over.");
+
+    ssl_free(ssl);
+    ssl_ctx_free(ssl_ctx);
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+}
+
+char * all_tests() {
+    mu_suite_start();
+
+    mu_run_test(test_session_cache);
+    mu_run_test(test_session_tickets);
+    mu_run_test(test_write_buf);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,327 @@
+#include "minunit.h"
+#include <write_queue.h>
+#include <register.h>
+#include <task/task.h>
+#include <superpoll.h>
+#include <ssl/ssl.h>
+#include <sys/socket.h>
+
+FILE *LOG_FILE = NULL;
+
+extern SuperPoll *POLL;
+
+#define BIG_SEND (1024 * 1024)
+
+static int read_all(int fd, char *buf, int len)
+{
+    int n = 0;
+    int total = 0;
+
+    for(total = 0; total < len; total += n) {
+        n = fdrecv(fd, buf + total, len - total);
+        if(n <= 0) break;
+    }
+
+    return total;
+}
+
+char *test_WriteQueue_send()
+{
+    int fds[2] = {0};
+    char *data = calloc(BIG_SEND, 1);
+    char *got = calloc(BIG_SEND, 1);
+    int i = 0;
+
+    for(i = 0; i < BIG_SEND; i++) data[i] = 'a' + (i % 26);
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Failed to make socketpair.");
+    fdnoblock(fds[0]);
+    fdnoblock(fds[1]);
+    Register_connect(fds[0], CONN_TYPE_MSG);
+
+    // small goes right out
+    mu_assert(WriteQueue_send(fds[0], "hello", 5) == 5, "Failed small send.");
+    mu_assert(WriteQueue_pending(fds[0]) == 0, "Small send shouldn't queue.");
+    mu_assert(read_all(fds[1], got, 5) == 5, "Didn't get small send.");
+
+    // too big for the socket buffer so some of it has to wait
+    mu_assert(WriteQueue_send(fds[0], data, BIG_SEND) == BIG_SEND, "Failed big send.");
+    mu_assert(WriteQueue_pending(fds[0]) > 0, "Big send should have queued.");
+
+    mu_assert(read_all(fds[1], got, BIG_SEND) == BIG_SEND, "Didn't get all of big send.");
+    mu_assert(memcmp(data, got, BIG_SEND) == 0, "Big send came out wrong.");
+    mu_assert(WriteQueue_pending(fds[0]) == 0, "Should be drained.");
+
+    Register_disconnect(fds[0]);
+    close(fds[1]);
+    free(data);
+    free(got);
+
+    return NULL;
+}
+
+char *test_WriteQueue_disconnect()
+{
+    int fds[2] = {0};
+    char *data = calloc(BIG_SEND, 1);
+    char *got = calloc(BIG_SEND, 1);
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Failed to make socketpair.");
+    fdnoblock(fds[0]);
+    fdnoblock(fds[1]);
+    Register_connect(fds[0], CONN_TYPE_HTTP);
+
+    mu_assert(WriteQueue_send(fds[0], data, BIG_SEND) == BIG_SEND, "Failed big send.");
+    mu_assert(WriteQueue_disconnect(fds[0]) == 0, "Disconnect should wait for the queue.");
+    mu_assert(Register_fd_exists(fds[0]), "Shouldn't be disconnected yet.");
+
+    mu_assert(read_all(fds[1], got, BIG_SEND) == BIG_SEND, "Didn't get all before close.");
+    mu_assert(fdrecv(fds[1], got, 1) == 0, "Should be closed after the queue drained.");
+    mu_assert(Register_fd_exists(fds[0]) == 0, "Should be disconnected.");
+
+    close(fds[1]);
+    free(data);
+    free(got);
+
+    return NULL;
+}
+
+char *test_WriteQueue_discard()
+{
+    int fds[2] = {0};
+    char *data = calloc(BIG_SEND, 1);
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Failed to make socketpair.");
+    fdnoblock(fds[0]);
+    fdnoblock(fds[1]);
+    Register_connect(fds[0], CONN_TYPE_MSG);
+
+    mu_assert(WriteQueue_send(fds[0], data, BIG_SEND) == BIG_SEND, "Failed big send.");
+    WriteQueue_discard(fds[0]);
+    mu_assert(WriteQueue_pending(fds[0]) == 0, "Discard should drop the queue.");
+
+    Register_disconnect(fds[0]);
+    taskdelay(10);
+    close(fds[1]);
+    free(data);
+
+    return NULL;
+}
+
+char *test_WriteQueue_discard_idle()
+{
+    int fds[2] = {0};
+    char *data = calloc(BIG_SEND, 1);
+    WriteBuffer *buf = WriteBuffer_create(blk2bstr(data, BIG_SEND));
+    int max_hot = SuperPoll_max_hot(POLL);
+    int idle = SuperPoll_active_idle(POLL);
+
+    mu_assert(buf != NULL, "Failed to make a WriteBuffer.");
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Failed to make socketpair.");
+    fdnoblock(fds[0]);
+    fdnoblock(fds[1]);
+    Register_connect(fds[0], CONN_TYPE_MSG);
+
+    // a full hot set sends the writer's wait to the idle set
+    POLL->max_hot = SuperPoll_active_hot(POLL);
+    mu_assert(WriteQueue_send_buffer(fds[0], buf) == BIG_SEND, "Failed big send.");
+    taskyield();
+    POLL->max_hot = max_hot;
+
+    mu_assert(SuperPoll_active_idle(POLL) == idle + 1, "Writer should be waiting in idle.");
+    mu_assert(buf->refcount == 2, "Queue should hold the buffer.");
+
+    WriteQueue_discard(fds[0]);
+    Register_disconnect(fds[0]);
+    taskdelay(10);
+
+    mu_assert(SuperPoll_active_idle(POLL) == idle, "Writer is still in the idle set.");
+    mu_assert(buf->refcount == 1, "Writer didn't let go of the buffer.");
+
+    WriteBuffer_release(buf);
+    close(fds[1]);
+    free(data);
+
+    return NULL;
+}
+
+char *test_WriteQueue_overflow()
+{
+    int fds[2] = {0};
+    char *data = calloc(BIG_SEND, 1);
+    int old_max = WRITE_QUEUE_MAX;
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Failed to make socketpair.");
+    fdnoblock(fds[0]);
+    fdnoblock(fds[1]);
+    Register_connect(fds[0], CONN_TYPE_MSG);
+
+    WRITE_QUEUE_MAX = 1024;
+
+    // one message always fits when nothing is waiting
+    mu_assert(WriteQueue_send(fds[0], data, BIG_SEND) == BIG_SEND, "Failed big send.");
+    mu_assert(WriteQueue_pending(fds[0]) > 0, "Big send should have queued.");
+
+    WRITE_QUEUE_DROP = 1;
+    mu_assert(WriteQueue_send(fds[0], "hello", 5) == 0, "Should drop when full.");
+    mu_assert(WriteQueue_pending(fds[0]) > 0, "Drop should keep the queue.");
+
+    WRITE_QUEUE_DROP = 0;
+    mu_assert(WriteQueue_send(fds[0], "hello", 5) == -1, "Should fail when full.");
+    mu_assert(WriteQueue_pending(fds[0]) == 0, "Disconnect should drop the queue.");
+
+    WRITE_QUEUE_MAX = old_max;
+    Register_disconnect(fds[0]);
+    taskdelay(10);
+    close(fds[1]);
+    free(data);
+
+    return NULL;
+}
+
+char *test_WriteQueue_send_buffer()
+{
+    int a[2] = {0};
+    int b[2] = {0};
+    char *got = calloc(BIG_SEND, 1);
+    bstring data = bfromcstralloc(BIG_SEND, "");
+    int i = 0;
+
+    mu_assert(data != NULL, "Failed to make the reply.");
+    for(i = 0; i < BIG_SEND; i++) bconchar(data, 'a' + (i % 26));
+
+    WriteBuffer *buf = WriteBuffer_create(data);
+    mu_assert(buf != NULL, "Failed to make a WriteBuffer.");
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, a) == 0, "Failed to make socketpair.");
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, b) == 0, "Failed to make socketpair.");
+    fdnoblock(a[0]); fdnoblock(a[1]);
+    fdnoblock(b[0]); fdnoblock(b[1]);
+    Register_connect(a[0], CONN_TYPE_MSG);
+    Register_connect(b[0], CONN_TYPE_MSG);
+
+    mu_assert(WriteQueue_send_buffer(a[0], buf) == BIG_SEND, "Failed send to a.");
+    mu_assert(WriteQueue_send_buffer(b[0], buf) == BIG_SEND, "Failed send to b.");
+    mu_assert(buf->refcount == 3, "Both queues should hold a reference.");
+
+    mu_assert(read_all(a[1], got, BIG_SEND) == BIG_SEND, "Didn't get all of a.");
+    mu_assert(memcmp(data->data, got, BIG_SEND) == 0, "a came out wrong.");
+    mu_assert(read_all(b[1], got, BIG_SEND) == BIG_SEND, "Didn't get all of b.");
+    mu_assert(memcmp(data->data, got, BIG_SEND) == 0, "b came out wrong.");
+
+    taskdelay(10);
+    mu_assert(buf->refcount == 1, "Queues should have let go of the buffer.");
+    WriteBuffer_release(buf);
+
+    Register_disconnect(a[0]);
+    Register_disconnect(b[0]);
+    close(a[1]);
+    close(b[1]);
+    free(got);
+
+    return NULL;
+}
+
+typedef struct TLSServer {
+    SSL_CTX *ssl_ctx;
+    SSL *ssl;
+    int fd;
+} TLSServer;
+
+static void tls_server_task(void *arg)
+{
+    TLSServer *srv = (TLSServer *)arg;
+    uint8_t *data = NULL;
+    int rc = SSL_OK;
+
+    srv->ssl = ssl_server_new(srv->ssl_ctx, srv->fd);
+
+    while(rc >= SSL_OK && ssl_handshake_status(srv->ssl) != SSL_OK) {
+        rc = ssl_read(srv->ssl, &data);
+    }
+}
+
+static int tls_read(SSL *ssl, uint8_t **data)
+{
+    int rc = SSL_OK;
+
+    while((rc = ssl_read(ssl, data)) == SSL_OK);
+
+    return rc;
+}
+
+char *test_WriteQueue_ssl()
+{
+    TLSServer srv = {.ssl = NULL};
+    SSL_CTX *client_ctx = NULL;
+    SSL *client = NULL;
+    uint8_t *got = NULL;
+    int fds[2] = {0};
+    bstring data = bfromcstr("200 OK\r\nContent-Length: 0\r\n\r\n");
+
+    mu_assert(data != NULL, "Failed to make the reply.");
+    srv.ssl_ctx = ssl_ctx_new(SSL_NO_DEFAULT_KEY, SSL_DEFAULT_SVR_SESS);
+    mu_assert(ssl_obj_load(srv.ssl_ctx, SSL_OBJ_X509_CERT, "tests/certs/zedshaw.com.crt", NULL) == SSL_OK,
+            "Failed to load the certificate.");
+    mu_assert(ssl_obj_load(srv.ssl_ctx, SSL_OBJ_RSA_KEY, "tests/certs/zedshaw.com.key", NULL) == SSL_OK,
+            "Failed to load the key.");
+    client_ctx = ssl_ctx_new(SSL_SERVER_VERIFY_LATER | SSL_NO_DEFAULT_KEY, SSL_DEFAULT_CLNT_SESS);
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Failed to make socketpair.");
+    srv.fd = fds[1];
+    fdnoblock(srv.fd);
+    taskcreate(tls_server_task, &srv, 64 * 1024);
+
+    client = ssl_client_new(client_ctx, fds[0], NULL, 0);
+    mu_assert(ssl_handshake_status(client) == SSL_OK, "Handshake failed.");
+    mu_assert(ssl_handshake_status(srv.ssl) == SSL_OK, "Server didn't finish the handshake.");
+
+    Register_connect(srv.fd, CONN_TYPE_HTTP);
+    Register_ssl(srv.fd, srv.ssl);
+
+    // what the connection buffered itself has to go ahead of the reply
+    mu_assert(ssl_write_buf(srv.ssl, (uint8_t *)"HTTP/1.1 ", 9) == 9, "Failed to buffer.");
+
+    WriteBuffer *reply = WriteBuffer_create(data);
+    mu_assert(WriteQueue_send_buffer(srv.fd, reply) == blength(data), "Failed to queue the reply.");
+    mu_assert(WriteQueue_pending(srv.fd) > 0, "An SSL reply should go through the writer.");
+
+    mu_assert(tls_read(client, &got) == 9, "Buffered data didn't come first.");
+    mu_assert(memcmp(got, "HTTP/1.1 ", 9) == 0, "Buffered data came out wrong.");
+    mu_assert(tls_read(client, &got) == blength(data), "Didn't get the reply as a record.");
+    mu_assert(memcmp(got, data->data, blength(data)) == 0, "Reply came out wrong.");
+
+    WriteQueue_wait(srv.fd);
+    mu_assert(WriteQueue_pending(srv.fd) == 0, "Queue should be done.");
+    WriteBuffer_release(reply);
+
+    WriteQueue_discard(srv.fd);
+    Register_disconnect(srv.fd);
+    ssl_free(srv.ssl);
+    ssl_free(client);
+    ssl_ctx_free(srv.ssl_ctx);
+    ssl_ctx_free(client_ctx);
+    close(fds[0]);
+
+    return NULL;
+}
+
+
+char * all_tests() {
+    mu_suite_start();
+
+    Register_init();
+
+    mu_run_test(test_WriteQueue_send);
+    mu_run_test(test_WriteQueue_disconnect);
+    mu_run_test(test_WriteQueue_discard);
+    mu_run_test(test_WriteQueue_discard_idle);
+    mu_run_test(test_WriteQueue_overflow);
+    mu_run_test(test_WriteQueue_send_buffer);
+    mu_run_test(test_WriteQueue_ssl);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <dbg.h>
 #include <assert.h>
+#include <string.h>
 
 
 Value *Value_create(ValueType type, void *data) {
@@ -170,6 +171,15 @@ const char *AST_str(tst_t *settings, tst_t *fr, const char *name, TokenType type
     return bdata(val);
 }
 
+const char *AST_str_default(tst_t *settings, tst_t *fr, const char *name, TokenType type, const char *def)
+{
+    if(tst_search(fr, name, strlen(name)) == NULL) {
+        return def;
+    } else {
+        return AST_str(settings, fr, name, type);
+    }
+}
+
 static void Class_destroy(Class *cls)
 {
     Token_destroy(cls->ident);
@@ -58,6 +58,7 @@ int AST_walk_hash(tst_t *settings, Value *data, ast_hash_walk_cb cb);
 Value *AST_get(tst_t *settings, tst_t *fr, bstring name, ValueType type);
 bstring AST_get_bstr(tst_t *settings, tst_t *fr, bstring name, ValueType type);
 const char *AST_str(tst_t *settings, tst_t *fr, const char *name, TokenType type);
+const char *AST_str_default(tst_t *settings, tst_t *fr, const char *name, TokenType type, const char *def);
 
 void AST_destroy(tst_t *settings);
 
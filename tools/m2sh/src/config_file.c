@@ -44,7 +44,8 @@ int Handler_load(tst_t *settings, tst_t *params)
             send_spec,
             AST_str(settings, params, "send_ident", VAL_QSTRING),
             AST_str(settings, params, "recv_spec", VAL_QSTRING),
-            AST_str(settings, params, "recv_ident", VAL_QSTRING));
+            AST_str(settings, params, "recv_ident", VAL_QSTRING),
+            AST_str_default(settings, params, "coalesce", VAL_NUMBER, "0"));
 
     int rc = DB_exec(sql, NULL, NULL);
     check(rc == 0, "Failed to load Handler: %s", send_spec);
@@ -62,12 +63,15 @@ error:
 int Proxy_load(tst_t *settings, tst_t *params)
 {
     const char *addr = AST_str(settings, params, "addr", VAL_QSTRING);
-    const char *port = AST_str(settings, params, "port", VAL_NUMBER);
+    const char *port = AST_str_default(settings, params, "port", VAL_NUMBER, "0");
+    const char *buffer_size = AST_str_default(settings, params, "buffer_size", VAL_NUMBER, "0");
+    const char *retries = AST_str_default(settings, params, "retries", VAL_NUMBER, "0");
+    const char *hedge_delay = AST_str_default(settings, params, "hedge_delay", VAL_NUMBER, "0");
 
     char *sql = NULL;
     
     sql = sqlite3_mprintf(bdata(&PROXY_SQL),
-            addr, port);
+            addr, port, buffer_size, retries, hedge_delay);
 
     int rc = DB_exec(sql, NULL, NULL);
     check(rc == 0, "Failed to load Proxy: %s:%s", addr, port);
@@ -222,7 +226,9 @@ int Server_load(tst_t *settings, Value *val)
             AST_str(settings, cls->params, "chroot", VAL_QSTRING),
             AST_str(settings, cls->params, "default_host", VAL_QSTRING),
             AST_str(settings, cls->params, "name", VAL_QSTRING),
-            AST_str(settings, cls->params, "port", VAL_NUMBER));
+            AST_str(settings, cls->params, "port", VAL_NUMBER),
+            AST_str_default(settings, cls->params, "bind_addr", VAL_QSTRING, "0.0.0.0"),
+            AST_str_default(settings, cls->params, "use_ssl", VAL_NUMBER, "0"));
 
     rc = DB_exec(sql, NULL, NULL);
     check(rc == 0, "Failed to exec SQL: %s", sql);
@@ -19,7 +19,9 @@ struct tagbstring CONFIG_SCHEMA = bsStatic(
 "    pid_File TEXT,\n"
 "    default_host INTEGER,\n"
 "    name TEXT DEFAULT '',\n"
-"    port INTEGER);\n"
+"    port INTEGER,\n"
+"    bind_addr TEXT DEFAULT '0.0.0.0',\n"
+"    use_ssl INTEGER DEFAULT 0);\n"
 "\n"
 "CREATE TABLE host (id INTEGER PRIMARY KEY, \n"
 "    server_id INTEGER,\n"
@@ -31,11 +33,15 @@ struct tagbstring CONFIG_SCHEMA = bsStatic(
 "    send_spec TEXT, \n"
 "    send_ident TEXT,\n"
 "    recv_spec TEXT,\n"
-"    recv_ident TEXT);\n"
+"    recv_ident TEXT,\n"
+"    coalesce INTEGER DEFAULT 0);\n"
 "\n"
 "CREATE TABLE proxy (id INTEGER PRIMARY KEY,\n"
 "    addr TEXT,\n"
-"    port INTEGER);\n"
+"    port INTEGER,\n"
+"    buffer_size INTEGER DEFAULT 0,\n"
+"    retries INTEGER DEFAULT 0,\n"
+"    hedge_delay INTEGER DEFAULT 0);\n"
 "\n"
 "CREATE TABLE directory (id INTEGER PRIMARY KEY,\n"
 "    base TEXT, index_file TEXT, default_ctype TEXT);\n"
@@ -74,7 +80,7 @@ struct tagbstring CONFIG_SCHEMA = bsStatic(
 
 
 
-struct tagbstring SERVER_SQL = bsStatic("INSERT INTO server (uuid, access_log, error_log, pid_file, chroot, default_host, name, port) VALUES (%Q, %Q, %Q, %Q, %Q, %Q, %Q, %s);");
+struct tagbstring SERVER_SQL = bsStatic("INSERT INTO server (uuid, access_log, error_log, pid_file, chroot, default_host, name, port, bind_addr, use_ssl) VALUES (%Q, %Q, %Q, %Q, %Q, %Q, %Q, %s, %Q, %s);");
 
 struct tagbstring HOST_SQL = bsStatic("INSERT INTO host (server_id, name, matching) VALUES (%d, %Q, %Q);");
 
@@ -83,9 +89,9 @@ struct tagbstring MIMETYPE_SQL = bsStatic("DELETE from mimetype where extension=
 
 struct tagbstring DIR_SQL = bsStatic("INSERT INTO directory (base, index_file, default_ctype) VALUES (%Q, %Q, %Q);");
 
-struct tagbstring PROXY_SQL = bsStatic("INSERT INTO proxy (addr, port) VALUES (%Q, %Q);");
+struct tagbstring PROXY_SQL = bsStatic("INSERT INTO proxy (addr, port, buffer_size, retries, hedge_delay) VALUES (%Q, %Q, %Q, %Q, %Q);");
 
-struct tagbstring HANDLER_SQL = bsStatic("INSERT INTO handler (send_spec, send_ident, recv_spec, recv_ident) VALUES (%Q, %Q, %Q, %Q);");
+struct tagbstring HANDLER_SQL = bsStatic("INSERT INTO handler (send_spec, send_ident, recv_spec, recv_ident, coalesce) VALUES (%Q, %Q, %Q, %Q, %Q);");
 
 struct tagbstring ROUTE_SQL = bsStatic("INSERT INTO route (path, host_id, target_id, target_type) VALUES (%Q, %d, %d, %Q);");
 